@@ -38,9 +38,14 @@
 #include <sofia-sip/nta_stateless.h>
 #include <sofia-sip/nth.h>
 
+#include <chrono>
+#include <cstring>
 #include <string>
 #include <sstream>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include <ifaddrs.h>
 
 #if ENABLE_MDNS
@@ -51,6 +56,8 @@ namespace flexisip {
 
 class Module;
 class DomainRegistrationManager;
+class OverloadControl;
+class LoopMonitor;
 
 /**
  * The agent class represents a SIP agent.
@@ -111,8 +118,12 @@ class Agent : public IncomingAgent,
 
 private:
 	template <typename SipEventT>
-	void doSendEvent(std::shared_ptr<SipEventT> ev, const std::list<Module *>::iterator &begin,
-					 const std::list<Module *>::iterator &end);
+	void doSendEvent(std::shared_ptr<SipEventT> ev, const std::vector<Module *>::const_iterator &begin,
+					 const std::vector<Module *>::const_iterator &end);
+	std::vector<Module *>::const_iterator findNextModule(const std::vector<Module *> &chain, Module *module) const;
+	void buildModuleChains();
+	void updateLocalAddresses();
+	static void sUpdateAliases(su_root_magic_t *rm, su_msg_r msg, void *u);
 
 public:
 	Agent(su_root_t *root);
@@ -135,6 +146,25 @@ public:
 	virtual Agent *getAgent() {
 		return this;
 	}
+	/**
+	 * Sets the index of this process among the workers sharing the ports of the proxy, see the 'workers' setting.
+	 * Each worker listens on its own internal transport, whose port is the one of 'internal-transport' plus its index.
+	 * Must be called before loadConfig().
+	 */
+	void setWorker(int index, int count) {
+		mWorkerIndex = index;
+		mWorkerCount = count;
+	}
+	int getWorkerIndex() const {
+		return mWorkerIndex;
+	}
+	int getWorkerCount() const {
+		return mWorkerCount;
+	}
+	/**
+	 * Whether the url is the internal transport of another worker of this proxy, see setWorker().
+	 */
+	bool isOtherWorker(const url_t *url) const;
 	// Preferred route for inter-proxy communication
 	std::string getPreferredRoute() const;
 	const url_t *getPreferredRouteUrl() const {
@@ -166,6 +196,9 @@ public:
 	const std::string &getUniqueId() const;
 	void idle();
 	bool isUs(const url_t *url, bool check_aliases = true) const;
+	LoopMonitor *getLoopMonitor() const {
+		return mLoopMonitor.get();
+	}
 	su_root_t *getRoot() const {
 		return mRoot;
 	}
@@ -187,6 +220,9 @@ public:
 	bool doOnConfigStateChanged(const ConfigValue &conf, ConfigState state);
 	void logEvent(const std::shared_ptr<SipEvent> &ev);
 	Module *findModule(const std::string &moduleName) const;
+	const std::list<Module *> &getModules() const {
+		return mModules;
+	}
 	nth_engine_t *getHttpEngine() {
 		return mHttpEngine;
 	}
@@ -209,12 +245,50 @@ private:
 
 	std::string mServerString;
 	std::list<Module *> mModules;
+	// The modules to hand each kind of request, and the responses to each kind of request, in the order of mModules.
+	// Replaced as a whole when a module is reloaded, possibly from another thread.
+	struct ModuleChains {
+		std::vector<std::vector<Module *>> requests;
+		std::vector<std::vector<Module *>> responses;
+	};
+	std::shared_ptr<const ModuleChains> mModuleChains;
 	std::list<std::string> mAliases;
+	// What isUs() looks hosts up in, rebuilt when the transports or the aliases change.
+	struct LocalAddresses {
+		// A host, pointing to the names stored here or to the buffer of a lookup, which then allocates nothing.
+		struct Host {
+			const char *data;
+			size_t size;
+			bool operator==(const Host &other) const {
+				return size == other.size && memcmp(data, other.data, size) == 0;
+			}
+		};
+		struct HostHash {
+			size_t operator()(const Host &host) const {
+				size_t hash = 0;
+				for (size_t i = 0; i < host.size; ++i) hash = hash * 31 + (unsigned char)host.data[i];
+				return hash;
+			}
+		};
+		struct Ports {
+			std::vector<std::string> ports;
+			bool defaultPort = false; // Whether a port-less host designates one of the transports.
+		};
+		Host store(const char *name, size_t size) {
+			return Host{names.emplace(name, size).first->c_str(), size};
+		}
+		std::unordered_set<std::string> names;
+		std::unordered_set<Host, HostHash> aliases;
+		std::unordered_map<Host, Ports, HostHash> transports;
+	};
+	std::shared_ptr<const LocalAddresses> mLocalAddresses;
 	url_t *mPreferredRouteV4;
 	url_t *mPreferredRouteV6;
 	const url_t *mNodeUri = nullptr;
 	const url_t *mClusterUri = nullptr;
 	const url_t *mDefaultUri = nullptr;
+	int mWorkerIndex = 0;
+	int mWorkerCount = 1;
 	class Network {
 		struct sockaddr_storage mPrefix;
 		struct sockaddr_storage mMask;
@@ -244,6 +318,11 @@ private:
 	static int messageCallback(nta_agent_magic_t *context, nta_agent_t *agent, msg_t *msg, sip_t *sip);
 	bool mTerminating;
 	bool mUseMaddr;
+	// Total time spent in the events sent so far, so that each module is only accounted its own processing time.
+	std::chrono::steady_clock::duration mNestedProcessingTime{0};
+	std::unique_ptr<OverloadControl> mOverloadControl;
+	std::unique_ptr<LoopMonitor> mLoopMonitor;
+	std::vector<int> mIdleSources; // Source of the loop monitor of the idle() of each module, in the order of mModules.
 #if ENABLE_MDNS
 	std::vector<belle_sip_mdns_register_t *> mMdnsRegisterList;
 #endif
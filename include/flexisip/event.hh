@@ -23,6 +23,7 @@
 #include <sofia-sip/sip.h>
 #include <sofia-sip/nta.h>
 
+#include <chrono>
 #include <memory>
 #include <list>
 #include <string>
@@ -163,6 +164,10 @@ class SipEvent : public std::enable_shared_from_this<SipEvent> {
 		SUSPENDED,
 		TERMINATED,
 	} mState;
+	// When the event was suspended, to measure how long its current module kept it waiting.
+	std::chrono::steady_clock::time_point mSuspendedAt;
+	// Count of the events suspended by the module that suspended this one, while it is.
+	std::shared_ptr<int> mSuspendedCount;
 	static std::string stateStr(State s) {
 		switch (s) {
 			case STARTED:
@@ -174,6 +179,10 @@ class SipEvent : public std::enable_shared_from_this<SipEvent> {
 		}
 		return "invalid";
 	}
+
+  private:
+	// Accounts the end of the suspension of the event to the module that suspended it.
+	void leaveSuspension();
 };
 
 class RequestSipEvent : public SipEvent {
@@ -22,16 +22,21 @@
 #include <sofia-sip/sip.h>
 #endif
 
+#include <list>
 #include <string>
 #include <memory>
+#include <vector>
 #include <flexisip/flexisip-exception.hh>
 
+#include <regex.h>
+
 void log_boolean_expression_evaluation(bool value);
 void log_boolean_expression_parsing(bool value);
 
 namespace flexisip {
 
 class SipAttributes;
+class CompiledBooleanExpression;
 
 class BooleanExpression {
   protected:
@@ -43,9 +48,77 @@ class BooleanExpression {
 	bool eval(const sip_t *sip);
 #endif
 	virtual bool eval(const SipAttributes *args) = 0;
+	// Returns true, with the value in value, when the expression has the same value for any message.
+	virtual bool isConstant(bool &value) const {
+		return false;
+	}
 	virtual ~BooleanExpression();
 	static std::shared_ptr<BooleanExpression> parse(const std::string &str);
 	long ptr();
+#ifndef NO_SOFIA
+	// Appends the instructions evaluating the expression to the program, returns false if it cannot be compiled.
+	virtual bool compile(CompiledBooleanExpression &program) {
+		return false;
+	}
+#endif
 };
 
+#ifndef NO_SOFIA
+/*
+ * Reads an attribute of a sip message, the buffer being used for the values that are not strings of the message.
+ * A missing attribute is returned as null.
+ */
+typedef const char *(*SipAttributeAccessor)(const sip_t *sip, char *buffer, size_t size);
+
+/*
+ * A boolean expression compiled to a flat program: the attributes are resolved to their ids when compiling, the
+ * constant sub-expressions are folded, and the evaluation reads the values memoized by the attributes of the message,
+ * without throwing.
+ */
+class CompiledBooleanExpression {
+  public:
+	enum class Op { Constant, IsRequest, IsResponse, Equals, UnEquals, Contains, In, Numeric, Defined, Regex, Not,
+					JumpIfFalse, JumpIfTrue };
+	struct Operand {
+		Operand() : attribute(-1) {
+		}
+		int attribute; // Id of the attribute, see SipAttributes, -1 for a constant.
+		std::string constant;
+		std::list<std::string> constantList; // The constant split as a list, for the 'in' operator.
+	};
+
+	// Returns null when the expression uses attributes unknown at compile time, it must then be evaluated as is.
+	static std::shared_ptr<CompiledBooleanExpression> compile(const std::shared_ptr<BooleanExpression> &expr);
+
+	// Returns false, leaving result unchanged, when an attribute the expression needs is missing in the message.
+	bool eval(const SipAttributes &attributes, bool &result) const;
+	// Same, for a message whose attributes are not memoized.
+	bool eval(const sip_t *sip, bool &result) const;
+	bool isConstant(bool &value) const;
+	size_t size() const {
+		return mProgram.size();
+	}
+
+	// Used by the expressions to compile themselves.
+	bool compileChild(const std::shared_ptr<BooleanExpression> &expr);
+	void emitConstant(bool value);
+	void emit(Op op, const Operand &left = Operand(), const Operand &right = Operand(), const regex_t *regex = nullptr);
+	size_t emitJump(Op op);
+	void patchJump(size_t jump);
+
+  private:
+	struct Instruction {
+		Op op;
+		bool value;
+		size_t target;
+		Operand left, right;
+		const regex_t *regex;
+	};
+	static const char *getValue(const Operand &operand, const SipAttributes &attributes);
+
+	std::vector<Instruction> mProgram;
+	std::shared_ptr<BooleanExpression> mSource; // Owns the regular expressions used by the program.
+};
+#endif
+
 }
\ No newline at end of file
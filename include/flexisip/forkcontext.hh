@@ -23,6 +23,9 @@
 #include <flexisip/transaction.hh>
 #include <flexisip/registrardb.hh>
 
+#include <list>
+#include <unordered_map>
+
 namespace flexisip {
 
 class OnContactRegisteredListener;
@@ -42,6 +45,22 @@ class ForkContextConfig {
 
 class ForkContext;
 
+/*
+ * The late fork contexts waiting for new registrations of a routing key, along with the listener subscribed to these
+ * registrations.
+ */
+struct ForkMapEntry {
+	std::list<std::shared_ptr<ForkContext>> mForks;
+	std::shared_ptr<OnContactRegisteredListener> mListener;
+};
+typedef std::unordered_map<std::string, ForkMapEntry> ForkMap;
+
+/* Position of a fork context in a ForkMap, from which it can be removed in constant time. */
+struct ForkMapHandle {
+	ForkMap::value_type *mEntry;
+	std::list<std::shared_ptr<ForkContext>>::iterator mPosition;
+};
+
 class ForkContextListener {
   public:
 	virtual ~ForkContextListener();
@@ -78,11 +97,10 @@ class ForkContext : public std::enable_shared_from_this<ForkContext> {
 	std::list<std::shared_ptr<BranchInfo>> mWaitingBranches;
 	std::list<std::shared_ptr<BranchInfo>> mCurrentBranches;
 	float mCurrentPriority;
-	std::list<std::string> mKeys;
+	std::list<ForkMapHandle> mForkMapHandles;
 	void init();
 	void processLateTimeout();
 	std::shared_ptr<BranchInfo> _findBestBranch(const int urgentReplies[], bool ignore503And408);
-	std::shared_ptr<OnContactRegisteredListener> mContactRegisteredListener;
 	// Request if the fork has other branches with lower priorities to try
 	bool hasNextBranches();
 	// Set the next branches to try and process them
@@ -149,11 +167,9 @@ class ForkContext : public std::enable_shared_from_this<ForkContext> {
 	// Start the processing of the highest priority branches that are not completed yet
 	void start();
 
-	void addKey(std::string key);
-	std::list<std::string> getKeys();
-
-	void setContactRegisteredListener (const std::shared_ptr<OnContactRegisteredListener> &listener);
-	const std::shared_ptr<OnContactRegisteredListener> &getContactRegisteredListener () const;
+	// Called by the router module when it stores the context in its fork map, once per key, and when it removes it.
+	void addForkMapHandle(const ForkMapHandle &handle);
+	std::list<ForkMapHandle> takeForkMapHandles();
 	/*
 	 * Informs the forked call context that a new register from a potential destination of the fork just arrived.
 	 * If the fork context is interested in handling this new destination, then it should return true, false otherwise.
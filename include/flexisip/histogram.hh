@@ -0,0 +1,135 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+namespace flexisip {
+
+/*
+ * Distribution of durations in power of two buckets of microseconds: bucket 0 counts the durations under 1us and
+ * bucket i the ones in [2^(i-1), 2^i) us, the last bucket counting everything longer (more than 67s).
+ * Values are recorded by a single thread, the main loop, and can be read from any other one, such as the command
+ * line interface: the fields are relaxed atomics, so that recording stays a handful of plain loads and stores. A
+ * reader working on a copy gets consistent figures, up to the values recorded while it was being copied.
+ */
+class LatencyHistogram {
+  public:
+	static constexpr int sBucketCount = 28;
+
+	LatencyHistogram() {
+		clear();
+	}
+	LatencyHistogram(const LatencyHistogram &other) {
+		*this = other;
+	}
+	LatencyHistogram &operator=(const LatencyHistogram &other) {
+		for (int i = 0; i < sBucketCount; ++i) store(mBuckets[i], load(other.mBuckets[i]));
+		store(mSum, load(other.mSum));
+		store(mMax, load(other.mMax));
+		// The count is derived from the buckets so that the percentiles of the copy are consistent.
+		uint64_t count = 0;
+		for (int i = 0; i < sBucketCount; ++i) count += load(mBuckets[i]);
+		store(mCount, count);
+		return *this;
+	}
+
+	void record(uint64_t us) {
+		int index = us == 0 ? 0 : 64 - __builtin_clzll(us);
+		if (index >= sBucketCount) index = sBucketCount - 1;
+		// Only one thread records values, there is no need for atomic read-modify-write operations.
+		store(mBuckets[index], load(mBuckets[index]) + 1);
+		store(mCount, load(mCount) + 1);
+		store(mSum, load(mSum) + us);
+		if (us > load(mMax)) store(mMax, us);
+	}
+	void record(std::chrono::steady_clock::duration duration) {
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+		record(us > 0 ? (uint64_t)us : 0);
+	}
+
+	uint64_t getCount() const {
+		return load(mCount);
+	}
+	uint64_t getSum() const {
+		return load(mSum);
+	}
+	uint64_t getMax() const {
+		return load(mMax);
+	}
+	uint64_t getMean() const {
+		uint64_t count = getCount();
+		return count ? getSum() / count : 0;
+	}
+	/* Upper bound, in microseconds, of the bucket holding the given percentile (between 0 and 100). */
+	uint64_t getPercentile(double percentile) const {
+		uint64_t count = getCount();
+		uint64_t max = getMax();
+		if (count == 0) return 0;
+		uint64_t rank = (uint64_t)(count * percentile / 100.0);
+		if (rank >= count) rank = count - 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < sBucketCount; ++i) {
+			seen += load(mBuckets[i]);
+			if (seen > rank) return (i == sBucketCount - 1 || (1ULL << i) > max) ? max : (1ULL << i);
+		}
+		return max;
+	}
+	void reset() {
+		clear();
+	}
+
+	/*
+	 * One line summary such as "count=12 mean=40us p50<=64us p90<=128us p99<=512us max=430us". It is computed on a
+	 * copy, hence can be called while values are being recorded.
+	 */
+	std::string toString() const {
+		LatencyHistogram snapshot(*this);
+		std::ostringstream oss;
+		oss << "count=" << snapshot.getCount() << " mean=" << snapshot.getMean() << "us p50<="
+			<< snapshot.getPercentile(50) << "us p90<=" << snapshot.getPercentile(90) << "us p99<="
+			<< snapshot.getPercentile(99) << "us max=" << snapshot.getMax() << "us";
+		return oss.str();
+	}
+
+  private:
+	static uint64_t load(const std::atomic<uint64_t> &value) {
+		return value.load(std::memory_order_relaxed);
+	}
+	static void store(std::atomic<uint64_t> &value, uint64_t newValue) {
+		value.store(newValue, std::memory_order_relaxed);
+	}
+	void clear() {
+		for (int i = 0; i < sBucketCount; ++i) store(mBuckets[i], 0);
+		store(mCount, 0);
+		store(mSum, 0);
+		store(mMax, 0);
+	}
+
+	std::atomic<uint64_t> mBuckets[sBucketCount];
+	std::atomic<uint64_t> mCount;
+	std::atomic<uint64_t> mSum;
+	std::atomic<uint64_t> mMax;
+};
+
+}
@@ -0,0 +1,201 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace flexisip {
+
+/*
+ * Immutable value shared by all the holders of an equal value, for values repeated across many objects such as the
+ * user agents of the contacts. The pool only keeps the values that are in use, and an empty value is not stored.
+ */
+template <typename T, typename Hash = std::hash<T>> class Interned {
+  public:
+	Interned() {
+	}
+	Interned(const T &value) : mValue(intern(value)) {
+	}
+
+	const T &get() const {
+		return mValue ? *mValue : emptyValue();
+	}
+	operator const T &() const {
+		return get();
+	}
+	bool empty() const {
+		return !mValue;
+	}
+	// Equal values are the same object.
+	bool operator==(const Interned &other) const {
+		return mValue == other.mValue;
+	}
+	bool operator!=(const Interned &other) const {
+		return mValue != other.mValue;
+	}
+	/* Number of distinct values in use. */
+	static size_t getPoolSize() {
+		Pool &p = pool();
+		std::lock_guard<std::mutex> lock(p.mutex);
+		return p.values.size();
+	}
+
+  protected:
+	/* Share of the memory used by the value that falls to this holder, given the memory of the value itself. */
+	size_t shareOf(size_t valueUsage) const {
+		if (!mValue) return 0;
+		// The control block of the shared pointer and the entry of the pool are counted along with the value.
+		size_t usage = valueUsage + 4 * sizeof(void *) + sizeof(std::weak_ptr<const T>) + 2 * sizeof(void *);
+		return usage / mValue.use_count();
+	}
+
+	std::shared_ptr<const T> mValue;
+
+  private:
+	struct PointerHash {
+		size_t operator()(const T *value) const {
+			return Hash()(*value);
+		}
+	};
+	struct PointerEqual {
+		bool operator()(const T *v1, const T *v2) const {
+			return *v1 == *v2;
+		}
+	};
+	struct Pool {
+		std::mutex mutex;
+		std::unordered_map<const T *, std::weak_ptr<const T>, PointerHash, PointerEqual> values;
+	};
+
+	/* The pool is never destroyed, as values may still be released during the destruction of static objects. */
+	static Pool &pool() {
+		static Pool *p = new Pool();
+		return *p;
+	}
+	static const T &emptyValue() {
+		static const T empty{};
+		return empty;
+	}
+	static void release(const T *value) {
+		Pool &p = pool();
+		{
+			std::lock_guard<std::mutex> lock(p.mutex);
+			auto it = p.values.find(value);
+			// The entry may already be the one of a new equal value, created while this one was being released.
+			if (it != p.values.end() && it->first == value) p.values.erase(it);
+		}
+		delete value;
+	}
+	static std::shared_ptr<const T> intern(const T &value) {
+		if (value.empty()) return nullptr;
+		Pool &p = pool();
+		std::lock_guard<std::mutex> lock(p.mutex);
+		auto it = p.values.find(&value);
+		if (it != p.values.end()) {
+			std::shared_ptr<const T> existing = it->second.lock();
+			if (existing) return existing;
+			p.values.erase(it);
+		}
+		std::shared_ptr<const T> created(new T(value), release);
+		p.values.emplace(created.get(), created);
+		return created;
+	}
+};
+
+class InternedString : public Interned<std::string> {
+  public:
+	InternedString() {
+	}
+	InternedString(const std::string &value) : Interned(value) {
+	}
+	const char *c_str() const {
+		return get().c_str();
+	}
+	size_t size() const {
+		return get().size();
+	}
+	size_t getMemoryUsage() const {
+		return shareOf(sizeof(std::string) + get().capacity() + 1);
+	}
+};
+
+inline std::ostream &operator<<(std::ostream &stream, const InternedString &str) {
+	return stream << str.get();
+}
+
+struct StringVectorHash {
+	size_t operator()(const std::vector<std::string> &values) const {
+		size_t hash = values.size();
+		for (const auto &value : values) hash = hash * 31 + std::hash<std::string>()(value);
+		return hash;
+	}
+};
+
+/* Read-only list of strings, such as the path or the accept headers of a contact. */
+class InternedStringList : public Interned<std::vector<std::string>, StringVectorHash> {
+  public:
+	typedef std::vector<std::string>::const_iterator const_iterator;
+
+	InternedStringList() {
+	}
+	InternedStringList(const std::vector<std::string> &values) : Interned(values) {
+	}
+	InternedStringList(const std::list<std::string> &values)
+		: Interned(std::vector<std::string>(values.begin(), values.end())) {
+	}
+
+	const_iterator begin() const {
+		return get().begin();
+	}
+	const_iterator end() const {
+		return get().end();
+	}
+	const_iterator cbegin() const {
+		return get().cbegin();
+	}
+	const_iterator cend() const {
+		return get().cend();
+	}
+	size_t size() const {
+		return get().size();
+	}
+	const std::string &front() const {
+		return get().front();
+	}
+	const std::string &back() const {
+		return get().back();
+	}
+	std::list<std::string> toList() const {
+		return std::list<std::string>(begin(), end());
+	}
+	size_t getMemoryUsage() const {
+		size_t usage = sizeof(std::vector<std::string>) + get().capacity() * sizeof(std::string);
+		for (const auto &value : get()) usage += value.capacity() + 1;
+		return shareOf(usage);
+	}
+};
+
+}
@@ -43,6 +43,13 @@ public:
 	virtual bool handleTlsClientAuthentication(std::shared_ptr<RequestSipEvent> &ev);
 	void onRequest(std::shared_ptr<RequestSipEvent> &ev) override;
 	void onResponse(std::shared_ptr<ResponseSipEvent> &ev) override;
+	// ACK, CANCEL and BYE are never challenged.
+	bool handlesRequests(MessageKind kind) const override {
+		return kind != KindAck && kind != KindCancel && kind != KindBye;
+	}
+	bool handlesResponses(MessageKind kind) const override {
+		return mNewAuthOn407;
+	}
 	void onIdle() override;
 	bool doOnConfigStateChanged(const ConfigValue &conf, ConfigState state) override;
 
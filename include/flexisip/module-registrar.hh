@@ -29,10 +29,37 @@
 
 namespace flexisip {
 
+struct RegistrarConnectionStats {
+	StatCounter64 *mPendingCommands;
+	StatCounter64 *mCommandCount;
+	StatCounter64 *mRoundTripAvgUs;
+};
+
+struct RegistrarReplicaStats {
+	StatCounter64 *mLag;
+	StatCounter64 *mLagBytes;
+	StatCounter64 *mReads;
+	StatCounter64 *mRoundTripAvgUs;
+};
+
 struct RegistrarStats {
 	std::unique_ptr<StatPair> mCountBind;
 	std::unique_ptr<StatPair> mCountClear;
 	StatCounter64 *mCountLocalActives;
+	StatCounter64 *mCountBindBytesWritten;
+	StatCounter64 *mCountClusterRedirections;
+	StatCounter64 *mCountCacheHits;
+	StatCounter64 *mCountCacheMisses;
+	StatCounter64 *mCountCacheInvalidations;
+	StatCounter64 *mCountReplicaReadsAvoided;
+	StatCounter64 *mCountCoalescedFetches;
+	StatCounter64 *mCountContactsMigrated;
+	StatCounter64 *mCountRefreshes;
+	StatCounter64 *mCountRecords;
+	StatCounter64 *mCountBindings;
+	StatCounter64 *mBytesPerBinding;
+	std::vector<RegistrarConnectionStats> mConnections;
+	std::vector<RegistrarReplicaStats> mReplicas;
 };
 
 class ModuleRegistrar;
@@ -47,6 +74,8 @@ class OnRequestBindListener : public ContactUpdateListener {
 	sip_contact_t *mContact;
 	sip_path_t *mPath;
 
+	void onBound(const std::shared_ptr<Record> &r, bool publish);
+
   public:
 	OnRequestBindListener(ModuleRegistrar *module, std::shared_ptr<RequestSipEvent> ev, const sip_from_t *sipuri = NULL,
 						  sip_contact_t *contact = NULL, sip_path_t *path = NULL);
@@ -54,6 +83,7 @@ class OnRequestBindListener : public ContactUpdateListener {
 
 	void onContactUpdated(const std::shared_ptr<ExtendedContact> &ec) override;
 	void onRecordFound(const std::shared_ptr<Record> &r)override;
+	void onRecordRefreshed(const std::shared_ptr<Record> &r) override;
 	void onError()override;
 	void onInvalid()override;
 };
@@ -64,11 +94,14 @@ class OnResponseBindListener : public ContactUpdateListener {
 	std::shared_ptr<OutgoingTransaction> mTr;
 	std::shared_ptr<ResponseContext> mCtx;
 
+	void onBound(const std::shared_ptr<Record> &r, bool publish);
+
   public:
 	OnResponseBindListener(ModuleRegistrar *module, std::shared_ptr<ResponseSipEvent> ev, std::shared_ptr<OutgoingTransaction> tr,
 						   std::shared_ptr<ResponseContext> ctx);
 	void onContactUpdated(const std::shared_ptr<ExtendedContact> &ec)override;
 	void onRecordFound(const std::shared_ptr<Record> &r)override;
+	void onRecordRefreshed(const std::shared_ptr<Record> &r) override;
 	void onError()override;
 	void onInvalid()override;
 };
@@ -135,6 +168,16 @@ class ModuleRegistrar : public Module, public ModuleToolbox {
 
 	virtual void onResponse(std::shared_ptr<ResponseSipEvent> &ev);
 
+	virtual bool handlesRequests(MessageKind kind) const {
+		return kind == KindRegister;
+	}
+
+	virtual bool handlesResponses(MessageKind kind) const {
+		return mUpdateOnResponse && kind == KindRegister;
+	}
+
+	virtual void onIdle();
+
 	template <typename SipEventT, typename ListenerT>
 	void processUpdateRequest(std::shared_ptr<SipEventT> &ev, const sip_t *sip);
 
@@ -149,6 +192,8 @@ class ModuleRegistrar : public Module, public ModuleToolbox {
 
 	void updateLocalRegExpire();
 
+	void updateRegistrarDbStats();
+
 	bool isManagedDomain(const url_t *url);
 
 	std::string routingKey(const url_t *sipUri);
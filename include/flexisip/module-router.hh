@@ -32,6 +32,10 @@ struct RouterStats {
 	std::unique_ptr<StatPair> mCountForkTransactions;
 	StatCounter64 *mCountNonForks = nullptr;
 	StatCounter64 *mCountLocalActives = nullptr;
+	StatCounter64 *mCountLiveCallForks = nullptr;
+	StatCounter64 *mCountLiveMessageForks = nullptr;
+	StatCounter64 *mCountLiveBasicForks = nullptr;
+	StatCounter64 *mCountForkKeys = nullptr;
 };
 
 class ModuleRouter : public Module, public ModuleToolbox, public ForkContextListener {
@@ -55,6 +59,11 @@ class ModuleRouter : public Module, public ModuleToolbox, public ForkContextList
 
 	virtual void onResponse(std::shared_ptr<ResponseSipEvent> &ev) override;
 
+	// Registers are left to the Registrar.
+	virtual bool handlesRequests(MessageKind kind) const override {
+		return kind != KindRegister;
+	}
+
 	virtual void onForkContextFinished(std::shared_ptr<ForkContext> ctx) override;
 
 	void sendReply(std::shared_ptr<RequestSipEvent> &ev, int code, const char *reason, int warn_code = 0, const char *warning = nullptr);
@@ -88,6 +97,9 @@ class ModuleRouter : public Module, public ModuleToolbox, public ForkContextList
 	virtual bool lateDispatch(const std::shared_ptr<RequestSipEvent> &ev, const std::shared_ptr<ExtendedContact> &contact,
 				  std::shared_ptr<ForkContext> context, const std::string &targetUris);
 	std::string routingKey(const url_t *sipUri);
+	// Stores a late fork context under a key, subscribing to the registrations of this key if it is the first one.
+	void addToForkMap(const std::string &key, const std::shared_ptr<ForkContext> &context, const url_t *sipUri);
+	StatCounter64 *getLiveForksStat(const std::shared_ptr<ForkContext> &context);
 	std::vector<std::string> split(const char *data, const char *delim);
 
 	std::list<std::string> mDomains;
@@ -95,7 +107,6 @@ class ModuleRouter : public Module, public ModuleToolbox, public ForkContextList
 	std::shared_ptr<ForkContextConfig> mForkCfg;
 	std::shared_ptr<ForkContextConfig> mMessageForkCfg;
 	std::shared_ptr<ForkContextConfig> mOtherForkCfg;
-	typedef std::multimap<std::string, std::shared_ptr<ForkContext>> ForkMap;
 	ForkMap mForks;
 	std::string mGeneratedContactRoute;
 	std::string mExpectedRealm;
@@ -20,6 +20,7 @@
 
 #include <flexisip/configmanager.hh>
 #include <flexisip/event.hh>
+#include <flexisip/histogram.hh>
 
 #include <sofia-sip/nta_tport.h>
 #include <sofia-sip/tport.h>
@@ -62,6 +63,22 @@ class Module : protected ConfigValueListener {
 	friend Module *__flexisipCreatePlugin(Agent *agent, SharedLibrary *sharedLibrary);
 
 public:
+	// Kinds of messages whose processing time is measured separately.
+	enum MessageKind {
+		KindRegister,
+		KindInvite,
+		KindAck,
+		KindBye,
+		KindCancel,
+		KindMessage,
+		KindSubscribe,
+		KindNotify,
+		KindOptions,
+		KindOther,
+		KindResponse,
+		KindCount
+	};
+
 	Module(Agent *agent);
 	virtual ~Module();
 
@@ -90,6 +107,33 @@ public:
 	}
 	void setInfo(ModuleInfoBase *moduleInfo);
 
+	static MessageKind getMessageKind(const sip_t *sip);
+	static MessageKind getMethodKind(sip_method_t method);
+	static const char *getMessageKindName(MessageKind kind);
+	// Time spent in process(), without the processing of the events sent meanwhile by the module.
+	void recordProcessingTime(MessageKind kind, std::chrono::steady_clock::duration duration);
+	// Time an event suspended by this module waited before being restarted or terminated.
+	void recordSuspendedTime(MessageKind kind, std::chrono::steady_clock::duration duration);
+	const LatencyHistogram &getProcessingTimes(MessageKind kind) const {
+		return mLatencies[kind].processing;
+	}
+	const LatencyHistogram &getSuspendedTimes(MessageKind kind) const {
+		return mLatencies[kind].suspended;
+	}
+	// Number of events suspended by this module and not yet restarted nor terminated, such as the requests waiting
+	// for the registrar database or for an authentication backend. Shared with these events, that may outlive the
+	// module.
+	int getSuspendedEvents() const {
+		return *mSuspendedEvents;
+	}
+	const std::shared_ptr<int> &getSuspendedEventsCount() const {
+		return mSuspendedEvents;
+	}
+	// Whether the module may act on the requests of the given kind, or on the responses to such requests (kind being
+	// the method of their CSeq). False when it is disabled or its filter can never be true.
+	bool isProcessingRequests(MessageKind kind);
+	bool isProcessingResponses(MessageKind kind);
+
 protected:
 	virtual void onDeclare(GenericStruct *root) {}
 	virtual void onLoad(const GenericStruct *root) {}
@@ -98,6 +142,20 @@ protected:
 	virtual void onRequest(std::shared_ptr<RequestSipEvent> &ev) = 0;
 	virtual void onResponse(std::shared_ptr<ResponseSipEvent> &ev) = 0;
 
+	// The kinds of requests, and the kinds of requests whose responses, the module has to see. All of them by default.
+	// Asked when the module is loaded, so the answer may depend on its configuration.
+	virtual bool handlesRequests(MessageKind kind) const {
+		return true;
+	}
+	virtual bool handlesResponses(MessageKind kind) const {
+		return true;
+	}
+	// Whether the module may change the messages it processes, the attributes memoized for the filters being forgotten
+	// after it then. True by default, modules that only read the messages answer false.
+	virtual bool changesMessages() const {
+		return true;
+	}
+
 	virtual bool doOnConfigStateChanged(const ConfigValue &conf, ConfigState state);
 	virtual void onIdle() {}
 
@@ -126,6 +184,18 @@ private:
 	bool mDirtyConfig;
 	su_home_t mHome;
 
+	struct Latencies {
+		LatencyHistogram processing;
+		LatencyHistogram suspended;
+	};
+	Latencies mLatencies[KindCount];
+	// Totals over all the message kinds, exported with the other statistics of the module.
+	StatCounter64 *mProcessingCount = nullptr;
+	StatCounter64 *mProcessingTime = nullptr;
+	StatCounter64 *mSuspendedCount = nullptr;
+	StatCounter64 *mSuspendedTime = nullptr;
+	std::shared_ptr<int> mSuspendedEvents = std::make_shared<int>(0);
+
 	FLEXISIP_DISABLE_COPY(Module);
 };
 
@@ -266,6 +336,7 @@ public:
 
 	static void addRecordRouteIncoming(Agent *agent, const std::shared_ptr<RequestSipEvent> &ev);
 	static void addRecordRoute(Agent *agent, const std::shared_ptr<RequestSipEvent> &ev, const tport_t *tport);
+	static void addRecordRoute(Agent *agent, const std::shared_ptr<RequestSipEvent> &ev, url_t *url);
 
 	static void cleanAndPrependRoute(Agent *agent, msg_t *msg, sip_t *sip, sip_route_t *route);
 
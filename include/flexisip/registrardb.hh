@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <flexisip/interned-string.hh>
 #include <flexisip/logmanager.hh>
 #include <flexisip/agent.hh>
 #include <flexisip/module.hh>
@@ -27,6 +28,7 @@
 #include <sofia-sip/su_random.h>
 
 #include <map>
+#include <unordered_map>
 #include <list>
 #include <set>
 #include <string>
@@ -40,6 +42,7 @@
 namespace flexisip {
 
 class ContactUpdateListener;
+class CoalescedFetchListener;
 
 struct ExtendedContactCommon {
 	std::string mContactId;
@@ -65,22 +68,22 @@ struct ExtendedContact {
 	std::string mContactId;
 	std::string mCallId;
 	std::string mUniqueId;
-	std::list<std::string> mPath; //list of urls as string (not enclosed with brakets)
-	std::string mUserAgent;
-	sip_contact_t *mSipContact; // Full contact
+	InternedStringList mPath; //list of urls as string (not enclosed with brakets)
+	InternedString mUserAgent;
+	sip_contact_t *mSipContact; // Full contact, allocated as a single block owned by this contact
 	float mQ;
 	time_t mExpireAt;
 	time_t mExpireNotAtMessage;  // real expires time but not for message
 	time_t mUpdatedTime;
 	uint32_t mCSeq;
-	std::list<std::string> mAcceptHeader;
+	InternedStringList mAcceptHeader;
 	uintptr_t mConnId; // a unique id shared with associate t_port
-	SofiaAutoHome mHome;
 	bool mAlias;
 	bool mUsedAsRoute; /*whether the contact information shall be used as a route when forming a request, instead of
 						  replacing the request-uri*/
 	
 	bool mIsFallback = false; // boolean indicating whether this ExtendedContact is a fallback route or not. There is no need for it to be serialized to database.
+	bool mIsDirty = false; // whether this contact was inserted or updated since it was last written to the database. Not serialized.
 
 	const char *callId() const {
 		return mCallId.c_str();
@@ -98,7 +101,7 @@ struct ExtendedContact {
 		return mUserAgent.c_str();
 	}
 	const std::string &getUserAgent() const {
-		return mUserAgent;
+		return mUserAgent.get();
 	}
 
 	static int resolveExpire(const char *contact_expire, int global_expire) {
@@ -136,55 +139,85 @@ struct ExtendedContact {
 	}
 
 	std::string serializeAsUrlEncodedParams();
+	/* Versioned binary encoding, which is decoded without parsing the contact as a SIP header. */
+	std::string serializeAsBinary() const;
+	static bool isBinarySerialization(const char *data, size_t size) {
+		// A url encoded contact never starts with a nul byte.
+		return size > 0 && data[0] == '\0';
+	}
 
 	std::string getOrgLinphoneSpecs() const;
 
 	void extractInfoFromHeader(const char *urlHeaders);
 	const std::string getMessageExpires(const msg_param_t *m_params);
 	void init();
+	void extractContactParams();
 	void extractInfoFromUrl(const char* full_url);
+	bool extractInfoFromBinary(const char *data, size_t size);
+	/* Replaces mSipContact by a copy of the first contact of the list. */
+	void setSipContact(const sip_contact_t *contact);
+	/* Whether this contact was registered with the same contact, path, user agent and accept headers as in sip. */
+	bool isRegisteredBy(const sip_t *sip, const sip_contact_t *contact) const;
 
 	ExtendedContact(const char *contactId, const char *uniqueId, const char* fullUrl)
 		: mCallId(), mUserAgent(), mSipContact(nullptr), mQ(1.0), mExpireAt(LONG_MAX), mExpireNotAtMessage(LONG_MAX),
-			mUpdatedTime(0), mCSeq(0), mAcceptHeader({}), mConnId(0), mHome(), mAlias(false), mUsedAsRoute(false) {
+			mUpdatedTime(0), mCSeq(0), mAcceptHeader(), mConnId(0), mAlias(false), mUsedAsRoute(false) {
 		if (contactId) mContactId = contactId;
 		if (uniqueId) mUniqueId = uniqueId;
 		extractInfoFromUrl(fullUrl);
 		init();
 	}
 
+	/* A contact serialized either as url encoded parameters or with serializeAsBinary(). */
+	ExtendedContact(const char *contactId, const char *uniqueId, const char *data, size_t size)
+		: mCallId(), mUserAgent(), mSipContact(nullptr), mQ(1.0), mExpireAt(LONG_MAX), mExpireNotAtMessage(LONG_MAX),
+			mUpdatedTime(0), mCSeq(0), mAcceptHeader(), mConnId(0), mAlias(false), mUsedAsRoute(false) {
+		if (contactId) mContactId = contactId;
+		if (uniqueId) mUniqueId = uniqueId;
+		if (isBinarySerialization(data, size)) {
+			if (!extractInfoFromBinary(data, size)) setSipContact(nullptr);
+		} else {
+			extractInfoFromUrl(std::string(data, size).c_str());
+			init();
+		}
+	}
+
 	ExtendedContact(const ExtendedContactCommon &common, const sip_contact_t *sip_contact, int global_expire, uint32_t cseq,
 					time_t updateTime, bool alias, const std::list<std::string> &acceptHeaders, const std::string &userAgent)
 		: mContactId(common.mContactId), mCallId(common.mCallId), mUniqueId(common.mUniqueId), mPath(common.mPath),
 			mUserAgent(userAgent), mSipContact(nullptr), mQ(1.0),mExpireNotAtMessage(global_expire), mUpdatedTime(updateTime),
-			mCSeq(cseq), mAcceptHeader(acceptHeaders), mConnId(0), mHome(), mAlias(alias), mUsedAsRoute(false) {
+			mCSeq(cseq), mAcceptHeader(acceptHeaders), mConnId(0), mAlias(alias), mUsedAsRoute(false) {
 
-		mSipContact = sip_contact_dup(mHome.home(), sip_contact);
-		mSipContact->m_next = nullptr;
+		setSipContact(sip_contact);
 		init();
 	}
 
 	ExtendedContact(const url_t *url, const std::string &route, const float q = 1.0)
-	: mContactId(), mCallId(), mUniqueId(), mPath({route}), mUserAgent(), mSipContact(nullptr), mQ(q), mExpireAt(LONG_MAX),
-		mExpireNotAtMessage(LONG_MAX), mUpdatedTime(0), mCSeq(0), mAcceptHeader({}),
-		mConnId(0), mHome(), mAlias(false), mUsedAsRoute(false) {
-		mSipContact = sip_contact_create(mHome.home(), (url_string_t*)url, nullptr);
+	: mContactId(), mCallId(), mUniqueId(), mPath(std::vector<std::string>{route}), mUserAgent(), mSipContact(nullptr),
+		mQ(q), mExpireAt(LONG_MAX), mExpireNotAtMessage(LONG_MAX), mUpdatedTime(0), mCSeq(0), mAcceptHeader(),
+		mConnId(0), mAlias(false), mUsedAsRoute(false) {
+		SofiaAutoHome home;
+		setSipContact(sip_contact_create(home.home(), (url_string_t*)url, nullptr));
 	}
 
 	ExtendedContact(const ExtendedContact &ec)
 		: mContactId(ec.mContactId), mCallId(ec.mCallId), mUniqueId(ec.mUniqueId), mPath(ec.mPath), mUserAgent(ec.mUserAgent),
 		mSipContact(nullptr), mQ(ec.mQ), mExpireAt(ec.mExpireAt), mExpireNotAtMessage(ec.mExpireNotAtMessage), mUpdatedTime(ec.mUpdatedTime),
-		mCSeq(ec.mCSeq), mAcceptHeader(ec.mAcceptHeader), mConnId(ec.mConnId), mHome(), mAlias(ec.mAlias), mUsedAsRoute(ec.mUsedAsRoute), mIsFallback(ec.mIsFallback){
-		mSipContact = sip_contact_dup(mHome.home(), ec.mSipContact);
-		mSipContact->m_next = nullptr;
+		mCSeq(ec.mCSeq), mAcceptHeader(ec.mAcceptHeader), mConnId(ec.mConnId), mAlias(ec.mAlias), mUsedAsRoute(ec.mUsedAsRoute), mIsFallback(ec.mIsFallback){
+		setSipContact(ec.mSipContact);
 	}
 
+	ExtendedContact &operator=(const ExtendedContact &ec) = delete;
+	~ExtendedContact();
+
 	std::ostream &print(std::ostream &stream, time_t _now = getCurrentTime(), time_t offset = 0) const;
 	sip_contact_t *toSofiaContact(su_home_t *home, time_t now) const;
 	sip_route_t *toSofiaRoute(su_home_t *home) const;
 
 	/*returns a new url_t where ConnId (private flexisip parameter) is removed*/
 	url_t *toSofiaUrlClean(su_home_t *home);
+	/*returns an estimation of the memory used by this contact, in bytes*/
+	size_t getMemoryUsage() const;
 };
 
 template <typename TraitsT>
@@ -228,11 +261,19 @@ class Record {
 	bool isInvalidRegister(const std::string &call_id, uint32_t cseq);
 	void clean(time_t time, const std::shared_ptr<ContactUpdateListener> &listener);
 	void update(const sip_t *sip, int globalExpire, bool alias, int version, const std::shared_ptr<ContactUpdateListener> &listener);
+	/*
+	 * Refreshes the binding of a REGISTER holding a single contact that is already bound with the same call-id and a
+	 * lower CSeq, and not changed otherwise: only its expiry and CSeq are moved. Returns the refreshed contact, or
+	 * nullptr if the REGISTER is not such a refresh and must go through update().
+	 */
+	std::shared_ptr<ExtendedContact> refresh(const sip_t *sip, int globalExpire);
 	//Deprecated: this one is used by protobuf serializer
 	void update(const ExtendedContactCommon &ecc, const char *sipuri, long int expireAt, float q, uint32_t cseq,
 				time_t updated_time, bool alias, const std::list<std::string> accept, bool usedAsRoute,
 				const std::shared_ptr<ContactUpdateListener> &listener);
 	bool updateFromUrlEncodedParams(const char *key, const char *uid, const char *full_url, const std::shared_ptr<ContactUpdateListener> &listener);
+	/* Same as updateFromUrlEncodedParams(), for a contact in any of the formats ExtendedContact can be read from. */
+	bool updateFromSerializedContact(const char *key, const char *uid, const char *data, size_t size, const std::shared_ptr<ContactUpdateListener> &listener);
 
 	void print(std::ostream &stream) const;
 	bool isEmpty() const {
@@ -253,6 +294,10 @@ class Record {
 	void cleanContactsToRemoveList() {
 		mContactsToRemove.clear();
 	}
+	/**
+	 * Forget about the pending changes (dirty contacts and contacts to remove) once they have been written to the database.
+	 */
+	void cleanPendingChanges();
 	/*
 	 * Synthetise the pub-gruu address from an extended contact belonging to this Record.
 	 * FIXME: Unfortunately this function is not widely used in Flexisip, instead there are several
@@ -270,6 +315,8 @@ class Record {
 	}
 	time_t latestExpire() const;
 	time_t latestExpire(Agent *ag) const;
+	/*returns an estimation of the memory used by this record and its contacts, in bytes*/
+	size_t getMemoryUsage() const;
 	static std::list<std::string> route_to_stl(const sip_route_s *route);
 	void appendContactsFrom(const std::shared_ptr<Record> &src);
 	static std::string defineKeyFromUrl(const url_t *aor);
@@ -308,6 +355,40 @@ class RegistrarDbListener : public StatFinishListener {
 	virtual void onInvalid() = 0;
 };
 
+/**
+ * Counters maintained by the RegistrarDb implementations. They are published in the stats of the Registrar module.
+ */
+struct RegistrarDbConnectionStats {
+	uint64_t mPendingCommands = 0; // commands sent and not answered yet
+	uint64_t mCommandCount = 0; // commands answered
+	uint64_t mRoundTripTotalUs = 0; // sum of the round trip times of the answered commands, in microseconds
+};
+
+struct RegistrarDbReplicaStats {
+	std::string mAddress; // host:port of the replica
+	size_t mConnection = 0; // index of the connection to the replica in RegistrarDbStats::mConnections
+	int64_t mLag = -1; // seconds since the replica last acknowledged the replication stream, -1 if unknown
+	int64_t mLagBytes = -1; // replication offset of the master minus the one of the replica, -1 if unknown
+	uint64_t mReads = 0; // read commands sent to the replica
+};
+
+struct RegistrarDbStats {
+	uint64_t mBindBytesWritten = 0; // bytes of serialized contacts written to the database by binds
+	std::vector<RegistrarDbConnectionStats> mConnections; // one entry per connection to the database, if any
+	uint64_t mClusterRedirections = 0; // commands sent again to another node of a redis cluster
+	uint64_t mCacheHits = 0; // fetches served by the local record cache
+	uint64_t mCacheMisses = 0; // fetches sent to the database while the local record cache is enabled
+	uint64_t mCacheInvalidations = 0; // records removed from the local record cache because they changed
+	std::vector<RegistrarDbReplicaStats> mReplicas; // one entry per replica used for reads, if any
+	uint64_t mReplicaReadsAvoided = 0; // reads sent to the master because the record was recently written
+	uint64_t mCoalescedFetches = 0; // fetches answered by the database lookup of an identical pending fetch
+	uint64_t mContactsMigrated = 0; // url encoded contacts read from redis and written again in binary
+	uint64_t mRefreshes = 0; // binds that only moved the expiry and CSeq of an unchanged binding
+	uint64_t mRecords = 0; // records held in memory by the internal implementation
+	uint64_t mBindings = 0; // contacts of these records
+	uint64_t mBindingBytes = 0; // estimation of the memory used by these records, in bytes
+};
+
 class RegistrarDbStateListener {
 public:
 	virtual void onRegistrarDbWritable (bool writable) = 0;
@@ -317,6 +398,10 @@ class ContactUpdateListener : public RegistrarDbListener {
 	public:
 	virtual ~ContactUpdateListener();
 	virtual void onContactUpdated(const std::shared_ptr<ExtendedContact> &ec) = 0;
+	/* Called instead of onRecordFound() when a bind only refreshed a binding that did not change. */
+	virtual void onRecordRefreshed(const std::shared_ptr<Record> &r) {
+		onRecordFound(r);
+	}
 };
 
 class ListContactUpdateListener {
@@ -325,6 +410,10 @@ class ListContactUpdateListener {
 	virtual void onContactsUpdated() = 0;
 
 	std::vector<std::shared_ptr<Record>> records;
+	/* The answer to each url of the fetchList(), in the order of the urls: the record found, or nullptr if there is
+	 * none or if its fetch failed, as told by failedFetches. */
+	std::vector<std::shared_ptr<Record>> recordsByUrl;
+	std::vector<bool> failedFetches;
 };
 
 class ContactRegisteredListener {
@@ -380,6 +469,9 @@ class RegistrarDb {
 	unsigned long countLocalActiveRecords() {
 		return mLocalRegExpire->countActives();
 	}
+	const RegistrarDbStats &getStats() const {
+		return mStats;
+	}
 
 	void addStateListener (const std::shared_ptr<RegistrarDbStateListener> &listener);
 	void removeStateListener (const std::shared_ptr<RegistrarDbStateListener> &listener);
@@ -402,40 +494,69 @@ class RegistrarDb {
 		mLocalRegExpire->unsubscribe(listener);
 	}
   protected:
+	/**
+	 * Keeps the expiration time of the local registrations in a hierarchical timer wheel: level 0 has a slot per
+	 * second for the next 256 seconds, and each next level 64 slots covering 64 slots of the previous one. The entries
+	 * of a slot are moved to the lower level when its time comes, so that removeExpiredBefore() only handles the
+	 * entries that expire, whatever the number of registrations.
+	 */
 	class LocalRegExpire {
-		std::map<std::string, time_t> mRegMap;
+		struct Entry {
+			std::string key;
+			time_t expire;
+		};
+		typedef std::list<Entry> Slot;
+		struct Position {
+			unsigned level;
+			size_t slot;
+			Slot::iterator entry;
+		};
+
+		std::unordered_map<std::string, Position> mRegMap;
+		std::vector<std::vector<Slot>> mWheel;
+		time_t mCurrent; // time up to which the expired entries have been removed
 		std::mutex mMutex;
 		std::list<LocalRegExpireListener *> mLocalRegListenerList;
 		Agent *mAgent;
 
+		void schedule(const std::string &key, time_t expire);
+		void place(Slot &from, Slot::iterator entry, time_t earliest);
+		void cascade(unsigned level, size_t slot);
+		void unschedule(std::unordered_map<std::string, Position>::iterator it);
+		void update(const std::string &key, time_t expire, bool schedulable);
+
 	  public:
-		void remove(const std::string key) {
-			std::lock_guard<std::mutex> lock(mMutex);
-			mRegMap.erase(key);
-		}
+		void remove(const std::string key);
 		void update(const std::shared_ptr<Record> &record);
+		/* Schedules the removal of a key at the given time, or unschedules it if the time is 0. */
+		void update(const std::string &key, time_t expire);
 		size_t countActives();
 		void removeExpiredBefore(time_t before);
 		LocalRegExpire(Agent *ag);
-		void clearAll() {
-			std::lock_guard<std::mutex> lock(mMutex);
-			mRegMap.clear();
-		}
+		void clearAll();
 
 		void subscribe(LocalRegExpireListener *listener);
 		void unsubscribe(LocalRegExpireListener *listener);
 		void notifyLocalRegExpireListener(unsigned int count);
 	};
 	virtual void doBind(const sip_t *sip, int globalExpire, bool alias, int version, const std::shared_ptr<ContactUpdateListener> &listener) = 0;
+	/* Handles the bind if it is a refresh of an unchanged binding (see Record::refresh()), returns false otherwise. */
+	virtual bool doRefresh(const sip_t *sip, int globalExpire, const std::shared_ptr<ContactUpdateListener> &listener) {
+		return false;
+	}
 	virtual void doClear(const sip_t *sip, const std::shared_ptr<ContactUpdateListener> &listener) = 0;
 	virtual void doFetch(const url_t *url, const std::shared_ptr<ContactUpdateListener> &listener) = 0;
 	virtual void doFetchForGruu(const url_t *url, const std::string &gruu, const std::shared_ptr<ContactUpdateListener> &listener) = 0;
+	/* Fetches the records of urls, without gruu, each of them being answered to the listener at the same position. */
+	virtual void doFetchList(const std::vector<url_t *> urls, const std::vector<std::shared_ptr<ContactUpdateListener>> &listeners) = 0;
 	virtual void doMigration() = 0;
 
 	int count_sip_contacts(const sip_contact_t *contact);
 	bool errorOnTooMuchContactInBind(const sip_contact_t *sip_contact, const std::string &key,
 									 const std::shared_ptr<RegistrarDbListener> &listener);
 	void fetchWithDomain(const url_t *url, const std::shared_ptr<ContactUpdateListener> &listener, bool recursive);
+	void fetchCoalesced(const url_t *url, const std::string &gruu, const std::shared_ptr<ContactUpdateListener> &listener);
+	void detachPendingFetches(const std::string &key);
 	void notifyContactListener(const std::string &key, const std::string &uid);
 	void notifyStateListener () const;
 
@@ -443,7 +564,11 @@ class RegistrarDb {
 	virtual ~RegistrarDb();
 	std::multimap<std::string, std::shared_ptr<ContactRegisteredListener>> mContactListenersMap;
 	std::list<std::shared_ptr<RegistrarDbStateListener>> mStateListeners;
+	/* Database lookups in progress, by record key, or by record key followed by ";gr=<gruu>" for a gruu lookup. */
+	std::map<std::string, std::shared_ptr<CoalescedFetchListener>> mPendingFetches;
+	friend class CoalescedFetchListener;
 	LocalRegExpire *mLocalRegExpire;
+	RegistrarDbStats mStats;
 	bool mUseGlobalDomain;
 	std::string mMessageExpiresName;
 	static RegistrarDb *sUnique;
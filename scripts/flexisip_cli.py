@@ -4,7 +4,7 @@
 import sys
 
 def print_usage():
-	print 'Usage: ./flexisip_cli.py [-p/--pid <pid>] [-s/--server "proxy"/"presence"] <CONFIG_GET/CONFIG_LIST/CONFIG_SET/REGISTRAR_CLEAR> <"all"/path_to_value> [value_to_set]'
+	print 'Usage: ./flexisip_cli.py [-p/--pid <pid>] [-s/--server "proxy"/"presence"] <CONFIG_GET/CONFIG_LIST/CONFIG_SET/REGISTRAR_CLEAR/MODULE_LATENCY/LOOP_HEALTH> ["all"/path_to_value/sip_address/module_name] [value_to_set]'
 
 def getpid(serverType):
 	from subprocess import check_output, CalledProcessError
@@ -52,13 +52,13 @@ def main():
 		print_usage()
 		sys.exit(2)
 		
-	if len(args) < 2:
+	if len(args) < 2 and args[:1] != ['LOOP_HEALTH']:
 		print 'Error: at least 2 arguments expected'
 		print_usage()
 		sys.exit(2)
 		
-	if not args[0] in ['CONFIG_GET', 'CONFIG_LIST', 'CONFIG_SET', 'REGISTRAR_CLEAR']:
-		print 'Error: command must be either CONFIG_GET, CONFIG_LIST, CONFIG_SET or REGISTRAR_CLEAR'
+	if not args[0] in ['CONFIG_GET', 'CONFIG_LIST', 'CONFIG_SET', 'REGISTRAR_CLEAR', 'MODULE_LATENCY', 'LOOP_HEALTH']:
+		print 'Error: command must be either CONFIG_GET, CONFIG_LIST, CONFIG_SET, REGISTRAR_CLEAR, MODULE_LATENCY or LOOP_HEALTH'
 		print_usage()
 		sys.exit(2)
 		
@@ -21,6 +21,8 @@
 
 #include "domain-registrations.hh"
 #include "plugin/plugin-loader.hh"
+#include "loop-monitor.hh"
+#include "overload-control.hh"
 #include <flexisip/registrardb.hh>
 
 #include <flexisip/logmanager.hh>
@@ -28,6 +30,7 @@
 
 #include "etchosts.hh"
 #include <algorithm>
+#include <cctype>
 #include <sstream>
 #include <sofia-sip/tport_tag.h>
 #include <sofia-sip/su_tagarg.h>
@@ -35,8 +38,17 @@
 #include <sofia-sip/su_md5.h>
 #include <sofia-sip/tport.h>
 
+/*
+ * TPTAG_REUSEPORT() is provided by sofia-sip once patched with patches/sofia/sofia_tport_reuseport.patch. Without it,
+ * the proxy cannot run several workers, which main() checks, and the tag is skipped.
+ */
+#ifndef TPTAG_REUSEPORT
+#define TPTAG_REUSEPORT(x) TAG_SKIP(x)
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 
 #include <net/if.h>
@@ -172,8 +184,10 @@ void Agent::checkAllowedParams(const url_t *uri) {
 
 void Agent::initializePreferredRoute() {
 	//Adding internal transport to transport in "cluster" case
+	//The workers of a proxy behave as the nodes of a cluster, the requests for a contact being routed to the one
+	//holding its connection.
 	GenericStruct *cluster = GenericManager::get()->getRoot()->get<GenericStruct>("cluster");
-	if (cluster->get<ConfigBoolean>("enabled")->read()) {
+	if (cluster->get<ConfigBoolean>("enabled")->read() || mWorkerCount > 1) {
 		int err = 0;
 		string internalTransport = cluster->get<ConfigString>("internal-transport")->read();
 
@@ -193,6 +207,12 @@ void Agent::initializePreferredRoute() {
 			url_t *url = url_make(&mHome, internalTransport.c_str());
 
 			if (url != nullptr) {
+				if (mWorkerCount > 1) {
+					// Unlike the public ports, the internal one is proper to each worker.
+					int port = url->url_port ? atoi(url->url_port) : url->url_type == url_sips ? 5061 : 5060;
+					url->url_port = su_sprintf(&mHome, "%d", port + mWorkerIndex);
+					internalTransport = url_as_string(&mHome, url);
+				}
 				mPreferredRouteV4 = url_hdup(&mHome, url);
 				LOGD("Agent's preferred IP for internal routing find: v4: %s", internalTransport.c_str());
 			}
@@ -208,8 +228,54 @@ void Agent::loadModules() {
 		(*it)->checkConfig();
 		(*it)->load();
 	}
+	buildModuleChains();
 	if (mDrm) mDrm->load(mPassphrase);
 	mPassphrase = "";
+	// The domain registrations may have added transports.
+	updateLocalAddresses();
+}
+
+void Agent::buildModuleChains() {
+	auto chains = make_shared<ModuleChains>();
+	chains->requests.resize(Module::KindCount);
+	chains->responses.resize(Module::KindCount);
+	for (int i = 0; i < Module::KindCount; ++i) {
+		Module::MessageKind kind = (Module::MessageKind)i;
+		ostringstream requestModules, responseModules;
+		for (Module *module : mModules) {
+			if (module->isProcessingRequests(kind)) {
+				chains->requests[i].push_back(module);
+				requestModules << " " << module->getModuleName();
+			}
+			if (module->isProcessingResponses(kind)) {
+				chains->responses[i].push_back(module);
+				responseModules << " " << module->getModuleName();
+			}
+		}
+		if (kind != Module::KindResponse) {
+			SLOGD << "Modules processing " << Module::getMessageKindName(kind) << " requests:" << requestModules.str();
+			SLOGD << "Modules processing responses to " << Module::getMessageKindName(kind)
+				  << " requests:" << responseModules.str();
+		}
+	}
+	atomic_store(&mModuleChains, shared_ptr<const ModuleChains>(chains));
+}
+
+// Position in the chain of the first module following the given one. The given module may be missing from the chain
+// when it was rebuilt after the module suspended the event.
+vector<Module *>::const_iterator Agent::findNextModule(const vector<Module *> &chain, Module *module) const {
+	auto it = find(chain.begin(), chain.end(), module);
+	if (it != chain.end())
+		return it + 1;
+	auto next = find(mModules.begin(), mModules.end(), module);
+	if (next != mModules.end())
+		++next;
+	for (; next != mModules.end(); ++next) {
+		it = find(chain.begin(), chain.end(), *next);
+		if (it != chain.end())
+			return it;
+	}
+	return chain.end();
 }
 
 bool getUriParameter(const url_t *url, const char *param, string &value){
@@ -273,6 +339,7 @@ void Agent::startMdns(){
 }
 
 static void timerfunc(su_root_magic_t *magic, su_timer_t *t, Agent *a) {
+	LoopMonitor::Probe probe(a->getLoopMonitor(), LoopMonitor::SourceAgentIdle);
 	a->idle();
 }
 
@@ -301,6 +368,8 @@ void Agent::start(const string &transport_override, const string passphrase) {
 
 	mTimer = su_timer_create(su_root_task(mRoot), 5000);
 	su_timer_set_for_ever(mTimer, reinterpret_cast<su_timer_f>(timerfunc), this);
+	mLoopMonitor->start();
+	mOverloadControl->start(mLoopMonitor.get());
 
 	mainTlsCertsDir = absolutePath(currDir, mainTlsCertsDir);
 
@@ -323,6 +392,16 @@ void Agent::start(const string &transport_override, const string passphrase) {
 		su_home_init(&home);
 		url = url_make(&home, uri.c_str());
 		LOGD("Enabling transport %s", uri.c_str());
+		/* The workers share the UDP socket and the Via sent-by, so the responses of a peer that a worker sent a request
+		 * to, without it having registered through this worker, would be handed by the kernel to any of them. */
+		if (mWorkerCount > 1 && url && uri.find("sips") != 0) {
+			char transport[16] = {0};
+			if (!url_param(url->url_params, "transport", transport, sizeof(transport)) ||
+				strcasecmp(transport, "udp") == 0) {
+				LOGF("Running several workers requires transports without UDP, add ';transport=tcp' to %s.",
+					 uri.c_str());
+			}
+		}
 		if (uri.find("sips") == 0) {
 			string keys;
 			string value;
@@ -352,7 +431,7 @@ void Agent::start(const string &transport_override, const string passphrase) {
 				TPTAG_TLS_VERIFY_POLICY(tls_policy), TPTAG_IDLE(tports_idle_timeout),
 				TPTAG_TIMEOUT(incompleteIncomingMessageTimeout),
 				TPTAG_KEEPALIVE(keepAliveInterval), TPTAG_SDWN_ERROR(1),
-				TPTAG_QUEUESIZE(queueSize),
+				TPTAG_QUEUESIZE(queueSize), TAG_IF(mWorkerCount > 1, TPTAG_REUSEPORT(1)),
 				TAG_END()
 			);
 		} else {
@@ -360,7 +439,7 @@ void Agent::start(const string &transport_override, const string passphrase) {
 				mAgent, (const url_string_t *)url, TPTAG_IDLE(tports_idle_timeout),
 				TPTAG_TIMEOUT(incompleteIncomingMessageTimeout),
 				TPTAG_KEEPALIVE(keepAliveInterval), TPTAG_SDWN_ERROR(1),
-				TPTAG_QUEUESIZE(queueSize),
+				TPTAG_QUEUESIZE(queueSize), TAG_IF(mWorkerCount > 1, TPTAG_REUSEPORT(1)),
 				TAG_END()
 			);
 		}
@@ -624,6 +703,10 @@ Agent::Agent(su_root_t *root) : mBaseConfigListener(NULL), mTerminating(false) {
 		module->declare(cr);
 
 	onDeclare(cr);
+	mOverloadControl.reset(new OverloadControl(this, cr->get<GenericStruct>("global")));
+	mLoopMonitor.reset(new LoopMonitor(root, cr->get<GenericStruct>("global")));
+	for (Module *module : mModules)
+		mIdleSources.push_back(mLoopMonitor->addSource("timer:idle:" + module->getModuleName()));
 
 	struct ifaddrs *net_addrs;
 	int err = getifaddrs(&net_addrs);
@@ -688,8 +771,23 @@ bool Agent::doOnConfigStateChanged(const ConfigValue &conf, ConfigState state) {
 	LOGD("Configuration of agent changed for key %s to %s", conf.getName().c_str(), conf.get().c_str());
 
 	if (conf.getName() == "aliases" && state == ConfigState::Commited) {
-		mAliases = ((ConfigStringList *)(&conf))->read();
-		LOGD("Global aliases updated");
+		/* The configuration is changed from the command line thread, while the transports and isUs() belong to the
+		 * main loop: the new aliases are handed to it. */
+		su_msg_r msg = SU_MSG_R_INIT;
+		if (-1 == su_msg_create(msg, su_root_task(mRoot), su_root_task(mRoot), sUpdateAliases,
+								sizeof(pair<Agent *, list<string> *>))) {
+			LOGE("Couldn't create the message updating the aliases");
+			return false;
+		}
+		auto update = (pair<Agent *, list<string> *> *)su_msg_data(msg);
+		update->first = this;
+		update->second = new list<string>(((ConfigStringList *)(&conf))->read());
+		if (-1 == su_msg_send(msg)) {
+			LOGE("Couldn't send the message updating the aliases to the main thread");
+			delete update->second;
+			su_msg_destroy(msg);
+			return false;
+		}
 		return true;
 	}
 
@@ -707,6 +805,7 @@ void Agent::loadConfig(GenericManager *cm) {
 	for (list<string>::iterator it = mAliases.begin(); it != mAliases.end(); ++it) {
 		LOGD("%s", (*it).c_str());
 	}
+	updateLocalAddresses();
 
 	RegistrarDb::initialize(this);
 
@@ -884,44 +983,92 @@ int Agent::countUsInVia(sip_via_t *via) const {
 	return count;
 }
 
-bool Agent::isUs(const char *host, const char *port, bool check_aliases) const {
-	char *tmp = NULL;
-	size_t end;
-	tport_t *tport = tport_primaries(nta_agent_tports(mAgent));
-
-	// skip possibly trailing '.' at the end of host
-	if (host[end = (strlen(host) - 1)] == '.') {
-		tmp = (char *)alloca(end + 1);
-		memcpy(tmp, host, end);
-		tmp[end] = '\0';
-		host = tmp;
+void Agent::sUpdateAliases(su_root_magic_t *rm, su_msg_r msg, void *u) {
+	auto update = (pair<Agent *, list<string> *> *)su_msg_data(msg);
+	update->first->mAliases = move(*update->second);
+	delete update->second;
+	update->first->updateLocalAddresses();
+	LOGD("Global aliases updated");
+}
+
+// Size of the buffer of hostKey(), larger than any host name and than INET6_ADDRSTRLEN.
+static const size_t sHostKeySize = 256;
+
+// Writes the lower case host without brackets nor trailing dot, IPv6 addresses being in their canonical form, so that
+// the names of a same host give a same key. Returns its length, 0 for a host too long to be one of ours.
+static size_t hostKey(const char *host, char *key) {
+	size_t len = strlen(host);
+	if (len > 0 && host[len - 1] == '.')
+		--len;
+	if (len >= 2 && host[0] == '[' && host[len - 1] == ']') {
+		++host;
+		len -= 2;
 	}
-	const char *matched_port = port;
-
-	if (check_aliases) {
-		/*the checking of aliases ignores the port number, since a domain name in a Route header might resolve to
-		 * multiple ports
-			* thanks to SRV records*/
-		list<string>::const_iterator it;
-		for (it = mAliases.begin(); it != mAliases.end(); ++it) {
-			if (ModuleToolbox::urlHostMatch(host, (*it).c_str()))
-				return true;
-		}
+	if (len >= sHostKeySize)
+		return 0;
+	memcpy(key, host, len);
+	key[len] = '\0';
+	if (memchr(key, ':', len)) {
+		struct in6_addr addr;
+		if (inet_pton(AF_INET6, key, &addr) == 1 && inet_ntop(AF_INET6, &addr, key, sHostKeySize))
+			return strlen(key);
 	}
+	for (size_t i = 0; i < len; ++i)
+		key[i] = tolower(key[i]);
+	return len;
+}
 
-	for (; tport != NULL; tport = tport_next(tport)) {
+void Agent::updateLocalAddresses() {
+	auto addresses = make_shared<LocalAddresses>();
+	char key[sHostKeySize];
+	for (const auto &alias : mAliases) {
+		size_t len = hostKey(alias.c_str(), key);
+		if (len > 0)
+			addresses->aliases.insert(addresses->store(key, len));
+	}
+	for (tport_t *tport = tport_primaries(nta_agent_tports(mAgent)); tport != NULL; tport = tport_next(tport)) {
 		const tp_name_t *tn = tport_name(tport);
-		if (port == NULL) {
-			if (strcasecmp(tn->tpn_proto, "tls") == 0)
-				matched_port = "5061";
-			else
-				matched_port = "5060";
-		}
-		if (strcmp(matched_port, tn->tpn_port) == 0) {
-			if (ModuleToolbox::urlHostMatch(host, tn->tpn_canon) || ModuleToolbox::urlHostMatch(host, tn->tpn_host))
-				return true;
+		if (!tn->tpn_port)
+			continue;
+		const char *defaultPort = strcasecmp(tn->tpn_proto, "tls") == 0 ? "5061" : "5060";
+		for (const char *host : {tn->tpn_canon, tn->tpn_host}) {
+			size_t len = host ? hostKey(host, key) : 0;
+			if (len == 0)
+				continue;
+			LocalAddresses::Ports &ports = addresses->transports[addresses->store(key, len)];
+			if (find(ports.ports.begin(), ports.ports.end(), tn->tpn_port) == ports.ports.end())
+				ports.ports.push_back(tn->tpn_port);
+			// A host without port designates the transport listening on the default port of its protocol.
+			if (strcmp(tn->tpn_port, defaultPort) == 0)
+				ports.defaultPort = true;
 		}
 	}
+	atomic_store(&mLocalAddresses, shared_ptr<const LocalAddresses>(addresses));
+}
+
+bool Agent::isUs(const char *host, const char *port, bool check_aliases) const {
+	auto addresses = atomic_load(&mLocalAddresses);
+	if (!addresses)
+		return false;
+	char key[sHostKeySize];
+	LocalAddresses::Host lookup{key, hostKey(host, key)};
+	if (lookup.size == 0)
+		return false;
+
+	/*the checking of aliases ignores the port number, since a domain name in a Route header might resolve to
+	 * multiple ports thanks to SRV records*/
+	if (check_aliases && addresses->aliases.count(lookup))
+		return true;
+
+	auto it = addresses->transports.find(lookup);
+	if (it == addresses->transports.end())
+		return false;
+	if (port == NULL)
+		return it->second.defaultPort;
+	for (const auto &transportPort : it->second.ports) {
+		if (transportPort == port)
+			return true;
+	}
 	return false;
 }
 
@@ -934,6 +1081,20 @@ sip_via_t *Agent::getNextVia(sip_t *response) {
 	return NULL;
 }
 
+/**
+ * Tells whether the url is the internal transport of another worker of this proxy.
+ */
+bool Agent::isOtherWorker(const url_t *url) const {
+	if (mWorkerCount <= 1 || !mPreferredRouteV4 || !url->url_host || !mPreferredRouteV4->url_host)
+		return false;
+	if (!ModuleToolbox::urlHostMatch(url->url_host, mPreferredRouteV4->url_host))
+		return false;
+	// The internal ports of the workers follow each other, from the one of the first worker.
+	int port = ModuleToolbox::sipPortToInt(url->url_port);
+	int ownPort = ModuleToolbox::sipPortToInt(mPreferredRouteV4->url_port);
+	return port != ownPort && port >= ownPort - mWorkerIndex && port < ownPort - mWorkerIndex + mWorkerCount;
+}
+
 /**
  * Takes care of an eventual maddr parameter.
  */
@@ -972,11 +1133,13 @@ Module *Agent::findModule(const string &moduleName) const {
 
 template <typename SipEventT>
 inline void Agent::doSendEvent(
-	shared_ptr<SipEventT> ev, const list<Module *>::iterator &begin, const list<Module *>::iterator &end
+	shared_ptr<SipEventT> ev, const vector<Module *>::const_iterator &begin, const vector<Module *>::const_iterator &end
 ) {
 #define LOG_SCOPED_EV_THREAD(ssargs, key) LOG_SCOPED_THREAD(key, ssargs->getOrEmpty(key));
 
 	auto ssargs = ev->getMsgSip()->getSipAttr();
+	// The message may have changed while the event was suspended, or before it was injected.
+	ssargs->invalidate();
 	LOG_SCOPED_EV_THREAD(ssargs, "from.uri.user");
 	LOG_SCOPED_EV_THREAD(ssargs, "from.uri.domain");
 	LOG_SCOPED_EV_THREAD(ssargs, "to.uri.user");
@@ -984,12 +1147,25 @@ inline void Agent::doSendEvent(
 	LOG_SCOPED_EV_THREAD(ssargs, "method_or_status");
 	LOG_SCOPED_EV_THREAD(ssargs, "callid");
 
+	Module::MessageKind kind = Module::getMessageKind(ev->getSip());
+	auto nestedAtStart = mNestedProcessingTime;
+	auto start = chrono::steady_clock::now();
+	auto moduleStart = start;
 	for (auto it = begin; it != end; ++it) {
 		ev->mCurrModule = (*it);
+		auto nested = mNestedProcessingTime;
 		(*it)->process(ev);
+		auto moduleEnd = chrono::steady_clock::now();
+		// The events sent by the module meanwhile, such as forks, are accounted to the modules processing them.
+		auto own = (moduleEnd - moduleStart) - (mNestedProcessingTime - nested);
+		(*it)->recordProcessingTime(kind, own.count() > 0 ? own : chrono::steady_clock::duration::zero());
+		if (mLoopMonitor->getStallThreshold().count() > 0 && own >= mLoopMonitor->getStallThreshold())
+			mLoopMonitor->reportStall("module:" + (*it)->getModuleName(), own, ev->getSip());
+		moduleStart = moduleEnd;
 		if (ev->isTerminated() || ev->isSuspended())
 			break;
 	}
+	mNestedProcessingTime = nestedAtStart + (moduleStart - start);
 	if (!ev->isTerminated() && !ev->isSuspended()) {
 		LOGA("Event not handled");
 	}
@@ -1037,7 +1213,9 @@ void Agent::sendRequestEvent(shared_ptr<RequestSipEvent> ev) {
 			break;
 	}
 
-	doSendEvent(ev, mModules.begin(), mModules.end());
+	auto chains = atomic_load(&mModuleChains);
+	const vector<Module *> &chain = chains->requests[Module::getMethodKind(req->rq_method)];
+	doSendEvent(ev, chain.cbegin(), chain.cend());
 }
 
 void Agent::sendResponseEvent(shared_ptr<ResponseSipEvent> ev) {
@@ -1096,36 +1274,30 @@ void Agent::sendResponseEvent(shared_ptr<ResponseSipEvent> ev) {
 			break;
 	}
 
-	doSendEvent(ev, mModules.begin(), mModules.end());
+	auto chains = atomic_load(&mModuleChains);
+	const vector<Module *> &chain =
+		chains->responses[sip->sip_cseq ? Module::getMethodKind(sip->sip_cseq->cs_method) : Module::KindOther];
+	doSendEvent(ev, chain.cbegin(), chain.cend());
 }
 
 void Agent::injectRequestEvent(shared_ptr<RequestSipEvent> ev) {
 	SLOGD << "Inject Request SIP message:\n" << *ev->getMsgSip();
 	ev->restartProcessing();
 	SLOGD << "Injecting request event after " << ev->mCurrModule->getModuleName();
-	list<Module *>::iterator it;
-	for (it = mModules.begin(); it != mModules.end(); ++it) {
-		if (ev->mCurrModule == *it) {
-			++it;
-			break;
-		}
-	}
-	doSendEvent(ev, it, mModules.end());
+	auto chains = atomic_load(&mModuleChains);
+	const vector<Module *> &chain = chains->requests[Module::getMessageKind(ev->getSip())];
+	doSendEvent(ev, findNextModule(chain, ev->mCurrModule), chain.cend());
 }
 
 void Agent::injectResponseEvent(shared_ptr<ResponseSipEvent> ev) {
 	SLOGD << "Inject Response SIP message:\n" << *ev->getMsgSip();
-	list<Module *>::iterator it;
 	ev->restartProcessing();
 	SLOGD << "Injecting response event after " << ev->mCurrModule->getModuleName();
-	for (it = mModules.begin(); it != mModules.end(); ++it) {
-		if (ev->mCurrModule == *it) {
-			++it;
-			break;
-		}
-	}
-
-	doSendEvent(ev, it, mModules.end());
+	sip_t *sip = ev->getSip();
+	auto chains = atomic_load(&mModuleChains);
+	const vector<Module *> &chain =
+		chains->responses[sip->sip_cseq ? Module::getMethodKind(sip->sip_cseq->cs_method) : Module::KindOther];
+	doSendEvent(ev, findNextModule(chain, ev->mCurrModule), chain.cend());
 }
 
 /**
@@ -1147,6 +1319,13 @@ int Agent::onIncomingMessage(msg_t *msg, const sip_t *sip) {
 		LOGI("Skipping incoming message on expired agent");
 		return -1;
 	}
+	if (sip->sip_request && mOverloadControl->shouldReject(sip)) {
+		// Rejected before any event is created, so that it costs as little as possible.
+		incrReplyStat(503);
+		nta_msg_treply(mAgent, msg, 503, "Service Unavailable",
+					   SIPTAG_RETRY_AFTER_STR(to_string(mOverloadControl->getRetryAfter()).c_str()), TAG_END());
+		return 0;
+	}
 	// Assuming sip is derived from msg
 	shared_ptr<MsgSip> ms = make_shared<MsgSip>(msg);
 	if (sip->sip_request) {
@@ -1192,11 +1371,16 @@ url_t* Agent::urlFromTportName(su_home_t* home, const tp_name_t* name, bool avoi
 
 int Agent::messageCallback(nta_agent_magic_t *context, nta_agent_t *agent, msg_t *msg, sip_t *sip) {
 	Agent *a = (Agent *)context;
+	LoopMonitor::Probe probe(a->getLoopMonitor(), LoopMonitor::SourceIncomingMessage, msg_ref_create(msg));
 	return a->onIncomingMessage(msg, sip);
 }
 
 void Agent::idle() {
-	for_each(mModules.begin(), mModules.end(), mem_fun(&Module::idle));
+	auto source = mIdleSources.begin();
+	for (Module *module : mModules) {
+		LoopMonitor::Probe probe(mLoopMonitor.get(), *source++);
+		module->idle();
+	}
 	if (GenericManager::get()->mNeedRestart) {
 		exit(RESTART_EXIT_CODE);
 	}
@@ -27,8 +27,10 @@
 #include <poll.h>
 
 #include "cli.hh"
+#include "loop-monitor.hh"
 #include <flexisip/common.hh>
 #include <flexisip/logmanager.hh>
+#include <flexisip/module.hh>
 #include <flexisip/registrardb.hh>
 
 using namespace flexisip;
@@ -348,9 +350,47 @@ void ProxyCommandLineInterface::handle_registrar_clear_command(unsigned int sock
 	RegistrarDb::get()->clear(sip, listener);
 }
 
+void ProxyCommandLineInterface::handle_module_latency_command(unsigned int socket, const std::vector<std::string> &args) {
+	if (args.size() < 1) {
+		answer(socket, "Error: a module name or 'all' is expected for the MODULE_LATENCY command");
+		return;
+	}
+
+	std::string output;
+	for (Module *module : mAgent->getModules()) {
+		if (args.front() != "all" && args.front() != module->getModuleName()) continue;
+		if (!module->isEnabled()) continue;
+		output += module->getModuleName() + ":\r\n";
+		for (int i = 0; i < Module::KindCount; ++i) {
+			Module::MessageKind kind = (Module::MessageKind)i;
+			// Copies, as the main loop keeps recording values meanwhile.
+			LatencyHistogram processing = module->getProcessingTimes(kind);
+			LatencyHistogram suspended = module->getSuspendedTimes(kind);
+			std::string name = Module::getMessageKindName(kind);
+			if (processing.getCount() > 0)
+				output += "    " + name + " processing : " + processing.toString() + "\r\n";
+			if (suspended.getCount() > 0)
+				output += "    " + name + " suspended : " + suspended.toString() + "\r\n";
+		}
+	}
+	if (output.empty()) {
+		answer(socket, "Error: no enabled module named " + args.front());
+		return;
+	}
+	answer(socket, output);
+}
+
+void ProxyCommandLineInterface::handle_loop_health_command(unsigned int socket, const std::vector<std::string> &args) {
+	answer(socket, mAgent->getLoopMonitor()->toString());
+}
+
 void ProxyCommandLineInterface::parseAndAnswer(unsigned int socket, const std::string &command, const std::vector<std::string> &args) {
 	if (command == "REGISTRAR_CLEAR")
 		handle_registrar_clear_command(socket, args);
+	else if (command == "MODULE_LATENCY")
+		handle_module_latency_command(socket, args);
+	else if (command == "LOOP_HEALTH")
+		handle_loop_health_command(socket, args);
 	else
 		CommandLineInterface::parseAndAnswer(socket, command, args);
 }
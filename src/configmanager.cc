@@ -838,6 +838,18 @@ GenericManager::GenericManager()
 			"\techo \"/home/cores/core.\%e.\%t.\%p\" >/proc/sys/kernel/core_pattern"
 			, "true"},
 		{Boolean, "auto-respawn", "Automatically respawn flexisip in case of abnormal termination (crashes)", "true"},
+		{Integer, "workers",
+			"Number of processes running the proxy, each with its own SIP stack, so that it uses several cores. They all "
+			"listen on the ports of 'transports' thanks to SO_REUSEPORT, the kernel spreading the incoming datagrams and "
+			"connections between them, and behave as the nodes of a cluster on this host: each worker listens on the "
+			"'internal-transport' of the 'cluster' section, its port being incremented by the index of the worker, "
+			"through which the other workers reach the clients whose connection it holds, and the requests of the dialogs "
+			"it handles with another worker are routed back to it. The workers share the "
+			"registrations, so a value above 1 requires the 'redis' implementation of the registrar database, and "
+			"sofia-sip built with patches/sofia/sofia_tport_reuseport.patch. It also requires transports without UDP "
+			"(sips, or sip with ';transport=tcp'): the workers share the UDP socket, so the responses to the requests a "
+			"worker sends over UDP could be received by another one. Only supported by the proxy server.",
+			"1"},
 		{StringList, "aliases", "List of white space separated host names pointing to this machine. This is to prevent "
 								"loops while routing SIP messages.",
 		 "localhost"},
@@ -902,6 +914,25 @@ GenericManager::GenericManager()
 		{Boolean, "require-peer-certificate", "Require client certificate from peer (inbound connections only).", "false"},
 		{Integer, "transaction-timeout", "SIP transaction timeout in milliseconds. It is T1*64 (32000 ms) by default.",
 		 "32000"},
+		{Integer, "overload-max-loop-lag",
+		 "Lag of the main loop, in milliseconds, beyond which the proxy is overloaded: it then rejects a growing share "
+		 "of the requests out of dialogs, such as REGISTERs and new INVITEs, with a 503 and a Retry-After header, until "
+		 "it is no longer. The requests within dialogs and the responses are always processed. 0 disables this limit.",
+		 "0"},
+		{Integer, "overload-max-suspended-events",
+		 "Number of events waiting for asynchronous work, such as the requests waiting for the registrar database or "
+		 "an authentication backend, beyond which the proxy is overloaded, see 'overload-max-loop-lag'. 0 disables "
+		 "this limit.",
+		 "0"},
+		{Integer, "overload-retry-after",
+		 "Minimum value, in seconds, of the Retry-After header of the requests rejected because the proxy is "
+		 "overloaded. Each rejection gets a value between this one and its double, to spread the retries.",
+		 "10"},
+		{Integer, "loop-stall-threshold",
+		 "Duration, in milliseconds, beyond which a callback of the main loop (processing of a message, transaction, "
+		 "redis reply, timer or module) is logged as a stall, along with the SIP message it was handling. The "
+		 "durations of the callbacks are shown by the LOOP_HEALTH command of flexisip_cli. 0 disables the logs.",
+		 "100"},
 		{Integer, "udp-mtu",
 		 "The UDP MTU. Flexisip will fallback to TCP when sending a message whose size exceeds the UDP MTU."
 		 " Please read http://sofia-sip.sourceforge.net/refdocs/nta/nta__tag_8h.html#a6f51c1ff713ed4b285e95235c4cc999a "
@@ -66,29 +66,45 @@ void ConfigEntryFilter::loadConfig(const GenericStruct *mc) {
 	}
 	mEnabled = mc->get<ConfigBoolean>("enabled")->read();
 	mBooleanExprFilter = BooleanExpression::parse(filter);
+	mCompiledFilter = CompiledBooleanExpression::compile(mBooleanExprFilter);
 	mEntryName = mc->getName();
+	if (mCompiledFilter)
+		LOGD("Filter of %s compiled to %zu instructions", mEntryName.c_str(), mCompiledFilter->size());
+	else
+		LOGD("Filter of %s uses unknown attributes, it is not compiled", mEntryName.c_str());
 }
 
 bool ConfigEntryFilter::canEnter(const shared_ptr<MsgSip> &ms) {
 	if (!mEnabled)
 		return false;
 
+	bool result;
 	auto attr = ms->getSipAttr();
-	try {
-		bool e = mBooleanExprFilter->eval(attr.get());
-		if (e)
-			++*mCountEvalTrue;
-		else
-			++*mCountEvalFalse;
-		return e;
-	} catch (FlexisipException &e) {
-		SLOGD << "Cannot evaluate entry filter [" << mEntryName << "] filter: " << e.what() << "returning false";
-		return false;
-	} catch (invalid_argument &e) {
-		throw FLEXISIP_EXCEPTION << "Fix your " << mEntryName << " filter: " << e.what();
+	if (mCompiledFilter) {
+		if (!mCompiledFilter->eval(*attr, result))
+			throw FLEXISIP_EXCEPTION << "Fix your " << mEntryName << " filter: an attribute it uses is missing";
+	} else {
+		try {
+			result = mBooleanExprFilter->eval(attr.get());
+		} catch (FlexisipException &e) {
+			SLOGD << "Cannot evaluate entry filter [" << mEntryName << "] filter: " << e.what() << "returning false";
+			return false;
+		} catch (invalid_argument &e) {
+			throw FLEXISIP_EXCEPTION << "Fix your " << mEntryName << " filter: " << e.what();
+		}
 	}
+	if (result)
+		++*mCountEvalTrue;
+	else
+		++*mCountEvalFalse;
+	return result;
 }
 
 bool ConfigEntryFilter::isEnabled() {
 	return mEnabled;
 }
+
+bool ConfigEntryFilter::isAlwaysFalse() {
+	bool value;
+	return !mEnabled || (mBooleanExprFilter->isConstant(value) && !value);
+}
@@ -38,6 +38,10 @@ class EntryFilter {
 	}
 	virtual bool canEnter(const std::shared_ptr<MsgSip> &ms) = 0;
 	virtual bool isEnabled() = 0;
+	// True when no message can enter, so that the module needs not be given any.
+	virtual bool isAlwaysFalse() {
+		return !isEnabled();
+	}
 	virtual ~EntryFilter() {
 	}
 };
@@ -53,10 +57,12 @@ class ConfigEntryFilter : public EntryFilter {
 	virtual void loadConfig(const GenericStruct *module_config);
 	virtual bool canEnter(const std::shared_ptr<MsgSip> &ms);
 	virtual bool isEnabled();
+	virtual bool isAlwaysFalse();
 
   private:
 	bool mEnabled;
 	std::shared_ptr<BooleanExpression> mBooleanExprFilter;
+	std::shared_ptr<CompiledBooleanExpression> mCompiledFilter; // Null when the filter cannot be compiled.
 	std::string mEntryName;
 };
 
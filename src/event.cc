@@ -89,14 +89,20 @@ SipEvent::SipEvent(const shared_ptr<OutgoingAgent> &outAgent, const shared_ptr<M
 
 SipEvent::SipEvent(const SipEvent &sipEvent): enable_shared_from_this<SipEvent>(),
 	  mCurrModule(sipEvent.mCurrModule), mIncomingAgent(sipEvent.mIncomingAgent),
-	  mOutgoingAgent(sipEvent.mOutgoingAgent), mAgent(sipEvent.mAgent), mState(sipEvent.mState) {
+	  mOutgoingAgent(sipEvent.mOutgoingAgent), mAgent(sipEvent.mAgent), mState(sipEvent.mState),
+	  mSuspendedAt(sipEvent.mSuspendedAt), mSuspendedCount(sipEvent.mSuspendedCount) {
 	LOGD("New SipEvent %p with state %s", this, stateStr(mState).c_str());
+	if (mSuspendedCount)
+		++*mSuspendedCount;
 	// make a copy of the msgsip when the SipEvent is copy-constructed
 	mMsgSip = make_shared<MsgSip>(*sipEvent.mMsgSip);
 }
 
 SipEvent::~SipEvent() {
 	// LOGD("Destroy SipEvent %p", this);
+	// An event may be released while suspended, its module giving up on it.
+	if (mSuspendedCount)
+		--*mSuspendedCount;
 }
 
 void SipEvent::flushLog() {
@@ -116,6 +122,7 @@ void SipEvent::setEventLog(const std::shared_ptr<EventLog> &log) {
 void SipEvent::terminateProcessing() {
 	LOGD("Terminate SipEvent %p", this);
 	if (mState == STARTED || mState == SUSPENDED) {
+		if (mState == SUSPENDED) leaveSuspension();
 		mState = TERMINATED;
 		flushLog();
 		mIncomingAgent.reset();
@@ -131,6 +138,11 @@ void SipEvent::suspendProcessing() {
 	LOGD("Suspend SipEvent %p", this);
 	if (mState == STARTED) {
 		mState = SUSPENDED;
+		mSuspendedAt = chrono::steady_clock::now();
+		if (mCurrModule) {
+			mSuspendedCount = mCurrModule->getSuspendedEventsCount();
+			++*mSuspendedCount;
+		}
 	} else {
 		LOGA("Can't suspendProcessing: wrong state %s", stateStr(mState).c_str());
 	}
@@ -139,12 +151,23 @@ void SipEvent::suspendProcessing() {
 void SipEvent::restartProcessing() {
 	LOGD("Restart SipEvent %p", this);
 	if (mState == SUSPENDED) {
+		leaveSuspension();
 		mState = STARTED;
 	} else {
 		LOGA("Can't restartProcessing: wrong state %s", stateStr(mState).c_str());
 	}
 }
 
+void SipEvent::leaveSuspension() {
+	if (mCurrModule) {
+		mCurrModule->recordSuspendedTime(Module::getMessageKind(getSip()), chrono::steady_clock::now() - mSuspendedAt);
+	}
+	if (mSuspendedCount) {
+		--*mSuspendedCount;
+		mSuspendedCount.reset();
+	}
+}
+
 std::shared_ptr<IncomingTransaction> SipEvent::getIncomingTransaction() {
 	return dynamic_pointer_cast<IncomingTransaction>(getIncomingAgent());
 }
@@ -67,6 +67,10 @@ class EmptyBooleanExpression : public BooleanExpression {
 	bool eval(const SipAttributes *args) {
 		return true;
 	}
+	bool isConstant(bool &value) const {
+		value = true;
+		return true;
+	}
 };
 
 shared_ptr<BooleanExpression> parseExpression(const string &expr, size_t *newpos);
@@ -99,6 +103,46 @@ void log_boolean_expression_parsing(bool value) {
 	if (logEval)                                                                                                       \
 	SLOGI
 
+/* Splits a space separated list, as given to the 'in' operator. */
+static void splitList(const string &s, list<string> &values) {
+	values.clear();
+
+	size_t pos1 = 0;
+	size_t pos2 = 0;
+	for (pos2 = 0; pos2 < s.size(); ++pos2) {
+		if (s[pos2] != ' ') {
+			if (s[pos1] == ' ')
+				pos1 = pos2;
+			continue;
+		}
+		if (s[pos2] == ' ' && s[pos1] == ' ') {
+			pos1 = pos2;
+			continue;
+		}
+		values.push_back(s.substr(pos1, pos2 - pos1));
+		pos1 = pos2;
+	}
+
+	if (pos1 != pos2)
+		values.push_back(s.substr(pos1, pos2 - pos1));
+}
+
+static bool isInList(const char *value, const list<string> &values) {
+	for (auto it = values.begin(); it != values.end(); ++it) {
+		if (*it == value)
+			return true;
+	}
+	return false;
+}
+
+static bool isNumeric(const char *value) {
+	for (; *value; ++value) {
+		if (!isdigit(*value))
+			return false;
+	}
+	return true;
+}
+
 class VariableOrConstant {
 	list<string> mValueList;
 
@@ -106,6 +150,13 @@ class VariableOrConstant {
 	virtual ~VariableOrConstant() {
 	}
 	virtual const std::string &get(const SipAttributes *args) = 0;
+	// The value when it does not depend on the message, null otherwise.
+	virtual const std::string *getConstant() const {
+		return nullptr;
+	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression::Operand &operand) const = 0;
+#endif
 	bool defined(const SipAttributes *args) {
 		try {
 			get(args);
@@ -115,28 +166,7 @@ class VariableOrConstant {
 		return false;
 	}
 	const list<string> &getAsList(const SipAttributes *args) {
-		string s = get(args);
-		mValueList.clear();
-
-		size_t pos1 = 0;
-		size_t pos2 = 0;
-		for (pos2 = 0; pos2 < s.size(); ++pos2) {
-			if (s[pos2] != ' ') {
-				if (s[pos1] == ' ')
-					pos1 = pos2;
-				continue;
-			}
-			if (s[pos2] == ' ' && s[pos1] == ' ') {
-				pos1 = pos2;
-				continue;
-			}
-			mValueList.push_back(s.substr(pos1, pos2 - pos1));
-			pos1 = pos2;
-		}
-
-		if (pos1 != pos2)
-			mValueList.push_back(s.substr(pos1, pos2 - pos1));
-
+		splitList(get(args), mValueList);
 		return mValueList;
 	}
 };
@@ -151,20 +181,47 @@ class Constant : public VariableOrConstant {
 	virtual const std::string &get(const SipAttributes *args) {
 		return mVal;
 	}
+	virtual const std::string *getConstant() const {
+		return &mVal;
+	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression::Operand &operand) const {
+		operand.constant = mVal;
+		splitList(mVal, operand.constantList);
+		return true;
+	}
+#endif
 };
 
 class Variable : public VariableOrConstant {
 	string mId;
 	string mVal;
+#ifndef NO_SOFIA
+	int mAttributeId;
+#endif
 
   public:
 	Variable(const std::string &val) : mId(val) {
 		LOGPARSE << "Creating variable XX" << val << "XX";
+#ifndef NO_SOFIA
+		mAttributeId = SipAttributes::getAttributeId(mId);
+#endif
 	}
 	virtual const std::string &get(const SipAttributes *args) {
+#ifndef NO_SOFIA
+		// The value memoized by the attributes of the message.
+		if (mAttributeId >= 0)
+			return args->get(mAttributeId);
+#endif
 		mVal = args->get(mId);
 		return mVal;
 	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression::Operand &operand) const {
+		operand.attribute = SipAttributes::getAttributeId(mId);
+		return operand.attribute >= 0;
+	}
+#endif
 };
 
 class TrueFalseExpression : public BooleanExpression {
@@ -180,6 +237,23 @@ class TrueFalseExpression : public BooleanExpression {
 			return false;
 		return args->isTrue(mId);
 	}
+	virtual bool isConstant(bool &value) const {
+		if (mId != "true" && mId != "false")
+			return false;
+		value = (mId == "true");
+		return true;
+	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression &program) {
+		if (mId == "is_request")
+			program.emit(CompiledBooleanExpression::Op::IsRequest);
+		else if (mId == "is_response")
+			program.emit(CompiledBooleanExpression::Op::IsResponse);
+		else
+			return false;
+		return true;
+	}
+#endif
 };
 
 class LogicalAnd : public BooleanExpression {
@@ -197,6 +271,27 @@ class LogicalAnd : public BooleanExpression {
 		LOGEVAL << "eval && : " << ptr() << tf(res);
 		return res;
 	}
+	virtual bool isConstant(bool &value) const {
+		bool v1 = false, v2 = false;
+		bool c1 = mExp1->isConstant(v1), c2 = mExp2->isConstant(v2);
+		if ((c1 && !v1) || (c2 && !v2)) {
+			value = false;
+			return true;
+		}
+		value = true;
+		return c1 && c2;
+	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression &program) {
+		if (!program.compileChild(mExp1))
+			return false;
+		size_t jump = program.emitJump(CompiledBooleanExpression::Op::JumpIfFalse);
+		if (!program.compileChild(mExp2))
+			return false;
+		program.patchJump(jump);
+		return true;
+	}
+#endif
 };
 
 class LogicalOr : public BooleanExpression {
@@ -213,6 +308,27 @@ class LogicalOr : public BooleanExpression {
 		LOGEVAL << "eval || : " << tf(res);
 		return res;
 	}
+	virtual bool isConstant(bool &value) const {
+		bool v1 = false, v2 = false;
+		bool c1 = mExp1->isConstant(v1), c2 = mExp2->isConstant(v2);
+		if ((c1 && v1) || (c2 && v2)) {
+			value = true;
+			return true;
+		}
+		value = false;
+		return c1 && c2;
+	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression &program) {
+		if (!program.compileChild(mExp1))
+			return false;
+		size_t jump = program.emitJump(CompiledBooleanExpression::Op::JumpIfTrue);
+		if (!program.compileChild(mExp2))
+			return false;
+		program.patchJump(jump);
+		return true;
+	}
+#endif
 
   private:
 	shared_ptr<BooleanExpression> mExp1, mExp2;
@@ -228,11 +344,37 @@ class LogicalNot : public BooleanExpression {
 		LOGEVAL << "evaluating logicalnot : " << (res ? "true" : "false");
 		return res;
 	}
+	virtual bool isConstant(bool &value) const {
+		if (!mExp->isConstant(value))
+			return false;
+		value = !value;
+		return true;
+	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression &program) {
+		if (!program.compileChild(mExp))
+			return false;
+		program.emit(CompiledBooleanExpression::Op::Not);
+		return true;
+	}
+#endif
 
   private:
 	shared_ptr<BooleanExpression> mExp;
 };
 
+#ifndef NO_SOFIA
+static bool compileOperator(CompiledBooleanExpression &program, CompiledBooleanExpression::Op op,
+							const shared_ptr<VariableOrConstant> &var1, const shared_ptr<VariableOrConstant> &var2,
+							const regex_t *regex = nullptr) {
+	CompiledBooleanExpression::Operand left, right;
+	if (!var1->compile(left) || (var2 && !var2->compile(right)))
+		return false;
+	program.emit(op, left, right, regex);
+	return true;
+}
+#endif
+
 class EqualsOp : public BooleanExpression {
   public:
 	EqualsOp(shared_ptr<VariableOrConstant> var1, shared_ptr<VariableOrConstant> var2) : mVar1(var1), mVar2(var2) {
@@ -243,6 +385,18 @@ class EqualsOp : public BooleanExpression {
 		LOGEVAL << "evaluating " << mVar1->get(args) << " == " << mVar2->get(args) << " : " << (res ? "true" : "false");
 		return res;
 	}
+	virtual bool isConstant(bool &value) const {
+		const string *v1 = mVar1->getConstant(), *v2 = mVar2->getConstant();
+		if (!v1 || !v2)
+			return false;
+		value = (*v1 == *v2);
+		return true;
+	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression &program) {
+		return compileOperator(program, CompiledBooleanExpression::Op::Equals, mVar1, mVar2);
+	}
+#endif
 
   private:
 	shared_ptr<VariableOrConstant> mVar1, mVar2;
@@ -258,6 +412,18 @@ class UnEqualsOp : public BooleanExpression {
 		LOGEVAL << "evaluating " << mVar1->get(args) << " != " << mVar2->get(args) << " : " << (res ? "true" : "false");
 		return res;
 	}
+	virtual bool isConstant(bool &value) const {
+		const string *v1 = mVar1->getConstant(), *v2 = mVar2->getConstant();
+		if (!v1 || !v2)
+			return false;
+		value = (*v1 != *v2);
+		return true;
+	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression &program) {
+		return compileOperator(program, CompiledBooleanExpression::Op::UnEquals, mVar1, mVar2);
+	}
+#endif
 
   private:
 	shared_ptr<VariableOrConstant> mVar1, mVar2;
@@ -282,6 +448,18 @@ class NumericOp : public BooleanExpression {
 		LOGEVAL << "evaluating " << var << " is numeric : " << (res ? "true" : "false");
 		return res;
 	}
+	virtual bool isConstant(bool &value) const {
+		const string *v = mVar->getConstant();
+		if (!v)
+			return false;
+		value = isNumeric(v->c_str());
+		return true;
+	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression &program) {
+		return compileOperator(program, CompiledBooleanExpression::Op::Numeric, mVar, nullptr);
+	}
+#endif
 };
 
 class DefinedOp : public BooleanExpression {
@@ -297,6 +475,17 @@ class DefinedOp : public BooleanExpression {
 		LOGEVAL << "evaluating is defined for " << mName << (res ? "true" : "false");
 		return res;
 	}
+	virtual bool isConstant(bool &value) const {
+		if (!mVar->getConstant())
+			return false;
+		value = true;
+		return true;
+	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression &program) {
+		return compileOperator(program, CompiledBooleanExpression::Op::Defined, mVar, nullptr);
+	}
+#endif
 };
 
 class Regex : public BooleanExpression {
@@ -335,6 +524,21 @@ class Regex : public BooleanExpression {
 		LOGEVAL << "evaluating " << input << " is regex  " << mPattern->get(NULL) << " : " << (res ? "true" : "false");
 		return res;
 	}
+	virtual bool isConstant(bool &value) const {
+		const string *input = mInput->getConstant();
+		if (!input)
+			return false;
+		int match = regexec(&preg, input->c_str(), 0, NULL, 0);
+		if (match != 0 && match != REG_NOMATCH)
+			return false;
+		value = (match == 0);
+		return true;
+	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression &program) {
+		return compileOperator(program, CompiledBooleanExpression::Op::Regex, mInput, nullptr, &preg);
+	}
+#endif
 };
 
 class ContainsOp : public BooleanExpression {
@@ -360,6 +564,18 @@ class ContainsOp : public BooleanExpression {
 		// we could get a runtime_error, which we let bubble up because this error denotes a badly written filter (instead of just a missing field in the SIP message.
 		return res;
 	}
+	virtual bool isConstant(bool &value) const {
+		const string *v1 = mVar1->getConstant(), *v2 = mVar2->getConstant();
+		if (!v1 || !v2)
+			return false;
+		value = v1->find(*v2) != string::npos;
+		return true;
+	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression &program) {
+		return compileOperator(program, CompiledBooleanExpression::Op::Contains, mVar1, mVar2);
+	}
+#endif
 };
 
 class InOp : public BooleanExpression {
@@ -382,6 +598,20 @@ class InOp : public BooleanExpression {
 		LOGEVAL << "->" << (res ? "true" : "false");
 		return res;
 	}
+	virtual bool isConstant(bool &value) const {
+		const string *v1 = mVar1->getConstant(), *v2 = mVar2->getConstant();
+		if (!v1 || !v2)
+			return false;
+		list<string> values;
+		splitList(*v2, values);
+		value = isInList(v1->c_str(), values);
+		return true;
+	}
+#ifndef NO_SOFIA
+	virtual bool compile(CompiledBooleanExpression &program) {
+		return compileOperator(program, CompiledBooleanExpression::Op::In, mVar1, mVar2);
+	}
+#endif
 
   private:
 	shared_ptr<VariableOrConstant> mVar1, mVar2;
@@ -722,3 +952,149 @@ shared_ptr<BooleanExpression> parseExpression(const string &expr, size_t *newpos
 	*newpos += i;
 	return cur_exp;
 };
+
+#ifndef NO_SOFIA
+shared_ptr<CompiledBooleanExpression> CompiledBooleanExpression::compile(const shared_ptr<BooleanExpression> &expr) {
+	auto program = make_shared<CompiledBooleanExpression>();
+	if (!program->compileChild(expr))
+		return nullptr;
+	program->mSource = expr;
+	return program;
+}
+
+bool CompiledBooleanExpression::compileChild(const shared_ptr<BooleanExpression> &expr) {
+	bool value;
+	if (expr->isConstant(value)) {
+		emitConstant(value);
+		return true;
+	}
+	return expr->compile(*this);
+}
+
+void CompiledBooleanExpression::emitConstant(bool value) {
+	emit(Op::Constant);
+	mProgram.back().value = value;
+}
+
+void CompiledBooleanExpression::emit(Op op, const Operand &left, const Operand &right, const regex_t *regex) {
+	Instruction instruction;
+	instruction.op = op;
+	instruction.value = false;
+	instruction.target = 0;
+	instruction.left = left;
+	instruction.right = right;
+	instruction.regex = regex;
+	mProgram.push_back(instruction);
+}
+
+/* The jumps keep the value of the left operand of && and ||, which is the value of the whole when taken. */
+size_t CompiledBooleanExpression::emitJump(Op op) {
+	emit(op);
+	return mProgram.size() - 1;
+}
+
+void CompiledBooleanExpression::patchJump(size_t jump) {
+	mProgram[jump].target = mProgram.size();
+}
+
+bool CompiledBooleanExpression::isConstant(bool &value) const {
+	if (mProgram.size() != 1 || mProgram.front().op != Op::Constant)
+		return false;
+	value = mProgram.front().value;
+	return true;
+}
+
+const char *CompiledBooleanExpression::getValue(const Operand &operand, const SipAttributes &attributes) {
+	if (operand.attribute < 0)
+		return operand.constant.c_str();
+	const string *value = attributes.find(operand.attribute);
+	return value ? value->c_str() : nullptr;
+}
+
+bool CompiledBooleanExpression::eval(const sip_t *sip, bool &result) const {
+	SipAttributes attributes(sip);
+	return eval(attributes, result);
+}
+
+bool CompiledBooleanExpression::eval(const SipAttributes &attributes, bool &result) const {
+	const sip_t *sip = attributes.getSip();
+	bool value = true;
+	for (size_t pc = 0; pc < mProgram.size(); ++pc) {
+		const Instruction &instruction = mProgram[pc];
+		const char *left, *right;
+		switch (instruction.op) {
+			case Op::Constant:
+				value = instruction.value;
+				break;
+			case Op::IsRequest:
+				value = sip->sip_request != NULL;
+				break;
+			case Op::IsResponse:
+				value = sip->sip_request == NULL;
+				break;
+			case Op::Not:
+				value = !value;
+				break;
+			case Op::JumpIfFalse:
+				if (!value)
+					pc = instruction.target - 1;
+				break;
+			case Op::JumpIfTrue:
+				if (value)
+					pc = instruction.target - 1;
+				break;
+			case Op::Defined:
+				value = getValue(instruction.left, attributes) != nullptr;
+				break;
+			case Op::Contains:
+				// As ContainsOp, a missing operand makes it false instead of failing the evaluation.
+				left = getValue(instruction.left, attributes);
+				right = getValue(instruction.right, attributes);
+				value = left && right && strstr(left, right) != nullptr;
+				break;
+			case Op::Equals:
+			case Op::UnEquals:
+				left = getValue(instruction.left, attributes);
+				right = getValue(instruction.right, attributes);
+				if (!left || !right)
+					return false;
+				value = (strcmp(left, right) == 0) == (instruction.op == Op::Equals);
+				break;
+			case Op::In: {
+				left = getValue(instruction.left, attributes);
+				if (!left)
+					return false;
+				if (instruction.right.attribute < 0) {
+					value = isInList(left, instruction.right.constantList);
+					break;
+				}
+				right = getValue(instruction.right, attributes);
+				if (!right)
+					return false;
+				list<string> values;
+				splitList(right, values);
+				value = isInList(left, values);
+				break;
+			}
+			case Op::Numeric:
+				left = getValue(instruction.left, attributes);
+				if (!left)
+					return false;
+				value = isNumeric(left);
+				break;
+			case Op::Regex: {
+				left = getValue(instruction.left, attributes);
+				if (!left)
+					return false;
+				int match = regexec(instruction.regex, left, 0, NULL, 0);
+				if (match != 0 && match != REG_NOMATCH)
+					return false;
+				value = (match == 0);
+				break;
+			}
+		}
+	}
+	result = value;
+	return true;
+}
+#endif
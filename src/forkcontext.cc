@@ -481,20 +481,14 @@ void ForkContext::onNewBranch(const shared_ptr<BranchInfo> &br) {
 void ForkContext::onCancel(const shared_ptr<RequestSipEvent> &ev) {
 }
 
-void ForkContext::addKey(string key) {
-     mKeys.push_back(key);
+void ForkContext::addForkMapHandle(const ForkMapHandle &handle) {
+	mForkMapHandles.push_back(handle);
 }
 
-list<string> ForkContext::getKeys() {
-     return mKeys;
-}
-
-void ForkContext::setContactRegisteredListener (const shared_ptr<OnContactRegisteredListener> &listener) {
-	mContactRegisteredListener = listener;
-}
-
-const shared_ptr<OnContactRegisteredListener> &ForkContext::getContactRegisteredListener () const {
-	return mContactRegisteredListener;
+list<ForkMapHandle> ForkContext::takeForkMapHandles() {
+	list<ForkMapHandle> handles;
+	handles.swap(mForkMapHandles);
+	return handles;
 }
 
 shared_ptr<BranchInfo> ForkContext::createBranchInfo() {
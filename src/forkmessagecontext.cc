@@ -176,7 +176,7 @@ bool isMessageARCSFileTransferMessage(shared_ptr<RequestSipEvent> &ev) {
 }
 
 bool isConversionFromRcsToExternalBodyUrlNeeded(shared_ptr<ExtendedContact> &ec) {
-	list<string> acceptHeaders = ec->mAcceptHeader;
+	list<string> acceptHeaders = ec->mAcceptHeader.toList();
 	if (acceptHeaders.size() == 0) {
 		return true;
 	}
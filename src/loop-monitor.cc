@@ -0,0 +1,203 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "loop-monitor.hh"
+
+#include <sstream>
+#include <vector>
+
+#include <flexisip/logmanager.hh>
+
+using namespace std;
+using namespace flexisip;
+
+static void onPrepoll(su_prepoll_magic_t *magic, su_root_t *root) {
+	static_cast<LoopMonitor *>(magic)->onIteration();
+}
+
+static void onLagTimer(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg) {
+	static_cast<LoopMonitor *>(arg)->onLagTick();
+}
+
+LoopMonitor::Probe::Probe(LoopMonitor *monitor, int source, msg_t *msg)
+	: mMonitor(monitor), mSource(monitor ? &monitor->mSources[source] : nullptr), mMsg(msg) {
+	if (!mMonitor)
+		return;
+	if (mMonitor->mDepth++ == 0)
+		mMonitor->mStallReported = false;
+	mStart = chrono::steady_clock::now();
+}
+
+LoopMonitor::Probe::~Probe() {
+	if (mMonitor) {
+		auto duration = chrono::steady_clock::now() - mStart;
+		mMonitor->record(mSource, duration, mMsg ? (const sip_t *)msg_object(mMsg) : nullptr);
+		// The nested probes are already included in the outermost one.
+		if (--mMonitor->mDepth == 0) {
+			mMonitor->mIterationBusy += duration;
+			mMonitor->mIterationBusySet = true;
+		}
+	}
+	if (mMsg)
+		msg_destroy(mMsg);
+}
+
+LoopMonitor::LoopMonitor(su_root_t *root, GenericStruct *global) : mRoot(root) {
+	// In the order of the Source enum.
+	for (const char *name : {"incoming-message", "incoming-transaction", "outgoing-transaction", "redis",
+							 "timer:agent-idle", "timer:redis-info", "timer:redis-expiration", "timer:redis-bind-retry",
+							 "timer:registrar-file-sync"})
+		addSource(name);
+	mCountStalls = global->createStat("count-loop-stalls",
+									  "Number of callbacks of the main loop lasting longer than the loop-stall-threshold.");
+}
+
+LoopMonitor::~LoopMonitor() {
+	if (mLagTimer) {
+		su_timer_destroy(mLagTimer);
+		su_root_set_prepoll(mRoot, nullptr, nullptr);
+	}
+}
+
+void LoopMonitor::start() {
+	GenericStruct *global = GenericManager::get()->getRoot()->get<GenericStruct>("global");
+	mStallThreshold = chrono::milliseconds(global->get<ConfigInt>("loop-stall-threshold")->read());
+	su_root_set_prepoll(mRoot, onPrepoll, (su_prepoll_magic_t *)this);
+	mLastLagTick = chrono::steady_clock::now();
+	mLagTimer = su_timer_create(su_root_task(mRoot), sLagTickMs);
+	su_timer_set_for_ever(mLagTimer, onLagTimer, (su_timer_arg_t *)this);
+}
+
+/*
+ * Only called from the main loop, which is thus the only one changing the list, and the only one reading it without
+ * the mutex.
+ */
+int LoopMonitor::addSource(const string &name) {
+	auto it = mSourcesByName.find(name);
+	if (it != mSourcesByName.end())
+		return it->second;
+	lock_guard<mutex> lock(mMutex);
+	mSources.emplace_back(name);
+	return mSourcesByName[name] = (int)mSources.size() - 1;
+}
+
+/*
+ * The innermost callback exceeding the threshold is the one reported, the ones enclosing it being only accounted.
+ */
+void LoopMonitor::record(SourceStats *source, chrono::steady_clock::duration duration, const sip_t *sip) {
+	source->durations.record(duration);
+	if (mStallThreshold.count() <= 0 || duration < mStallThreshold)
+		return;
+	source->stalls.store(source->stalls.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	if (mStallReported)
+		return;
+	mStallReported = true;
+	++*mCountStalls;
+	logStall(source->name, duration, sip);
+}
+
+void LoopMonitor::reportStall(const string &source, chrono::steady_clock::duration duration, const sip_t *sip) {
+	if (mStallThreshold.count() <= 0 || duration < mStallThreshold)
+		return;
+	SourceStats &stats = mSources[addSource(source)];
+	stats.stalls.store(stats.stalls.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	if (mStallReported)
+		return;
+	if (mDepth > 0)
+		mStallReported = true;
+	++*mCountStalls;
+	logStall(source, duration, sip);
+}
+
+void LoopMonitor::logStall(const string &source, chrono::steady_clock::duration duration, const sip_t *sip) {
+	SLOGW << "Main loop stalled for " << chrono::duration_cast<chrono::milliseconds>(duration).count() << "ms in "
+		  << source << (sip ? " while handling " + describe(sip) : "");
+}
+
+string LoopMonitor::describe(const sip_t *sip) {
+	ostringstream oss;
+	if (sip->sip_request)
+		oss << sip->sip_request->rq_method_name;
+	else if (sip->sip_status)
+		oss << sip->sip_status->st_status << " " << (sip->sip_cseq ? sip->sip_cseq->cs_method_name : "");
+	if (sip->sip_call_id)
+		oss << " Call-ID: " << sip->sip_call_id->i_id;
+	if (sip->sip_from)
+		oss << " from " << (sip->sip_from->a_url->url_user ? sip->sip_from->a_url->url_user : "") << "@"
+			<< (sip->sip_from->a_url->url_host ? sip->sip_from->a_url->url_host : "");
+	if (sip->sip_to)
+		oss << " to " << (sip->sip_to->a_url->url_user ? sip->sip_to->a_url->url_user : "") << "@"
+			<< (sip->sip_to->a_url->url_host ? sip->sip_to->a_url->url_host : "");
+	return oss.str();
+}
+
+/*
+ * Called by the loop before it waits again, that is after each of its iterations.
+ */
+void LoopMonitor::onIteration() {
+	if (!mIterationBusySet)
+		return;
+	mIterations.record(mIterationBusy);
+	mIterationBusy = chrono::steady_clock::duration::zero();
+	mIterationBusySet = false;
+}
+
+/*
+ * The timer is rescheduled from the time it fired, so the time elapsed beyond the tick is how late the loop ran it.
+ */
+void LoopMonitor::onLagTick() {
+	auto now = chrono::steady_clock::now();
+	auto lag = (now - mLastLagTick) - chrono::milliseconds(sLagTickMs);
+	mLastLagTick = now;
+	if (lag.count() < 0)
+		lag = chrono::steady_clock::duration::zero();
+	mLag.record(lag);
+	if (mLagListener)
+		mLagListener(lag);
+}
+
+/*
+ * The figures are copied, the list of the sources under the mutex, and formatted afterwards.
+ */
+string LoopMonitor::toString() const {
+	struct SourceSnapshot {
+		string name;
+		LatencyHistogram durations;
+		uint64_t stalls;
+	};
+	LatencyHistogram lag = mLag;
+	LatencyHistogram iterations = mIterations;
+	vector<SourceSnapshot> sources;
+	{
+		lock_guard<mutex> lock(mMutex);
+		for (const auto &source : mSources)
+			sources.push_back({source.name, source.durations, source.stalls.load(memory_order_relaxed)});
+	}
+
+	string output = "loop lag : " + lag.toString() + "\r\n";
+	output += "iteration busy time : " + iterations.toString() + "\r\n";
+	output += "stalls : " + to_string(mCountStalls->read()) + " (threshold " +
+			  to_string(chrono::duration_cast<chrono::milliseconds>(mStallThreshold).count()) + "ms)\r\n";
+	for (const auto &source : sources) {
+		if (source.durations.getCount() == 0 && source.stalls == 0)
+			continue;
+		output += "    " + source.name + " : " + source.durations.toString() +
+				  " stalls=" + to_string(source.stalls) + "\r\n";
+	}
+	return output;
+}
@@ -0,0 +1,134 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <flexisip/configmanager.hh>
+#include <flexisip/histogram.hh>
+
+#include <sofia-sip/msg.h>
+#include <sofia-sip/sip.h>
+#include <sofia-sip/su_wait.h>
+
+namespace flexisip {
+
+/*
+ * Health of the main loop: how late it runs its timers, how long each of its iterations is busy, and how long the
+ * callbacks it runs take, by source (incoming messages, transactions, redis, timers...). A callback longer than the
+ * 'loop-stall-threshold' is logged along with the SIP message it was handling, so that a blocking call on the main
+ * thread shows up immediately. Only used from the thread of the main loop, except toString() which the cli calls from
+ * its own thread: the figures are relaxed atomics, and only the list of the sources, which the loop may extend, is
+ * read under a mutex.
+ */
+class LoopMonitor {
+  public:
+	// The sources known in advance, the others being added with addSource() before being probed.
+	enum Source {
+		SourceIncomingMessage,
+		SourceIncomingTransaction,
+		SourceOutgoingTransaction,
+		SourceRedis,
+		SourceAgentIdle,
+		SourceRedisInfo,
+		SourceRedisExpiration,
+		SourceRedisBindRetry,
+		SourceRegistrarFileSync,
+		SourceCount
+	};
+
+	struct SourceStats {
+		SourceStats(const std::string &name) : name(name) {
+		}
+		std::string name;
+		LatencyHistogram durations;
+		std::atomic<uint64_t> stalls{0};
+	};
+
+	/*
+	 * Measures a callback run by the main loop, from its construction to its destruction. The probe takes a reference
+	 * on the message handled by the callback, if any, so that it can still be described once the callback is over.
+	 */
+	class Probe {
+	  public:
+		Probe(LoopMonitor *monitor, int source, msg_t *msg = nullptr);
+		~Probe();
+
+	  private:
+		LoopMonitor *mMonitor;
+		SourceStats *mSource;
+		msg_t *mMsg;
+		std::chrono::steady_clock::time_point mStart;
+	};
+
+	LoopMonitor(su_root_t *root, GenericStruct *global);
+	~LoopMonitor();
+	// Reads the stall threshold and starts measuring the lag of the loop and the duration of its iterations.
+	void start();
+	// Called with each lag measured, every 100ms, by whatever needs to know whether the loop falls behind.
+	void setLagListener(const std::function<void(std::chrono::steady_clock::duration)> &listener) {
+		mLagListener = listener;
+	}
+	// Id of the source of the given name, to be given to the probes, the source being added if it is not known yet.
+	int addSource(const std::string &name);
+	// Accounts a stall of the given duration to a source that is not measured by a probe, such as a module.
+	void reportStall(const std::string &source, std::chrono::steady_clock::duration duration, const sip_t *sip);
+	std::chrono::steady_clock::duration getStallThreshold() const {
+		return mStallThreshold;
+	}
+	// One line per histogram, as shown by the LOOP_HEALTH command of the cli.
+	std::string toString() const;
+	// Called by the loop after each of its iterations, and by the timer measuring its lag.
+	void onIteration();
+	void onLagTick();
+
+  private:
+	void record(SourceStats *source, std::chrono::steady_clock::duration duration, const sip_t *sip);
+	void logStall(const std::string &source, std::chrono::steady_clock::duration duration, const sip_t *sip);
+	static std::string describe(const sip_t *sip);
+
+	static constexpr int sLagTickMs = 100;
+
+	su_root_t *mRoot;
+	su_timer_t *mLagTimer = nullptr;
+	std::chrono::steady_clock::time_point mLastLagTick;
+	std::chrono::steady_clock::duration mStallThreshold{0};
+	// A deque so that the probes can keep pointers to the sources while new ones are added.
+	std::deque<SourceStats> mSources;
+	std::unordered_map<std::string, int> mSourcesByName;
+	mutable std::mutex mMutex; // protects the list of the sources, not their figures
+	LatencyHistogram mLag;
+	LatencyHistogram mIterations;
+	// Time spent in the probes since the last iteration of the loop, and whether any ran.
+	std::chrono::steady_clock::duration mIterationBusy{0};
+	bool mIterationBusySet = false;
+	int mDepth = 0;
+	bool mStallReported = false; // Whether the stall of the current callback was reported by a nested probe.
+	StatCounter64 *mCountStalls;
+	std::function<void(std::chrono::steady_clock::duration)> mLagListener;
+};
+
+}
@@ -29,7 +29,9 @@
 #include <sys/prctl.h>
 #endif
 
+#include <algorithm>
 #include <iostream>
+#include <vector>
 #include <tclap/CmdLine.h>
 
 #ifdef ENABLE_TRANSCODER
@@ -51,6 +53,7 @@
 #include <sofia-sip/su_log.h>
 #include <sofia-sip/msg.h>
 #include <sofia-sip/sofia_features.h>
+#include <sofia-sip/tport_tag.h>
 #ifdef ENABLE_SNMP
 #include "snmp-agent.h"
 #endif
@@ -95,9 +98,12 @@
 
 static int run = 1;
 static int pipe_wdog_flexisip[2] = {
-	-1}; // This is the pipe that flexisip will write to to signify it has started to the Watchdog
+	-1, -1}; // This is the pipe that flexisip will write to to signify it has started to the Watchdog
+static int pipe_master_worker[2] = {
+	-1, -1}; // This is the pipe that the workers write to to signify they have started to their master
 static pid_t flexisip_pid = -1;
 static pid_t monitor_pid = -1;
+static std::vector<pid_t> worker_pids; // set in the master of the workers only, -1 for a worker that is not running
 static su_root_t *root = NULL;
 
 #if ENABLE_PRESENCE
@@ -134,6 +140,12 @@ static void flexisip_stop(int signum) {
 		// LOGD("Watchdog received quit signal...passing to child.");
 		/*we are the watchdog, pass the signal to our child*/
 		kill(flexisip_pid, signum);
+	} else if (!worker_pids.empty()) {
+		/*we are the master of the workers, pass the signal to them*/
+		run = 0;
+		for (pid_t pid : worker_pids) {
+			if (pid > 0) kill(pid, signum);
+		}
 	} else if (run != 0) {
 		// LOGD("Received quit signal...");
 
@@ -543,15 +555,118 @@ static const string getFunctionName(bool startProxy, bool startPresence, bool st
 
 static void notifyWatchDog(){
 	static bool notified = false;
-	if (!notified){
+	if (!notified && pipe_wdog_flexisip[1] != -1){
 		if (write(pipe_wdog_flexisip[1], "ok", 3) == -1) {
 			LOGF("Failed to write starter pipe: %s", strerror(errno));
 		}
 		close(pipe_wdog_flexisip[1]);
+		// The workers respawned later must not close the descriptor, which may have been reused in the meantime.
+		pipe_wdog_flexisip[1] = -1;
 		notified = true;
 	}
 }
 
+static void stopWorkersAndExit(int status) {
+	run = 0;
+	for (pid_t pid : worker_pids) {
+		if (pid > 0) kill(pid, SIGTERM);
+	}
+	for (pid_t pid : worker_pids) {
+		if (pid > 0) waitpid(pid, NULL, 0);
+	}
+	exit(status);
+}
+
+/* Forks a worker of the proxy, returning 0 in the worker. */
+static pid_t spawnWorker(int index, const string &functionName) {
+	pid_t pid = fork();
+	if (pid < 0) {
+		LOGE("Could not fork worker %i: %s", index, strerror(errno));
+	} else if (pid == 0) {
+		worker_pids.clear();
+		if (pipe_master_worker[0] != -1) close(pipe_master_worker[0]);
+		if (pipe_wdog_flexisip[1] != -1) close(pipe_wdog_flexisip[1]);
+		// The worker tells the master that it has started, the master telling the watchdog once all of them have.
+		pipe_wdog_flexisip[1] = pipe_master_worker[1];
+		// Keep the workers from drawing the same random numbers, such as the ports of the media relay.
+		srand((unsigned int)(time(NULL) ^ getpid()));
+		set_process_name("flexisip-" + functionName + "-" + to_string(index));
+	} else {
+		LOGI("Flexisip worker %i PID: %d", index, pid);
+	}
+	return pid;
+}
+
+/*
+ * Forks the workers of the proxy, see the 'workers' setting, and returns in each of them with its index. The calling
+ * process becomes their master: it waits for them to start, respawns the ones that crash, and exits with them.
+ */
+static int forkWorkers(int workerCount, bool autoRespawn, const string &functionName) {
+	if (pipe(pipe_master_worker) == -1) {
+		LOGE("Could not create pipes: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	worker_pids.assign(workerCount, -1);
+	for (int i = 0; i < workerCount; ++i) {
+		pid_t pid = spawnWorker(i, functionName);
+		if (pid == 0) return i;
+		if (pid < 0) stopWorkersAndExit(EXIT_FAILURE);
+		worker_pids[i] = pid;
+	}
+	set_process_name("flexisipmaster");
+
+	/* Each worker writes to the pipe and closes it once started: it is at end of file once all of them did or died. */
+	close(pipe_master_worker[1]);
+	pipe_master_worker[1] = -1;
+	size_t received = 0;
+	char buf[16];
+	ssize_t err;
+	while ((err = read(pipe_master_worker[0], buf, sizeof(buf))) != 0) {
+		if (err == -1 && errno != EINTR) break;
+		if (err > 0) received += err;
+	}
+	close(pipe_master_worker[0]);
+	pipe_master_worker[0] = -1;
+	if (received != 3 * (size_t)workerCount) {
+		LOGE("Not all the workers of flexisip could start");
+		stopWorkersAndExit(EXIT_FAILURE);
+	}
+	notifyWatchDog();
+
+	while (true) {
+		int status = 0;
+		pid_t pid = wait(&status);
+		if (pid < 0) {
+			if (errno == EINTR) continue;
+			LOGE("wait() error: %s", strerror(errno));
+			stopWorkersAndExit(EXIT_FAILURE);
+		}
+		auto it = find(worker_pids.begin(), worker_pids.end(), pid);
+		if (it == worker_pids.end()) continue;
+		int index = (int)(it - worker_pids.begin());
+		*it = -1;
+		if (run == 0) {
+			if (count(worker_pids.begin(), worker_pids.end(), -1) == workerCount) exit(EXIT_SUCCESS);
+			continue;
+		}
+		if (WIFEXITED(status)) {
+			// A worker exiting on its own, to apply a new configuration or because of an error, takes the others along.
+			LOGI("Flexisip worker %i exited with status %i, stopping the others", index, WEXITSTATUS(status));
+			stopWorkersAndExit(WEXITSTATUS(status));
+		}
+		if (!autoRespawn) {
+			LOGE("Flexisip worker %i apparently crashed, stopping the others", index);
+			stopWorkersAndExit(EXIT_FAILURE);
+		}
+		LOGE("Flexisip worker %i apparently crashed, respawning now...", index);
+		sleep(1);
+		pid = spawnWorker(index, functionName);
+		if (pid == 0) return index;
+		if (pid < 0) stopWorkersAndExit(EXIT_FAILURE);
+		worker_pids[index] = pid;
+	}
+}
+
 static string version() {
 	ostringstream version;
 	version << VERSION " (git: " FLEXISIP_GIT_VERSION ")\n";
@@ -875,6 +990,25 @@ int main(int argc, char *argv[]) {
 		makePidFile(pidFile.getValue());
 	}
 
+	/*
+	 * With several workers, this process only supervises them from now on, each of them running the proxy.
+	 */
+	int workers = startProxy ? cfg->getGlobal()->get<ConfigInt>("workers")->read() : 1;
+	int workerIndex = 0;
+	if (workers > 1) {
+		if (startPresence || startConference) {
+			LOGF("The 'workers' setting is only supported by the proxy server, the presence and conference servers "
+				 "must be started in their own process.");
+		}
+#ifndef TPTAG_REUSEPORT
+		LOGF("Running several workers requires sofia-sip built with patches/sofia/sofia_tport_reuseport.patch.");
+#endif
+		bool autoRespawn = cfg->getGlobal()->get<ConfigBoolean>("auto-respawn")->read();
+		workerIndex = forkWorkers(workers, autoRespawn, fName);
+	} else {
+		workers = 1;
+	}
+
 	/*
 	 * From now on, we are a flexisip daemon, that is a process that will run proxy, presence, or conference server.
 	 */
@@ -887,14 +1021,23 @@ int main(int argc, char *argv[]) {
 
 	//we create an Agent in all cases, because it will declare config items that are necessary for presence server to run.
 	a = make_shared<Agent>(root);
+	a->setWorker(workerIndex, workers);
 	setOpenSSLThreadSafe();
 	a->loadConfig(cfg);
 
 	if (startProxy){
+		if (workers > 1 && cfg->getRoot()
+								->get<GenericStruct>("module::Registrar")
+								->get<ConfigString>("db-implementation")
+								->read()
+								.find("redis") != 0) {
+			LOGF("Running several workers requires the 'redis' implementation of the registrar database, through "
+				 "which they share the registrations.");
+		}
 		a->start(transportsArg.getValue(), passphrase);
 	#ifdef ENABLE_SNMP
 		bool snmpEnabled = cfg->getGlobal()->get<ConfigBoolean>("enable-snmp")->read();
-		if (snmpEnabled) {
+		if (snmpEnabled && workerIndex == 0) {
 			snmpAgent.reset(new SnmpAgent(*a, *cfg, oset));
 		}
 	#endif
@@ -903,7 +1046,7 @@ int main(int argc, char *argv[]) {
 			cfg->applyOverrides(true); // using default + overrides
 
 		// Create cached test accounts for the Flexisip monitor if necessary
-		if (monitorEnabled) {
+		if (monitorEnabled && workerIndex == 0) {
 			try {
 				Monitor::createAccounts();
 			} catch (const FlexisipException &e) {
@@ -911,11 +1054,10 @@ int main(int argc, char *argv[]) {
 			}
 		}
 
-		if (daemonMode) {
-			notifyWatchDog();
-		}
+		notifyWatchDog();
 
-		if (cfg->getRoot()->get<GenericStruct>("stun-server")->get<ConfigBoolean>("enabled")->read()) {
+		// The workers share the ports of the proxy, not the one of the STUN server.
+		if (workerIndex == 0 && cfg->getRoot()->get<GenericStruct>("stun-server")->get<ConfigBoolean>("enabled")->read()) {
 			stun = new StunServer(cfg->getRoot()->get<GenericStruct>("stun-server")->get<ConfigInt>("port")->read());
 			stun->start();
 		}
@@ -934,9 +1076,7 @@ int main(int argc, char *argv[]) {
 			auto presenceLongTerm = make_shared<flexisip::PresenceLongterm>(presenceServer->getBelleSipMainLoop());
 			presenceServer->addPresenceInfoObserver(presenceLongTerm);
 		}
-		if (daemonMode) {
-			notifyWatchDog();
-		}
+		notifyWatchDog();
 		try{
 			presenceServer->init();
 		}catch(FlexisipException &e){
@@ -953,9 +1093,7 @@ int main(int argc, char *argv[]) {
 	if (startConference){
 #ifdef ENABLE_CONFERENCE
 		conferenceServer = make_shared<flexisip::ConferenceServer>(a->getPreferredRoute(), root);
-		if (daemonMode) {
-			notifyWatchDog();
-		}
+		notifyWatchDog();
 		try{
 			conferenceServer->init();
 		}catch(FlexisipException &e){
@@ -40,6 +40,12 @@ class MediaRelay : public Module, protected ModuleToolbox {
 	virtual void onUnload();
 	virtual void onRequest(std::shared_ptr<RequestSipEvent> &ev);
 	virtual void onResponse(std::shared_ptr<ResponseSipEvent> &ev);
+	virtual bool handlesRequests(MessageKind kind) const {
+		return kind == KindInvite || kind == KindBye || kind == KindCancel;
+	}
+	virtual bool handlesResponses(MessageKind kind) const {
+		return kind == KindInvite;
+	}
 	virtual void onIdle();
 
   protected:
@@ -46,6 +46,10 @@ public:
 
 	virtual void onResponse(shared_ptr<ResponseSipEvent> &ev) {}
 
+	virtual bool changesMessages() const {
+		return false;
+	}
+
 protected:
 	virtual void onDeclare(GenericStruct *module_config) {
 		ConfigItemDescriptor items[] = {{String, "assign-date-command",
@@ -272,6 +272,10 @@ class DoSProtection : public Module, ModuleToolbox {
 		su_timer_set_interval(ctx->timer, invokeLambdaFromSofiaTimerCallback, ctx, mBanTime * 60 * 1000);
 	}
 
+	bool changesMessages() const {
+		return false;
+	}
+
 	void onRequest(shared_ptr<RequestSipEvent> &ev) {
 		shared_ptr<tport_t> inTport = ev->getIncomingTport();
 		tport_t *tport = inTport.get();
@@ -312,7 +312,13 @@ void ForwardModule::sendRequest(shared_ptr<RequestSipEvent> &ev, url_t *dest) {
 	// to bridge to networks: for example, we'll end with UDP, TCP.
 	const sip_method_t method = ms->getSip()->sip_request->rq_method;
 	if (ev->mRecordRouteAdded && (method == sip_method_invite || method == sip_method_subscribe)) {
-		addRecordRoute(getAgent(), ev, tport);
+		if (getAgent()->isOtherWorker(dest)) {
+			// All the workers share the public address: the one the request is sent to must send the requests of the
+			// dialog back through the internal transport of this one, which holds the connection of the other party.
+			addRecordRoute(getAgent(), ev, url_hdup(ms->getHome(), getAgent()->getPreferredRouteUrl()));
+		} else {
+			addRecordRoute(getAgent(), ev, tport);
+		}
 	}
 
 	// Add path
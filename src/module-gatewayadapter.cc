@@ -350,6 +350,10 @@ public:
 
 	virtual void onResponse(shared_ptr<ResponseSipEvent> &ev);
 
+	virtual bool handlesResponses(MessageKind kind) const {
+		return false;
+	}
+
 	virtual bool isValidNextConfig(const ConfigValue &cv);
 
 private:
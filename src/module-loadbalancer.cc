@@ -32,6 +32,9 @@ public:
 	virtual void onLoad(const GenericStruct *modconf);
 	virtual void onRequest(shared_ptr<RequestSipEvent> &ev);
 	virtual void onResponse(shared_ptr<ResponseSipEvent> &ev);
+	virtual bool handlesResponses(MessageKind kind) const {
+		return false;
+	}
 
 private:
 	vector<string> mRoutes;
@@ -75,6 +75,10 @@ public:
 	void onDeclare(GenericStruct *module_config);
 	virtual void onRequest(std::shared_ptr<RequestSipEvent> &ev);
 	virtual void onResponse(std::shared_ptr<ResponseSipEvent> &ev);
+	// Pushes are sent for INVITE, MESSAGE and REFER, the latter being one of the other requests.
+	virtual bool handlesRequests(MessageKind kind) const {
+		return kind == KindInvite || kind == KindMessage || kind == KindOther;
+	}
 	virtual void onLoad(const GenericStruct *mc);
 	PushNotificationService *getService() const {
 		return mPNS;
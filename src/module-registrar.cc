@@ -88,13 +88,24 @@ void OnRequestBindListener::onContactUpdated(const std::shared_ptr<ExtendedConta
 }
 
 void OnRequestBindListener::onRecordFound(const shared_ptr<Record> &r) {
+	onBound(r, true);
+}
+
+/* Over a connection, a binding refreshed without any change tells that the device stayed connected: whatever was
+ * waiting for it could already reach it, so its registration is not published again. Over UDP, it may be the refresh of
+ * a device woken up by a push notification, which the late forks wait for. */
+void OnRequestBindListener::onRecordRefreshed(const shared_ptr<Record> &r) {
+	onBound(r, !tport_is_reliable(mEv->getIncomingTport().get()));
+}
+
+void OnRequestBindListener::onBound(const shared_ptr<Record> &r, bool publish) {
 	const shared_ptr<MsgSip> &ms = mEv->getMsgSip();
 	time_t now = getCurrentTime();
 	if (r) {
 		addEventLogRecordFound(mEv, mContact);
 		mModule->reply(mEv, 200, "Registration successful", r->getContacts(ms->getHome(), now));
 
-		if (mContact) {
+		if (mContact && publish) {
 			string uid = Record::extractUniqueId(mContact);
 			string topic = mModule->routingKey(mSipFrom->a_url);
 			RegistrarDb::get()->publish(topic, uid);
@@ -120,12 +131,22 @@ OnResponseBindListener::OnResponseBindListener(ModuleRegistrar *module, shared_p
 }
 
 void OnResponseBindListener::onRecordFound(const shared_ptr<Record> &r) {
+	onBound(r, true);
+}
+
+void OnResponseBindListener::onRecordRefreshed(const shared_ptr<Record> &r) {
+	onBound(r, !tport_is_reliable(mCtx->reqSipEvent->getIncomingTport().get()));
+}
+
+void OnResponseBindListener::onBound(const shared_ptr<Record> &r, bool publish) {
 	const shared_ptr<MsgSip> &ms = mEv->getMsgSip();
 	time_t now = getCurrentTime();
 	if (r) {
-		string uid = Record::extractUniqueId(mCtx->mContacts);
-		string topic = mModule->routingKey(mCtx->mFrom->a_url);
-		RegistrarDb::get()->publish(topic, uid);
+		if (publish) {
+			string uid = Record::extractUniqueId(mCtx->mContacts);
+			string topic = mModule->routingKey(mCtx->mFrom->a_url);
+			RegistrarDb::get()->publish(topic, uid);
+		}
 
 		const sip_contact_t *dbContacts = r->getContacts(ms->getHome(), now);
 		// Replace received contacts by our ones
@@ -332,11 +353,21 @@ void ModuleRegistrar::onDeclare(GenericStruct *mc) {
 			"Timeout in seconds after which the static records file is re-read and the contacts updated.", "600"},
 
 		{String, "db-implementation",
-			"Implementation used for storing address of records contact uris. Two backends are available:\n"
+			"Implementation used for storing address of records contact uris. Three backends are available:\n"
 			"- redis : contacts are stored in a redis database, which allows persistent and shared storage accross multiple flexisip nodes\n"
 			"- internal : contacts are stored in RAM. Of course, if flexisip is restarted, all contacts are lost until client update their"
 			" registration.\n"
-			"The redis backend is recommended, the internal being more adapted to very small deployments.", "internal"},
+			"- file : contacts are stored in RAM and every change is logged in a local file, from which they are restored when flexisip"
+			" restarts. See 'file-db-path'.\n"
+			"The redis backend is recommended, the internal and file ones being more adapted to very small deployments.", "internal"},
+		{String, "file-db-path", "Path of the file holding the contacts when 'db-implementation' is 'file'.",
+			"/var/lib/flexisip/registrar.db"},
+		{Integer, "file-db-sync-interval", "Period in seconds at which the changes logged in 'file-db-path' are flushed to"
+			" the disk. The changes made within the last period may be lost on a system crash, though not on a crash of flexisip"
+			" itself. 0 flushes the file as soon as changes are written: the writes and flushes are made by a thread of their own, so"
+			" the registrations are not slowed down, but they are answered before their change reached the disk, and the changes"
+			" made during the last flush, that is a few milliseconds on a SSD and up to a few tens on a rotating disk, may still be"
+			" lost on a system crash. Changes made during a flush are grouped in the next one.", "1"},
 		// Redis config support
 		{String, "redis-server-domain", "Domain of the redis server. ", "localhost"},
 		{Integer, "redis-server-port", "Port of the redis server.", "6379"},
@@ -351,6 +382,58 @@ void ModuleRegistrar::onDeclare(GenericStruct *mc) {
 												"Note: This requires that all redis instances have the same "
 												"password. Otherwise the authentication will fail.",
 			"60"},
+		{Boolean, "redis-server-side-bind",
+			"Perform the read-modify-write of a REGISTER inside redis with a Lua script, in a single round trip. "
+			"Only the contacts of the REGISTER are sent, and redis drops expired contacts and updates the expiration "
+			"date of the record by itself. This requires redis 3.2 or newer.",
+			"false"},
+		{Integer, "redis-connection-pool-size",
+			"Number of connections opened to the redis server for the registrar operations. The operations on an "
+			"address of record always use the same connection, so that they are executed in order, and each "
+			"connection pipelines its commands. The queue depth and round trip time of each connection are "
+			"reported in the redis-connection-<n>-* statistics.",
+			"1"},
+		{Boolean, "redis-cluster",
+			"Use a redis cluster. The configured redis server is used to discover the masters of the cluster, and "
+			"the records are read and written on the master serving their hash slot. Redirections are followed when "
+			"slots move between masters. The redis-connection-pool-size setting is ignored in this mode.",
+			"false"},
+		{Integer, "redis-record-cache-size",
+			"Maximum size in kilobytes of the local cache of the records read from redis, 0 to disable it. The "
+			"cached records are invalidated by the key expiration events of redis and by the publication every "
+			"node makes after writing or deleting a record, which allows most fetches to be served without any "
+			"request to redis. The nodes only make this publication with the cache enabled, so it must be enabled "
+			"on all the nodes of the platform or none.",
+			"0"},
+		{Integer, "redis-record-cache-max-age",
+			"Maximum time in seconds during which a record is served from the local cache, as a safety net against "
+			"lost invalidations.",
+			"60"},
+		{Boolean, "redis-replica-reads",
+			"Send the fetches of records to the replicas of the redis master, which are discovered through the "
+			"replication checks. Binds and clears are still sent to the master. Replicas that are not online or that "
+			"did not acknowledge the replication stream during the last second are not used. This setting is "
+			"ignored in cluster mode.",
+			"false"},
+		{Integer, "redis-replica-read-after-write-delay",
+			"Duration in milliseconds during which the fetches of a record written by this instance are sent to the "
+			"master rather than to a replica, so that they see the write. 0 sends every fetch to the replicas.",
+			"1000"},
+		{String, "redis-contact-format",
+			"Format in which the contacts are written to redis: 'url-encoded' or 'binary'. Both formats are read whatever "
+			"the value, and the binary one is decoded without parsing the contacts again. With 'binary', the url encoded "
+			"contacts read from redis are written again in binary. Switch to 'binary' once every flexisip node sharing "
+			"the redis database is able to read it.",
+			"url-encoded"},
+		{Integer, "redis-pubsub-channels",
+			"Number of redis channels the registrations of the records are published on. With 0, each record has its own "
+			"channel, subscribed by the instances waiting for it, and every instance receives the expiration events of "
+			"all the keys. A positive value multiplexes the records onto this number of channels, each publication "
+			"carrying the expiration date of its record. The expiration events are still used if the redis server sends "
+			"them (see its notify-keyspace-events setting); removing 'x' from this setting has each instance only watch "
+			"the expiration of the records it waits for instead. Every flexisip node sharing the redis database must use "
+			"the same value.",
+			"0"},
 		{String, "service-route",
 			"Sequence of proxies (space-separated) where requests will be redirected through (RFC3608)", ""},
 		{String, "name-message-expires", "The name used for the expire time of forking message", "message-expires"},
@@ -361,6 +444,31 @@ void ModuleRegistrar::onDeclare(GenericStruct *mc) {
 	mStats.mCountClear = mc->createStats("count-clear", "Number of cleared registrations.");
 	mStats.mCountBind = mc->createStats("count-bind", "Number of registers.");
 	mStats.mCountLocalActives = mc->createStat("count-local-registered-users", "Number of users currently registered through this server.");
+	mStats.mCountBindBytesWritten = mc->createStat("count-bind-bytes-written",
+		"Number of bytes of serialized contacts written to the registrar database by binds. "
+		"Divide by count-bind-finished to get the average cost of a bind.");
+	mStats.mCountClusterRedirections = mc->createStat("count-redis-cluster-redirections",
+		"Number of redis commands redirected to another node of the cluster.");
+	mStats.mCountCacheHits = mc->createStat("count-record-cache-hits",
+		"Number of fetches served by the local record cache.");
+	mStats.mCountCacheMisses = mc->createStat("count-record-cache-misses",
+		"Number of fetches not found in the local record cache.");
+	mStats.mCountCacheInvalidations = mc->createStat("count-record-cache-invalidations",
+		"Number of records removed from the local record cache because they changed or expired.");
+	mStats.mCountReplicaReadsAvoided = mc->createStat("count-redis-replica-reads-avoided",
+		"Number of fetches sent to the redis master instead of a replica because the record was recently written.");
+	mStats.mCountCoalescedFetches = mc->createStat("count-coalesced-fetches",
+		"Number of fetches answered by the database lookup of an identical fetch that was already pending.");
+	mStats.mCountContactsMigrated = mc->createStat("count-redis-contacts-migrated",
+		"Number of url encoded contacts read from redis and sent to be written again in binary.");
+	mStats.mCountRefreshes = mc->createStat("count-bind-refreshes",
+		"Number of binds that only moved the expiry and CSeq of a binding that did not change otherwise.");
+	mStats.mCountRecords = mc->createStat("count-internal-records",
+		"Number of records held in memory by the internal registrar database.");
+	mStats.mCountBindings = mc->createStat("count-internal-bindings",
+		"Number of contacts of the records held in memory by the internal registrar database.");
+	mStats.mBytesPerBinding = mc->createStat("internal-bytes-per-binding",
+		"Estimation of the memory used by the internal registrar database per contact, in bytes.");
 }
 
 void ModuleRegistrar::onLoad(const GenericStruct *mc) {
@@ -421,6 +529,70 @@ void ModuleRegistrar::idle() {
 	updateLocalRegExpire();
 }
 
+void ModuleRegistrar::onIdle() {
+	updateRegistrarDbStats();
+}
+
+void ModuleRegistrar::updateRegistrarDbStats() {
+	const RegistrarDbStats &stats = RegistrarDb::get()->getStats();
+	mStats.mCountBindBytesWritten->set(stats.mBindBytesWritten);
+	mStats.mCountClusterRedirections->set(stats.mClusterRedirections);
+	mStats.mCountCacheHits->set(stats.mCacheHits);
+	mStats.mCountCacheMisses->set(stats.mCacheMisses);
+	mStats.mCountCacheInvalidations->set(stats.mCacheInvalidations);
+	mStats.mCountReplicaReadsAvoided->set(stats.mReplicaReadsAvoided);
+	mStats.mCountCoalescedFetches->set(stats.mCoalescedFetches);
+	mStats.mCountContactsMigrated->set(stats.mContactsMigrated);
+	mStats.mCountRefreshes->set(stats.mRefreshes);
+	mStats.mCountRecords->set(stats.mRecords);
+	mStats.mCountBindings->set(stats.mBindings);
+	mStats.mBytesPerBinding->set(stats.mBindings > 0 ? stats.mBindingBytes / stats.mBindings : 0);
+
+	// The connections are only known once the database is connected, and cluster nodes may appear at any time.
+	while (mStats.mConnections.size() < stats.mConnections.size()) {
+		GenericStruct *registrarConf = GenericManager::get()->getRoot()->get<GenericStruct>("module::Registrar");
+		string prefix = "redis-connection-" + to_string(mStats.mConnections.size());
+		RegistrarConnectionStats connection;
+		connection.mPendingCommands = registrarConf->createStat(prefix + "-pending-commands",
+			"Number of commands sent on this redis connection and not answered yet.");
+		connection.mCommandCount = registrarConf->createStat(prefix + "-commands",
+			"Number of commands answered on this redis connection.");
+		connection.mRoundTripAvgUs = registrarConf->createStat(prefix + "-round-trip-avg-us",
+			"Average round trip time of the commands of this redis connection, in microseconds.");
+		mStats.mConnections.push_back(connection);
+	}
+	for (size_t i = 0; i < stats.mConnections.size(); ++i) {
+		const RegistrarDbConnectionStats &connection = stats.mConnections[i];
+		mStats.mConnections[i].mPendingCommands->set(connection.mPendingCommands);
+		mStats.mConnections[i].mCommandCount->set(connection.mCommandCount);
+		mStats.mConnections[i].mRoundTripAvgUs->set(
+			connection.mCommandCount > 0 ? connection.mRoundTripTotalUs / connection.mCommandCount : 0);
+	}
+
+	while (mStats.mReplicas.size() < stats.mReplicas.size()) {
+		GenericStruct *registrarConf = GenericManager::get()->getRoot()->get<GenericStruct>("module::Registrar");
+		string prefix = "redis-replica-" + to_string(mStats.mReplicas.size());
+		RegistrarReplicaStats replica;
+		replica.mLag = registrarConf->createStat(prefix + "-lag",
+			"Seconds since this redis replica last acknowledged the replication stream, as reported by the master.");
+		replica.mLagBytes = registrarConf->createStat(prefix + "-lag-bytes",
+			"Number of bytes of the replication stream not acknowledged yet by this redis replica.");
+		replica.mReads = registrarConf->createStat(prefix + "-reads", "Number of fetches sent to this redis replica.");
+		replica.mRoundTripAvgUs = registrarConf->createStat(prefix + "-round-trip-avg-us",
+			"Average round trip time of the commands sent to this redis replica, in microseconds.");
+		mStats.mReplicas.push_back(replica);
+	}
+	for (size_t i = 0; i < stats.mReplicas.size(); ++i) {
+		const RegistrarDbReplicaStats &replica = stats.mReplicas[i];
+		const RegistrarDbConnectionStats &connection = stats.mConnections[replica.mConnection];
+		mStats.mReplicas[i].mLag->set(replica.mLag >= 0 ? replica.mLag : 0);
+		mStats.mReplicas[i].mLagBytes->set(replica.mLagBytes >= 0 ? replica.mLagBytes : 0);
+		mStats.mReplicas[i].mReads->set(replica.mReads);
+		mStats.mReplicas[i].mRoundTripAvgUs->set(
+			connection.mCommandCount > 0 ? connection.mRoundTripTotalUs / connection.mCommandCount : 0);
+	}
+}
+
 void ModuleRegistrar::updateLocalRegExpire() {
 	RegistrarDb::get()->mLocalRegExpire->removeExpiredBefore(getCurrentTime());
 	mStats.mCountLocalActives->set(RegistrarDb::get()->mLocalRegExpire->countActives());
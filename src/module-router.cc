@@ -81,6 +81,12 @@ void ModuleRouter::onDeclare(GenericStruct *mc) {
 	mStats.mCountNonForks = mc->createStat("count-non-forked", "Number of non forked invites.");
 	mStats.mCountLocalActives =
 		mc->createStat("count-local-registered-users", "Number of users currently registered through this server.");
+	mStats.mCountLiveCallForks = mc->createStat("count-live-call-forks", "Number of call forks in progress.");
+	mStats.mCountLiveMessageForks =
+		mc->createStat("count-live-message-forks", "Number of message and text refer forks in progress.");
+	mStats.mCountLiveBasicForks = mc->createStat("count-live-basic-forks", "Number of other forks in progress.");
+	mStats.mCountForkKeys =
+		mc->createStat("count-fork-keys", "Number of routing keys with late forks waiting for new registrations.");
 }
 
 void ModuleRouter::onLoad(const GenericStruct *mc) {
@@ -336,17 +342,17 @@ void ModuleRouter::onContactRegistered(const string &uid, const shared_ptr<Recor
 
 	// Find all contexts
 	const string key(routingKey(sipUri));
-	auto range = mForks.equal_range(key.c_str());
+	auto forks = mForks.find(key);
 	SLOGD << "Searching for fork context with key " << key;
 
 	const shared_ptr<ExtendedContact> ec = aor->extractContactByUniqueId(uid);
-	if (ec) {
+	if (ec && forks != mForks.end()) {
 		contact = ec->toSofiaContact(home.home(), ec->mExpireAt - 1);
 		path = ec->toSofiaRoute(home.home());
 
-		// First use sipURI
-		for (auto it = range.first; it != range.second; ++it) {
-			shared_ptr<ForkContext> context = it->second;
+		// First use sipURI. The dispatch may add forks to the map, iterate over a copy of the list.
+		const vector<shared_ptr<ForkContext>> contexts(forks->second.mForks.begin(), forks->second.mForks.end());
+		for (const auto &context : contexts) {
 			if (context->onNewRegister(contact->m_url, uid)) {
 				SLOGD << "Found a pending context for key " << key << ": " << context.get();
 				lateDispatch(context->getEvent(), ec, context, "");
@@ -363,11 +369,13 @@ void ModuleRouter::onContactRegistered(const string &uid, const shared_ptr<Recor
 			continue;
 
 		// Find all contexts
+		auto aliasForks = mForks.find(ExtendedContact::urlToString(ec->mSipContact->m_url));
+		if (aliasForks == mForks.end())
+			continue;
 		contact = ec->toSofiaContact(home.home(), ec->mExpireAt - 1);
 		path = ec->toSofiaRoute(home.home());
-		auto rang = mForks.equal_range(ExtendedContact::urlToString(ec->mSipContact->m_url));
-		for (auto ite = rang.first; ite != rang.second; ++ite) {
-			shared_ptr<ForkContext> context = ite->second;
+		const vector<shared_ptr<ForkContext>> contexts(aliasForks->second.mForks.begin(), aliasForks->second.mForks.end());
+		for (const auto &context : contexts) {
 			if (context->onNewRegister(contact->m_url, uid)) {
 				LOGD("Found a pending context for contact %s: %p", ExtendedContact::urlToString(ec->mSipContact->m_url).c_str(), context.get());
 				auto stlpath = Record::route_to_stl(path);
@@ -580,15 +588,10 @@ void ModuleRouter::routeRequest(shared_ptr<RequestSipEvent> &ev, const shared_pt
 			context = make_shared<ForkBasicContext>(getAgent(), ev, mOtherForkCfg, this);
 		}
 		if (context) {
+			++*getLiveForksStat(context);
 			if (context->getConfig()->mForkLate) {
 				const string key(routingKey(sipUri));
-				context->addKey(key);
-				mForks.insert(make_pair(key, context));
-				if (mForks.count(key) == 1) {
-					auto listener = make_shared<OnContactRegisteredListener>(this, sipUri);
-					context->setContactRegisteredListener(listener);
-					RegistrarDb::get()->subscribe(key, listener);
-				}
+				addToForkMap(key, context, sipUri);
 				SLOGD << "Add fork " << context.get() << " to store with key '" << key << "'";
 			}
 		}
@@ -621,13 +624,7 @@ void ModuleRouter::routeRequest(shared_ptr<RequestSipEvent> &ev, const shared_pt
 					temp_ctt->m_url->url_port = NULL;
 				}
 				const string key(routingKey(temp_ctt->m_url));
-				context->addKey(key);
-				mForks.insert(make_pair(key, context));
-				if (mForks.count(key) == 1) {
-					auto listener = make_shared<OnContactRegisteredListener>(this, temp_ctt->m_url);
-					context->setContactRegisteredListener(listener);
-					RegistrarDb::get()->subscribe(key, listener);
-				}
+				addToForkMap(key, context, temp_ctt->m_url);
 				LOGD("Add fork %p to store with key '%s' because it is an alias", context.get(), key.c_str());
 			} else {
 				if (dispatch(ev, ec, context, targetUris)) {
@@ -971,34 +968,43 @@ void ModuleRouter::onResponse(shared_ptr<ResponseSipEvent> &ev) {
 	ForkContext::processResponse(ev);
 }
 
+void ModuleRouter::addToForkMap(const string &key, const shared_ptr<ForkContext> &context, const url_t *sipUri) {
+	auto entry = mForks.find(key);
+	if (entry == mForks.end()) {
+		entry = mForks.emplace(key, ForkMapEntry()).first;
+		entry->second.mListener = make_shared<OnContactRegisteredListener>(this, sipUri);
+		RegistrarDb::get()->subscribe(key, entry->second.mListener);
+		++*mStats.mCountForkKeys;
+	}
+	auto &forks = entry->second.mForks;
+	forks.push_back(context);
+	// The elements of an unordered_map keep their address when it rehashes, unlike its iterators.
+	context->addForkMapHandle({&*entry, prev(forks.end())});
+	LOGD("%zu fork(s) waiting for new registrations of key '%s'", forks.size(), key.c_str());
+}
+
+StatCounter64 *ModuleRouter::getLiveForksStat(const shared_ptr<ForkContext> &context) {
+	if (dynamic_cast<ForkCallContext *>(context.get()))
+		return mStats.mCountLiveCallForks;
+	if (dynamic_cast<ForkMessageContext *>(context.get()))
+		return mStats.mCountLiveMessageForks;
+	return mStats.mCountLiveBasicForks;
+}
+
 void ModuleRouter::onForkContextFinished(shared_ptr<ForkContext> ctx) {
-	if (!ctx->getConfig()->mForkLate) return;
-
-	list<string> keys = ctx->getKeys();
-	for (list<string>::iterator it=keys.begin(); it != keys.end(); ++it) {
-		string key = *it;
-		LOGD("Looking at fork contexts with key %s", key.c_str());
-
-		int count = 0;
-		int removed = 0;
-		auto range = mForks.equal_range(key.c_str());
-		for (auto it = range.first; it != range.second;) {
-			count++;
-			if (it->second == ctx) {
-				LOGD("Remove fork %s from store", it->first.c_str());
-				mStats.mCountForks->incrFinish();
-				auto cur_it = it;
-				++it;
-				// for some reason the multimap erase does not return the next iterator !
-				mForks.erase(cur_it);
-				removed++;
-				// do not break, because a single fork context might appear several time in the map because of aliases.
-			} else {
-				++it;
-			}
-		}
-		if (count == removed && count > 0) {
-			RegistrarDb::get()->unsubscribe(key, ctx->getContactRegisteredListener());
+	mStats.mCountForks->incrFinish();
+	--*getLiveForksStat(ctx);
+
+	// A single fork context might appear several times in the map because of aliases.
+	for (const auto &handle : ctx->takeForkMapHandles()) {
+		ForkMapEntry &entry = handle.mEntry->second;
+		LOGD("Remove fork %p from store with key '%s'", ctx.get(), handle.mEntry->first.c_str());
+		entry.mForks.erase(handle.mPosition);
+		if (entry.mForks.empty()) {
+			const string key = handle.mEntry->first;
+			RegistrarDb::get()->unsubscribe(key, entry.mListener);
+			mForks.erase(key);
+			--*mStats.mCountForkKeys;
 		}
 	}
 }
@@ -47,6 +47,10 @@ public:
 		// don't check our responses ;)
 	}
 
+	virtual bool changesMessages() const {
+		return false;
+	}
+
 	void onDeclare(GenericStruct *mc) {
 	}
 
@@ -37,6 +37,12 @@ public:
 	virtual void onLoad(const GenericStruct *root);
 	virtual void onRequest(shared_ptr<RequestSipEvent> &ev);
 	virtual void onResponse(shared_ptr<ResponseSipEvent> &ev);
+	virtual bool handlesResponses(MessageKind kind) const {
+		return false;
+	}
+	virtual bool changesMessages() const {
+		return false;
+	}
 
 private:
 	int managePublishContent(const shared_ptr<RequestSipEvent> ev);
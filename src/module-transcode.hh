@@ -72,6 +72,13 @@ public:
 	virtual void onLoad(const GenericStruct *module_config);
 	virtual void onRequest(std::shared_ptr<RequestSipEvent> &ev);
 	virtual void onResponse(std::shared_ptr<ResponseSipEvent> &ev);
+	// INFO is one of the other requests.
+	virtual bool handlesRequests(MessageKind kind) const {
+		return kind == KindInvite || kind == KindAck || kind == KindBye || kind == KindOther;
+	}
+	virtual bool handlesResponses(MessageKind kind) const {
+		return kind == KindInvite;
+	}
 	virtual void onIdle();
 	virtual void onDeclare(GenericStruct *mc);
 #ifdef ENABLE_TRANSCODER
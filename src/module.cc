@@ -19,6 +19,7 @@
 #include <flexisip/module.hh>
 #include <flexisip/agent.hh>
 #include "entryfilter.hh"
+#include "sipattrextractor.hh"
 #include "sofia-sip/auth_digest.h"
 #include "sofia-sip/nta.h"
 #include <flexisip/logmanager.hh>
@@ -96,6 +97,15 @@ void Module::declare(GenericStruct *root) {
 		mModuleConfig->get<ConfigBoolean>("enabled")->setDefault("false");
 	}
 	onDeclare(mModuleConfig);
+
+	// The times per message kind are only given by the histograms, see the MODULE_LATENCY command.
+	mProcessingCount = mModuleConfig->createStat("count-processed", "Number of messages processed by the module.");
+	mProcessingTime = mModuleConfig->createStat("processing-time-us",
+		"Total time in microseconds spent processing messages in the module.");
+	mSuspendedCount = mModuleConfig->createStat("count-suspended",
+		"Number of messages suspended by the module while waiting for asynchronous work.");
+	mSuspendedTime = mModuleConfig->createStat("suspended-time-us",
+		"Total time in microseconds messages spent suspended by the module.");
 }
 
 void Module::checkConfig() {
@@ -122,15 +132,18 @@ void Module::unload() {
 void Module::reload() {
 	onUnload();
 	load();
+	mAgent->buildModuleChains();
 }
 
 void Module::processRequest(shared_ptr<RequestSipEvent> &ev) {
 	const shared_ptr<MsgSip> &ms = ev->getMsgSip();
 	LOG_SCOPED_THREAD("Module", getModuleName());
+	bool entered = false;
 
 	try {
 		if (mFilter->canEnter(ms)) {
 			SLOGD << "Invoking onRequest() on module " << getModuleName();
+			entered = true;
 			onRequest(ev);
 		} else {
 			SLOGD << "Skipping onRequest() on module " << getModuleName();
@@ -145,15 +158,20 @@ void Module::processRequest(shared_ptr<RequestSipEvent> &ev) {
 		SLOGD << "Replying with error 500";
 		ev->reply(500, "Internal Error", SIPTAG_SERVER_STR(getAgent()->getServerString()), TAG_END());
 	}
+	// The module may have changed the message, the next ones must not see the attributes it had before.
+	if (entered && changesMessages())
+		ev->getMsgSip()->getSipAttr()->invalidate();
 }
 
 void Module::processResponse(shared_ptr<ResponseSipEvent> &ev) {
 	const shared_ptr<MsgSip> &ms = ev->getMsgSip();
 	LOG_SCOPED_THREAD("Module", getModuleName());
+	bool entered = false;
 
 	try {
 		if (mFilter->canEnter(ms)) {
 			LOGD("Invoking onResponse() on module %s", getModuleName().c_str());
+			entered = true;
 			onResponse(ev);
 		} else {
 			LOGD("Skipping onResponse() on module %s", getModuleName().c_str());
@@ -161,6 +179,8 @@ void Module::processResponse(shared_ptr<ResponseSipEvent> &ev) {
 	} catch (FlexisipException &fe) {
 		SLOGD << "Skipping onResponse() on module" << getModuleName() << " because " << fe;
 	}
+	if (entered && changesMessages())
+		ev->getMsgSip()->getSipAttr()->invalidate();
 }
 
 void Module::idle() {
@@ -184,6 +204,91 @@ ModuleClass Module::getClass() const {
 	return mInfo->getClass();
 }
 
+Module::MessageKind Module::getMessageKind(const sip_t *sip) {
+	if (!sip->sip_request) return KindResponse;
+	return getMethodKind(sip->sip_request->rq_method);
+}
+
+Module::MessageKind Module::getMethodKind(sip_method_t method) {
+	switch (method) {
+		case sip_method_register:
+			return KindRegister;
+		case sip_method_invite:
+			return KindInvite;
+		case sip_method_ack:
+			return KindAck;
+		case sip_method_bye:
+			return KindBye;
+		case sip_method_cancel:
+			return KindCancel;
+		case sip_method_message:
+			return KindMessage;
+		case sip_method_subscribe:
+			return KindSubscribe;
+		case sip_method_notify:
+			return KindNotify;
+		case sip_method_options:
+			return KindOptions;
+		default:
+			return KindOther;
+	}
+}
+
+const char *Module::getMessageKindName(MessageKind kind) {
+	switch (kind) {
+		case KindRegister:
+			return "register";
+		case KindInvite:
+			return "invite";
+		case KindAck:
+			return "ack";
+		case KindBye:
+			return "bye";
+		case KindCancel:
+			return "cancel";
+		case KindMessage:
+			return "message";
+		case KindSubscribe:
+			return "subscribe";
+		case KindNotify:
+			return "notify";
+		case KindOptions:
+			return "options";
+		case KindOther:
+			return "other";
+		case KindResponse:
+		case KindCount:
+			break;
+	}
+	return "response";
+}
+
+bool Module::isProcessingRequests(MessageKind kind) {
+	return !mFilter->isAlwaysFalse() && handlesRequests(kind);
+}
+
+bool Module::isProcessingResponses(MessageKind kind) {
+	return !mFilter->isAlwaysFalse() && handlesResponses(kind);
+}
+
+void Module::recordProcessingTime(MessageKind kind, chrono::steady_clock::duration duration) {
+	mLatencies[kind].processing.record(duration);
+	if (mProcessingCount) {
+		auto us = chrono::duration_cast<chrono::microseconds>(duration).count();
+		++*mProcessingCount;
+		mProcessingTime->set(mProcessingTime->read() + us);
+	}
+}
+
+void Module::recordSuspendedTime(MessageKind kind, chrono::steady_clock::duration duration) {
+	mLatencies[kind].suspended.record(duration);
+	if (mSuspendedCount) {
+		auto us = chrono::duration_cast<chrono::microseconds>(duration).count();
+		++*mSuspendedCount;
+		mSuspendedTime->set(mSuspendedTime->read() + us);
+	}
+}
+
 // -----------------------------------------------------------------------------
 // ModuleInfo.
 // -----------------------------------------------------------------------------
@@ -273,8 +378,6 @@ void ModuleToolbox::addRecordRoute(
 	const shared_ptr<RequestSipEvent> &ev,
 	const tport_t *tport
 ) {
-	msg_t *msg = ev->getMsgSip()->getMsg();
-	sip_t *sip = ev->getMsgSip()->getSip();
 	su_home_t *home = ev->getMsgSip()->getHome();
 	url_t *url = NULL;
 
@@ -301,6 +404,16 @@ void ModuleToolbox::addRecordRoute(
 		// default to Agent's default address.
 		url = url_hdup(home, ag->getNodeUri());
 	}
+	addRecordRoute(ag, ev, url);
+}
+
+/*
+ * Adds a record-route to the given url, which is allocated in the home of the message.
+ */
+void ModuleToolbox::addRecordRoute(Agent *ag, const shared_ptr<RequestSipEvent> &ev, url_t *url) {
+	msg_t *msg = ev->getMsgSip()->getMsg();
+	sip_t *sip = ev->getMsgSip()->getSip();
+	su_home_t *home = ev->getMsgSip()->getHome();
 
 	url_param_add(home, url, "lr");
 	sip_record_route_t *rr = sip_record_route_create(home, url, NULL);
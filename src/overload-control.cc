@@ -0,0 +1,106 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "overload-control.hh"
+#include "loop-monitor.hh"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <flexisip/agent.hh>
+#include <flexisip/logmanager.hh>
+#include <flexisip/module.hh>
+
+using namespace std;
+using namespace flexisip;
+
+OverloadControl::OverloadControl(Agent *agent, GenericStruct *global) : mAgent(agent) {
+	mCountRejected = global->createStat("count-overload-rejected",
+										"Number of new requests rejected with a 503 because the proxy was overloaded.");
+	mLoopLagStat = global->createStat("overload-loop-lag-ms", "Last measured lag of the main loop, in milliseconds.");
+	mSuspendedEventsStat =
+		global->createStat("overload-suspended-events", "Number of events waiting for asynchronous work.");
+	mRejectPercentStat =
+		global->createStat("overload-reject-percent", "Share of the new requests currently rejected, in percent.");
+}
+
+void OverloadControl::start(LoopMonitor *monitor) {
+	GenericStruct *global = GenericManager::get()->getRoot()->get<GenericStruct>("global");
+	mMaxLoopLag = global->get<ConfigInt>("overload-max-loop-lag")->read();
+	mMaxSuspendedEvents = global->get<ConfigInt>("overload-max-suspended-events")->read();
+	mRetryAfter = max(1, global->get<ConfigInt>("overload-retry-after")->read());
+	if (mMaxLoopLag <= 0 && mMaxSuspendedEvents <= 0)
+		return;
+	SLOGI << "Overload control: rejecting new requests beyond a loop lag of " << mMaxLoopLag << "ms or "
+		  << mMaxSuspendedEvents << " suspended events (0 meaning no limit)";
+	monitor->setLagListener([this](chrono::steady_clock::duration lag) { update(lag); });
+}
+
+int OverloadControl::getSuspendedEvents() const {
+	int count = 0;
+	for (Module *module : mAgent->getModules())
+		count += module->getSuspendedEvents();
+	return count;
+}
+
+/*
+ * Called by the loop monitor each time it measures how late the loop runs its timers.
+ */
+void OverloadControl::update(chrono::steady_clock::duration loopLag) {
+	long lag = chrono::duration_cast<chrono::milliseconds>(loopLag).count();
+	int suspended = getSuspendedEvents();
+	mLoopLagStat->set(lag);
+	mSuspendedEventsStat->set(suspended);
+
+	bool overloaded =
+		(mMaxLoopLag > 0 && lag > mMaxLoopLag) || (mMaxSuspendedEvents > 0 && suspended > mMaxSuspendedEvents);
+	int previous = mRejectPercent;
+	mRejectPercent =
+		overloaded ? min(100, mRejectPercent + sRejectIncrease) : max(0, mRejectPercent - sRejectDecrease);
+	mRejectPercentStat->set(mRejectPercent);
+	if (previous == 0 && mRejectPercent > 0) {
+		SLOGW << "Proxy overloaded (loop lag of " << lag << "ms, " << suspended
+			  << " suspended events): rejecting new requests";
+	} else if (previous > 0 && mRejectPercent == 0) {
+		mRejectCredit = 0;
+		SLOGW << "Proxy no longer overloaded, " << mCountRejected->read() << " requests rejected so far";
+	}
+}
+
+/*
+ * Only the requests out of dialogs start new work, the others belonging to calls or subscriptions that were
+ * already accepted. The rejected ones are spread evenly among the new requests.
+ */
+bool OverloadControl::shouldReject(const sip_t *sip) {
+	if (mRejectPercent == 0)
+		return false;
+	sip_method_t method = sip->sip_request->rq_method;
+	if (method == sip_method_ack || method == sip_method_cancel || (sip->sip_to && sip->sip_to->a_tag))
+		return false;
+	mRejectCredit += mRejectPercent;
+	if (mRejectCredit < 100)
+		return false;
+	mRejectCredit -= 100;
+	++*mCountRejected;
+	return true;
+}
+
+unsigned int OverloadControl::getRetryAfter() const {
+	return mRetryAfter + rand() % (mRetryAfter + 1);
+}
@@ -0,0 +1,68 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <chrono>
+
+#include <flexisip/configmanager.hh>
+
+#include <sofia-sip/sip.h>
+
+namespace flexisip {
+
+class Agent;
+class LoopMonitor;
+
+/*
+ * Rejects the requests starting new work, with a 503 and a Retry-After, when the proxy falls behind: when its main loop
+ * runs late, or when too many events wait for asynchronous work such as the registrar database or an authentication
+ * backend. The share of the requests rejected grows as long as the proxy stays overloaded and decreases once it is no
+ * longer, the requests within dialogs, the ACKs, the CANCELs and the responses being always processed.
+ */
+class OverloadControl {
+  public:
+	OverloadControl(Agent *agent, GenericStruct *global);
+	// Reads the thresholds and starts following the lag of the main loop, as measured by the loop monitor.
+	void start(LoopMonitor *monitor);
+	bool shouldReject(const sip_t *sip);
+	// Value of the Retry-After header of the rejections, spread so that the clients do not all come back at once.
+	unsigned int getRetryAfter() const;
+
+  private:
+	void update(std::chrono::steady_clock::duration loopLag);
+	int getSuspendedEvents() const;
+
+	// Steps, in percent of the new requests, by which the share of rejected requests changes at each lag measure.
+	static constexpr int sRejectIncrease = 10;
+	static constexpr int sRejectDecrease = 5;
+
+	Agent *mAgent;
+	int mMaxLoopLag = 0;
+	int mMaxSuspendedEvents = 0;
+	int mRetryAfter = 0;
+	int mRejectPercent = 0;
+	int mRejectCredit = 0;
+	StatCounter64 *mCountRejected;
+	StatCounter64 *mLoopLagStat;
+	StatCounter64 *mSuspendedEventsStat;
+	StatCounter64 *mRejectPercentStat;
+};
+
+}
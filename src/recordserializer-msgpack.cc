@@ -79,14 +79,14 @@ bool RecordSerializerMsgPack::serialize(Record *r, std::string &serialized, bool
 			c->mContactId,
 			c->mCallId,
 			c->mUniqueId,
-			c->mPath,
+			c->mPath.toList(),
 			ExtendedContact::urlToString(c->mSipContact->m_url),
 			c->mQ,
 			c->mExpireAt,
 			c->mUpdatedTime,
 			c->mCSeq,
 			c->mAlias,
-			c->mAcceptHeader,
+			c->mAcceptHeader.toList(),
 			c->mUsedAsRoute,
 			c->line()
 		});
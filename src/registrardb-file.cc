@@ -0,0 +1,584 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "registrardb-file.hh"
+#include "loop-monitor.hh"
+#include <flexisip/common.hh>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <sofia-sip/sip_protos.h>
+
+using namespace std;
+using namespace flexisip;
+
+/*
+ * The log starts with sLogMagic, followed by entries made of the size of their body, the crc32 of their body and
+ * the body itself. A body starts with its type and the key of the record. A put entry goes on with the aor of the
+ * record and its contacts, each one as its unique id, its url encoded parameters and its expiration times. All the
+ * integers are little endian.
+ */
+static const char sLogMagic[8] = {'F', 'S', 'R', 'E', 'G', 'D', 'B', '1'};
+static const size_t sEntryHeaderSize = 8;
+static const uint8_t sPutEntry = 1;
+static const uint8_t sDeleteEntry = 2;
+// The log is compacted once it is twice as large as the records it holds, and at least this large.
+static const off_t sMinCompactionSize = 1024 * 1024;
+static const size_t sCompactionBufferSize = 256 * 1024;
+
+static uint32_t crc32(const uint8_t *data, size_t size) {
+	static uint32_t table[256];
+	static bool tableReady = false;
+	if (!tableReady) {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		tableReady = true;
+	}
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFF;
+}
+
+static void putUint32(string &out, uint32_t value) {
+	for (int i = 0; i < 4; ++i) out.push_back((char)((value >> (8 * i)) & 0xFF));
+}
+
+static void putUint64(string &out, uint64_t value) {
+	for (int i = 0; i < 8; ++i) out.push_back((char)((value >> (8 * i)) & 0xFF));
+}
+
+static void putString(string &out, const string &value) {
+	putUint32(out, value.size());
+	out.append(value);
+}
+
+static uint32_t getUint32(const uint8_t *data) {
+	return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static bool writeAll(int fd, const char *data, size_t size) {
+	while (size > 0) {
+		ssize_t written = ::write(fd, data, size);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+namespace {
+
+/* Reads the fields of an entry body, each read failing once the end of the body is reached. */
+class EntryReader {
+  public:
+	EntryReader(const uint8_t *data, size_t size) : mData(data), mSize(size), mPos(0) {
+	}
+	bool readUint8(uint8_t &value) {
+		if (mSize - mPos < 1) return false;
+		value = mData[mPos++];
+		return true;
+	}
+	bool readUint32(uint32_t &value) {
+		if (mSize - mPos < 4) return false;
+		value = getUint32(mData + mPos);
+		mPos += 4;
+		return true;
+	}
+	bool readUint64(uint64_t &value) {
+		uint32_t low, high;
+		if (!readUint32(low) || !readUint32(high)) return false;
+		value = ((uint64_t)high << 32) | low;
+		return true;
+	}
+	bool readString(string &value) {
+		uint32_t size;
+		if (!readUint32(size) || mSize - mPos < size) return false;
+		value.assign((const char *)mData + mPos, size);
+		mPos += size;
+		return true;
+	}
+
+  private:
+	const uint8_t *mData;
+	size_t mSize;
+	size_t mPos;
+};
+
+}
+
+RegistrarDbFile::RegistrarDbFile(Agent *ag, const string &path, int syncInterval)
+	: RegistrarDbInternal(ag), mPath(path), mSyncInterval(syncInterval), mFd(-1), mLogSize(0),
+	  mLiveSize(sizeof(sLogMagic)), mSyncTimer(nullptr), mWrittenSize(0), mSyncRequested(false), mStopping(false),
+	  mCompacting(false), mCompactionStarted(false), mCompactionDone(false), mCompactionOk(false),
+	  mCompactionLogSize(0), mCompactedSize(0) {
+}
+
+RegistrarDbFile::~RegistrarDbFile() {
+	if (mSyncTimer) mAgent->stopTimer(mSyncTimer);
+	if (mWriter.joinable()) {
+		// The writer writes and flushes whatever is pending before leaving.
+		unique_lock<mutex> lock(mMutex);
+		mStopping = true;
+		mCondVar.notify_all();
+		lock.unlock();
+		mWriter.join();
+	}
+	if (mFd != -1) ::close(mFd);
+}
+
+void RegistrarDbFile::open() {
+	auto start = chrono::steady_clock::now();
+	vector<shared_ptr<Record>> rekeyed;
+	load(rekeyed);
+	// The restored records are written again in a fresh file, which also drops a possibly torn tail of the log.
+	// Nothing else runs yet, hence this first compaction is done right away.
+	off_t validSize = mLogSize;
+	auto items = prepareCompaction();
+	off_t newSize;
+	if (writeCompacted(items, mLogSize, newSize)) {
+		applyCompaction(items, mLogSize, newSize);
+	} else {
+		if (!openLog(mLogSize)) LOGF("Cannot open registrar database file %s: %s", mPath.c_str(), strerror(errno));
+		// Entries appended after a torn one would never be read back.
+		if (validSize > 0 && mLogSize > validSize && ftruncate(mFd, validSize) == 0) mLogSize = validSize;
+	}
+	mWrittenSize = mLogSize;
+	mWriter = thread(&RegistrarDbFile::runWriter, this);
+
+	for (const auto &record : rekeyed) {
+		onRecordChanged(record->getKey(), record);
+	}
+	auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+	LOGI("Registrar database file %s: %llu records with %llu bindings restored in %lli ms", mPath.c_str(),
+		 (unsigned long long)mStats.mRecords, (unsigned long long)mStats.mBindings, (long long)elapsed.count());
+
+	// The timer also checks whether the log needs to be compacted, hence it runs even if every write is flushed.
+	mSyncTimer = mAgent->createTimer(max(mSyncInterval, 1) * 1000, sHandleSyncTimer, this);
+}
+
+void RegistrarDbFile::load(vector<shared_ptr<Record>> &rekeyed) {
+	int fd = ::open(mPath.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno == ENOENT) {
+			LOGI("No registrar database file %s yet, starting with no record", mPath.c_str());
+		} else {
+			LOGE("Cannot read registrar database file %s: %s", mPath.c_str(), strerror(errno));
+		}
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return;
+	}
+	size_t size = st.st_size;
+	void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) {
+		LOGE("Cannot map registrar database file %s: %s", mPath.c_str(), strerror(errno));
+		return;
+	}
+	madvise(map, size, MADV_SEQUENTIAL);
+	const uint8_t *data = (const uint8_t *)map;
+	if (size < sizeof(sLogMagic) || memcmp(data, sLogMagic, sizeof(sLogMagic)) != 0) {
+		LOGE("%s is not a registrar database file, it will be overwritten", mPath.c_str());
+		munmap(map, size);
+		return;
+	}
+
+	// First pass: only the latest entry of each record matters.
+	unordered_map<string, LogEntry> entries;
+	size_t pos = sizeof(sLogMagic);
+	while (size - pos >= sEntryHeaderSize) {
+		uint32_t bodySize = getUint32(data + pos);
+		uint32_t crc = getUint32(data + pos + 4);
+		if (bodySize > size - pos - sEntryHeaderSize || crc32(data + pos + sEntryHeaderSize, bodySize) != crc) break;
+		EntryReader reader(data + pos + sEntryHeaderSize, bodySize);
+		uint8_t type;
+		string key;
+		if (!reader.readUint8(type) || !reader.readString(key)) break;
+		if (type == sPutEntry) {
+			LogEntry &entry = entries[key];
+			entry.offset = pos;
+			entry.size = sEntryHeaderSize + bodySize;
+			entry.expire = 0;
+		} else {
+			entries.erase(key);
+		}
+		pos += sEntryHeaderSize + bodySize;
+	}
+	if (pos < size) {
+		LOGW("Registrar database file %s ends with an incomplete entry, the last %zu bytes are dropped", mPath.c_str(),
+			 size - pos);
+	}
+
+	// Second pass: build the records.
+	time_t now = getCurrentTime();
+	for (auto &e : entries) {
+		EntryReader reader(data + e.second.offset + sEntryHeaderSize, e.second.size - sEntryHeaderSize);
+		uint8_t type;
+		string key, aor;
+		uint32_t count;
+		reader.readUint8(type);
+		reader.readString(key);
+		if (!reader.readString(aor) || !reader.readUint32(count)) continue;
+
+		SofiaAutoHome home;
+		url_t *url = url_make(home.home(), aor.c_str());
+		if (!url || (url->url_type != url_sip && url->url_type != url_sips)) continue;
+		auto record = make_shared<Record>(url);
+		for (uint32_t i = 0; i < count; ++i) {
+			string uid, contact;
+			uint64_t expireAt, expireNotAtMessage;
+			if (!reader.readString(uid) || !reader.readString(contact) || !reader.readUint64(expireAt) ||
+				!reader.readUint64(expireNotAtMessage))
+				break;
+			if ((time_t)expireAt <= now) continue;
+			auto ec = make_shared<ExtendedContact>(key.c_str(), uid.c_str(), contact.c_str());
+			if (!ec->mSipContact) continue;
+			// The url encoded expires is relative to the time of the write, the absolute times are used instead.
+			ec->mExpireAt = expireAt;
+			ec->mExpireNotAtMessage = expireNotAtMessage;
+			record->insertOrUpdateBinding(ec, nullptr);
+		}
+		record->cleanPendingChanges();
+		if (record->isEmpty()) continue;
+
+		restoreRecord(record);
+		if (record->getKey() != key) {
+			// The key depends on the configuration, which changed since the record was written.
+			rekeyed.push_back(record);
+			continue;
+		}
+		e.second.expire = record->latestExpire();
+		mEntries.insert(e);
+		mLiveSize += e.second.size;
+	}
+
+	// The first compaction copies the restored entries from the log, which is read up to its last complete entry.
+	mLogSize = pos;
+	munmap(map, size);
+}
+
+bool RegistrarDbFile::openLog(off_t &size) {
+	mFd = ::open(mPath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (mFd == -1) return false;
+	struct stat st;
+	if (fstat(mFd, &st) != 0) return false;
+	size = st.st_size;
+	if (size == 0) {
+		if (!writeAll(mFd, sLogMagic, sizeof(sLogMagic))) return false;
+		size = sizeof(sLogMagic);
+	}
+	return true;
+}
+
+/*
+ * Drops the records whose contacts all expired, and lists the latest entry of the others. A dropped record is not
+ * written anymore, the next fetch of it removes it from memory as well.
+ */
+vector<RegistrarDbFile::CompactionItem> RegistrarDbFile::prepareCompaction() {
+	vector<CompactionItem> items;
+	items.reserve(mEntries.size());
+	time_t now = getCurrentTime();
+	for (auto it = mEntries.begin(); it != mEntries.end();) {
+		if (it->second.expire <= now) {
+			mLiveSize -= it->second.size;
+			it = mEntries.erase(it);
+		} else {
+			items.push_back(CompactionItem{it->first, it->second.offset, it->second.size, 0});
+			++it;
+		}
+	}
+	return items;
+}
+
+/*
+ * Copies the listed entries of the first logSize bytes of the log in a new file, which then atomically replaces the
+ * log. A crash in the middle leaves the previous log untouched. Only touches mFd and the items, so that it runs on
+ * the writer thread.
+ */
+bool RegistrarDbFile::writeCompacted(vector<CompactionItem> &items, off_t logSize, off_t &newSize) {
+	auto start = chrono::steady_clock::now();
+	string tmpPath = mPath + ".tmp";
+	int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		LOGE("Cannot create %s: %s", tmpPath.c_str(), strerror(errno));
+		return false;
+	}
+
+	const uint8_t *data = nullptr;
+	void *map = MAP_FAILED;
+	if (!items.empty()) {
+		int src = ::open(mPath.c_str(), O_RDONLY | O_CLOEXEC);
+		if (src != -1) {
+			map = mmap(nullptr, logSize, PROT_READ, MAP_PRIVATE, src, 0);
+			::close(src);
+		}
+		if (map == MAP_FAILED) {
+			LOGE("Cannot map registrar database file %s: %s", mPath.c_str(), strerror(errno));
+			::close(fd);
+			unlink(tmpPath.c_str());
+			return false;
+		}
+		data = (const uint8_t *)map;
+	}
+
+	bool ok = true;
+	string buffer(sLogMagic, sizeof(sLogMagic));
+	off_t written = 0;
+	for (auto &item : items) {
+		item.newOffset = written + buffer.size();
+		buffer.append((const char *)data + item.offset, item.size);
+		if (buffer.size() >= sCompactionBufferSize) {
+			ok = writeAll(fd, buffer.data(), buffer.size());
+			if (!ok) break;
+			written += buffer.size();
+			buffer.clear();
+		}
+	}
+	if (map != MAP_FAILED) munmap(map, logSize);
+	off_t compactedSize = written + buffer.size();
+	ok = ok && writeAll(fd, buffer.data(), buffer.size()) && fsync(fd) == 0;
+	::close(fd);
+	if (!ok || rename(tmpPath.c_str(), mPath.c_str()) != 0) {
+		LOGE("Cannot compact registrar database file %s: %s", mPath.c_str(), strerror(errno));
+		unlink(tmpPath.c_str());
+		return false;
+	}
+
+	// The rename itself is made durable by syncing the directory.
+	size_t slash = mPath.rfind('/');
+	string dir = slash == string::npos ? "." : (slash == 0 ? "/" : mPath.substr(0, slash));
+	int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirFd != -1) {
+		fsync(dirFd);
+		::close(dirFd);
+	}
+
+	if (mFd != -1) ::close(mFd);
+	mFd = -1;
+	// The compacted file replaced the log already, the entries move to it even if it cannot be reopened.
+	newSize = compactedSize;
+	if (!openLog(newSize)) LOGE("Cannot reopen registrar database file %s: %s", mPath.c_str(), strerror(errno));
+	auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+	LOGD("Registrar database file %s compacted to %lli bytes in %lli ms", mPath.c_str(), (long long)newSize,
+		 (long long)elapsed.count());
+	return true;
+}
+
+/*
+ * Moves the entries to the compacted log: the copied ones to their new offset, and the ones appended since the
+ * compaction was requested by as much as the log shrank.
+ */
+void RegistrarDbFile::applyCompaction(const vector<CompactionItem> &items, off_t logSize, off_t newSize) {
+	for (auto &e : mEntries) {
+		if (e.second.offset >= logSize) e.second.offset += newSize - logSize;
+	}
+	for (const auto &item : items) {
+		auto it = mEntries.find(item.key);
+		if (it != mEntries.end() && it->second.offset == item.offset) it->second.offset = item.newOffset;
+	}
+	mLogSize += newSize - logSize;
+}
+
+void RegistrarDbFile::requestCompaction() {
+	auto items = prepareCompaction();
+	unique_lock<mutex> lock(mMutex);
+	mCompactionItems = move(items);
+	mCompactionLogSize = mLogSize;
+	mCompacting = true;
+	mCompactionStarted = false;
+	mCompactionDone = false;
+	mCondVar.notify_all();
+}
+
+/* Applies the result of the compaction handed to the writer if it is done, or once it is done if asked to wait. */
+void RegistrarDbFile::finishCompaction(bool wait) {
+	unique_lock<mutex> lock(mMutex);
+	if (!mCompacting) return;
+	if (wait) {
+		mCondVar.wait(lock, [this] { return mCompactionDone; });
+	} else if (!mCompactionDone) {
+		return;
+	}
+	mCompacting = false;
+	auto items = move(mCompactionItems);
+	mCompactionItems.clear();
+	bool ok = mCompactionOk;
+	off_t logSize = mCompactionLogSize;
+	off_t newSize = mCompactedSize;
+	lock.unlock();
+	// On failure the log was left as it was, the entries keep their offsets.
+	if (ok) applyCompaction(items, logSize, newSize);
+}
+
+/*
+ * Writes the appended entries in order, and flushes them either after each batch or when the sync timer asks for
+ * it. A compaction copies the log as it was when it was requested: the entries appended until then are written
+ * before it, and the following ones after it, in the compacted log.
+ */
+void RegistrarDbFile::runWriter() {
+	bool dirty = false;
+	unique_lock<mutex> lock(mMutex);
+	while (true) {
+		mCondVar.wait(lock, [this] {
+			return mStopping || mSyncRequested || !mPending.empty() || (mCompacting && !mCompactionStarted);
+		});
+		string pending;
+		pending.swap(mPending);
+		bool flush = mSyncRequested || mSyncInterval <= 0 || mStopping;
+		mSyncRequested = false;
+		bool compaction = mCompacting && !mCompactionStarted;
+		mCompactionStarted = mCompactionStarted || compaction;
+		size_t before = compaction ? mCompactionLogSize - mWrittenSize : pending.size();
+		bool stopping = mStopping;
+		lock.unlock();
+
+		bool ok = true;
+		off_t newSize = 0;
+		if (before > 0) {
+			if (!writeAll(mFd, pending.data(), before)) {
+				LOGE("Cannot write to registrar database file %s: %s", mPath.c_str(), strerror(errno));
+				// Whatever part of the entries was written is dropped at the next load, as its checksum does not
+				// match.
+			}
+			dirty = true;
+		}
+		if (compaction) {
+			ok = writeCompacted(mCompactionItems, mCompactionLogSize, newSize);
+			if (ok) dirty = false;
+		}
+		if (pending.size() > before) {
+			if (!writeAll(mFd, pending.data() + before, pending.size() - before)) {
+				LOGE("Cannot write to registrar database file %s: %s", mPath.c_str(), strerror(errno));
+			}
+			dirty = true;
+		}
+		if (flush && dirty) {
+			if (fdatasync(mFd) != 0) {
+				LOGE("Cannot flush registrar database file %s: %s", mPath.c_str(), strerror(errno));
+			} else {
+				dirty = false;
+			}
+		}
+
+		lock.lock();
+		if (compaction) {
+			mWrittenSize = (ok ? newSize : mCompactionLogSize) + (pending.size() - before);
+			mCompactionOk = ok;
+			mCompactedSize = newSize;
+			mCompactionDone = true;
+			mCondVar.notify_all();
+		} else {
+			mWrittenSize += pending.size();
+		}
+		if (stopping && mPending.empty() && !(mCompacting && !mCompactionStarted)) return;
+	}
+}
+
+void RegistrarDbFile::append(const string &body) {
+	string entry;
+	entry.reserve(sEntryHeaderSize + body.size());
+	putUint32(entry, body.size());
+	putUint32(entry, crc32((const uint8_t *)body.data(), body.size()));
+	entry.append(body);
+	mLogSize += entry.size();
+	unique_lock<mutex> lock(mMutex);
+	mPending.append(entry);
+	mCondVar.notify_all();
+}
+
+void RegistrarDbFile::onRecordChanged(const string &key, const shared_ptr<Record> &record) {
+	string body;
+	body.push_back((char)(record ? sPutEntry : sDeleteEntry));
+	putString(body, key);
+	auto it = mEntries.find(key);
+	if (!record) {
+		// Nothing to write if the record was not in the log, for instance if it expired before a compaction.
+		if (it == mEntries.end()) return;
+		mLiveSize -= it->second.size;
+		mEntries.erase(it);
+		append(body);
+		return;
+	}
+
+	SofiaAutoHome home;
+	putString(body, url_as_string(home.home(), record->getAor()));
+	const auto &contacts = record->getExtendedContacts();
+	putUint32(body, contacts.size());
+	for (const auto &ec : contacts) {
+		putString(body, ec->getUniqueId());
+		putString(body, ec->serializeAsUrlEncodedParams());
+		putUint64(body, ec->mExpireAt);
+		putUint64(body, ec->mExpireNotAtMessage);
+	}
+
+	off_t offset = mLogSize;
+	append(body);
+	if (it == mEntries.end()) {
+		it = mEntries.insert(make_pair(key, LogEntry{0, 0, 0})).first;
+	} else {
+		mLiveSize -= it->second.size;
+	}
+	it->second.offset = offset;
+	it->second.size = sEntryHeaderSize + body.size();
+	it->second.expire = record->latestExpire();
+	mLiveSize += it->second.size;
+}
+
+void RegistrarDbFile::clearAll() {
+	RegistrarDbInternal::clearAll();
+	finishCompaction(true);
+	mEntries.clear();
+	mLiveSize = sizeof(sLogMagic);
+	requestCompaction();
+}
+
+/*
+ * Runs on the main loop, and never waits for the writer: it only picks the result of a finished compaction, and
+ * asks for a flush or a new compaction.
+ */
+void RegistrarDbFile::sHandleSyncTimer(void *unused, su_timer_t *t, void *data) {
+	RegistrarDbFile *zis = (RegistrarDbFile *)data;
+	LoopMonitor::Probe probe(zis->mAgent->getLoopMonitor(), LoopMonitor::SourceRegistrarFileSync);
+	zis->finishCompaction(false);
+	if (zis->mSyncInterval > 0) {
+		unique_lock<mutex> lock(zis->mMutex);
+		zis->mSyncRequested = true;
+		zis->mCondVar.notify_all();
+	}
+	if (!zis->mCompacting && zis->mLogSize > max<off_t>(2 * zis->mLiveSize, sMinCompactionSize)) {
+		zis->requestCompaction();
+	}
+}
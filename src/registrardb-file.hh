@@ -0,0 +1,106 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "registrardb-internal.hh"
+#include <flexisip/agent.hh>
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace flexisip {
+
+/*
+ * Records are kept in memory as with the internal implementation, and each change is appended to a log file.
+ * Every entry of the log carries a checksum, so that a log cut by a crash is read up to its last complete entry.
+ * At startup the log is mapped in memory and every record restored, then it is compacted to one entry per record.
+ * Afterwards the log is only written by a thread of its own, which also flushes and compacts it, so that the main
+ * loop never waits for the disk.
+ * Its cost over the internal implementation is measured on the same workload by:
+ *   flexisip_registrar_bench --backends internal,file --aors 100000 --devices 1-3 --refresh-ratio 0.8 --rounds 5
+ *     --concurrency 100 --seed 1 --file-db-path /var/tmp/registrar-bench.log
+ */
+class RegistrarDbFile : public RegistrarDbInternal {
+  public:
+	RegistrarDbFile(Agent *ag, const std::string &path, int syncInterval);
+	virtual ~RegistrarDbFile();
+	/* Restores the records of the file, to be called once the database is set as the registrar one. */
+	void open();
+	virtual void clearAll();
+
+  protected:
+	virtual void onRecordChanged(const std::string &key, const std::shared_ptr<Record> &record);
+
+  private:
+	/* Position in the log of the latest entry holding a record, with the time its last contact expires. */
+	struct LogEntry {
+		off_t offset;
+		size_t size;
+		time_t expire;
+	};
+	/* Entry copied by a compaction, from its offset in the log to its offset in the compacted file. */
+	struct CompactionItem {
+		std::string key;
+		off_t offset;
+		size_t size;
+		off_t newOffset;
+	};
+
+	bool openLog(off_t &size);
+	void load(std::vector<std::shared_ptr<Record>> &rekeyed);
+	void append(const std::string &body);
+	std::vector<CompactionItem> prepareCompaction();
+	bool writeCompacted(std::vector<CompactionItem> &items, off_t logSize, off_t &newSize);
+	void applyCompaction(const std::vector<CompactionItem> &items, off_t logSize, off_t newSize);
+	void requestCompaction();
+	void finishCompaction(bool wait);
+	void runWriter();
+	static void sHandleSyncTimer(void *unused, su_timer_t *t, void *data);
+
+	std::string mPath;
+	int mSyncInterval; // seconds between two flushes of the log on disk, 0 to flush after each batch of writes
+	int mFd; // only used by the writer thread once it is started
+	off_t mLogSize; // size of the log once all the appended entries are written
+	size_t mLiveSize; // bytes of the entries of mEntries, the size the log would have once compacted
+	std::unordered_map<std::string, LogEntry> mEntries;
+	su_timer_t *mSyncTimer;
+
+	// State shared with the writer thread, under mMutex.
+	std::thread mWriter;
+	std::mutex mMutex;
+	std::condition_variable mCondVar;
+	std::string mPending; // entries appended and not taken by the writer yet
+	off_t mWrittenSize; // size of the log once the writer wrote the entries it took
+	bool mSyncRequested;
+	bool mStopping;
+	bool mCompacting; // a compaction was requested and its result is not applied yet
+	bool mCompactionStarted;
+	bool mCompactionDone;
+	bool mCompactionOk;
+	std::vector<CompactionItem> mCompactionItems;
+	off_t mCompactionLogSize; // size of the log when the compaction was requested
+	off_t mCompactedSize;
+};
+
+}
@@ -30,22 +30,60 @@
 using namespace std;
 using namespace flexisip;
 
-RegistrarDbInternal::RegistrarDbInternal(Agent *ag) : RegistrarDb(ag) {
+static const size_t sShardCount = 64;
+
+RegistrarDbInternal::RegistrarDbInternal(Agent *ag) : RegistrarDb(ag), mShards(sShardCount) {
 	mWritable = true;
 }
 
+RegistrarDbInternal::RecordMap &RegistrarDbInternal::getShard(const string &key) {
+	return mShards[hash<string>()(key) % sShardCount];
+}
+
+/* The memory usage of a record is computed again each time it may have changed, which only costs a pass over its
+ * contacts. */
+void RegistrarDbInternal::updateMemoryUsage(RecordEntry &entry) {
+	mStats.mBindings -= entry.bindings;
+	mStats.mBindingBytes -= entry.bytes;
+	entry.bindings = entry.record->count();
+	entry.bytes = entry.record->getMemoryUsage();
+	mStats.mBindings += entry.bindings;
+	mStats.mBindingBytes += entry.bytes;
+}
+
+void RegistrarDbInternal::erase(RecordMap &shard, RecordMap::iterator it) {
+	string key = it->first;
+	mStats.mRecords--;
+	mStats.mBindings -= it->second.bindings;
+	mStats.mBindingBytes -= it->second.bytes;
+	shard.erase(it);
+	onRecordChanged(key, nullptr);
+}
+
+void RegistrarDbInternal::restoreRecord(const shared_ptr<Record> &record) {
+	RecordMap &records = getShard(record->getKey());
+	auto inserted = records.insert(make_pair(record->getKey(), RecordEntry{record, 0, 0}));
+	auto it = inserted.first;
+	if (inserted.second) mStats.mRecords++;
+	else it->second.record = record;
+	updateMemoryUsage(it->second);
+	mLocalRegExpire->update(record);
+}
+
 void RegistrarDbInternal::doBind(const sip_t *sip, int globalExpire, bool alias, int version, const shared_ptr<ContactUpdateListener> &listener) {
 	string key = Record::defineKeyFromUrl(sip->sip_from->a_url);
 
-	auto it = mRecords.find(key);
+	RecordMap &records = getShard(key);
+	auto it = records.find(key);
 	shared_ptr<Record> r;
-	if (sip->sip_from && it == mRecords.end()) {
+	if (sip->sip_from && it == records.end()) {
 		r = make_shared<Record>(sip->sip_from->a_url);
-		mRecords.insert(make_pair(key, r));
+		it = records.insert(make_pair(key, RecordEntry{r, 0, 0})).first;
+		mStats.mRecords++;
 		LOGD("Creating AOR %s association", key.c_str());
 	} else {
 		LOGD("AOR %s found", key.c_str());
-		r = (*it).second;
+		r = it->second.record;
 	}
 
 	if (sip->sip_call_id && sip->sip_cseq && r->isInvalidRegister(sip->sip_call_id->i_id, sip->sip_cseq->cs_seq)) {
@@ -55,22 +93,49 @@ void RegistrarDbInternal::doBind(const sip_t *sip, int globalExpire, bool alias,
 	}
 
 	r->update(sip, globalExpire, alias, version, listener);
+	// Nothing to write, the record is the storage itself.
+	r->cleanPendingChanges();
+	updateMemoryUsage(it->second);
+	onRecordChanged(key, r);
 
 	mLocalRegExpire->update(r);
 	if (listener) listener->onRecordFound(r);
 }
 
+bool RegistrarDbInternal::doRefresh(const sip_t *sip, int globalExpire, const shared_ptr<ContactUpdateListener> &listener) {
+	string key = Record::defineKeyFromUrl(sip->sip_from->a_url);
+
+	RecordMap &records = getShard(key);
+	auto it = records.find(key);
+	if (it == records.end()) return false;
+	shared_ptr<Record> r = it->second.record;
+	if (!r->refresh(sip, globalExpire)) return false;
+
+	LOGD("AOR %s refreshed", key.c_str());
+	mStats.mRefreshes++;
+	r->cleanPendingChanges();
+	updateMemoryUsage(it->second);
+	onRecordChanged(key, r);
+
+	mLocalRegExpire->update(r);
+	if (listener) listener->onRecordRefreshed(r);
+	return true;
+}
+
 void RegistrarDbInternal::doFetch(const url_t *url, const shared_ptr<ContactUpdateListener> &listener) {
 	string key(Record::defineKeyFromUrl(url));
 
-	auto it = mRecords.find(key);
+	RecordMap &records = getShard(key);
+	auto it = records.find(key);
 	shared_ptr<Record> r = NULL;
-	if (it != mRecords.end()) {
-		r = (*it).second;
+	if (it != records.end()) {
+		r = it->second.record;
 		r->clean(getCurrentTime(), listener);
 		if (r->isEmpty()) {
-			mRecords.erase(it);
+			erase(records, it);
 			r = nullptr;
+		} else {
+			updateMemoryUsage(it->second);
 		}
 	}
 
@@ -81,22 +146,24 @@ void RegistrarDbInternal::doFetchForGruu(const url_t *url, const string &gruu, c
 	string key(Record::defineKeyFromUrl(url));
 	SofiaAutoHome home;
 
-	auto it = mRecords.find(key);
+	RecordMap &records = getShard(key);
+	auto it = records.find(key);
 	shared_ptr<Record> r = NULL;
 
-	if (it == mRecords.end()) {
+	if (it == records.end()) {
 		listener->onRecordFound(r);
 		return;
 	}
 
-	r = (*it).second;
+	r = it->second.record;
 	r->clean(getCurrentTime(), listener);
 	if (r->isEmpty()) {
-		mRecords.erase(it);
+		erase(records, it);
 		r = nullptr;
 		listener->onRecordFound(r);
 		return;
 	}
+	updateMemoryUsage(it->second);
 
 	const list<shared_ptr<ExtendedContact>> &contacts = r->getExtendedContacts();
 	shared_ptr<Record> retRecord = make_shared<Record>(url);
@@ -120,6 +187,28 @@ void RegistrarDbInternal::doFetchForGruu(const url_t *url, const string &gruu, c
 	listener->onRecordFound(retRecord);
 }
 
+void RegistrarDbInternal::doFetchList(const vector<url_t *> urls, const vector<shared_ptr<ContactUpdateListener>> &listeners) {
+	// All the records are at hand: the list is answered in one pass.
+	time_t now = getCurrentTime();
+	for (size_t i = 0; i < urls.size(); ++i) {
+		const auto &urlListener = listeners[i];
+		string key = Record::defineKeyFromUrl(urls[i]);
+		RecordMap &records = getShard(key);
+		auto it = records.find(key);
+		shared_ptr<Record> r = nullptr;
+		if (it != records.end()) {
+			it->second.record->clean(now, urlListener);
+			if (it->second.record->isEmpty()) {
+				erase(records, it);
+			} else {
+				r = it->second.record;
+				updateMemoryUsage(it->second);
+			}
+		}
+		urlListener->onRecordFound(r);
+	}
+}
+
 void RegistrarDbInternal::doClear(const sip_t *sip, const shared_ptr<ContactUpdateListener> &listener) {
 	string key(Record::defineKeyFromUrl(sip->sip_from->a_url));
 
@@ -128,22 +217,23 @@ void RegistrarDbInternal::doClear(const sip_t *sip, const shared_ptr<ContactUpda
 		return;
 	}
 
-	auto it = mRecords.find(key);
+	RecordMap &records = getShard(key);
+	auto it = records.find(key);
 
-	if (it == mRecords.end()) {
+	if (it == records.end()) {
 		listener->onRecordFound(NULL);
 		return;
 	}
 
 	LOGD("AOR %s found", key.c_str());
-	shared_ptr<Record> r = (*it).second;
+	shared_ptr<Record> r = it->second.record;
 
 	if (r->isInvalidRegister(sip->sip_call_id->i_id, sip->sip_cseq->cs_seq)) {
 		listener->onInvalid();
 		return;
 	}
 
-	mRecords.erase(it);
+	erase(records, it);
 	mLocalRegExpire->remove(key);
 	listener->onRecordFound(NULL);
 }
@@ -153,7 +243,10 @@ void RegistrarDbInternal::doMigration() {
 }
 
 void RegistrarDbInternal::clearAll() {
-	mRecords.clear();
+	for (auto &shard : mShards) shard.clear();
+	mStats.mRecords = 0;
+	mStats.mBindings = 0;
+	mStats.mBindingBytes = 0;
 	mLocalRegExpire->clearAll();
 }
 
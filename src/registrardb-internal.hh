@@ -21,22 +21,46 @@
 
 #include <flexisip/registrardb.hh>
 #include <sofia-sip/sip.h>
+#include <unordered_map>
+#include <vector>
 
 namespace flexisip {
 
 class RegistrarDbInternal : public RegistrarDb {
   public:
 	RegistrarDbInternal(Agent *ag);
-	void clearAll();
+	virtual void clearAll();
 
-  private:
+  protected:
 	virtual void doBind(const sip_t *sip, int globalExpire, bool alias, int version, const std::shared_ptr<ContactUpdateListener> &listener);
+	virtual bool doRefresh(const sip_t *sip, int globalExpire, const std::shared_ptr<ContactUpdateListener> &listener);
 	virtual void doClear(const sip_t *sip, const std::shared_ptr<ContactUpdateListener> &listener);
 	virtual void doFetch(const url_t *url, const std::shared_ptr<ContactUpdateListener> &listener);
 	virtual void doFetchForGruu(const url_t *url, const std::string &gruu, const std::shared_ptr<ContactUpdateListener> &listener);
+	virtual void doFetchList(const std::vector<url_t *> urls, const std::vector<std::shared_ptr<ContactUpdateListener>> &listeners);
 	virtual void doMigration();
 	virtual void publish(const std::string &topic, const std::string &uid);
-	std::map<std::string, std::shared_ptr<Record>> mRecords;
+
+	/* A record with the memory usage it was accounted for in mStats. */
+	struct RecordEntry {
+		std::shared_ptr<Record> record;
+		size_t bindings;
+		size_t bytes;
+	};
+	typedef std::unordered_map<std::string, RecordEntry> RecordMap;
+
+	RecordMap &getShard(const std::string &key);
+	void updateMemoryUsage(RecordEntry &entry);
+	void erase(RecordMap &shard, RecordMap::iterator it);
+	/* Adds a record read from a persistent storage, without notifying any listener. */
+	void restoreRecord(const std::shared_ptr<Record> &record);
+	/* Called once a record was written by a bind, or with a null record once it was removed. */
+	virtual void onRecordChanged(const std::string &key, const std::shared_ptr<Record> &record) {
+	}
+
+	/* The records are spread over several hash tables, so that each growth of a table only rehashes a fraction of
+	 * them. */
+	std::vector<RecordMap> mShards;
 };
 
 }
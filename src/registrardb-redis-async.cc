@@ -22,6 +22,9 @@
 
 #include <ctime>
 #include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <functional>
 #include <vector>
 #include <algorithm>
 #include <iterator>
@@ -31,6 +34,7 @@
 
 #include <hiredis/hiredis.h>
 
+#include "registrardb-redis-scripts.hh"
 #include "registrardb-redis-sofia-event.h"
 #include <sofia-sip/sip_protos.h>
 
@@ -38,41 +42,159 @@
 /* The timeout to retry a bind request after encountering a failure. It gives us a chance to reconnect to a new master.*/
 constexpr int redisRetryTimeoutMs = 5000;
 
+/* Number of hash slots of a redis cluster, and the maximum number of redirections followed by a command. */
+constexpr int sClusterSlotCount = 16384;
+constexpr int sClusterMaxRedirections = 5;
+
+/* Unique id published on the topic of a record each time it is written or deleted, which tells the other nodes to drop
+ * it from their cache without notifying the contact listeners, unlike the unique id of a contact that registered. */
+static const char *sRecordChangedUid = "<record-changed>";
+
+/* A replica acknowledges the replication stream every second, a greater lag means that it is late or disconnected. */
+constexpr int sReplicaMaxLag = 1;
+
 using namespace std;
 using namespace flexisip;
 
 RegistrarUserData::RegistrarUserData(RegistrarDbRedisAsync *s, const url_t *url, shared_ptr<ContactUpdateListener> listener)
-	: self(s), listener(listener), token(0), mRetryTimer(nullptr), mRetryCount(0), mGruu(""), mUpdateExpire(false), mIsUnregister(false) {
+	: self(s), listener(listener), token(0), mRetryTimer(nullptr), mRetryCount(0), mGruu(""), mUpdateExpire(false), mIsUnregister(false),
+	  mCacheGeneration(0), mSubscriptionConfirmed(false), mReadFromReplica(false) {
 	mRecord = make_shared<Record>(url);
 }
 RegistrarUserData::~RegistrarUserData() {
 
 }
 
+/******
+ * RedisRecordCache class
+ */
+
+const RedisRecordCache::Bindings *RedisRecordCache::get(const string &key, time_t now) {
+	auto it = mIndex.find(key);
+	if (it == mIndex.end() || !it->second->usable) return nullptr;
+	if (now - it->second->insertedAt >= mMaxAge) {
+		erase(it->second);
+		return nullptr;
+	}
+	mEntries.splice(mEntries.begin(), mEntries, it->second);
+	return &mEntries.front().bindings;
+}
+
+bool RedisRecordCache::insert(const string &key, Bindings &&bindings, bool usable, uint64_t generation, time_t now,
+							  list<string> &evicted) {
+	if (generation != mGeneration) return false;
+
+	size_t bytes = key.size();
+	for (const auto &binding : bindings) bytes += binding.first.size() + binding.second.size();
+	bool known = false;
+	auto it = mIndex.find(key);
+	if (it != mIndex.end()) {
+		erase(it->second);
+		known = true;
+	}
+	if (bytes > mMaxBytes) return false;
+
+	while (mBytes + bytes > mMaxBytes && !mEntries.empty()) {
+		evicted.push_back(mEntries.back().key);
+		erase(prev(mEntries.end()));
+	}
+	mEntries.push_front(Entry{key, move(bindings), bytes, now, usable});
+	mIndex[key] = mEntries.begin();
+	mBytes += bytes;
+	return !known;
+}
+
+bool RedisRecordCache::remove(const string &key) {
+	mGeneration++;
+	auto it = mIndex.find(key);
+	if (it == mIndex.end()) return false;
+	erase(it->second);
+	return true;
+}
+
+void RedisRecordCache::clear() {
+	mGeneration++;
+	mEntries.clear();
+	mIndex.clear();
+	mBytes = 0;
+}
+
+void RedisRecordCache::erase(list<Entry>::iterator it) {
+	mBytes -= it->bytes;
+	mIndex.erase(it->key);
+	mEntries.erase(it);
+}
+
 /******
  * RegistrarDbRedisAsync class
  */
 
 RegistrarDbRedisAsync::RegistrarDbRedisAsync(Agent *ag, RedisParameters params)
 	: RegistrarDb(ag), mContext(nullptr), mSubscribeContext(nullptr),
-	  mDomain(params.domain), mAuthPassword(params.auth), mPort(params.port), mTimeout(params.timeout), mRoot(ag->getRoot()),
-	  mReplicationTimer(nullptr), mSlaveCheckTimeout(params.mSlaveCheckTimeout) {
+	  mPoolContexts(params.mUseCluster ? 0 : max(params.mConnectionPoolSize, 1) - 1, nullptr),
+	  mUseCluster(params.mUseCluster), mClusterSlotsPending(false), mDomain(params.domain), mAuthPassword(params.auth),
+	  mPort(params.port), mTimeout(params.timeout), mRoot(ag->getRoot()), mReplicationTimer(nullptr),
+	  mSlaveCheckTimeout(params.mSlaveCheckTimeout), mUseServerSideBind(params.mUseServerSideBind),
+	  mRecordCache(params.mRecordCacheSize, params.mRecordCacheMaxAge),
+	  mUseReplicaReads(params.mUseReplicaReads && !params.mUseCluster),
+	  mReplicaReadAfterWriteDelay(max(params.mReplicaReadAfterWriteDelay, 0)), mMasterReplOffset(-1),
+	  mUseBinaryContacts(params.mUseBinaryContacts),
+	  mPubSubChannels(min(max(params.mPubSubChannels, 0), sClusterSlotCount)), mExpirationTimer(nullptr),
+	  mKeyExpirationEvents(false),
+	  mFetchListScript(sFetchListScript), mContactMigrationScript(sContactMigrationScript),
+	  mRefreshScript(sRefreshScript) {
 	mSerializer = RecordSerializer::get();
 	mCurSlave = 0;
+	mStats.mConnections.resize(mPoolContexts.size() + 1);
+	if (mUseCluster) {
+		if (params.mConnectionPoolSize > 1) LOGW("Redis connection pool size is ignored in cluster mode");
+		if (params.mUseReplicaReads) LOGW("Redis replica reads are ignored in cluster mode");
+		mClusterSlots.assign(sClusterSlotCount, -1);
+	}
+	mChannelTopics.assign(mPubSubChannels, 0);
+	startExpirationTimer();
 }
 
 RegistrarDbRedisAsync::RegistrarDbRedisAsync(const string &preferredRoute, su_root_t *root, RecordSerializer *serializer, RedisParameters params)
 	: RegistrarDb(nullptr), mContext(nullptr), mSubscribeContext(nullptr),
-	  mDomain(params.domain), mAuthPassword(params.auth), mPort(params.port), mTimeout(params.timeout), mRoot(root),
-	  mReplicationTimer(nullptr), mSlaveCheckTimeout(params.mSlaveCheckTimeout) {
+	  mPoolContexts(params.mUseCluster ? 0 : max(params.mConnectionPoolSize, 1) - 1, nullptr),
+	  mUseCluster(params.mUseCluster), mClusterSlotsPending(false), mDomain(params.domain), mAuthPassword(params.auth),
+	  mPort(params.port), mTimeout(params.timeout), mRoot(root), mReplicationTimer(nullptr),
+	  mSlaveCheckTimeout(params.mSlaveCheckTimeout), mUseServerSideBind(params.mUseServerSideBind),
+	  mRecordCache(params.mRecordCacheSize, params.mRecordCacheMaxAge),
+	  mUseReplicaReads(params.mUseReplicaReads && !params.mUseCluster),
+	  mReplicaReadAfterWriteDelay(max(params.mReplicaReadAfterWriteDelay, 0)), mMasterReplOffset(-1),
+	  mUseBinaryContacts(params.mUseBinaryContacts),
+	  mPubSubChannels(min(max(params.mPubSubChannels, 0), sClusterSlotCount)), mExpirationTimer(nullptr),
+	  mKeyExpirationEvents(false),
+	  mFetchListScript(sFetchListScript), mContactMigrationScript(sContactMigrationScript),
+	  mRefreshScript(sRefreshScript) {
 	mSerializer = serializer;
 	mCurSlave = 0;
+	mStats.mConnections.resize(mPoolContexts.size() + 1);
+	if (mUseCluster) {
+		if (params.mConnectionPoolSize > 1) LOGW("Redis connection pool size is ignored in cluster mode");
+		if (params.mUseReplicaReads) LOGW("Redis replica reads are ignored in cluster mode");
+		mClusterSlots.assign(sClusterSlotCount, -1);
+	}
+	mChannelTopics.assign(mPubSubChannels, 0);
+	startExpirationTimer();
 }
 
 RegistrarDbRedisAsync::~RegistrarDbRedisAsync() {
 	if (mContext) {
 		redisAsyncDisconnect(mContext);
 	}
+	for (auto poolContext : mPoolContexts) {
+		if (poolContext) redisAsyncDisconnect(poolContext);
+	}
+	for (const auto &node : mClusterNodes) {
+		if (node.context) redisAsyncDisconnect(node.context);
+		if (node.subscribeContext) redisAsyncDisconnect(node.subscribeContext);
+	}
+	for (const auto &replica : mReplicas) {
+		if (replica.context) redisAsyncDisconnect(replica.context);
+	}
 	if (mSubscribeContext) {
 		redisAsyncDisconnect(mSubscribeContext);
 	}
@@ -80,9 +202,37 @@ RegistrarDbRedisAsync::~RegistrarDbRedisAsync() {
 		mAgent->stopTimer(mReplicationTimer);
 		mReplicationTimer = nullptr;
 	}
+	if (mExpirationTimer) {
+		su_timer_destroy(mExpirationTimer);
+		mExpirationTimer = nullptr;
+	}
 }
 
 void RegistrarDbRedisAsync::onDisconnect(const redisAsyncContext *c, int status) {
+	auto poolContext = find(mPoolContexts.begin(), mPoolContexts.end(), c);
+	if (poolContext != mPoolContexts.end()) {
+		// The connection is opened again by the next command sent through it (see sendFormattedCommand()).
+		*poolContext = nullptr;
+		LOGD("REDIS pool connection %p disconnected", c);
+		if (status != REDIS_OK) LOGE("Redis disconnection message: %s", c->errstr);
+		return;
+	}
+	RedisClusterNode *node = findClusterNode(c);
+	if (node) {
+		// The connection is opened again by the next command for this node or the next slots refresh.
+		node->context = nullptr;
+		LOGD("REDIS cluster node %s:%d disconnected", node->address.c_str(), node->port);
+		if (status != REDIS_OK) LOGE("Redis disconnection message: %s", c->errstr);
+		return;
+	}
+	RedisReplica *replica = findReplica(c);
+	if (replica) {
+		// The reads go to the other replicas or to the master until the next replication check reconnects it.
+		replica->context = nullptr;
+		LOGD("REDIS replica %s:%d disconnected", replica->host.address.c_str(), replica->host.port);
+		if (status != REDIS_OK) LOGE("Redis disconnection message: %s", c->errstr);
+		return;
+	}
 	if (mContext != nullptr && mContext != c) {
 		LOGE("Redis context %p disconnected, but current context is %p", c, mContext);
 		return;
@@ -98,6 +248,37 @@ void RegistrarDbRedisAsync::onDisconnect(const redisAsyncContext *c, int status)
 }
 
 void RegistrarDbRedisAsync::onConnect(const redisAsyncContext *c, int status) {
+	auto poolContext = find(mPoolContexts.begin(), mPoolContexts.end(), c);
+	if (poolContext != mPoolContexts.end()) {
+		if (status != REDIS_OK) {
+			LOGE("Couldn't connect pool connection to redis: %s", c->errstr);
+			*poolContext = nullptr;
+		} else {
+			LOGD("REDIS pool connection done %p", c);
+		}
+		return;
+	}
+	RedisClusterNode *node = findClusterNode(c);
+	if (node) {
+		if (status != REDIS_OK) {
+			LOGE("Couldn't connect to redis cluster node %s:%d: %s", node->address.c_str(), node->port, c->errstr);
+			node->context = nullptr;
+		} else {
+			LOGD("REDIS cluster node %s:%d connected %p", node->address.c_str(), node->port, c);
+		}
+		return;
+	}
+	RedisReplica *replica = findReplica(c);
+	if (replica) {
+		if (status != REDIS_OK) {
+			LOGE("Couldn't connect to redis replica %s:%d: %s", replica->host.address.c_str(), replica->host.port,
+				 c->errstr);
+			replica->context = nullptr;
+		} else {
+			LOGD("REDIS replica %s:%d connected %p", replica->host.address.c_str(), replica->host.port, c);
+		}
+		return;
+	}
 	if (status != REDIS_OK) {
 		LOGE("Couldn't connect to redis: %s", c->errstr);
 		mContext = nullptr;
@@ -108,12 +289,22 @@ void RegistrarDbRedisAsync::onConnect(const redisAsyncContext *c, int status) {
 }
 
 void RegistrarDbRedisAsync::onSubscribeDisconnect(const redisAsyncContext *c, int status) {
+	RedisClusterNode *node = findClusterNode(c);
+	if (node) {
+		node->subscribeContext = nullptr;
+		LOGD("Disconnected subscribe context of redis cluster node %s:%d", node->address.c_str(), node->port);
+		if (status != REDIS_OK) LOGE("Redis disconnection message: %s", c->errstr);
+		return;
+	}
 	if (mSubscribeContext != nullptr && mSubscribeContext != c) {
 		LOGE("Redis subscribe context %p disconnected, but current context is %p", c, mSubscribeContext);
 		return;
 	}
 
 	mSubscribeContext = nullptr;
+	mPendingSubscriptions.clear();
+	// Invalidations may be missed until the subscriptions are restored, the cached records can't be trusted anymore.
+	mRecordCache.clear();
 	LOGD("Disconnected subscribe context %p...", c);
 	if (status != REDIS_OK) {
 		LOGE("Redis disconnection message: %s", c->errstr);
@@ -123,6 +314,14 @@ void RegistrarDbRedisAsync::onSubscribeDisconnect(const redisAsyncContext *c, in
 }
 
 void RegistrarDbRedisAsync::onSubscribeConnect(const redisAsyncContext *c, int status) {
+	RedisClusterNode *node = findClusterNode(c);
+	if (node) {
+		if (status != REDIS_OK) {
+			LOGE("Couldn't connect to redis cluster node %s:%d: %s", node->address.c_str(), node->port, c->errstr);
+			node->subscribeContext = nullptr;
+		}
+		return;
+	}
 	if (status != REDIS_OK) {
 		LOGE("Couldn't connect to redis: %s", c->errstr);
 		mSubscribeContext = nullptr;
@@ -130,11 +329,12 @@ void RegistrarDbRedisAsync::onSubscribeConnect(const redisAsyncContext *c, int s
 		return;
 	}
 	LOGD("REDIS Connection done for subscribe channel %p", c);
-	if (!mContactListenersMap.empty()){
+	if (!mContactListenersMap.empty() || !mSubscribedTopics.empty()){
 		LOGD("Now re-subscribing all topics we had before being disconnected.");
 		subscribeAll();
 	}
-	subscribeToKeyExpiration();
+	// In cluster mode, the key expiration events are received from each node (see connectCluster()).
+	if (!mUseCluster && (mPubSubChannels == 0 || mKeyExpirationEvents)) subscribeToKeyExpiration();
 }
 
 bool RegistrarDbRedisAsync::isConnected() {
@@ -168,6 +368,185 @@ bool RegistrarDbRedisAsync::handleRedisStatus(const string &desc, int redisStatu
 		}                                                                                                              \
 	} while (0)
 
+/* CRC16 (XMODEM) of the key, or of its hash tag, as defined by the redis cluster specification. */
+static int clusterKeySlot(const string &key) {
+	string hashed = key;
+	size_t start = key.find('{');
+	if (start != string::npos) {
+		size_t end = key.find('}', start + 1);
+		if (end != string::npos && end > start + 1) hashed = key.substr(start + 1, end - start - 1);
+	}
+
+	uint16_t crc = 0;
+	for (unsigned char c : hashed) {
+		crc ^= (uint16_t)(c << 8);
+		for (int i = 0; i < 8; ++i) {
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+		}
+	}
+	return crc % sClusterSlotCount;
+}
+
+/* Commands related to an AOR are sent through the connection of the pool given by the hash of its key. The hiredis
+ * adapter writes all the commands queued during a main loop iteration at once, so consecutive commands on a connection
+ * are pipelined without waiting for each other's reply. */
+
+size_t RegistrarDbRedisAsync::getConnectionIndex(const string &key) const {
+	if (mUseCluster) {
+		// Until the node of the slot is known, the command goes to the node we are connected to, which redirects it.
+		int node = mClusterSlots[clusterKeySlot(key)];
+		return node < 0 ? 0 : node + 1;
+	}
+	return hash<string>()(key) % (mPoolContexts.size() + 1);
+}
+
+redisAsyncContext *RegistrarDbRedisAsync::getConnectionContext(size_t connection) const {
+	if (connection == 0) return mContext;
+	if (mUseCluster) return mClusterNodes[connection - 1].context;
+	if (isReplicaConnection(connection)) return mReplicas[connection - 1 - mPoolContexts.size()].context;
+	return mPoolContexts[connection - 1];
+}
+
+int RegistrarDbRedisAsync::sendCommand(size_t connection, redisCallbackFn *fn, void *privdata, const char *format, ...) {
+	char *formatted = nullptr;
+	va_list args;
+
+	va_start(args, format);
+	int len = redisvFormatCommand(&formatted, format, args);
+	va_end(args);
+	if (len < 0) return REDIS_ERR;
+	return sendFormattedCommand(new RedisCommandContext(this, connection, fn, privdata), formatted, len);
+}
+
+int RegistrarDbRedisAsync::sendCommandArgv(size_t connection, redisCallbackFn *fn, void *privdata, int argc,
+										   const char **argv, const size_t *argvlen) {
+	char *formatted = nullptr;
+	int len = redisFormatCommandArgv(&formatted, argc, argv, argvlen);
+	if (len < 0) return REDIS_ERR;
+	return sendFormattedCommand(new RedisCommandContext(this, connection, fn, privdata), formatted, len);
+}
+
+/* Runs the script with EVALSHA, args being the arguments that follow the script: the number of keys, the keys and the
+ * other arguments. Until its sha is known, the script is sent along with EVAL, which also caches it in redis. */
+int RegistrarDbRedisAsync::sendScript(size_t connection, redisCallbackFn *fn, void *privdata, RedisScript &script,
+									  vector<string> &&args) {
+	bool cached = !script.sha.empty();
+	vector<const char *> argv{cached ? "EVALSHA" : "EVAL", cached ? script.sha.c_str() : script.body};
+	vector<size_t> argvlen{strlen(argv[0]), strlen(argv[1])};
+	for (const auto &arg : args) {
+		argv.push_back(arg.c_str());
+		argvlen.push_back(arg.size());
+	}
+	char *formatted = nullptr;
+	int len = redisFormatCommandArgv(&formatted, (int)argv.size(), argv.data(), argvlen.data());
+	if (len < 0) return REDIS_ERR;
+
+	auto cmd = new RedisCommandContext(this, connection, fn, privdata);
+	if (cached) {
+		cmd->script = &script;
+		cmd->scriptArgs = move(args);
+	}
+	return sendFormattedCommand(cmd, formatted, len);
+}
+
+/* Runs a script again with EVAL once redis answered NOSCRIPT to its EVALSHA, because its script cache was flushed or
+ * because another server now serves the connection. */
+bool RegistrarDbRedisAsync::resendScript(RedisCommandContext *cmd) {
+	RedisScript *script = cmd->script;
+	LOGW("Redis script %s unknown by redis, sending it again", script->sha.c_str());
+	script->sha.clear();
+	loadScripts(mContext);
+	cmd->script = nullptr;
+
+	vector<const char *> argv{"EVAL", script->body};
+	vector<size_t> argvlen{4, strlen(script->body)};
+	for (const auto &arg : cmd->scriptArgs) {
+		argv.push_back(arg.c_str());
+		argvlen.push_back(arg.size());
+	}
+	char *formatted = nullptr;
+	int len = redisFormatCommandArgv(&formatted, (int)argv.size(), argv.data(), argvlen.data());
+	if (len < 0) return false;
+	redisAsyncContext *context = getConnectionContext(cmd->connection);
+	if (!context || redisAsyncFormattedCommand(context, sHandleCommandReply, cmd, formatted, len) != REDIS_OK) {
+		free(formatted);
+		return false;
+	}
+	if (mUseCluster) cmd->command.assign(formatted, len);
+	free(formatted);
+	cmd->scriptArgs.clear();
+	mStats.mConnections[cmd->connection].mPendingCommands++;
+	return true;
+}
+
+/* Asks the server for the sha of the scripts that are not known yet. */
+void RegistrarDbRedisAsync::loadScripts(redisAsyncContext *context) {
+	if (!context) return;
+	for (RedisScript *script : {&mFetchListScript, &mContactMigrationScript, &mRefreshScript}) {
+		if (script->sha.empty()) redisAsyncCommand(context, sHandleScriptLoad, script, "SCRIPT LOAD %s", script->body);
+	}
+}
+
+/* A command is never sent on another connection than the one of its key, where it could overtake the commands already
+ * sent for the key, or be overtaken by the next ones. If this connection was lost, it is opened again: hiredis queues
+ * the command until it is established, and fails it if it can't be. */
+int RegistrarDbRedisAsync::sendFormattedCommand(RedisCommandContext *cmd, char *formatted, int len) {
+	redisAsyncContext *context = getConnectionContext(cmd->connection);
+	if (!context && cmd->connection > 0 && mContext && !isReplicaConnection(cmd->connection)) {
+		if (mUseCluster) connectCluster();
+		else connectPool();
+		context = getConnectionContext(cmd->connection);
+	}
+	int status = context ? redisAsyncFormattedCommand(context, sHandleCommandReply, cmd, formatted, len) : REDIS_ERR;
+
+	if (status == REDIS_OK) {
+		if (mUseCluster) cmd->command.assign(formatted, len);
+		mStats.mConnections[cmd->connection].mPendingCommands++;
+	} else {
+		delete cmd;
+	}
+	free(formatted);
+	return status;
+}
+
+/* Follows a MOVED or ASK redirection of the cluster by sending the command again to the node serving its slot. A MOVED
+ * also updates the slot map, and triggers a refresh of the whole map since other slots have probably moved as well. */
+bool RegistrarDbRedisAsync::redirectCommand(RedisCommandContext *cmd, const char *redirection) {
+	bool ask = strncmp(redirection, "ASK ", 4) == 0;
+	if ((!ask && strncmp(redirection, "MOVED ", 6) != 0) || cmd->redirections >= sClusterMaxRedirections) return false;
+
+	istringstream input(redirection);
+	string type, target;
+	int slot = -1;
+	input >> type >> slot >> target;
+	size_t colon = target.rfind(':');
+	if (input.fail() || colon == string::npos || slot < 0 || slot >= sClusterSlotCount) {
+		LOGE("Invalid redis cluster redirection '%s'", redirection);
+		return false;
+	}
+
+	size_t node = getClusterNode(target.substr(0, colon), (unsigned short)atoi(target.c_str() + colon + 1));
+	connectCluster();
+	redisAsyncContext *context = mClusterNodes[node].context;
+	if (!context) return false;
+
+	LOGD("Redis cluster redirection: %s", redirection);
+	if (ask) {
+		redisAsyncCommand(context, nullptr, nullptr, "ASKING");
+	} else {
+		mClusterSlots[slot] = (int)node;
+		refreshClusterSlots();
+	}
+	if (redisAsyncFormattedCommand(context, sHandleCommandReply, cmd, cmd->command.data(), cmd->command.size()) != REDIS_OK) {
+		return false;
+	}
+	cmd->redirections++;
+	cmd->connection = node + 1;
+	mStats.mConnections[cmd->connection].mPendingCommands++;
+	mStats.mClusterRedirections++;
+	return true;
+}
+
 static bool is_end_line_character(char c) {
 	return c == '\r' || c == '\n';
 }
@@ -231,7 +610,10 @@ RedisHost RedisHost::parseSlave(const string &slave, int id) {
 		auto m = parseKeyValue(slave, ',', '=');
 
 		if (m.find("ip") != m.end() && m.find("port") != m.end() && m.find("state") != m.end()) {
-			return RedisHost(id, m.at("ip"), atoi(m.at("port").c_str()), m.at("state"));
+			RedisHost host(id, m.at("ip"), atoi(m.at("port").c_str()), m.at("state"));
+			if (m.find("offset") != m.end()) host.offset = atoll(m.at("offset").c_str());
+			if (m.find("lag") != m.end()) host.lag = atoi(m.at("lag").c_str());
+			return host;
 		} else {
 			SLOGW << "Missing fields in the slaveline " << slave;
 		}
@@ -249,6 +631,8 @@ RedisHost RedisHost::parseSlave(const string &slave, int id) {
 void RegistrarDbRedisAsync::updateSlavesList(const map<string, string> redisReply) {
 	vector<RedisHost> newSlaves;
 
+	auto masterOffset = redisReply.find("master_repl_offset");
+	mMasterReplOffset = masterOffset != redisReply.end() ? atoll(masterOffset->second.c_str()) : -1;
 	try {
 		int slaveCount = atoi(redisReply.at("connected_slaves").c_str());
 		for (int i = 0; i < slaveCount; i++) {
@@ -308,6 +692,11 @@ void RegistrarDbRedisAsync::handleReplicationInfoReply(const char *reply) {
 			// We are speaking to the master, set the DB as writable and update the list of slaves
 			setWritable(true);
 			updateSlavesList(replyMap);
+			if (mUseServerSideBind && mBindScriptSha.empty()) loadBindScript();
+			loadScripts(mContext);
+			connectPool();
+			if (mUseReplicaReads) updateReplicas();
+			if (mPubSubChannels > 0) checkKeyExpirationEvents();
 
 		} else if (role == "slave") {
 
@@ -353,55 +742,260 @@ void RegistrarDbRedisAsync::handleAuthReply(const redisReply *reply) {
 }
 
 void RegistrarDbRedisAsync::getReplicationInfo() {
-	redisAsyncCommand(mContext, sHandleReplicationInfoReply, this, "INFO replication");
+	if (mUseCluster) {
+		refreshClusterSlots();
+	} else {
+		redisAsyncCommand(mContext, sHandleReplicationInfoReply, this, "INFO replication");
+	}
 	// Workaround for issue https://github.com/redis/hiredis/issues/396
 	redisAsyncCommand(mSubscribeContext, sPublishCallback, nullptr, "SUBSCRIBE %s", "FLEXISIP");
 }
 
-bool RegistrarDbRedisAsync::connect() {
-	if (isConnected()) {
-		LOGW("Redis already connected");
-		return true;
+void RegistrarDbRedisAsync::refreshClusterSlots() {
+	if (mClusterSlotsPending || !mContext) return;
+	mClusterSlotsPending = true;
+	redisAsyncCommand(mContext, sHandleClusterSlotsReply, this, "CLUSTER SLOTS");
+}
+
+/* This callback is called when the node we are connected to answered our "CLUSTER SLOTS" message. It gives the master
+ * serving each range of hash slots. */
+void RegistrarDbRedisAsync::handleClusterSlotsReply(const redisReply *reply) {
+	for (size_t i = 0; i < reply->elements; ++i) {
+		// Each range is [first slot, last slot, [master address, master port, ...], replicas...]
+		const redisReply *range = reply->element[i];
+		if (range->type != REDIS_REPLY_ARRAY || range->elements < 3 || range->element[2]->type != REDIS_REPLY_ARRAY ||
+			range->element[2]->elements < 2) {
+			continue;
+		}
+		const redisReply *master = range->element[2];
+		int node = (int)getClusterNode(master->element[0]->str ? master->element[0]->str : "",
+									   (unsigned short)master->element[1]->integer);
+		long long last = min<long long>(range->element[1]->integer, sClusterSlotCount - 1);
+		for (long long slot = max<long long>(range->element[0]->integer, 0); slot <= last; ++slot) {
+			mClusterSlots[slot] = node;
+		}
 	}
+	LOGD("Redis cluster: %lu slot ranges served by %lu known nodes", (unsigned long)reply->elements,
+		 (unsigned long)mClusterNodes.size());
 
-	mContext = redisAsyncConnect(mDomain.c_str(), mPort);
-	mContext->data = this;
-	if (mContext->err) {
-		SLOGE << "Redis Connection error: " << mContext->errstr;
-		redisAsyncFree(mContext);
-		mContext = nullptr;
-		return false;
+	// The masters are the candidates to replace the node we are connected to, should it fail.
+	mSlaves.clear();
+	for (size_t i = 0; i < mClusterNodes.size(); ++i) {
+		mSlaves.emplace_back(i, mClusterNodes[i].address, mClusterNodes[i].port, "online");
+	}
+	setWritable(true);
+	connectCluster();
+	if (mUseServerSideBind && mBindScriptSha.empty()) loadBindScript();
+	loadScripts(mContext);
+	if (mPubSubChannels > 0) checkKeyExpirationEvents();
+
+	if (mAgent && mReplicationTimer == nullptr) {
+		SLOGD << "Creating cluster slots check timer with delay of " << mSlaveCheckTimeout << "s";
+		mReplicationTimer = mAgent->createTimer(mSlaveCheckTimeout * 1000, sHandleInfoTimer, this);
 	}
+}
 
-	mSubscribeContext = redisAsyncConnect(mDomain.c_str(), mPort);
-	mSubscribeContext->data = this;
-	if (mSubscribeContext->err) {
-		SLOGE << "Redis Connection error: " << mSubscribeContext->errstr;
-		redisAsyncFree(mSubscribeContext);
-		mSubscribeContext = nullptr;
-		return false;
+size_t RegistrarDbRedisAsync::getClusterNode(const string &address, unsigned short port) {
+	// A node which does not know its own address announces an empty one: it is the node we are connected to.
+	const string &host = address.empty() ? mDomain : address;
+	for (size_t i = 0; i < mClusterNodes.size(); ++i) {
+		if (mClusterNodes[i].address == host && mClusterNodes[i].port == port) return i;
+	}
+	LOGD("Redis cluster: adding node %s:%d", host.c_str(), port);
+	mClusterNodes.emplace_back(host, port);
+	if (mStats.mConnections.size() < mClusterNodes.size() + 1) mStats.mConnections.resize(mClusterNodes.size() + 1);
+	return mClusterNodes.size() - 1;
+}
+
+RedisClusterNode *RegistrarDbRedisAsync::findClusterNode(const redisAsyncContext *c) {
+	for (auto &node : mClusterNodes) {
+		if (node.context == c || node.subscribeContext == c) return &node;
+	}
+	return nullptr;
+}
+
+/* Opens the connections to the cluster nodes that are not established yet. Each node gets a second connection to
+ * receive its key expiration events, whereas the other published messages are broadcast to the whole cluster and
+ * received through mSubscribeContext. */
+void RegistrarDbRedisAsync::connectCluster() {
+	for (auto &node : mClusterNodes) {
+		if (!node.context) {
+			node.context = createContext(node.address, node.port, sConnectCallback, sDisconnectCallback);
+			if (node.context && !mAuthPassword.empty()) {
+				redisAsyncCommand(node.context, nullptr, nullptr, "AUTH %s", mAuthPassword.c_str());
+			}
+			if (node.context && mUseServerSideBind) {
+				redisAsyncCommand(node.context, nullptr, nullptr, "SCRIPT LOAD %s", sServerSideBindScript);
+			}
+		}
+		// Multiplexed topics only use the expiration events if the server sends them (see checkKeyExpirationEvents()).
+		if (!node.subscribeContext && (mPubSubChannels == 0 || mKeyExpirationEvents)) {
+			node.subscribeContext =
+				createContext(node.address, node.port, sSubscribeConnectCallback, sSubscribeDisconnectCallback);
+			if (node.subscribeContext && !mAuthPassword.empty()) {
+				redisAsyncCommand(node.subscribeContext, nullptr, nullptr, "AUTH %s", mAuthPassword.c_str());
+			}
+			if (node.subscribeContext) {
+				redisAsyncCommand(node.subscribeContext, sKeyExpirationPublishCallback, nullptr,
+								  "SUBSCRIBE __keyevent@0__:expired");
+			}
+		}
+	}
+}
+
+void RegistrarDbRedisAsync::loadBindScript() {
+	redisAsyncCommand(mContext, sHandleBindScriptLoad, this, "SCRIPT LOAD %s", sServerSideBindScript);
+}
+
+redisAsyncContext *RegistrarDbRedisAsync::createContext(const string &address, int port, redisConnectCallback *onConnect,
+														 redisDisconnectCallback *onDisconnect) {
+	redisAsyncContext *context = redisAsyncConnect(address.c_str(), port);
+	context->data = this;
+	if (context->err) {
+		SLOGE << "Redis Connection error: " << context->errstr;
+		redisAsyncFree(context);
+		return nullptr;
 	}
 
 #ifndef WITHOUT_HIREDIS_CONNECT_CALLBACK
-	redisAsyncSetConnectCallback(mContext, sConnectCallback);
-	redisAsyncSetConnectCallback(mSubscribeContext, sSubscribeConnectCallback);
+	redisAsyncSetConnectCallback(context, onConnect);
 #endif
+	redisAsyncSetDisconnectCallback(context, onDisconnect);
 
-	redisAsyncSetDisconnectCallback(mContext, sDisconnectCallback);
-	redisAsyncSetDisconnectCallback(mSubscribeContext, sSubscribeDisconnectCallback);
+	if (REDIS_OK != redisSofiaAttach(context, mRoot, mAgent ? mAgent->getLoopMonitor() : nullptr)) {
+		LOGE("Redis Connection error - %p", context);
+		redisAsyncDisconnect(context);
+		return nullptr;
+	}
+	return context;
+}
 
-	if (REDIS_OK != redisSofiaAttach(mContext, mRoot)) {
-		LOGE("Redis Connection error - %p", mContext);
-		redisAsyncDisconnect(mContext);
-		mContext = nullptr;
-		return false;
+/* Opens the connections of the pool that are not established yet. This is done once we know that we are talking to
+ * the master, and again at each replication check so that a lost connection is eventually replaced. */
+void RegistrarDbRedisAsync::connectPool() {
+	for (auto &poolContext : mPoolContexts) {
+		if (poolContext) continue;
+		poolContext = createContext(mDomain, mPort, sConnectCallback, sDisconnectCallback);
+		if (poolContext && !mAuthPassword.empty()) {
+			redisAsyncCommand(poolContext, nullptr, nullptr, "AUTH %s", mAuthPassword.c_str());
+		}
 	}
-	if (REDIS_OK != redisSofiaAttach(mSubscribeContext, mRoot)) {
-		LOGE("Redis Connection error - %p", mSubscribeContext);
-		redisAsyncDisconnect(mSubscribeContext);
-		mSubscribeContext = nullptr;
-		return false;
+}
+
+/* Keeps a connection to each online slave reported by the master. The replicas are never removed from mReplicas, so
+ * that their connection index and statistics stay the same across the replication checks. */
+void RegistrarDbRedisAsync::updateReplicas() {
+	for (auto &replica : mReplicas) replica.listed = false;
+	for (const auto &host : mSlaves) {
+		auto replica = find_if(mReplicas.begin(), mReplicas.end(), [&host](const RedisReplica &r) {
+			return r.host.address == host.address && r.host.port == host.port;
+		});
+		if (replica == mReplicas.end()) {
+			LOGD("Redis replica reads: adding replica %s:%d", host.address.c_str(), host.port);
+			mReplicas.emplace_back(host);
+			RegistrarDbReplicaStats stats;
+			stats.mAddress = host.address + ":" + to_string(host.port);
+			stats.mConnection = mPoolContexts.size() + mReplicas.size();
+			mStats.mReplicas.push_back(stats);
+			mStats.mConnections.resize(stats.mConnection + 1);
+			replica = prev(mReplicas.end());
+		} else {
+			replica->host = host;
+		}
+		replica->listed = true;
+	}
+
+	for (size_t i = 0; i < mReplicas.size(); ++i) {
+		RedisReplica &replica = mReplicas[i];
+		RegistrarDbReplicaStats &stats = mStats.mReplicas[i];
+		bool online = replica.listed && replica.host.state == "online";
+		stats.mLag = replica.listed ? replica.host.lag : -1;
+		stats.mLagBytes = replica.listed && replica.host.offset >= 0 && mMasterReplOffset >= 0
+							  ? mMasterReplOffset - replica.host.offset
+							  : -1;
+		if (!online && replica.context) {
+			LOGD("Redis replica reads: replica %s:%d is not online anymore", replica.host.address.c_str(),
+				 replica.host.port);
+			redisAsyncDisconnect(replica.context);
+			replica.context = nullptr;
+		} else if (online && !replica.context) {
+			replica.context = createContext(replica.host.address, replica.host.port, sConnectCallback, sDisconnectCallback);
+			if (replica.context && !mAuthPassword.empty()) {
+				redisAsyncCommand(replica.context, nullptr, nullptr, "AUTH %s", mAuthPassword.c_str());
+			}
+		}
+	}
+}
+
+RedisReplica *RegistrarDbRedisAsync::findReplica(const redisAsyncContext *c) {
+	for (auto &replica : mReplicas) {
+		if (replica.context == c) return &replica;
+	}
+	return nullptr;
+}
+
+bool RegistrarDbRedisAsync::isReplicaConnection(size_t connection) const {
+	return !mUseCluster && connection > mPoolContexts.size();
+}
+
+/* A read goes to the replica with the fewest pending commands among the online ones that acknowledged the
+ * replication stream recently, unless this instance wrote the record too recently for the replicas to have it. The
+ * writes of the other instances of the platform are not tracked: their fetches may see them a little later. */
+size_t RegistrarDbRedisAsync::getReadConnectionIndex(const string &key) {
+	size_t master = getConnectionIndex("fs:" + key);
+	if (!mUseReplicaReads || mReplicas.empty()) return master;
+
+	pruneRecentWrites(chrono::steady_clock::now());
+	if (mRecentWrites.count(key) > 0) {
+		mStats.mReplicaReadsAvoided++;
+		return master;
+	}
+
+	size_t best = 0;
+	for (size_t i = 0; i < mReplicas.size(); ++i) {
+		const RedisReplica &replica = mReplicas[i];
+		if (!replica.context || !replica.listed || replica.host.state != "online" ||
+			replica.host.lag > sReplicaMaxLag) {
+			continue;
+		}
+		size_t connection = mPoolContexts.size() + 1 + i;
+		if (best == 0 || mStats.mConnections[connection].mPendingCommands < mStats.mConnections[best].mPendingCommands) {
+			best = connection;
+		}
 	}
+	if (best == 0) return master;
+	mStats.mReplicas[best - 1 - mPoolContexts.size()].mReads++;
+	return best;
+}
+
+void RegistrarDbRedisAsync::recordWrite(const string &key) {
+	if (!mUseReplicaReads || mReplicaReadAfterWriteDelay.count() == 0) return;
+	auto now = chrono::steady_clock::now();
+	pruneRecentWrites(now);
+	mRecentWrites[key] = now;
+	mRecentWritesQueue.emplace_back(now, key);
+}
+
+void RegistrarDbRedisAsync::pruneRecentWrites(chrono::steady_clock::time_point now) {
+	while (!mRecentWritesQueue.empty() && now - mRecentWritesQueue.front().first >= mReplicaReadAfterWriteDelay) {
+		// A key written again later is still in the queue with the time of its last write.
+		auto write = mRecentWrites.find(mRecentWritesQueue.front().second);
+		if (write != mRecentWrites.end() && write->second == mRecentWritesQueue.front().first) mRecentWrites.erase(write);
+		mRecentWritesQueue.pop_front();
+	}
+}
+
+bool RegistrarDbRedisAsync::connect() {
+	if (isConnected()) {
+		LOGW("Redis already connected");
+		return true;
+	}
+
+	mContext = createContext(mDomain, mPort, sConnectCallback, sDisconnectCallback);
+	if (!mContext) return false;
+
+	mSubscribeContext = createContext(mDomain, mPort, sSubscribeConnectCallback, sSubscribeDisconnectCallback);
+	if (!mSubscribeContext) return false;
 
 	if (!mAuthPassword.empty()) {
 		redisAsyncCommand(mContext, shandleAuthReply, this, "AUTH %s", mAuthPassword.c_str());
@@ -416,22 +1010,55 @@ bool RegistrarDbRedisAsync::disconnect() {
 	LOGD("disconnect(%p)", mContext);
 	bool status = false;
 	setWritable(false);
+	mBindScriptSha.clear();
+	mFetchListScript.sha.clear();
+	mContactMigrationScript.sha.clear();
+	mRefreshScript.sha.clear();
+	mKeyExpirationEvents = false;
 	if (mContext) {
 		redisAsyncDisconnect(mContext);
 		mContext = nullptr;
 		status = true;
 	}
+	for (auto &poolContext : mPoolContexts) {
+		if (poolContext) {
+			redisAsyncDisconnect(poolContext);
+			poolContext = nullptr;
+		}
+	}
+	for (auto &node : mClusterNodes) {
+		if (node.context) {
+			redisAsyncDisconnect(node.context);
+			node.context = nullptr;
+		}
+		if (node.subscribeContext) {
+			redisAsyncDisconnect(node.subscribeContext);
+			node.subscribeContext = nullptr;
+		}
+	}
+	for (auto &replica : mReplicas) {
+		if (replica.context) {
+			redisAsyncDisconnect(replica.context);
+			replica.context = nullptr;
+		}
+	}
 	if (mSubscribeContext) {
 		// Workaround for issue https://github.com/redis/hiredis/issues/396
 		redisAsyncCommand(mSubscribeContext, nullptr, nullptr, "UNSUBSCRIBE %s", "FLEXISIP");
 		redisAsyncDisconnect(mSubscribeContext);
 		mSubscribeContext = nullptr;
+		mPendingSubscriptions.clear();
 	}
 	return status;
 }
 
 // This function is invoked after a redis disconnection on the subscribe channel, so that all topics we are interested in are re-subscribed
 void RegistrarDbRedisAsync::subscribeAll() {
+	// The record cache was cleared on disconnection, only the topics of the listeners remain.
+	mSubscribedTopics.clear();
+	mChannelTopics.assign(mPubSubChannels, 0);
+	mWatchedExpirations.clear();
+	mExpirationQueue.clear();
 	set<string> topics;
 	for (auto it = mContactListenersMap.begin(); it != mContactListenersMap.end(); ++it)
 		topics.insert(it->first);
@@ -444,13 +1071,174 @@ void RegistrarDbRedisAsync::subscribeToKeyExpiration() {
 	redisAsyncCommand(mSubscribeContext, sKeyExpirationPublishCallback, nullptr, "SUBSCRIBE __keyevent@0__:expired");
 }
 
+/* With multiplexed topics, the expiration events are still used when the server is configured to send them, as they
+ * tell an expiration as soon as it happens. Otherwise, the expiration of the records of the subscribed topics is
+ * watched instead. The configuration may be hidden by a managed redis, its events are then considered unavailable. */
+void RegistrarDbRedisAsync::checkKeyExpirationEvents() {
+	redisAsyncCommand(mContext, sHandleKeyExpirationEventsConfig, this, "CONFIG GET notify-keyspace-events");
+}
+
+void RegistrarDbRedisAsync::handleKeyExpirationEventsConfig(const redisReply *reply) {
+	bool available = false;
+	if (reply && reply->type == REDIS_REPLY_ARRAY && reply->elements == 2 && reply->element[1]->str) {
+		const string flags = reply->element[1]->str;
+		available = flags.find('E') != string::npos &&
+			(flags.find('x') != string::npos || flags.find('A') != string::npos);
+	}
+	if (available == mKeyExpirationEvents) return;
+	mKeyExpirationEvents = available;
+	if (available) {
+		LOGI("Redis sends key expiration events, they are used instead of watching the expiration of the records");
+		mWatchedExpirations.clear();
+		mExpirationQueue.clear();
+		if (mUseCluster) connectCluster();
+		else if (mSubscribeContext) subscribeToKeyExpiration();
+	} else {
+		LOGI("Redis doesn't send key expiration events anymore, watching the expiration of the records");
+		for (const auto &topic : mSubscribedTopics) watchExpiration(topic);
+	}
+}
+
+void RegistrarDbRedisAsync::sHandleKeyExpirationEventsConfig(redisAsyncContext *c, void *r, void *privdata) {
+	static_cast<RegistrarDbRedisAsync *>(privdata)->handleKeyExpirationEventsConfig(static_cast<redisReply *>(r));
+}
+
+/* The channel of a topic is given by the CRC16 of the cluster slots, so that all the nodes agree on it. */
+size_t RegistrarDbRedisAsync::getTopicChannel(const string &topic) const {
+	return clusterKeySlot(topic) % mPubSubChannels;
+}
+
+string RegistrarDbRedisAsync::getChannelName(size_t channel) const {
+	return "flexisip-topics:" + to_string(channel);
+}
+
 void RegistrarDbRedisAsync::subscribeTopic(const string &topic) {
-	LOGD("Sending SUBSCRIBE command to redis for topic '%s'", topic.c_str());
+	string channel = topic;
+	if (mPubSubChannels > 0) {
+		if (!mSubscribedTopics.insert(topic).second) return;
+		if (!mKeyExpirationEvents) watchExpiration(topic);
+		size_t index = getTopicChannel(topic);
+		if (mChannelTopics[index]++ > 0) return;
+		channel = getChannelName(index);
+	}
+	LOGD("Sending SUBSCRIBE command to redis for topic '%s'", channel.c_str());
 	if (mSubscribeContext){
-		redisAsyncCommand(mSubscribeContext, sPublishCallback, nullptr, "SUBSCRIBE %s", topic.c_str());
+		redisAsyncCommand(mSubscribeContext, sPublishCallback, nullptr, "SUBSCRIBE %s", channel.c_str());
+		mPendingSubscriptions[channel]++;
 	}else LOGE("RegistrarDbRedisAsync::subscribeTopic(): no context !");
 }
 
+void RegistrarDbRedisAsync::unsubscribeTopic(const string &topic) {
+	string channel = topic;
+	if (mPubSubChannels > 0) {
+		if (mSubscribedTopics.erase(topic) == 0) return;
+		mWatchedExpirations.erase(topic);
+		size_t index = getTopicChannel(topic);
+		if (--mChannelTopics[index] > 0) return;
+		channel = getChannelName(index);
+	}
+	if (mSubscribeContext) redisAsyncCommand(mSubscribeContext, nullptr, nullptr, "UNSUBSCRIBE %s", channel.c_str());
+}
+
+/* The messages published on a topic are only received once redis replied to the SUBSCRIBE of its channel. */
+bool RegistrarDbRedisAsync::isSubscriptionConfirmed(const string &topic) const {
+	string channel = topic;
+	if (mPubSubChannels > 0) {
+		if (mSubscribedTopics.count(topic) == 0) return false;
+		channel = getChannelName(getTopicChannel(topic));
+	} else if (mContactListenersMap.count(topic) == 0 && !mRecordCache.contains(topic)) {
+		return false;
+	}
+	return mSubscribeContext && mPendingSubscriptions.count(channel) == 0;
+}
+
+void RegistrarDbRedisAsync::onSubscriptionConfirmed(const string &channel) {
+	auto it = mPendingSubscriptions.find(channel);
+	if (it == mPendingSubscriptions.end()) return;
+	if (--it->second == 0) mPendingSubscriptions.erase(it);
+}
+
+namespace {
+struct ExpirationCheck {
+	RegistrarDbRedisAsync *self;
+	string topic;
+};
+}
+
+/* Watches the expiration of the record of a subscribed topic. The expiration date published along with a bind of the
+ * record is only a lower bound, since the other contacts of the record may expire later: the time to live of the
+ * record is asked when this date is reached, as well as when the topic is subscribed or the date is unknown. */
+void RegistrarDbRedisAsync::watchExpiration(const string &topic, time_t expireAt) {
+	if (expireAt > 0) {
+		auto watched = mWatchedExpirations.find(topic);
+		if (watched == mWatchedExpirations.end() || watched->second < expireAt) setWatchedExpiration(topic, expireAt);
+		return;
+	}
+	const string key = "fs:" + topic;
+	auto check = new ExpirationCheck{this, topic};
+	if (sendCommand(getConnectionIndex(key), sHandleExpirationTtl, check, "TTL %s", key.c_str()) != REDIS_OK) {
+		delete check;
+	}
+}
+
+void RegistrarDbRedisAsync::handleExpirationTtl(redisReply *reply, const string &topic) {
+	if (mSubscribedTopics.count(topic) == 0) return;
+	time_t now = getCurrentTime();
+	if (!reply || reply->type != REDIS_REPLY_INTEGER) {
+		LOGE("Couldn't get the time to live of fs:%s, will try later: %s", topic.c_str(),
+			reply && reply->str ? reply->str : "null reply");
+		setWatchedExpiration(topic, now + 1);
+		return;
+	}
+	if (reply->integer >= 0) {
+		setWatchedExpiration(topic, now + max<long long>(reply->integer, 1));
+		return;
+	}
+	/* A record without expiration is not watched. A record that is not found any longer expired or was removed, which
+	 * the listeners are told as with an expiration event. */
+	bool known = mWatchedExpirations.erase(topic) > 0;
+	if (reply->integer == -2 && known) {
+		LOGD("Record fs:%s expired", topic.c_str());
+		invalidateCachedRecord(topic);
+		if (mContactListenersMap.count(topic) > 0) notifyContactListener(topic, "");
+	}
+}
+
+void RegistrarDbRedisAsync::setWatchedExpiration(const string &topic, time_t expiration) {
+	auto &watched = mWatchedExpirations[topic];
+	if (watched == expiration) return;
+	watched = expiration;
+	mExpirationQueue.emplace(expiration, topic);
+}
+
+void RegistrarDbRedisAsync::sHandleExpirationTtl(redisAsyncContext *ac, void *r, void *privdata) {
+	auto check = static_cast<ExpirationCheck *>(privdata);
+	check->self->handleExpirationTtl(static_cast<redisReply *>(r), check->topic);
+	delete check;
+}
+
+/* The timer is created on the root rather than by the agent, since the database may be used without one. */
+void RegistrarDbRedisAsync::startExpirationTimer() {
+	if (mPubSubChannels == 0) return;
+	mExpirationTimer = su_timer_create(su_root_task(mRoot), 1000);
+	su_timer_set_for_ever(mExpirationTimer, (su_timer_f)sHandleExpirationTimer, this);
+}
+
+void RegistrarDbRedisAsync::sHandleExpirationTimer(void *unused, su_timer_t *t, void *data) {
+	RegistrarDbRedisAsync *zis = (RegistrarDbRedisAsync *)data;
+	LoopMonitor::Probe probe(zis->mAgent ? zis->mAgent->getLoopMonitor() : nullptr, LoopMonitor::SourceRedisExpiration);
+	time_t now = getCurrentTime();
+	auto &queue = zis->mExpirationQueue;
+	while (!queue.empty() && queue.begin()->first <= now) {
+		auto watched = zis->mWatchedExpirations.find(queue.begin()->second);
+		// The record may have been bound again, and the topic unsubscribed, since the date was queued.
+		if (watched != zis->mWatchedExpirations.end() && watched->second == queue.begin()->first) {
+			if (zis->isConnected()) zis->watchExpiration(watched->first);
+		}
+		queue.erase(queue.begin());
+	}
+}
+
 /*TODO: the listener should be also used to report when the subscription is active.
  * Indeed if we send a push notification to a device while REDIS has not yet confirmed the subscription, we will not do anything
  * when receiving the REGISTER from the device. The router module should wait confirmation that subscription is active before injecting the forked request
@@ -463,14 +1251,39 @@ void RegistrarDbRedisAsync::subscribe(const string &topic, const shared_ptr<Cont
 
 void RegistrarDbRedisAsync::unsubscribe(const string &topic, const shared_ptr<ContactRegisteredListener> &listener) {
 	RegistrarDb::unsubscribe(topic, listener);
-	if (mContactListenersMap.count(topic) == 0)
-		redisAsyncCommand(mSubscribeContext, nullptr, nullptr, "UNSUBSCRIBE %s", topic.c_str());
+	// The topic of a cached record is also needed to invalidate it.
+	if (mContactListenersMap.count(topic) == 0 && !mRecordCache.contains(topic)) unsubscribeTopic(topic);
+}
+
+/* Hands a record that was written or deleted to its listener, then publishes the change for the record caches of the
+ * other nodes, whatever its origin (REGISTER, clear, static record...). Any message on the topic of a record
+ * invalidates it: if the listener published a registration for the record, as the registrar does, nothing more is sent.
+ * Nothing is published either when the record cache is disabled, which is expected to be set the same way on all the
+ * nodes of the platform. */
+void RegistrarDbRedisAsync::notifyRecordChanged(const shared_ptr<ContactUpdateListener> &listener,
+												const shared_ptr<Record> &record, bool refreshed) {
+	const string key = record->getKey();
+	mUnpublishedChange = key;
+	mUnpublishedExpireAt = record->latestExpire();
+	if (listener && refreshed) listener->onRecordRefreshed(record);
+	else if (listener) listener->onRecordFound(record);
+	if (mUnpublishedChange == key && mRecordCache.enabled()) publish(key, sRecordChangedUid);
+	mUnpublishedChange.clear();
 }
 
 void RegistrarDbRedisAsync::publish(const string &topic, const string &uid) {
 	LOGD("Publish topic = %s, uid = %s", topic.c_str(), uid.c_str());
-	if (mContext){
-		redisAsyncCommand(mContext, nullptr, nullptr, "PUBLISH %s %s", topic.c_str(), uid.c_str());
+	time_t expireAt = 0;
+	if (topic == mUnpublishedChange) {
+		expireAt = mUnpublishedExpireAt;
+		mUnpublishedChange.clear();
+	}
+	if (mContext && mPubSubChannels > 0){
+		string channel = getChannelName(getTopicChannel(topic));
+		string message = topic + " " + to_string(expireAt) + " " + uid;
+		sendCommand(getConnectionIndex(channel), nullptr, nullptr, "PUBLISH %s %s", channel.c_str(), message.c_str());
+	}else if (mContext){
+		sendCommand(getConnectionIndex(topic), nullptr, nullptr, "PUBLISH %s %s", topic.c_str(), uid.c_str());
 	}else LOGE("RegistrarDbRedisAsync::publish(): no context !");
 }
 
@@ -512,10 +1325,34 @@ void RegistrarDbRedisAsync::sPublishCallback(redisAsyncContext *c, void *r, void
 
 	if (reply->type == REDIS_REPLY_ARRAY) {
 		LOGD("Publish array received: [%s, %s, %s/%i]", reply->element[0]->str, reply->element[1]->str, reply->element[2]->str, (int)reply->element[2]->integer);
-		if (reply->element[2]->str != nullptr) {
+		if (reply->element[0]->str != nullptr && strcmp(reply->element[0]->str, "subscribe") == 0) {
+			RegistrarDbRedisAsync *zis = (RegistrarDbRedisAsync *)c->data;
+			if (zis) zis->onSubscriptionConfirmed(reply->element[1]->str);
+		} else if (reply->element[2]->str != nullptr) {
 			RegistrarDbRedisAsync *zis = (RegistrarDbRedisAsync *)c->data;
 			if (zis) {
-				zis->notifyContactListener(reply->element[1]->str, reply->element[2]->str);
+				string topic = reply->element[1]->str;
+				string uid = reply->element[2]->str;
+				time_t expireAt = 0;
+				if (zis->mPubSubChannels > 0) {
+					// The message of a multiplexed channel starts with its topic, which may not be subscribed here,
+					// and the expiration date of its record, 0 if unknown.
+					size_t separator = uid.find(' ');
+					size_t expireEnd = separator == string::npos ? string::npos : uid.find(' ', separator + 1);
+					if (expireEnd == string::npos) return;
+					topic = uid.substr(0, separator);
+					if (zis->mSubscribedTopics.count(topic) == 0) return;
+					expireAt = (time_t)atoll(uid.c_str() + separator + 1);
+					uid = uid.substr(expireEnd + 1);
+				}
+				zis->invalidateCachedRecord(topic);
+				// The topic may only be subscribed for the cache
+				if (uid != sRecordChangedUid && zis->mContactListenersMap.count(topic) > 0)
+					zis->notifyContactListener(topic, uid);
+				// The record was bound, its expiration may have moved.
+				if (zis->mSubscribedTopics.count(topic) > 0 && !zis->mKeyExpirationEvents) {
+					zis->watchExpiration(topic, expireAt);
+				}
 			}
 		}
 	}
@@ -534,6 +1371,9 @@ void RegistrarDbRedisAsync::sKeyExpirationPublishCallback(redisAsyncContext *c,
 				string key = reply->element[2]->str;
 				if (key.substr(0, prefix.size()) == prefix)
 					key = key.substr(prefix.size());
+				// With multiplexed topics, the events are those of all the keys, not only of the subscribed ones.
+				if (zis->mPubSubChannels > 0 && zis->mSubscribedTopics.count(key) == 0) return;
+				zis->invalidateCachedRecord(key);
 				zis->notifyContactListener(key, "");
 			}
 		}
@@ -548,23 +1388,34 @@ void RegistrarDbRedisAsync::sHandleBindStart(redisAsyncContext *ac, redisReply *
 		delete data;
 		return;
 	}
-	data->mRecord = make_shared<Record>(recordToStore->getAor());
+	auto storedRecord = make_shared<Record>(recordToStore->getAor());
+	data->mRecord = storedRecord;
 	data->self->parseAndClean(reply, data); //received data will be parsed into data->mRecord
 
 	/*insertOrUpdateBinding() will do the job of contact comparison and invoke the onContactUpdated listener*/
 	for (auto ec : recordToStore->getExtendedContacts()) {
-		data->mRecord->insertOrUpdateBinding(ec, data->listener);
+		storedRecord->insertOrUpdateBinding(ec, data->listener);
 	}
-	/*But at the end all we want is to submit the ExtendedContacts in the original record to Redis*/
+	storedRecord->applyMaxAor();
+	/*Only the changes of the merged record are written, but the listener is given the ExtendedContacts in the original record*/
 	data->mRecord = recordToStore;
+	data->mUpdateExpire = true;
 
-	data->self->serializeAndSendToRedis(data, sHandleBindFinish);
+	data->self->serializeAndSendToRedis(data, storedRecord, sHandleBindFinish);
 }
 
 void RegistrarDbRedisAsync::sHandleBindFinish(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data) {
 	data->self->handleBind(reply, data);
 }
 
+void RegistrarDbRedisAsync::sHandleServerSideBind(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data) {
+	data->self->handleServerSideBind(reply, data);
+}
+
+void RegistrarDbRedisAsync::sHandleRefresh(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data) {
+	data->self->handleRefresh(reply, data);
+}
+
 void RegistrarDbRedisAsync::sHandleClear(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data) {
 	data->self->handleClear(reply, data);
 }
@@ -573,6 +1424,10 @@ void RegistrarDbRedisAsync::sHandleFetch(redisAsyncContext *ac, redisReply *repl
 	data->self->handleFetch(reply, data);
 }
 
+void RegistrarDbRedisAsync::sHandleFetchList(redisAsyncContext *ac, redisReply *reply, RegistrarListUserData *data) {
+	data->self->handleFetchList(reply, data);
+}
+
 void RegistrarDbRedisAsync::sHandleMigration(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data) {
 	data->self->handleMigration(reply, data);
 }
@@ -597,11 +1452,68 @@ void RegistrarDbRedisAsync::sHandleReplicationInfoReply(redisAsyncContext *ac, v
 void RegistrarDbRedisAsync::sHandleInfoTimer(void *unused, su_timer_t *t, void *data) {
 	RegistrarDbRedisAsync *zis = (RegistrarDbRedisAsync *)data;
 	if (zis && zis->mContext) {
+		LoopMonitor::Probe probe(zis->mAgent ? zis->mAgent->getLoopMonitor() : nullptr, LoopMonitor::SourceRedisInfo);
 		SLOGI << "Launching periodic INFO query on REDIS";
 		zis->getReplicationInfo();
 	}
 }
 
+void RegistrarDbRedisAsync::sHandleBindScriptLoad(redisAsyncContext *ac, void *r, void *privdata) {
+	redisReply *reply = (redisReply *)r;
+	RegistrarDbRedisAsync *zis = (RegistrarDbRedisAsync *)privdata;
+
+	if (!reply || reply->type != REDIS_REPLY_STRING) {
+		LOGE("Couldn't load the server-side bind script: %s", reply && reply->str ? reply->str : "null reply");
+		return;
+	}
+	if (zis) {
+		SLOGD << "Server-side bind script loaded with sha " << reply->str;
+		zis->mBindScriptSha = reply->str;
+	}
+}
+
+void RegistrarDbRedisAsync::sHandleScriptLoad(redisAsyncContext *ac, void *r, void *privdata) {
+	redisReply *reply = (redisReply *)r;
+	RedisScript *script = (RedisScript *)privdata;
+
+	if (!reply || reply->type != REDIS_REPLY_STRING) {
+		LOGE("Couldn't load a redis script: %s", reply && reply->str ? reply->str : "null reply");
+		return;
+	}
+	script->sha = reply->str;
+}
+
+void RegistrarDbRedisAsync::sHandleCommandReply(redisAsyncContext *ac, void *r, void *privdata) {
+	RedisCommandContext *cmd = (RedisCommandContext *)privdata;
+	redisReply *reply = (redisReply *)r;
+	RegistrarDbRedisAsync *zis = cmd->self;
+	RegistrarDbConnectionStats &stats = zis->mStats.mConnections[cmd->connection];
+	auto roundTrip = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - cmd->start);
+
+	stats.mPendingCommands--;
+	stats.mCommandCount++;
+	stats.mRoundTripTotalUs += roundTrip.count();
+	if (zis->mUseCluster && reply && reply->type == REDIS_REPLY_ERROR && zis->redirectCommand(cmd, reply->str)) return;
+	if (cmd->script && reply && reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "NOSCRIPT", 8) == 0 &&
+		zis->resendScript(cmd)) {
+		return;
+	}
+	if (cmd->fn) cmd->fn(ac, r, cmd->privdata);
+	delete cmd;
+}
+
+void RegistrarDbRedisAsync::sHandleClusterSlotsReply(redisAsyncContext *ac, void *r, void *privdata) {
+	redisReply *reply = (redisReply *)r;
+	RegistrarDbRedisAsync *zis = (RegistrarDbRedisAsync *)privdata;
+
+	zis->mClusterSlotsPending = false;
+	if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+		LOGE("Couldn't issue the CLUSTER SLOTS command, will try later: %s", reply && reply->str ? reply->str : "null reply");
+		return;
+	}
+	zis->handleClusterSlotsReply(reply);
+}
+
 void RegistrarDbRedisAsync::shandleAuthReply(redisAsyncContext *ac, void *r, void *privdata) {
 	RegistrarDbRedisAsync *zis = (RegistrarDbRedisAsync *)privdata;
 	if (zis) {
@@ -609,51 +1521,146 @@ void RegistrarDbRedisAsync::shandleAuthReply(redisAsyncContext *ac, void *r, voi
 	}
 }
 
-void RegistrarDbRedisAsync::serializeAndSendToRedis(RegistrarUserData *data, forwardFn *forward_fn) {
-	const char *key = data->mRecord->getKey().c_str();
+string RegistrarDbRedisAsync::serializeContact(const shared_ptr<ExtendedContact> &ec) const {
+	return mUseBinaryContacts ? ec->serializeAsBinary() : ec->serializeAsUrlEncodedParams();
+}
 
-	int argc = 2; // HMSET key
-	string cmd = "HMSET";
+/* The url encoded contacts read from a record are written again in binary, so that the database converges to the
+ * binary format without waiting for every client to register again. A contact written in the meantime is left as is. */
+void RegistrarDbRedisAsync::migrateContacts(const Record &record, const map<string, string> &urlEncoded) {
+	const string recordNamespace = "fs:" + record.getKey();
+	vector<string> args{"1", recordNamespace};
+	for (const auto &ec : record.getExtendedContacts()) {
+		auto it = urlEncoded.find(ec->getUniqueId());
+		if (it == urlEncoded.end()) continue;
+		args.push_back(it->first);
+		args.push_back(it->second);
+		args.push_back(ec->serializeAsBinary());
+	}
+	if (args.size() == 2) return;
+	mStats.mContactsMigrated += (args.size() - 2) / 3;
+	LOGD("Writing %lu contacts of %s again in binary", (unsigned long)(args.size() - 2) / 3, recordNamespace.c_str());
 
-	const auto &contacts = data->mRecord->getExtendedContacts();
-	argc += contacts.size() * 2;
+	sendScript(getConnectionIndex(recordNamespace), nullptr, nullptr, mContactMigrationScript, move(args));
+}
 
-	const char** argv = new const char*[argc];
-	size_t* argvlen = new size_t[argc];
+/* Only the pending changes of the record are written: contacts inserted or updated since they were read are sent with
+ * HMSET and contacts dropped from the record are removed with HDEL. The expiration date of the hash is only updated when
+ * data->mUpdateExpire is set, that is when the record holds all the contacts of the AOR.
+ * The forward function is called with the reply of the last write command. */
+void RegistrarDbRedisAsync::serializeAndSendToRedis(RegistrarUserData *data, const shared_ptr<Record> &record, forwardFn *forward_fn) {
+	const string recordNamespace = "fs:" + record->getKey();
+	auto callback = (void (*)(redisAsyncContext*, void*, void*))forward_fn;
+	size_t connection = getConnectionIndex(recordNamespace);
+	size_t bytesWritten = 0;
+
+	for (const auto &ec : record->getContactsToRemove()) {
+		const string &uid = ec->getUniqueId();
+		LOGD("Removing binding %s from %s", uid.c_str(), recordNamespace.c_str());
+		sendCommand(connection, nullptr, nullptr, "HDEL %s %s", recordNamespace.c_str(), uid.c_str());
+		bytesWritten += uid.size();
+	}
 
-	argv[0] = cmd.c_str();
-	argvlen[0] = strlen(argv[0]);
+	vector<string> args{"HMSET", recordNamespace};
+	for (const auto &ec : record->getExtendedContacts()) {
+		if (!ec->mIsDirty) continue;
+		args.push_back(ec->getUniqueId());
+		args.push_back(serializeContact(ec));
+		bytesWritten += args[args.size() - 2].size() + args.back().size();
+	}
+	mStats.mBindBytesWritten += bytesWritten;
 
-	int namespace_len = strlen(key) + 4; // 4 is fs: length + \0
-	char record_namespace[namespace_len];
-	snprintf(record_namespace, namespace_len, "fs:%s", key);
-	argv[1] = record_namespace;
-	argvlen[1] = strlen(argv[1]);
+	LOGD("Binding %s [%lu], %lu contacts in record, %lu written (%lu bytes)", recordNamespace.c_str(), data->token,
+		(unsigned long)record->getExtendedContacts().size(), (unsigned long)(args.size() - 2) / 2, (unsigned long)bytesWritten);
 
-	int i = 2;
-	for (auto it = contacts.begin(); it != contacts.end(); ++it) {
-		shared_ptr<ExtendedContact> ec = (*it);
+	time_t expireat = record->latestExpire();
+	if (args.size() == 2) {
+		/* Nothing to insert or update */
+		if (data->mUpdateExpire) {
+			check_redis_command(sendCommand(connection, callback, data, "EXPIREAT %s %lu", recordNamespace.c_str(),
+				expireat), data);
+		} else {
+			check_redis_command(sendCommand(connection, callback, data, "EXISTS %s", recordNamespace.c_str()), data);
+		}
+		return;
+	}
+
+	vector<const char *> argv;
+	vector<size_t> argvlen;
+	for (const auto &arg : args) {
+		argv.push_back(arg.c_str());
+		argvlen.push_back(arg.size());
+	}
+	check_redis_command(sendCommandArgv(connection, callback, data, (int)argv.size(), argv.data(), argvlen.data()), data);
+	if (data->mUpdateExpire) {
+		sendCommand(connection, nullptr, nullptr, "EXPIREAT %s %lu", recordNamespace.c_str(), expireat);
+	}
+}
 
-		argv[i] = strdup(ec->getUniqueId().c_str());
-		argvlen[i] = strlen(argv[i]);
-		i += 1;
+void RegistrarDbRedisAsync::sendServerSideBind(RegistrarUserData *data) {
+	const string &key = data->mRecord->getKey();
+	const auto &contacts = data->mRecord->getExtendedContacts();
+	vector<string> args;
+
+	/* EVALSHA is used once the script is known by the server, otherwise the script body is sent along. */
+	if (mBindScriptSha.empty()) {
+		args.push_back("EVAL");
+		args.push_back(sServerSideBindScript);
+	} else {
+		args.push_back("EVALSHA");
+		args.push_back(mBindScriptSha);
+	}
+	args.push_back("1");
+	args.push_back("fs:" + key);
+	args.push_back(to_string(getCurrentTime()));
+	args.push_back(to_string(Record::getMaxContacts()));
+	args.push_back(messageExpiresName());
+	for (const auto &ec : contacts) {
+		args.push_back(ec->getUniqueId());
+		args.push_back(serializeContact(ec));
+		mStats.mBindBytesWritten += args[args.size() - 2].size() + args.back().size();
+		args.push_back(to_string(ec->mExpireAt));
+		args.push_back(ec->mCallId);
+		args.push_back(to_string(ec->mCSeq));
+	}
 
-		string contact = ec->serializeAsUrlEncodedParams();
-		argv[i] = strdup(contact.c_str());
-		argvlen[i] = strlen(argv[i]);
-		i += 1;
+	vector<const char *> argv;
+	vector<size_t> argvlen;
+	for (const auto &arg : args) {
+		argv.push_back(arg.c_str());
+		argvlen.push_back(arg.size());
 	}
 
-	data->mUpdateExpire = true;
-	LOGD("Binding fs:%s [%lu], %lu contacts in record", key, data->token, (unsigned long)contacts.size());
-	check_redis_command(redisAsyncCommandArgv(mContext, (void (*)(redisAsyncContext*, void*, void*))forward_fn,
-		data, argc, argv, argvlen), data);
+	LOGD("Binding fs:%s [%lu] server-side, %lu contacts sent", key.c_str(), data->token, (unsigned long)contacts.size());
+	check_redis_command(sendCommandArgv(getConnectionIndex("fs:" + key), (void (*)(redisAsyncContext*, void*, void*))sHandleServerSideBind,
+		data, (int)argv.size(), argv.data(), argvlen.data()), data);
+}
+
+void RegistrarDbRedisAsync::handleServerSideBind(redisReply *reply, RegistrarUserData *data) {
+	const char *key = data->mRecord->getKey().c_str();
+
+	if (reply && reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "NOSCRIPT", 8) == 0) {
+		// The script cache was flushed or we are now talking to another server: send the script body this time.
+		LOGW("Server-side bind script unknown by redis, sending it again for fs:%s", key);
+		mBindScriptSha.clear();
+		loadBindScript();
+		sendServerSideBind(data);
+		return;
+	}
+	if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+		LOGE("Redis error while binding fs:%s [%lu] server-side: %s", key, data->token,
+			reply && reply->str ? reply->str : "null reply");
+		handleBind(nullptr, data);
+		return;
+	}
 
-	for (i = 2; i < argc; i++) {
-		free((char *)argv[i]);
+	/* The script only gives back the contacts it replaced or dropped, so that the listener can close their tports. */
+	for (size_t i = 0; i + 1 < reply->elements; i += 2) {
+		auto ec = make_shared<ExtendedContact>(key, reply->element[i]->str, reply->element[i + 1]->str,
+			reply->element[i + 1]->len);
+		if (ec->mSipContact && data->listener) data->listener->onContactUpdated(ec);
 	}
-	delete[] argv;
-	delete[] argvlen;
+	handleBind(reply, data);
 }
 
 /* Methods called by the callbacks */
@@ -663,8 +1670,13 @@ void RegistrarDbRedisAsync::sBindRetry(void *unused, su_timer_t *t, void *ud){
 	su_timer_destroy(data->mRetryTimer);
 	data->mRetryTimer = nullptr;
 	RegistrarDbRedisAsync *self = data->self;
+	LoopMonitor::Probe probe(self->mAgent ? self->mAgent->getLoopMonitor() : nullptr,
+							 LoopMonitor::SourceRedisBindRetry);
 	if (self->isConnected()){
-		self->serializeAndSendToRedis(data, sHandleBindFinish);
+		/* The record only holds the contacts of the REGISTER, it must not shorten the lifetime of the others. */
+		data->mUpdateExpire = false;
+		if (self->mUseServerSideBind) self->sendServerSideBind(data);
+		else self->serializeAndSendToRedis(data, data->mRecord, sHandleBindFinish);
 	}else{
 		LOGE("Unrecoverable error while updating record fs:%s : no connection", data->mRecord->getKey().c_str());
 		if (data->listener) data->listener->onError();
@@ -687,7 +1699,8 @@ void RegistrarDbRedisAsync::handleBind(redisReply *reply, RegistrarUserData *dat
 		}
 	} else {
 		data->mRetryCount = 0;
-		if (data->listener) data->listener->onRecordFound(data->mRecord);
+		data->mRecord->cleanPendingChanges();
+		notifyRecordChanged(data->listener, data->mRecord);
 		delete data;
 	}
 }
@@ -699,6 +1712,8 @@ void RegistrarDbRedisAsync::doBind(const sip_t *sip, int globalExpire, bool alia
 
 	RegistrarUserData *data = new RegistrarUserData(this, sip->sip_from->a_url, listener);
 
+	invalidateCachedRecord(data->mRecord->getKey());
+	recordWrite(data->mRecord->getKey());
 	data->mRecord->update(sip, globalExpire, alias, version, data->listener);
 	mLocalRegExpire->update(data->mRecord);
 
@@ -718,15 +1733,83 @@ void RegistrarDbRedisAsync::doBind(const sip_t *sip, int globalExpire, bool alia
 		uid = data->mRecord->getExtendedContacts().front()->getUniqueId();
 	}
 	if (globalExpire > 0 || message_expires > 0) {
-		check_redis_command(redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleBindStart,
-			data, "HGETALL fs:%s", key), data);
+		sendBind(data, !(Record::sAssumeUniqueDomains && sip->sip_from->a_url->url_user == nullptr));
 	} else {
 		data->mIsUnregister = true;
-		check_redis_command(redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleBindFinish,
+		check_redis_command(sendCommand(getConnectionIndex(string("fs:") + key), (void (*)(redisAsyncContext*, void*, void*))sHandleBindFinish,
 			data, "HDEL fs:%s %s", key, uid.c_str()), data);
 	}
 }
 
+/* Merges the contacts of data->mRecord into the stored record, with the server-side bind script if it is enabled and
+ * allowed for this record. */
+void RegistrarDbRedisAsync::sendBind(RegistrarUserData *data, bool allowServerSide) {
+	const char *key = data->mRecord->getKey().c_str();
+
+	if (allowServerSide && mUseServerSideBind) {
+		sendServerSideBind(data);
+	} else {
+		check_redis_command(sendCommand(getConnectionIndex(string("fs:") + key), (void (*)(redisAsyncContext*, void*, void*))sHandleBindStart,
+			data, "HGETALL fs:%s", key), data);
+	}
+}
+
+/* A refresh is checked and written by a single script, without reading the record first. The script compares the
+ * contacts in the format they are written in, and answers any other REGISTER with the stored record, which is then
+ * merged as a regular bind does after its HGETALL: the REGISTER costs no more round trips than without the fast path.
+ * The server-side bind is a single round trip already, it is kept for all the REGISTERs when enabled. */
+bool RegistrarDbRedisAsync::doRefresh(const sip_t *sip, int globalExpire, const shared_ptr<ContactUpdateListener> &listener) {
+	if (mUseServerSideBind) return false;
+	if (!sip->sip_contact || sip->sip_contact->m_next || !sip->sip_call_id || !sip->sip_cseq) return false;
+	if (Record::sAssumeUniqueDomains && sip->sip_from->a_url->url_user == nullptr) return false;
+	if (!isConnected()) return false;
+
+	RegistrarUserData *data = new RegistrarUserData(this, sip->sip_from->a_url, listener);
+	data->mRecord->update(sip, globalExpire, false, 0, data->listener);
+	if (data->mRecord->getExtendedContacts().size() != 1 || data->mRecord->latestExpire() <= getCurrentTime()) {
+		delete data;
+		return false;
+	}
+
+	const string recordNamespace = "fs:" + data->mRecord->getKey();
+	const auto &ec = data->mRecord->getExtendedContacts().front();
+	vector<string> args{"1", recordNamespace, ec->getUniqueId(), serializeContact(ec), to_string(getCurrentTime()),
+		to_string(ec->mExpireAt), to_string(ec->mCSeq)};
+	mStats.mBindBytesWritten += args[2].size() + args[3].size();
+	invalidateCachedRecord(data->mRecord->getKey());
+	recordWrite(data->mRecord->getKey());
+	mLocalRegExpire->update(data->mRecord);
+
+	LOGD("Refreshing %s [%lu]", recordNamespace.c_str(), data->token);
+	if (sendScript(getConnectionIndex(recordNamespace), (void (*)(redisAsyncContext*, void*, void*))sHandleRefresh,
+		data, mRefreshScript, move(args)) != REDIS_OK) {
+		delete data;
+		return false;
+	}
+	return true;
+}
+
+void RegistrarDbRedisAsync::handleRefresh(redisReply *reply, RegistrarUserData *data) {
+	const char *key = data->mRecord->getKey().c_str();
+
+	if (reply && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1) {
+		LOGD("Refreshed fs:%s [%lu]", key, data->token);
+		mStats.mRefreshes++;
+		data->mRecord->cleanPendingChanges();
+		notifyRecordChanged(data->listener, data->mRecord, true);
+		delete data;
+		return;
+	}
+	if (reply && reply->type == REDIS_REPLY_ARRAY) {
+		LOGD("fs:%s [%lu] is not the refresh of an unchanged binding", key, data->token);
+		sHandleBindStart(nullptr, reply, data);
+		return;
+	}
+	LOGE("Redis error while refreshing fs:%s [%lu]: %s", key, data->token, reply && reply->str ? reply->str : "null reply");
+	// The record of data still holds the contact of the REGISTER, which is bound as usual.
+	sendBind(data, true);
+}
+
 void RegistrarDbRedisAsync::handleClear(redisReply *reply, RegistrarUserData *data) {
 	const char *key = data->mRecord->getKey().c_str();
 
@@ -740,38 +1823,44 @@ void RegistrarDbRedisAsync::handleClear(redisReply *reply, RegistrarUserData *da
 		}
 	} else {
 		LOGD("Clearing fs:%s [%lu] success", key, data->token);
-		if (data->listener) data->listener->onRecordFound(data->mRecord);
+		// A DEL raises no expired keyevent, the other nodes only learn about it from a publication.
+		notifyRecordChanged(data->listener, data->mRecord);
 	}
 	delete data;
 }
 
 void RegistrarDbRedisAsync::parseAndClean(redisReply *reply, RegistrarUserData *data) {
 	const char *key = data->mRecord->getKey().c_str();
+	size_t connection = getConnectionIndex(string("fs:") + key);
+	map<string, string> urlEncoded;
 	for (size_t i = 0; i < reply->elements; i+=2) {
 			// Elements list is twice the size of the contacts list because the key is an element of the list itself
 		redisReply *element = reply->element[i];
 		const char *uid = element->str;
 		element = reply->element[i+1];
-		const char *contact = element->str;
-		LOGD("Parsing contact %s => %s", uid, contact);
-		if (!data->mRecord->updateFromUrlEncodedParams(key, uid, contact, data->listener)) {
+		bool binary = ExtendedContact::isBinarySerialization(element->str, element->len);
+		LOGD("Parsing contact %s => %s", uid, binary ? "(binary)" : element->str);
+		if (!data->mRecord->updateFromSerializedContact(key, uid, element->str, element->len, data->listener)) {
 			LOGD("Record %s seems to have an outdated contact %s, remove it from redis", key, uid);
-			check_redis_command(redisAsyncCommand(data->self->mContext, nullptr, nullptr, "HDEL fs:%s %s", key, uid), data);
+			check_redis_command(sendCommand(connection, nullptr, nullptr, "HDEL fs:%s %s", key, uid), data);
+		} else if (!binary && mUseBinaryContacts) {
+			urlEncoded[uid] = string(element->str, element->len);
 		}
 	}
 	data->mRecord->applyMaxAor();
+	if (!urlEncoded.empty()) migrateContacts(*data->mRecord, urlEncoded);
 
 	for (auto it = data->mRecord->getContactsToRemove().begin(); it != data->mRecord->getContactsToRemove().end(); ++it) {
 		// Remove from REDIS contacts removed from record
 		const char *uid = (*it)->mUniqueId.c_str();
-		LOGD("Record %s has too many contacts, removing %s from redis", key, uid);
-		check_redis_command(redisAsyncCommand(data->self->mContext, nullptr, nullptr, "HDEL fs:%s %s", key, uid), data);
+		LOGD("Record %s has too many or duplicated contacts, removing %s from redis", key, uid);
+		check_redis_command(sendCommand(connection, nullptr, nullptr, "HDEL fs:%s %s", key, uid), data);
 	}
 	data->mRecord->cleanContactsToRemoveList();
 
 	if (data->mUpdateExpire) {
 		time_t expireat = data->mRecord->latestExpire();
-		check_redis_command(redisAsyncCommand(data->self->mContext, nullptr, nullptr, "EXPIREAT fs:%s %lu", key, expireat), data);
+		check_redis_command(sendCommand(connection, nullptr, nullptr, "EXPIREAT fs:%s %lu", key, expireat), data);
 	}
 
 	time_t now = getCurrentTime();
@@ -792,8 +1881,10 @@ void RegistrarDbRedisAsync::doClear(const sip_t *sip, const shared_ptr<ContactUp
 
 	const char *key = data->mRecord->getKey().c_str();
 	LOGD("Clearing fs:%s [%lu]", key, data->token);
+	invalidateCachedRecord(key);
+	recordWrite(key);
 	mLocalRegExpire->remove(key);
-	check_redis_command(redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleClear,
+	check_redis_command(sendCommand(getConnectionIndex(string("fs:") + key), (void (*)(redisAsyncContext*, void*, void*))sHandleClear,
 		data, "DEL fs:%s", key), data);
 }
 
@@ -808,21 +1899,24 @@ void RegistrarDbRedisAsync::handleFetch(redisReply *reply, RegistrarUserData *da
 		// This is the most common scenario: we want all contacts inside the record
 		LOGD("GOT fs:%s [%lu] --> %lu contacts", key, data->token, (reply->elements / 2));
 		if (reply->elements > 0) {
+			// A replica may not have received a write whose invalidation was already handled, only the records read on
+			// the master are cached.
+			if (mRecordCache.enabled() && !data->mReadFromReplica) cacheRecord(reply, data);
 			parseAndClean(reply, data);
 			if (data->listener) data->listener->onRecordFound(data->mRecord);
 			delete data;
 		} else {
 			// We haven't found the record in redis, trying to find an old record
 			LOGD("Record fs:%s not found, trying aor:%s", key, key);
-			check_redis_command(redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleRecordMigration,
+			check_redis_command(sendCommand(getConnectionIndex(string("aor:") + key), (void (*)(redisAsyncContext*, void*, void*))sHandleRecordMigration,
 				data, "GET aor:%s", key), data);
 		}
 	} else {
 		// This is only when we want a contact matching a given gruu
 		const char *gruu = data->mGruu.c_str();
 		if (reply->len > 0) {
-			LOGD("GOT fs:%s [%lu] for gruu %s --> %s", key, data->token, gruu, reply->str);
-			data->mRecord->updateFromUrlEncodedParams(key, gruu, reply->str, data->listener);
+			LOGD("GOT fs:%s [%lu] for gruu %s", key, data->token, gruu);
+			data->mRecord->updateFromSerializedContact(key, gruu, reply->str, reply->len, data->listener);
 			time_t now = getCurrentTime();
 			data->mRecord->clean(now, data->listener);
 			if (data->listener) data->listener->onRecordFound(data->mRecord);
@@ -834,6 +1928,60 @@ void RegistrarDbRedisAsync::handleFetch(redisReply *reply, RegistrarUserData *da
 	}
 }
 
+/* The record cache serves the fetches of the records whose topic is subscribed, so that a bind or an expiration on
+ * any node of the platform invalidates them. */
+
+bool RegistrarDbRedisAsync::fetchFromCache(RegistrarUserData *data) {
+	const char *key = data->mRecord->getKey().c_str();
+	const RedisRecordCache::Bindings *bindings = mRecordCache.get(data->mRecord->getKey(), getCurrentTime());
+
+	if (!bindings) {
+		mStats.mCacheMisses++;
+		data->mCacheGeneration = mRecordCache.getGeneration();
+		data->mSubscriptionConfirmed = isSubscriptionConfirmed(data->mRecord->getKey());
+		return false;
+	}
+	mStats.mCacheHits++;
+	LOGD("GOT fs:%s [%lu] from cache --> %lu contacts", key, data->token, (unsigned long)bindings->size());
+	for (const auto &binding : *bindings) {
+		data->mRecord->updateFromSerializedContact(key, binding.first.c_str(), binding.second.data(),
+			binding.second.size(), data->listener);
+	}
+	data->mRecord->applyMaxAor();
+	data->mRecord->cleanContactsToRemoveList();
+	data->mRecord->clean(getCurrentTime(), data->listener);
+	if (data->listener) data->listener->onRecordFound(data->mRecord);
+	delete data;
+	return true;
+}
+
+void RegistrarDbRedisAsync::cacheRecord(const redisReply *reply, const RegistrarUserData *data) {
+	const string &key = data->mRecord->getKey();
+	RedisRecordCache::Bindings bindings;
+	list<string> evicted;
+
+	for (size_t i = 0; i + 1 < reply->elements; i += 2) {
+		bindings.emplace_back(string(reply->element[i]->str, reply->element[i]->len),
+			string(reply->element[i + 1]->str, reply->element[i + 1]->len));
+	}
+	// The record is only served once read after the subscription to its topic was confirmed, and if it still is.
+	bool usable = data->mSubscriptionConfirmed && isSubscriptionConfirmed(key);
+	if (mRecordCache.insert(key, move(bindings), usable, data->mCacheGeneration, getCurrentTime(), evicted) &&
+		mContactListenersMap.count(key) == 0) {
+		subscribeTopic(key);
+	}
+	for (const auto &evictedKey : evicted) {
+		if (mContactListenersMap.count(evictedKey) == 0) unsubscribeTopic(evictedKey);
+	}
+}
+
+void RegistrarDbRedisAsync::invalidateCachedRecord(const string &key) {
+	if (!mRecordCache.remove(key)) return;
+	mStats.mCacheInvalidations++;
+	LOGD("Record fs:%s removed from cache", key.c_str());
+	if (mContactListenersMap.count(key) == 0) unsubscribeTopic(key);
+}
+
 void RegistrarDbRedisAsync::doFetch(const url_t *url, const shared_ptr<ContactUpdateListener> &listener) {
 	// fetch all the contacts in the AOR (HGETALL) and call the onRecordFound of the listener
 	RegistrarUserData *data = new RegistrarUserData(this, url, listener);
@@ -845,9 +1993,13 @@ void RegistrarDbRedisAsync::doFetch(const url_t *url, const shared_ptr<ContactUp
 		return;
 	}
 
+	if (mRecordCache.enabled() && fetchFromCache(data)) return;
+
 	const char *key = data->mRecord->getKey().c_str();
+	size_t connection = getReadConnectionIndex(key);
+	data->mReadFromReplica = isReplicaConnection(connection);
 	LOGD("Fetching fs:%s [%lu]", key, data->token);
-	check_redis_command(redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleFetch,
+	check_redis_command(sendCommand(connection, (void (*)(redisAsyncContext*, void*, void*))sHandleFetch,
 		data, "HGETALL fs:%s", key), data);
 }
 
@@ -865,11 +2017,70 @@ void RegistrarDbRedisAsync::doFetchForGruu(const url_t *url, const string &gruu,
 
 	const char *key = data->mRecord->getKey().c_str();
 	const char *field = gruu.c_str();
+	size_t connection = getReadConnectionIndex(key);
+	data->mReadFromReplica = isReplicaConnection(connection);
 	LOGD("Fetching fs:%s [%lu] contact matching gruu %s", key, data->token, field);
-	check_redis_command(redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleFetch,
+	check_redis_command(sendCommand(connection, (void (*)(redisAsyncContext*, void*, void*))sHandleFetch,
 		data, "HGET fs:%s %s", key, field), data);
 }
 
+/* The records of a list are read by a single script call per connection, each reply being then handled as the one of
+ * a single fetch. In cluster mode a script can't read keys of different slots, and a read-only replica may refuse
+ * scripts, so the HGETALL are pipelined instead. */
+void RegistrarDbRedisAsync::doFetchList(const vector<url_t *> urls, const vector<shared_ptr<ContactUpdateListener>> &listeners) {
+	if (!isConnected() && !connect()) {
+		LOGE("Not connected to redis server");
+		for (const auto &listener : listeners) listener->onError();
+		return;
+	}
+
+	map<size_t, RegistrarListUserData *> batches;
+	for (size_t i = 0; i < urls.size(); ++i) {
+		RegistrarUserData *data = new RegistrarUserData(this, urls[i], listeners[i]);
+		if (mRecordCache.enabled() && fetchFromCache(data)) continue;
+
+		const string key = "fs:" + data->mRecord->getKey();
+		size_t connection = getReadConnectionIndex(data->mRecord->getKey());
+		data->mReadFromReplica = isReplicaConnection(connection);
+		if (mUseCluster || data->mReadFromReplica) {
+			LOGD("Fetching %s [%lu]", key.c_str(), data->token);
+			handleRedisStatus("HGETALL", sendCommand(connection, (void (*)(redisAsyncContext*, void*, void*))sHandleFetch,
+				data, "HGETALL %s", key.c_str()), data);
+			continue;
+		}
+		RegistrarListUserData *&batch = batches[connection];
+		if (!batch) batch = new RegistrarListUserData(this);
+		batch->records.push_back(data);
+	}
+
+	for (const auto &batch : batches) {
+		RegistrarListUserData *listData = batch.second;
+		vector<string> args{to_string(listData->records.size())};
+		for (const auto &data : listData->records) {
+			args.push_back("fs:" + data->mRecord->getKey());
+		}
+
+		LOGD("Fetching a list of %lu records", (unsigned long)listData->records.size());
+		if (sendScript(batch.first, (void (*)(redisAsyncContext*, void*, void*))sHandleFetchList, listData,
+			mFetchListScript, move(args)) != REDIS_OK) {
+			LOGE("Redis error while fetching a list of %lu records", (unsigned long)listData->records.size());
+			handleFetchList(nullptr, listData);
+		}
+	}
+}
+
+void RegistrarDbRedisAsync::handleFetchList(redisReply *reply, RegistrarListUserData *data) {
+	bool valid = reply && reply->type == REDIS_REPLY_ARRAY && reply->elements == data->records.size();
+
+	if (!valid) {
+		LOGE("Redis error while fetching a list of records: %s", reply && reply->str ? reply->str : "invalid reply");
+	}
+	for (size_t i = 0; i < data->records.size(); ++i) {
+		handleFetch(valid ? reply->element[i] : nullptr, data->records[i]);
+	}
+	delete data;
+}
+
 /*
  * The following code is to migrate a redis database to the new way
  */
@@ -885,7 +2096,8 @@ void RegistrarDbRedisAsync::handleRecordMigration(redisReply *reply, RegistrarUs
 				if (data->listener) data->listener->onRecordFound(nullptr);
 			} else {
 				LOGD("Parsing stored contacts for aor:%s successful", data->mRecord->getKey().c_str());
-				serializeAndSendToRedis(data, sHandleMigration);
+				data->mUpdateExpire = true;
+				serializeAndSendToRedis(data, data->mRecord, sHandleMigration);
 				return;
 			}
 		} else {
@@ -917,7 +2129,7 @@ void RegistrarDbRedisAsync::handleMigration(redisReply *reply, RegistrarUserData
 		su_home_deinit(&home);
 	} else {
 		LOGD("Record aor:%s successfully migrated", data->mRecord->getKey().c_str());
-		if (data->listener) data->listener->onRecordFound(data->mRecord);
+		notifyRecordChanged(data->listener, data->mRecord);
 		/*If we want someday to remove the previous record, uncomment the following and comment the delete data above
 		check_redis_command(redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleClear,
 			data, "DEL aor:%s", data->mRecord->getKey().c_str()), data);*/
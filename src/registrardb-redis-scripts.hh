@@ -0,0 +1,187 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Lua scripts run by the redis implementation of the registrar database. Those handling contacts serialized in binary
+ * read their fields at fixed offsets, which must follow the layout of ExtendedContact::serializeAsBinary().
+ */
+
+#pragma once
+
+/* Server-side bind: upserts the contacts of a REGISTER into fs:<aor> as one atomic step.
+ * KEYS[1] is the record hash, ARGV holds the current time, the maximum number of contacts, the name of the
+ * message-expires parameter and then, for each contact, its unique id, serialized value, expiration date, call-id
+ * and cseq. Expiration dates of the stored contacts are computed from their updatedAt/expires url parameters, the same
+ * way ExtendedContact::init() does, or read from the header of the contacts serialized in binary.
+ * As Record::insertOrUpdateBinding() does, a contact registered without unique id, which is stored under its call-id,
+ * is dropped by any other contact registered with the same call-id.
+ * It returns the uid/contact pairs that were replaced or dropped, which is all the listener needs to know. */
+static const char sServerSideBindScript[] = R"lua(
+if redis.replicate_commands then redis.replicate_commands() end
+local key = KEYS[1]
+local now = tonumber(ARGV[1])
+local maxContacts = tonumber(ARGV[2])
+local msgExpiresPattern = ';' .. string.gsub(ARGV[3], '%p', '%%%0') .. '=(%d+)'
+
+-- Binary contacts start with a nul byte and the version, followed by updatedAt, expireAt, expireNotAtMessage, cseq
+-- and call-id.
+local function isBinary(contact)
+	return string.byte(contact, 1) == 0
+end
+local function updatedAt(contact)
+	if isBinary(contact) then return (struct.unpack('<i8', contact, 3)) end
+	return tonumber(string.match(contact, ';updatedAt=(%d+)')) or 0
+end
+local function expireAt(contact)
+	if isBinary(contact) then return (struct.unpack('<i8', contact, 11)) end
+	local base = updatedAt(contact)
+	local latest = base + (tonumber(string.match(contact, ';expires=(%-?%d+)')) or 0)
+	local msgExpires = tonumber(string.match(contact, msgExpiresPattern))
+	if msgExpires and base + msgExpires > latest then latest = base + msgExpires end
+	return latest
+end
+local function callId(contact)
+	if isBinary(contact) then
+		local size = struct.unpack('<I4', contact, 31)
+		return string.sub(contact, 35, 34 + size)
+	end
+	return string.match(contact, ';callid=([^;?>]*)')
+end
+local function cseq(contact)
+	if isBinary(contact) then return tostring((struct.unpack('<I4', contact, 27))) end
+	return string.match(contact, ';cseq=(%d+)')
+end
+
+local removed = {}
+local contacts = {}
+local stored = redis.call('HGETALL', key)
+for i = 1, #stored, 2 do
+	if expireAt(stored[i + 1]) <= now then
+		redis.call('HDEL', key, stored[i])
+		table.insert(removed, stored[i])
+		table.insert(removed, stored[i + 1])
+	else
+		contacts[stored[i]] = stored[i + 1]
+	end
+end
+
+for i = 4, #ARGV, 5 do
+	local uid, contact, contactExpireAt = ARGV[i], ARGV[i + 1], tonumber(ARGV[i + 2])
+	local sameCallId = contacts[ARGV[i + 3]]
+	if ARGV[i + 3] ~= uid and sameCallId and callId(sameCallId) == ARGV[i + 3] then
+		contacts[ARGV[i + 3]] = nil
+		redis.call('HDEL', key, ARGV[i + 3])
+		table.insert(removed, ARGV[i + 3])
+		table.insert(removed, sameCallId)
+	end
+	local previous = contacts[uid]
+	if contactExpireAt <= now then
+		-- expires=0: keep the binding if it was registered by this very request (same call-id and cseq)
+		if previous and (callId(previous) ~= ARGV[i + 3] or cseq(previous) ~= ARGV[i + 4]) then
+			contacts[uid] = nil
+			redis.call('HDEL', key, uid)
+		end
+	else
+		if previous then
+			table.insert(removed, uid)
+			table.insert(removed, previous)
+		end
+		contacts[uid] = contact
+		redis.call('HSET', key, uid, contact)
+	end
+end
+
+local current = {}
+for uid, contact in pairs(contacts) do
+	table.insert(current, {uid, contact, updatedAt(contact)})
+end
+table.sort(current, function(a, b) return a[3] < b[3] or (a[3] == b[3] and a[1] < b[1]) end)
+while #current > maxContacts do
+	redis.call('HDEL', key, table.remove(current, 1)[1])
+end
+
+local latest = 0
+for _, c in ipairs(current) do
+	local e = expireAt(c[2])
+	if e > latest then latest = e end
+end
+if latest > 0 then redis.call('EXPIREAT', key, latest) end
+return removed
+)lua";
+
+/* Fetch of a list of records: the HGETALL replies of all the KEYS, in the same order. */
+static const char sFetchListScript[] = R"lua(
+local records = {}
+for i, key in ipairs(KEYS) do
+	records[i] = redis.call('HGETALL', key)
+end
+return records
+)lua";
+
+/* Rewrites contacts in another format, unless they changed since they were read. KEYS[1] is the record hash and ARGV
+ * holds, for each contact, its unique id, the value that was read and the new value. */
+static const char sContactMigrationScript[] = R"lua(
+local migrated = 0
+for i = 1, #ARGV, 3 do
+	if redis.call('HGET', KEYS[1], ARGV[i]) == ARGV[i + 1] then
+		redis.call('HSET', KEYS[1], ARGV[i], ARGV[i + 2])
+		migrated = migrated + 1
+	end
+end
+return migrated
+)lua";
+
+/* Refresh of a binding. KEYS[1] is the record hash, ARGV holds the unique id of the contact, its new value, the current
+ * time, and its new expiration date and CSeq. The contact is only written if the stored one, in the same format, has
+ * not expired and only differs by its updatedAt, expiry and CSeq fields, the latter being lower. Returns 1 if it was
+ * written, otherwise the stored record as HGETALL does, into which the contact is then merged by a regular bind. */
+static const char sRefreshScript[] = R"lua(
+local stored = redis.call('HGET', KEYS[1], ARGV[1])
+local contact, now, expireAt, cseq = ARGV[2], tonumber(ARGV[3]), tonumber(ARGV[4]), tonumber(ARGV[5])
+
+-- Bytes 3 to 30 of a binary contact hold updatedAt, expireAt, expireNotAtMessage and cseq, the call-id follows.
+local function isBinaryRefresh()
+	if string.byte(stored, 1) ~= 0 or string.sub(stored, 1, 2) ~= string.sub(contact, 1, 2) then return false end
+	if string.sub(stored, 31) ~= string.sub(contact, 31) then return false end
+	return struct.unpack('<i8', stored, 11) > now and struct.unpack('<I4', stored, 27) < cseq
+end
+-- An url encoded contact holds these fields in the first expires, cseq and updatedAt parameters of its url.
+local function withoutRefreshedFields(c)
+	c = string.gsub(c, ';expires=%-?%d+', '', 1)
+	c = string.gsub(c, ';cseq=%d+', '', 1)
+	return (string.gsub(c, ';updatedAt=%d+', '', 1))
+end
+local function isUrlEncodedRefresh()
+	if string.byte(stored, 1) == 0 or withoutRefreshedFields(stored) ~= withoutRefreshedFields(contact) then
+		return false
+	end
+	local storedExpireAt = (tonumber(string.match(stored, ';updatedAt=(%d+)')) or 0) +
+		(tonumber(string.match(stored, ';expires=(%-?%d+)')) or 0)
+	return storedExpireAt > now and (tonumber(string.match(stored, ';cseq=(%d+)')) or cseq) < cseq
+end
+
+local refresh = false
+if stored then
+	if string.byte(contact, 1) == 0 then refresh = isBinaryRefresh() else refresh = isUrlEncodedRefresh() end
+end
+if not refresh then return redis.call('HGETALL', KEYS[1]) end
+redis.call('HSET', KEYS[1], ARGV[1], contact)
+local ttl = redis.call('TTL', KEYS[1])
+if ttl >= 0 and now + ttl < expireAt then redis.call('EXPIREAT', KEYS[1], expireAt) end
+return 1
+)lua";
@@ -28,6 +28,8 @@
 #include <sofia-sip/su_wait.h>
 #endif
 
+#include "loop-monitor.hh"
+
 namespace flexisip {
 
 struct redisSofiaEvents;
@@ -36,12 +38,14 @@ typedef struct redisSofiaEvents redisSofiaEvents;
 typedef struct redisSofiaEvents {
 	redisAsyncContext *context;
 	su_root_t *root;
+	LoopMonitor *monitor; // Measures the handling of the replies, may be null.
 	su_wait_t wait;
 	int index;
 	int eventmask;
 } redisSofiaEvents;
 
 static int redisSofiaEvent(su_root_magic_t *magic, su_wait_t *wait, su_wakeup_arg_t *e) {
+	LoopMonitor::Probe probe(((redisSofiaEvents*)e)->monitor, LoopMonitor::SourceRedis);
 	if (wait->revents & SU_WAIT_IN)
 		redisAsyncHandleRead(((redisSofiaEvents*)e)->context);
 	if (wait->revents & SU_WAIT_OUT)
@@ -87,7 +91,7 @@ static void redisSofiaCleanup(void *privdata) {
 	free(e);
 }
 
-static int redisSofiaAttach(redisAsyncContext *ac, su_root_t *root) {
+static int redisSofiaAttach(redisAsyncContext *ac, su_root_t *root, LoopMonitor *monitor = nullptr) {
 	redisContext *c = &(ac->c);
 	redisSofiaEvents *e;
 
@@ -99,6 +103,7 @@ static int redisSofiaAttach(redisAsyncContext *ac, su_root_t *root) {
 	e = (redisSofiaEvents *)malloc(sizeof(*e));
 	e->context = ac;
 	e->root = root;
+	e->monitor = monitor;
 	e->eventmask = 0;
 
 	/* Register functions to start/stop listening for events */
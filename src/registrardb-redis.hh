@@ -25,17 +25,34 @@
 #include <hiredis/hiredis.h>
 #include <hiredis/async.h>
 #include <flexisip/agent.hh>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace flexisip {
 
 struct RedisParameters {
-	RedisParameters() : port(0), timeout(0) {
+	RedisParameters()
+		: port(0), timeout(0), mUseServerSideBind(false), mConnectionPoolSize(1), mUseCluster(false),
+		  mRecordCacheSize(0), mRecordCacheMaxAge(0), mUseReplicaReads(false), mReplicaReadAfterWriteDelay(0),
+		  mUseBinaryContacts(false), mPubSubChannels(0) {
 	}
 	std::string domain;
 	std::string auth;
 	int port;
 	int timeout;
 	int mSlaveCheckTimeout;
+	bool mUseServerSideBind;
+	int mConnectionPoolSize;
+	bool mUseCluster;
+	size_t mRecordCacheSize; // in bytes, 0 to disable the cache
+	int mRecordCacheMaxAge; // in seconds
+	bool mUseReplicaReads;
+	int mReplicaReadAfterWriteDelay; // in milliseconds
+	bool mUseBinaryContacts; // whether contacts are written with ExtendedContact::serializeAsBinary()
+	int mPubSubChannels; // number of channels the topics are multiplexed onto, 0 for a channel per topic
 };
 
 /**
@@ -43,12 +60,14 @@ struct RedisParameters {
  */
 struct RedisHost {
 	RedisHost(int id, const std::string &address, unsigned short port, const std::string &state)
-		: id(id), address(address), port(port), state(state) {
+		: id(id), address(address), port(port), state(state), offset(-1), lag(-1) {
 	}
 
 	RedisHost() {
 		// invalid host
 		id = -1;
+		offset = -1;
+		lag = -1;
 	}
 
 	inline bool operator==(const RedisHost &r) {
@@ -60,7 +79,8 @@ struct RedisHost {
 	 *
 	 * If the parsing goes well, the returned RedisHost will have the id field set to the one passed as argument,
 	 * otherwise -1.
-	 * @param slaveLine the Redis answer line where a slave is defined. Format is "host,port,state"
+	 * @param slaveLine the Redis answer line where a slave is defined. Format is "host,port,state", or
+	 * "ip=<ip>,port=<port>,state=<state>,offset=<offset>,lag=<lag>" since Redis 2.8
 	 * @param id an ID to give to this slave, usually its number.
 	 * @return A RedisHost with a valid ID or -1 if the parsing failed.
 	 */
@@ -69,9 +89,91 @@ struct RedisHost {
 	std::string address;
 	unsigned short port;
 	std::string state;
+	long long offset; // replication offset acknowledged by the slave, -1 if unknown
+	int lag; // seconds since the last acknowledgment of the slave, -1 if unknown
 };
 
 
+/**
+ * @brief The RedisClusterNode struct describes a master of a redis cluster and the connections opened to it.
+ */
+struct RedisClusterNode {
+	RedisClusterNode(const std::string &address, unsigned short port)
+		: address(address), port(port), context(nullptr), subscribeContext(nullptr) {
+	}
+
+	std::string address;
+	unsigned short port;
+	redisAsyncContext *context;
+	redisAsyncContext *subscribeContext; // only used for the key expiration events, which are local to each node
+};
+
+/**
+ * @brief The RedisReplica struct describes a slave of the master we are connected to, and the connection used to send
+ * it read commands.
+ */
+struct RedisReplica {
+	RedisReplica(const RedisHost &host) : host(host), context(nullptr), listed(true) {
+	}
+
+	RedisHost host;
+	redisAsyncContext *context;
+	bool listed; // false once the master does not report it anymore
+};
+
+/**
+ * @brief The RedisRecordCache class is a LRU cache of the records read from redis, bounded by the size of their
+ * serialized contacts.
+ *
+ * It keeps the raw uid/contact pairs of the HGETALL reply, so that each hit gives a fresh Record to its listener.
+ * Every removal increases a generation number: a reply is only cached if no entry was removed while it was pending,
+ * which prevents a reply older than an invalidation from being cached. A reply to a fetch sent before the subscription
+ * to the topic of the record was confirmed by redis is kept but not served, since the invalidations published in the
+ * meantime were not received: the next fetch reads the record from redis again.
+ */
+class RedisRecordCache {
+  public:
+	typedef std::vector<std::pair<std::string, std::string>> Bindings;
+
+	RedisRecordCache(size_t maxBytes, int maxAge) : mMaxBytes(maxBytes), mMaxAge(maxAge), mBytes(0), mGeneration(0) {
+	}
+
+	bool enabled() const {
+		return mMaxBytes > 0;
+	}
+	uint64_t getGeneration() const {
+		return mGeneration;
+	}
+	bool contains(const std::string &key) const {
+		return mIndex.find(key) != mIndex.end();
+	}
+	/* Returns the bindings of the record, or nullptr if it is not cached, not usable or too old. */
+	const Bindings *get(const std::string &key, time_t now);
+	/* Returns true if the record was not cached before. The keys evicted to make room are added to evicted. */
+	bool insert(const std::string &key, Bindings &&bindings, bool usable, uint64_t generation, time_t now,
+				std::list<std::string> &evicted);
+	/* Returns true if the record was cached. */
+	bool remove(const std::string &key);
+	void clear();
+
+  private:
+	struct Entry {
+		std::string key;
+		Bindings bindings;
+		size_t bytes;
+		time_t insertedAt;
+		bool usable;
+	};
+
+	void erase(std::list<Entry>::iterator it);
+
+	std::list<Entry> mEntries; // most recently used first
+	std::unordered_map<std::string, std::list<Entry>::iterator> mIndex;
+	size_t mMaxBytes;
+	int mMaxAge;
+	size_t mBytes;
+	uint64_t mGeneration;
+};
 
 /******
  * RegistrarUserData helper class
@@ -91,11 +193,52 @@ struct RegistrarUserData {
 	std::string mGruu;
 	bool mUpdateExpire;
 	bool mIsUnregister;
+	uint64_t mCacheGeneration;
+	bool mSubscriptionConfirmed; // whether the topic of the record was subscribed when it was fetched
+	bool mReadFromReplica;
 
 	RegistrarUserData(RegistrarDbRedisAsync *s, const url_t *url, std::shared_ptr<ContactUpdateListener> listener);
 	~RegistrarUserData();
 };
 
+/* The records fetched by a single request of a fetchList(), one RegistrarUserData per record. */
+struct RegistrarListUserData {
+	RegistrarDbRedisAsync *self;
+	std::vector<RegistrarUserData *> records;
+
+	RegistrarListUserData(RegistrarDbRedisAsync *s) : self(s) {
+	}
+};
+
+/* A lua script run with EVALSHA once SCRIPT LOAD gave its sha, and sent along with EVAL until then. */
+struct RedisScript {
+	RedisScript(const char *body) : body(body) {
+	}
+
+	const char *body;
+	std::string sha;
+};
+
+/* Wraps the callback of a command sent on a connection of the pool, to measure its round trip time. In cluster mode,
+ * the command is kept so that it can be sent again to another node when redis answers with a redirection. A script run
+ * with EVALSHA keeps its arguments, to be run again with EVAL should redis not know it. */
+struct RedisCommandContext {
+	RedisCommandContext(RegistrarDbRedisAsync *self, size_t connection, redisCallbackFn *fn, void *privdata)
+		: self(self), connection(connection), fn(fn), privdata(privdata), start(std::chrono::steady_clock::now()),
+		  redirections(0), script(nullptr) {
+	}
+
+	RegistrarDbRedisAsync *self;
+	size_t connection;
+	redisCallbackFn *fn;
+	void *privdata;
+	std::chrono::steady_clock::time_point start;
+	std::string command;
+	int redirections;
+	RedisScript *script;
+	std::vector<std::string> scriptArgs;
+};
+
 class RegistrarDbRedisAsync : public RegistrarDb {
   public:
 	RegistrarDbRedisAsync(const std::string &preferredRoute, su_root_t *root, RecordSerializer *serializer,
@@ -106,9 +249,11 @@ class RegistrarDbRedisAsync : public RegistrarDb {
 
   protected:
 	virtual void doBind(const sip_t *sip, int globalExpire, bool alias, int version, const std::shared_ptr<ContactUpdateListener> &listener);
+	virtual bool doRefresh(const sip_t *sip, int globalExpire, const std::shared_ptr<ContactUpdateListener> &listener);
 	virtual void doClear(const sip_t *sip, const std::shared_ptr<ContactUpdateListener> &listener);
 	virtual void doFetch(const url_t *url, const std::shared_ptr<ContactUpdateListener> &listener);
 	virtual void doFetchForGruu(const url_t *url, const std::string &gruu, const std::shared_ptr<ContactUpdateListener> &listener);
+	virtual void doFetchList(const std::vector<url_t *> urls, const std::vector<std::shared_ptr<ContactUpdateListener>> &listeners);
 	virtual void doMigration();
 	virtual void subscribe(const std::string &topic, const std::shared_ptr<ContactRegisteredListener> &listener);
 	virtual void unsubscribe(const std::string &topic, const std::shared_ptr<ContactRegisteredListener> &listener);
@@ -124,10 +269,23 @@ class RegistrarDbRedisAsync : public RegistrarDb {
 	static void sPublishCallback(redisAsyncContext *c, void *r, void *privdata);
 	static void sKeyExpirationPublishCallback(redisAsyncContext *c, void *r, void *data);
 	static void sBindRetry(void *unused, su_timer_t *t, void *ud);
+	static void sHandleBindScriptLoad(redisAsyncContext *c, void *r, void *privdata);
+	static void sHandleScriptLoad(redisAsyncContext *c, void *r, void *privdata);
+	static void sHandleCommandReply(redisAsyncContext *c, void *r, void *privdata);
+	static void sHandleClusterSlotsReply(redisAsyncContext *c, void *r, void *privdata);
 	bool isConnected();
 	void setWritable (bool value);
 	friend class RegistrarDb;
 	redisAsyncContext *mContext, *mSubscribeContext;
+	/* Additional connections of the pool, mContext being the first one. The commands of an AOR always go through
+	 * the same connection so that they are executed in order. A null entry is a connection to open again. */
+	std::vector<redisAsyncContext *> mPoolContexts;
+	/* In cluster mode, the masters of the cluster replace the pool: connection i > 0 is the one of
+	 * mClusterNodes[i - 1], and mClusterSlots gives the index of the node serving each hash slot, or -1. */
+	bool mUseCluster;
+	bool mClusterSlotsPending;
+	std::vector<RedisClusterNode> mClusterNodes;
+	std::vector<int> mClusterSlots;
 	RecordSerializer *mSerializer;
 	std::string mDomain;
 	std::string mAuthPassword;
@@ -138,15 +296,102 @@ class RegistrarDbRedisAsync : public RegistrarDb {
 	size_t mCurSlave;
 	su_timer_t *mReplicationTimer;
 	int mSlaveCheckTimeout;
+	bool mUseServerSideBind;
+	std::string mBindScriptSha;
+	RedisRecordCache mRecordCache;
+	/* With replica reads, the read commands are sent to the replicas of mReplicas, whose connection i is
+	 * 1 + mPoolContexts.size() + i. The records written by this instance during the last mReplicaReadAfterWriteDelay
+	 * are read from the master instead, so that a fetch following a bind sees it. */
+	bool mUseReplicaReads;
+	std::chrono::milliseconds mReplicaReadAfterWriteDelay;
+	std::vector<RedisReplica> mReplicas;
+	long long mMasterReplOffset;
+	std::unordered_map<std::string, std::chrono::steady_clock::time_point> mRecentWrites;
+	std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> mRecentWritesQueue;
+	/* Contacts are written in binary if set, in url encoded form otherwise. Both are read in any case. */
+	bool mUseBinaryContacts;
+	/* With mPubSubChannels > 0, the topics are multiplexed onto this number of channels, whose messages start with the
+	 * topic they are about and the expiration date of its record. The expiration events of the keys are only
+	 * received if the server sends them (mKeyExpirationEvents), otherwise the expiration of the records of the
+	 * subscribed topics is watched instead. mSubscribedTopics holds the topics subscribed for their listeners or for
+	 * the record cache, and mChannelTopics the number of them on each channel. */
+	int mPubSubChannels;
+	std::unordered_set<std::string> mSubscribedTopics;
+	std::vector<size_t> mChannelTopics;
+	/* Number of SUBSCRIBE commands sent on each channel whose reply is still awaited. */
+	std::unordered_map<std::string, int> mPendingSubscriptions;
+	/* Expiration date of the records of the subscribed topics that exist, and these topics by date. The queue may
+	 * hold outdated dates, which are skipped. */
+	std::unordered_map<std::string, time_t> mWatchedExpirations;
+	std::multimap<time_t, std::string> mExpirationQueue;
+	su_timer_t *mExpirationTimer;
+	bool mKeyExpirationEvents;
+	RedisScript mFetchListScript;
+	RedisScript mContactMigrationScript;
+	RedisScript mRefreshScript;
+	/* Key of the record handed to its listener by notifyRecordChanged(), until something is published on its topic. */
+	std::string mUnpublishedChange;
+	time_t mUnpublishedExpireAt = 0; // expiration date of this record, sent along with its publication
 	/*std::list<RegistrarUserData*> mQueue;
 	bool mAddToQueue;*/
 
-	void serializeAndSendToRedis(RegistrarUserData *data, forwardFn *forward_fn);
+	redisAsyncContext *createContext(const std::string &address, int port, redisConnectCallback *onConnect,
+									 redisDisconnectCallback *onDisconnect);
+	void connectPool();
+	size_t getConnectionIndex(const std::string &key) const;
+	redisAsyncContext *getConnectionContext(size_t connection) const;
+	int sendCommand(size_t connection, redisCallbackFn *fn, void *privdata, const char *format, ...);
+	int sendCommandArgv(size_t connection, redisCallbackFn *fn, void *privdata, int argc, const char **argv,
+						const size_t *argvlen);
+	int sendFormattedCommand(RedisCommandContext *cmd, char *formatted, int len);
+	int sendScript(size_t connection, redisCallbackFn *fn, void *privdata, RedisScript &script,
+				   std::vector<std::string> &&args);
+	bool resendScript(RedisCommandContext *cmd);
+	void loadScripts(redisAsyncContext *context);
+	bool redirectCommand(RedisCommandContext *cmd, const char *redirection);
+
+	/* cluster */
+	void refreshClusterSlots();
+	void handleClusterSlotsReply(const redisReply *reply);
+	size_t getClusterNode(const std::string &address, unsigned short port);
+	void connectCluster();
+	RedisClusterNode *findClusterNode(const redisAsyncContext *c);
+
+	/* replica reads */
+	size_t getReadConnectionIndex(const std::string &key);
+	bool isReplicaConnection(size_t connection) const;
+	void recordWrite(const std::string &key);
+	void pruneRecentWrites(std::chrono::steady_clock::time_point now);
+	void updateReplicas();
+	RedisReplica *findReplica(const redisAsyncContext *c);
+
+	std::string serializeContact(const std::shared_ptr<ExtendedContact> &ec) const;
+	void migrateContacts(const Record &record, const std::map<std::string, std::string> &urlEncoded);
+	void serializeAndSendToRedis(RegistrarUserData *data, const std::shared_ptr<Record> &record, forwardFn *forward_fn);
+	void sendBind(RegistrarUserData *data, bool allowServerSide);
+	void sendServerSideBind(RegistrarUserData *data);
+	void loadBindScript();
 	bool handleRedisStatus(const std::string &desc, int redisStatus, RegistrarUserData *data);
 	void onErrorData(RegistrarUserData *data);
 	void subscribeTopic(const std::string &topic);
+	void unsubscribeTopic(const std::string &topic);
+	size_t getTopicChannel(const std::string &topic) const;
+	std::string getChannelName(size_t channel) const;
+	bool isSubscriptionConfirmed(const std::string &topic) const;
+	void onSubscriptionConfirmed(const std::string &channel);
+	void watchExpiration(const std::string &topic, time_t expireAt = 0);
+	void setWatchedExpiration(const std::string &topic, time_t expiration);
+	void startExpirationTimer();
+	void checkKeyExpirationEvents();
+	void handleKeyExpirationEventsConfig(const redisReply *reply);
+	void handleExpirationTtl(redisReply *reply, const std::string &topic);
 	void subscribeAll();
 	void subscribeToKeyExpiration();
+	void cacheRecord(const redisReply *reply, const RegistrarUserData *data);
+	bool fetchFromCache(RegistrarUserData *data);
+	void invalidateCachedRecord(const std::string &key);
+	void notifyRecordChanged(const std::shared_ptr<ContactUpdateListener> &listener, const std::shared_ptr<Record> &record,
+							 bool refreshed = false);
 	void parseAndClean(redisReply *reply, RegistrarUserData *data);
 	//void dequeueNextRedisCommand();
 
@@ -154,8 +399,11 @@ class RegistrarDbRedisAsync : public RegistrarDb {
 	void handleAuthReply(const redisReply *reply);
 	void handleBind(redisReply *reply, RegistrarUserData *data);
 	void handleBindReplyAorSet(redisReply *reply, RegistrarUserData *data);
+	void handleServerSideBind(redisReply *reply, RegistrarUserData *data);
+	void handleRefresh(redisReply *reply, RegistrarUserData *data);
 	void handleClear(redisReply *reply, RegistrarUserData *data);
 	void handleFetch(redisReply *reply, RegistrarUserData *data);
+	void handleFetchList(redisReply *reply, RegistrarListUserData *data);
 	void handleReplicationInfoReply(const char *str);
 	void handleMigration(redisReply *reply, RegistrarUserData *data);
 	void handleRecordMigration(redisReply *reply, RegistrarUserData *data);
@@ -174,9 +422,15 @@ class RegistrarDbRedisAsync : public RegistrarDb {
 	static void shandleAuthReply(redisAsyncContext *ac, void *r, void *privdata);
 	static void sHandleBindStart(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data);
 	static void sHandleBindFinish(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data);
+	static void sHandleServerSideBind(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data);
+	static void sHandleRefresh(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data);
 	static void sHandleClear(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data);
 	static void sHandleFetch(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data);
+	static void sHandleFetchList(redisAsyncContext *ac, redisReply *reply, RegistrarListUserData *data);
 	static void sHandleInfoTimer(void *unused, su_timer_t *t, void *data);
+	static void sHandleExpirationTimer(void *unused, su_timer_t *t, void *data);
+	static void sHandleExpirationTtl(redisAsyncContext *ac, void *r, void *privdata);
+	static void sHandleKeyExpirationEventsConfig(redisAsyncContext *c, void *r, void *privdata);
 	static void sHandleReplicationInfoReply(redisAsyncContext *ac, void *r, void *privdata);
 	static void sHandleSet(redisAsyncContext *ac, void *r, void *privdata);
 	static void sHandleMigration(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data);
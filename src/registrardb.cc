@@ -17,6 +17,7 @@
 */
 
 #include <flexisip/registrardb.hh>
+#include "registrardb-file.hh"
 #include "registrardb-internal.hh"
 #ifdef ENABLE_REDIS
 #include "registrardb-redis.hh"
@@ -26,12 +27,15 @@
 #include <flexisip/configmanager.hh>
 
 #include <algorithm>
+#include <chrono>
 #include <ctime>
 #include <cstdio>
+#include <cstring>
 #include <iomanip>
 #include <ostream>
 #include <sstream>
 
+#include <sofia-sip/msg_header.h>
 #include <sofia-sip/sip_protos.h>
 #include "recordserializer.hh"
 #include <flexisip/module.hh>
@@ -76,6 +80,33 @@ url_t *ExtendedContact::toSofiaUrlClean(su_home_t *home) {
 	return ret;
 }
 
+/* Heap memory used by a string, unless it is stored inline by the small string optimization. */
+static size_t stringMemoryUsage(const string &str) {
+	const char *data = str.data();
+	bool isInline = data >= reinterpret_cast<const char *>(&str) && data < reinterpret_cast<const char *>(&str + 1);
+	return isInline ? 0 : str.capacity() + 1;
+}
+
+/* The interned values count for their share among the contacts holding them. */
+size_t ExtendedContact::getMemoryUsage() const {
+	size_t usage = sizeof(ExtendedContact) + stringMemoryUsage(mContactId) + stringMemoryUsage(mCallId) +
+				   stringMemoryUsage(mUniqueId) + mUserAgent.getMemoryUsage() + mPath.getMemoryUsage() +
+				   mAcceptHeader.getMemoryUsage();
+	if (mSipContact) {
+		// The contact and its strings are allocated as a single block.
+		const url_t *url = mSipContact->m_url;
+		usage += sizeof(sip_contact_t);
+		for (const char *str : {mSipContact->m_display, url->url_user, url->url_password, url->url_host, url->url_port,
+								url->url_path, url->url_params, url->url_headers, url->url_fragment}) {
+			if (str) usage += strlen(str) + 1;
+		}
+		for (const msg_param_t *param = mSipContact->m_params; param && *param; ++param) {
+			usage += sizeof(*param) + strlen(*param) + 1;
+		}
+	}
+	return usage;
+}
+
 string ExtendedContact::getOrgLinphoneSpecs() const {
 	if (!mSipContact) return string();
 	const char *specs = msg_params_find(mSipContact->m_params, "+org.linphone.specs");
@@ -87,6 +118,52 @@ const string ExtendedContact::getMessageExpires(const msg_param_t *m_params)  {
 	return RegistrarDb::get()->getMessageExpires(m_params);
 }
 
+ExtendedContact::~ExtendedContact() {
+	su_free(nullptr, mSipContact);
+}
+
+/* The contact is allocated outside of any home, so that it does not cost the block table of a home per contact. */
+void ExtendedContact::setSipContact(const sip_contact_t *contact) {
+	su_free(nullptr, mSipContact);
+	mSipContact = nullptr;
+	if (!contact) return;
+	sip_contact_t first = *contact;
+	first.m_next = nullptr;
+	mSipContact = sip_contact_dup(nullptr, &first);
+}
+
+static bool equalStrings(const char *s1, const char *s2) {
+	return (s1 && s2) ? strcmp(s1, s2) == 0 : s1 == s2;
+}
+
+bool ExtendedContact::isRegisteredBy(const sip_t *sip, const sip_contact_t *contact) const {
+	if (!mSipContact || url_cmp_all(mSipContact->m_url, contact->m_url) != 0) return false;
+	if (!equalStrings(mSipContact->m_display, contact->m_display)) return false;
+	const msg_param_t *params = mSipContact->m_params, *otherParams = contact->m_params;
+	for (; params && *params && otherParams && *otherParams; ++params, ++otherParams) {
+		if (strcmp(*params, *otherParams) != 0) return false;
+	}
+	if ((params && *params) || (otherParams && *otherParams)) return false;
+
+	if (mUserAgent.get() != (sip->sip_user_agent ? sip->sip_user_agent->g_string : "")) return false;
+
+	SofiaAutoHome home;
+	const sip_path_t *path = sip->sip_path;
+	for (const auto &route : mPath) {
+		const char *url = path ? url_as_string(home.home(), path->r_url) : nullptr;
+		if (!url || route != url) return false;
+		path = path->r_next;
+	}
+	if (path) return false;
+
+	const sip_accept_t *accept = sip->sip_accept;
+	for (const auto &type : mAcceptHeader) {
+		if (!accept || type != accept->ac_type) return false;
+		accept = accept->ac_next;
+	}
+	return accept == nullptr;
+}
+
 sip_contact_t *ExtendedContact::toSofiaContact(su_home_t *home, time_t now) const {
 	time_t expire = mExpireAt - now;
 	if (expire <= 0)
@@ -195,6 +272,15 @@ time_t Record::latestExpire() const {
 	return latest;
 }
 
+size_t Record::getMemoryUsage() const {
+	size_t usage = sizeof(Record) + stringMemoryUsage(mKey);
+	for (const auto &ec : mContacts) {
+		// list node holding the shared_ptr, and control block of the shared_ptr
+		usage += 2 * sizeof(void *) + sizeof(shared_ptr<ExtendedContact>) + 4 * sizeof(void *) + ec->getMemoryUsage();
+	}
+	return usage;
+}
+
 time_t Record::latestExpire(Agent *ag) const {
 	time_t latest = 0;
 	SofiaAutoHome home;
@@ -250,13 +336,22 @@ void Record::insertOrUpdateBinding(const shared_ptr<ExtendedContact> &ec, const
 
 	SLOGD << "Trying to insert new contact " << *ec;
 
+	/* Contacts dropped from the record are remembered so that they can be removed from the database, unless they
+	 * are going to be overwritten by ec because they are stored under the same unique id. */
+	auto dropContact = [this, &ec](list<shared_ptr<ExtendedContact>>::iterator it) {
+		if ((*it)->getUniqueId() != ec->getUniqueId()) mContactsToRemove.push_back(*it);
+		return mContacts.erase(it);
+	};
+
 	if (sAssumeUniqueDomains && mIsDomain) {
-		mContacts.clear();
+		for (auto it = mContacts.begin(); it != mContacts.end();) {
+			it = dropContact(it);
+		}
 	}
 	for (auto it = mContacts.begin(); it != mContacts.end();) {
 		if (now >= (*it)->mExpireAt) {
 			SLOGD << "Cleaning expired contact " << (*it)->mContactId;
-			it = mContacts.erase(it);
+			it = dropContact(it);
 		} else if (!(*it)->mUniqueId.empty() && (*it)->mUniqueId == ec->mUniqueId) {
 			if (ec->mExpireAt == now){
 				/*case of ;expires=0 in contact header*/
@@ -269,18 +364,19 @@ void Record::insertOrUpdateBinding(const shared_ptr<ExtendedContact> &ec, const
 					return;
 				} else {
 					/*this contact should be removed*/
+					mContactsToRemove.push_back(*it);
 					it = mContacts.erase(it);
 					return;
 				}
 			}
 			SLOGD << "Cleaning older line '" << ec->mUniqueId << "' for contact " << (*it)->mContactId;
 			if (listener) listener->onContactUpdated(*it);
-			it = mContacts.erase(it);
+			it = dropContact(it);
 		} else if ((*it)->mUniqueId.empty() && (*it)->callId() && (*it)->mCallId == ec->mCallId) {
 			/*we don't accept to clean a contact from call-id if the unique id was set previously*/
 			SLOGD << "Cleaning same call id contact " << (*it)->mContactId << "(" << ec->mCallId << ")";
 			if (listener) listener->onContactUpdated(*it);
-			it = mContacts.erase(it);
+			it = dropContact(it);
 		} else {
 			++it;
 		}
@@ -308,6 +404,9 @@ void ExtendedContact::extractInfoFromHeader(const char *urlHeaders) {
 
 		headers = *msg_chain_head(msg.get());
 
+		// The interned lists are only built once all their values are known.
+		vector<string> path(mPath.begin(), mPath.end());
+		vector<string> accept(mAcceptHeader.begin(), mAcceptHeader.end());
 		while(headers) {
 			if (reinterpret_cast<msg_common_t*>(headers)->h_len > 0 &&
 				reinterpret_cast<msg_common_t*>(headers)->h_class->hc_name) {
@@ -324,15 +423,17 @@ void ExtendedContact::extractInfoFromHeader(const char *urlHeaders) {
 					if (bracket != string::npos) valueStr.erase(bracket, static_cast<size_t>(1));
 					bracket = valueStr.find('>');
 					if (bracket != string::npos) valueStr.erase(bracket, static_cast<size_t>(1));
-					mPath.push_back(valueStr);
+					path.push_back(valueStr);
 				} else if (keyStr == "accept") {
-					mAcceptHeader.push_back(valueStr);
+					accept.push_back(valueStr);
 				} else if (keyStr == "user-agent") {
 					mUserAgent = valueStr;
 				}
 			}
 			headers = reinterpret_cast<msg_common_t*>(headers)->h_succ;
 		}
+		mPath = path;
+		mAcceptHeader = accept;
 	}
 }
 
@@ -448,18 +549,22 @@ static bool extractBoolParam(url_t *url, const char *param) {
 	return (extracted_param.empty()) ? FALSE : (extracted_param.find("yes") != string::npos);
 }
 
-void ExtendedContact::init() {
-	if (mSipContact) {
-		if (mSipContact->m_q) {
-			mQ = atof(mSipContact->m_q);
-		}
+void ExtendedContact::extractContactParams() {
+	if (mSipContact->m_q) {
+		mQ = atof(mSipContact->m_q);
+	}
 
-		if (url_has_param(mSipContact->m_url, "fs-conn-id")) {
-			char strConnId[32] = {0};
-			if (url_param(mSipContact->m_url->url_params, "fs-conn-id", strConnId, sizeof(strConnId) - 1) > 0) {
-				mConnId = std::strtoull(strConnId, nullptr, 16);
-			}
+	if (url_has_param(mSipContact->m_url, "fs-conn-id")) {
+		char strConnId[32] = {0};
+		if (url_param(mSipContact->m_url->url_params, "fs-conn-id", strConnId, sizeof(strConnId) - 1) > 0) {
+			mConnId = std::strtoull(strConnId, nullptr, 16);
 		}
+	}
+}
+
+void ExtendedContact::init() {
+	if (mSipContact) {
+		extractContactParams();
 
 		int expire = resolveExpire(mSipContact->m_expires, mExpireNotAtMessage);
 		mExpireNotAtMessage = mUpdatedTime + expire;
@@ -474,11 +579,12 @@ void ExtendedContact::init() {
 }
 
 void ExtendedContact::extractInfoFromUrl(const char* full_url) {
-	sip_contact_t *temp_contact = sip_contact_make(mHome.home(), full_url);
+	SofiaAutoHome home;
+	sip_contact_t *temp_contact = sip_contact_make(home.home(), full_url);
 	url_t *url = nullptr;
 	if (temp_contact == nullptr) {
 		SLOGD << "Couldn't parse " << full_url << " as contact, fallback to url instead";
-		url = url_make(mHome.home(), full_url);
+		url = url_make(home.home(), full_url);
 	} else {
 		url = temp_contact->m_url;
 	}
@@ -509,10 +615,245 @@ void ExtendedContact::extractInfoFromUrl(const char* full_url) {
 	url->url_headers = nullptr;
 
 	if (temp_contact == nullptr) {
-		mSipContact = sip_contact_create(mHome.home(), (url_string_t*)url, nullptr);
+		setSipContact(sip_contact_create(home.home(), (url_string_t*)url, nullptr));
 	} else {
-		mSipContact = temp_contact;
+		setSipContact(temp_contact);
+	}
+}
+
+/*
+ * Binary encoding of a contact: a nul byte and the version of the encoding, then the fields the server-side bind
+ * script reads at fixed offsets (updated time, expiration times, cseq and call-id), then the other fields and the
+ * parts of the contact. Strings are prefixed by their length, sNullString standing for a null one, and all the
+ * integers are little endian. The expiration times are absolute, unlike in the url encoded format.
+ */
+static const uint8_t sBinaryContactVersion = 1;
+static const uint32_t sNullString = 0xFFFFFFFF;
+
+namespace {
+
+class BinaryContactWriter {
+  public:
+	void putUint8(uint8_t value) {
+		mData.push_back((char)value);
+	}
+	void putUint32(uint32_t value) {
+		for (int i = 0; i < 4; ++i) mData.push_back((char)((value >> (8 * i)) & 0xFF));
+	}
+	void putInt64(int64_t value) {
+		for (int i = 0; i < 8; ++i) mData.push_back((char)(((uint64_t)value >> (8 * i)) & 0xFF));
+	}
+	void putString(const char *value) {
+		if (!value) {
+			putUint32(sNullString);
+			return;
+		}
+		size_t size = strlen(value);
+		putUint32(size);
+		mData.append(value, size);
+	}
+	void putString(const string &value) {
+		putUint32(value.size());
+		mData.append(value);
 	}
+	void putStringList(const InternedStringList &values) {
+		putUint32(values.size());
+		for (const auto &value : values) putString(value);
+	}
+	string &data() {
+		return mData;
+	}
+
+  private:
+	string mData;
+};
+
+/* The strings are not copied by the reader, they point into the decoded data. */
+struct BinaryString {
+	const char *str;
+	uint32_t size;
+};
+
+class BinaryContactReader {
+  public:
+	BinaryContactReader(const char *data, size_t size) : mData((const uint8_t *)data), mSize(size), mPos(0) {
+	}
+	bool readUint8(uint8_t &value) {
+		if (mSize - mPos < 1) return false;
+		value = mData[mPos++];
+		return true;
+	}
+	bool readUint32(uint32_t &value) {
+		if (mSize - mPos < 4) return false;
+		value = (uint32_t)mData[mPos] | ((uint32_t)mData[mPos + 1] << 8) | ((uint32_t)mData[mPos + 2] << 16) |
+				((uint32_t)mData[mPos + 3] << 24);
+		mPos += 4;
+		return true;
+	}
+	bool readInt64(int64_t &value) {
+		uint32_t low, high;
+		if (!readUint32(low) || !readUint32(high)) return false;
+		value = (int64_t)(((uint64_t)high << 32) | low);
+		return true;
+	}
+	bool readString(BinaryString &value) {
+		if (!readUint32(value.size)) return false;
+		if (value.size == sNullString) {
+			value.str = nullptr;
+			value.size = 0;
+			return true;
+		}
+		if (mSize - mPos < value.size) return false;
+		value.str = (const char *)mData + mPos;
+		mPos += value.size;
+		return true;
+	}
+	bool readString(string &value) {
+		BinaryString str;
+		if (!readString(str)) return false;
+		value.assign(str.str ? str.str : "", str.size);
+		return true;
+	}
+	bool readStringList(InternedStringList &values) {
+		uint32_t count;
+		if (!readUint32(count) || count > mSize) return false;
+		vector<string> read(count);
+		for (auto &value : read) {
+			if (!readString(value)) return false;
+		}
+		values = read;
+		return true;
+	}
+
+  private:
+	const uint8_t *mData;
+	size_t mSize;
+	size_t mPos;
+};
+
+}
+
+string ExtendedContact::serializeAsBinary() const {
+	BinaryContactWriter writer;
+	writer.putUint8(0);
+	writer.putUint8(sBinaryContactVersion);
+	writer.putInt64(mUpdatedTime);
+	writer.putInt64(mExpireAt);
+	writer.putInt64(mExpireNotAtMessage);
+	writer.putUint32(mCSeq);
+	writer.putString(mCallId);
+	writer.putString(mUserAgent.get());
+	writer.putUint8((mAlias ? 1 : 0) | (mUsedAsRoute ? 2 : 0));
+	writer.putStringList(mPath);
+	writer.putStringList(mAcceptHeader);
+
+	const url_t *url = mSipContact->m_url;
+	writer.putString(mSipContact->m_display);
+	writer.putUint8((uint8_t)url->url_type);
+	writer.putUint8((uint8_t)url->url_root);
+	writer.putString(url->url_scheme);
+	writer.putString(url->url_user);
+	writer.putString(url->url_password);
+	writer.putString(url->url_host);
+	writer.putString(url->url_port);
+	writer.putString(url->url_path);
+	writer.putString(url->url_params);
+	writer.putString(url->url_headers);
+	writer.putString(url->url_fragment);
+	uint32_t paramCount = 0;
+	for (const msg_param_t *param = mSipContact->m_params; param && *param; ++param) paramCount++;
+	writer.putUint32(paramCount);
+	for (uint32_t i = 0; i < paramCount; ++i) writer.putString(mSipContact->m_params[i]);
+	return move(writer.data());
+}
+
+bool ExtendedContact::extractInfoFromBinary(const char *data, size_t size) {
+	BinaryContactReader reader(data, size);
+	uint8_t marker, version, flags, urlType, urlRoot;
+	int64_t updatedTime, expireAt, expireNotAtMessage;
+	string userAgent;
+	if (!reader.readUint8(marker) || !reader.readUint8(version)) return false;
+	if (version != sBinaryContactVersion) {
+		LOGE("Unsupported binary contact version %u", (unsigned)version);
+		return false;
+	}
+	if (!reader.readInt64(updatedTime) || !reader.readInt64(expireAt) || !reader.readInt64(expireNotAtMessage) ||
+		!reader.readUint32(mCSeq) || !reader.readString(mCallId) || !reader.readString(userAgent) ||
+		!reader.readUint8(flags) || !reader.readStringList(mPath) || !reader.readStringList(mAcceptHeader))
+		return false;
+
+	// The parts of the contact, then its parameters.
+	BinaryString parts[10];
+	uint32_t paramCount;
+	if (!reader.readString(parts[0]) || !reader.readUint8(urlType) || !reader.readUint8(urlRoot)) return false;
+	for (int i = 1; i < 10; ++i) {
+		if (!reader.readString(parts[i])) return false;
+	}
+	if (!reader.readUint32(paramCount) || paramCount > size) return false;
+	vector<BinaryString> params(paramCount);
+	for (auto &param : params) {
+		if (!reader.readString(param) || !param.str) return false;
+	}
+
+	// The contact, its parameter array and all its strings are allocated as a single block.
+	size_t blockSize = sizeof(sip_contact_t) + (paramCount + 1) * sizeof(msg_param_t);
+	for (const auto &part : parts) blockSize += part.str ? part.size + 1 : 0;
+	for (const auto &param : params) blockSize += param.size + 1;
+	char *block = (char *)su_zalloc(nullptr, blockSize);
+	if (!block) return false;
+	sip_contact_t *contact = sip_contact_init((sip_contact_t *)block);
+	msg_param_t *paramArray = (msg_param_t *)(block + sizeof(sip_contact_t));
+	char *next = (char *)(paramArray + paramCount + 1);
+	auto copy = [&next](const BinaryString &str) -> char * {
+		if (!str.str) return nullptr;
+		char *copied = next;
+		memcpy(copied, str.str, str.size);
+		copied[str.size] = '\0';
+		next += str.size + 1;
+		return copied;
+	};
+
+	setSipContact(nullptr);
+	contact->m_display = copy(parts[0]);
+	url_t *url = contact->m_url;
+	url->url_type = (char)urlType;
+	url->url_root = (char)urlRoot;
+	url->url_scheme = copy(parts[1]);
+	url->url_user = copy(parts[2]);
+	url->url_password = copy(parts[3]);
+	url->url_host = copy(parts[4]);
+	url->url_port = copy(parts[5]);
+	url->url_path = copy(parts[6]);
+	url->url_params = copy(parts[7]);
+	url->url_headers = copy(parts[8]);
+	url->url_fragment = copy(parts[9]);
+	for (uint32_t i = 0; i < paramCount; ++i) paramArray[i] = copy(params[i]);
+	if (paramCount > 0) {
+		contact->m_params = paramArray;
+		// Sets m_q and m_expires, which point into the parameters as if the contact had been parsed.
+		msg_header_update_params(contact->m_common, 0);
+	}
+
+	mSipContact = contact;
+	mUserAgent = userAgent;
+	mUpdatedTime = updatedTime;
+	mExpireAt = expireAt;
+	mExpireNotAtMessage = expireNotAtMessage;
+	mAlias = (flags & 1) != 0;
+	mUsedAsRoute = (flags & 2) != 0;
+	extractContactParams();
+	return true;
+}
+
+bool Record::updateFromSerializedContact(const char *key, const char *uid, const char *data, size_t size, const shared_ptr<ContactUpdateListener> &listener) {
+	auto exc = make_shared<ExtendedContact>(key, uid, data, size);
+
+	if (exc->mSipContact && getCurrentTime() < exc->mExpireAt) {
+		insertOrUpdateBinding(exc, listener);
+		return true;
+	}
+
+	return false;
 }
 
 bool Record::updateFromUrlEncodedParams(const char *key, const char *uid, const char *full_url, const shared_ptr<ContactUpdateListener> &listener) {
@@ -563,6 +904,7 @@ void Record::update(const sip_t *sip, int globalExpire, bool alias, int version,
 		ExtendedContactCommon ecc(contactId.str().c_str(), stlPath, sip->sip_call_id->i_id, lineValuePtr);
 		auto exc = make_shared<ExtendedContact>(ecc, contacts, globalExpire, (sip->sip_cseq) ? sip->sip_cseq->cs_seq : 0, getCurrentTime(), alias, acceptHeaders, userAgent);
 		exc->mUsedAsRoute = sip->sip_from->a_url->url_user == nullptr;
+		exc->mIsDirty = true;
 		insertOrUpdateBinding(exc, listener);
 		contacts = contacts->m_next;
 	}
@@ -571,6 +913,41 @@ void Record::update(const sip_t *sip, int globalExpire, bool alias, int version,
 	SLOGD << *this;
 }
 
+shared_ptr<ExtendedContact> Record::refresh(const sip_t *sip, int globalExpire) {
+	const sip_contact_t *contact = sip->sip_contact;
+	if (!contact || contact->m_next || !sip->sip_call_id || !sip->sip_cseq) return nullptr;
+	if (sAssumeUniqueDomains && mIsDomain) return nullptr;
+
+	time_t now = getCurrentTime();
+	auto bound = mContacts.end();
+	for (auto it = mContacts.begin(); it != mContacts.end(); ++it) {
+		if ((*it)->mCallId != sip->sip_call_id->i_id) continue;
+		// Several contacts registered with this call-id are left to update().
+		if (bound != mContacts.end()) return nullptr;
+		bound = it;
+	}
+	if (bound == mContacts.end()) return nullptr;
+
+	const shared_ptr<ExtendedContact> &ec = *bound;
+	if (now >= ec->mExpireAt || sip->sip_cseq->cs_seq <= ec->mCSeq || ec->mAlias) return nullptr;
+	if (ec->mUsedAsRoute != (sip->sip_from->a_url->url_user == nullptr) || !ec->isRegisteredBy(sip, contact))
+		return nullptr;
+
+	/* The stored contact may be held by other records, such as the results of previous fetches: it is replaced by a
+	 * copy rather than modified. */
+	auto refreshed = make_shared<ExtendedContact>(*ec);
+	refreshed->mCSeq = sip->sip_cseq->cs_seq;
+	refreshed->mUpdatedTime = now;
+	refreshed->mExpireNotAtMessage = globalExpire;
+	refreshed->init();
+	if (refreshed->mExpireAt <= now) return nullptr;
+	refreshed->mIsDirty = true;
+	*bound = refreshed;
+
+	SLOGD << "Refreshed contact " << *refreshed;
+	return refreshed;
+}
+
 void Record::update(const ExtendedContactCommon &ecc, const char *sipuri, long expireAt, float q, uint32_t cseq,
 					time_t updated_time, bool alias, const list<string> accept, bool usedAsRoute,
 					const shared_ptr<ContactUpdateListener> &listener) {
@@ -589,6 +966,7 @@ void Record::update(const ExtendedContactCommon &ecc, const char *sipuri, long e
 
 	auto exct = make_shared<ExtendedContact>(ecc, contact, expireAt, cseq, updated_time, alias, accept, "");
 	exct->mUsedAsRoute = usedAsRoute;
+	exct->mIsDirty = true;
 	insertOrUpdateBinding(exct, listener);
 	applyMaxAor();
 
@@ -644,6 +1022,13 @@ url_t *Record::getPubGruu(const std::shared_ptr<ExtendedContact> &ec, su_home_t
 Record::~Record() {
 }
 
+void Record::cleanPendingChanges() {
+	for (const auto &ec : mContacts) {
+		ec->mIsDirty = false;
+	}
+	mContactsToRemove.clear();
+}
+
 void Record::init() {
 	GenericStruct *registrar = GenericManager::get()->getRoot()->get<GenericStruct>("module::Registrar");
 	sMaxContacts = registrar->get<ConfigInt>("max-contacts-by-aor")->read();
@@ -664,8 +1049,22 @@ void Record::appendContactsFrom(const shared_ptr<Record> &src) {
 	}
 }
 
-RegistrarDb::LocalRegExpire::LocalRegExpire(Agent *ag) : mAgent(ag) {
+/* Levels of the timer wheel of LocalRegExpire: level 0 has 256 slots of one second, the next levels have 64 slots each
+ * covering all the slots of the previous level. The time of an entry is encoded in the slot indexes of all levels. */
+static const unsigned sWheelLevels = 4;
+
+static unsigned wheelShift(unsigned level) {
+	return level == 0 ? 0 : 8 + 6 * (level - 1);
+}
+
+static time_t wheelSize(unsigned level) {
+	return level == 0 ? 256 : 64;
+}
 
+RegistrarDb::LocalRegExpire::LocalRegExpire(Agent *ag) : mCurrent(getCurrentTime()), mAgent(ag) {
+	for (unsigned level = 0; level < sWheelLevels; ++level) {
+		mWheel.emplace_back(wheelSize(level));
+	}
 }
 
 RegistrarDb::RegistrarDb(Agent *ag)
@@ -747,41 +1146,117 @@ void RegistrarDb::notifyContactListener (const shared_ptr<Record> &r, const stri
 }
 
 void RegistrarDb::LocalRegExpire::update(const shared_ptr<Record> &record) {
-	unique_lock<mutex> lock(mMutex);
 	time_t latest = record->latestExpire(mAgent);
-	if (latest > 0) {
-		auto it = mRegMap.find(record->getKey());
+	unique_lock<mutex> lock(mMutex);
+	update(record->getKey(), latest, !record->isEmpty() && !record->haveOnlyStaticContacts());
+}
+
+void RegistrarDb::LocalRegExpire::update(const string &key, time_t expire) {
+	unique_lock<mutex> lock(mMutex);
+	update(key, expire, true);
+}
+
+void RegistrarDb::LocalRegExpire::update(const string &key, time_t expire, bool schedulable) {
+	auto it = mRegMap.find(key);
+	if (expire > 0) {
 		if (it != mRegMap.end()) {
-			(*it).second = latest;
+			it->second.entry->expire = expire;
+			place(mWheel[it->second.level][it->second.slot], it->second.entry, mCurrent + 1);
 		} else {
-			if (!record->isEmpty() && !record->haveOnlyStaticContacts()) {
-				mRegMap.insert(make_pair(record->getKey(), latest));
+			if (schedulable) {
+				schedule(key, expire);
 				notifyLocalRegExpireListener(mRegMap.size());
 			}
 		}
 	} else {
-		mRegMap.erase(record->getKey());
+		if (it != mRegMap.end()) unschedule(it);
 		notifyLocalRegExpireListener(mRegMap.size());
 	}
 }
 
+void RegistrarDb::LocalRegExpire::remove(const string key) {
+	lock_guard<mutex> lock(mMutex);
+	auto it = mRegMap.find(key);
+	if (it != mRegMap.end()) unschedule(it);
+}
+
+void RegistrarDb::LocalRegExpire::clearAll() {
+	lock_guard<mutex> lock(mMutex);
+	for (auto &level : mWheel) {
+		for (auto &slot : level) slot.clear();
+	}
+	mRegMap.clear();
+}
+
 size_t RegistrarDb::LocalRegExpire::countActives() {
 	return mRegMap.size();
 }
+
 void RegistrarDb::LocalRegExpire::removeExpiredBefore(time_t before) {
 	unique_lock<mutex> lock(mMutex);
+	size_t count = mRegMap.size();
 
-	for (auto it = mRegMap.begin(); it != mRegMap.end();) {
-		// LOGE("> %s [%lu]", (*it).first.c_str(), (*it).second-before);
-		if ((*it).second <= before) {
-			auto prevIt = it;
-			++it;
-			mRegMap.erase(prevIt);
-			notifyLocalRegExpireListener(mRegMap.size());
-		} else {
-			++it;
+	while (mCurrent < before) {
+		if (mRegMap.empty()) {
+			mCurrent = before;
+			break;
+		}
+		mCurrent++;
+		// The higher levels are cascaded first, their entries may go to a slot of a lower level cascaded right after.
+		for (unsigned level = sWheelLevels - 1; level > 0; --level) {
+			if ((mCurrent & ((time_t(1) << wheelShift(level)) - 1)) == 0) {
+				cascade(level, (mCurrent >> wheelShift(level)) & (wheelSize(level) - 1));
+			}
 		}
+		Slot &expired = mWheel[0][mCurrent & (wheelSize(0) - 1)];
+		for (const auto &entry : expired) {
+			mRegMap.erase(entry.key);
+		}
+		expired.clear();
 	}
+	if (mRegMap.size() != count) notifyLocalRegExpireListener(mRegMap.size());
+}
+
+void RegistrarDb::LocalRegExpire::schedule(const string &key, time_t expire) {
+	Slot pending;
+	pending.push_back(Entry{key, expire});
+	place(pending, pending.begin(), mCurrent + 1);
+}
+
+/* Moves an entry to the slot of the lowest level able to hold its time, which is its expiration time or the first time
+ * still to be processed. An entry too far in the future waits in the farthest slot of the last level. */
+void RegistrarDb::LocalRegExpire::place(Slot &from, Slot::iterator entry, time_t earliest) {
+	time_t when = max(entry->expire, earliest);
+	unsigned level = 0;
+	while (level + 1 < sWheelLevels &&
+		   (when >> wheelShift(level)) - (mCurrent >> wheelShift(level)) >= wheelSize(level)) {
+		level++;
+	}
+	unsigned shift = wheelShift(level);
+	if ((when >> shift) - (mCurrent >> shift) >= wheelSize(level)) {
+		when = ((mCurrent >> shift) + wheelSize(level) - 1) << shift;
+	}
+	size_t slot = (when >> shift) & (wheelSize(level) - 1);
+
+	Slot &to = mWheel[level][slot];
+	to.splice(to.end(), from, entry);
+	Position &position = mRegMap[entry->key];
+	position.level = level;
+	position.slot = slot;
+	position.entry = entry;
+}
+
+void RegistrarDb::LocalRegExpire::cascade(unsigned level, size_t slot) {
+	Slot entries;
+	entries.splice(entries.end(), mWheel[level][slot]);
+	while (!entries.empty()) {
+		place(entries, entries.begin(), mCurrent);
+	}
+}
+
+void RegistrarDb::LocalRegExpire::unschedule(unordered_map<string, Position>::iterator it) {
+	mWheel[it->second.level][it->second.slot].erase(it->second.entry);
+	mRegMap.erase(it);
 }
 
 void RegistrarDb::LocalRegExpire::subscribe(LocalRegExpireListener *listener) {
@@ -846,6 +1321,13 @@ RegistrarDb *RegistrarDb::initialize(Agent *ag){
 		LOGI("RegistrarDB implementation is internal");
 		sUnique = new RegistrarDbInternal(ag);
 		sUnique->mUseGlobalDomain = useGlobalDomain;
+	} else if ("file" == dbImplementation) {
+		string path = mr->get<ConfigString>("file-db-path")->read();
+		LOGI("RegistrarDB implementation is file, in %s", path.c_str());
+		sUnique = new RegistrarDbFile(ag, path, mr->get<ConfigInt>("file-db-sync-interval")->read());
+		sUnique->mUseGlobalDomain = useGlobalDomain;
+		sUnique->mMessageExpiresName = mMessageExpiresName;
+		static_cast<RegistrarDbFile *>(sUnique)->open();
 	}
 #ifdef ENABLE_REDIS
 	/* Previous implementations allowed "redis-sync" and "redis-async", whereas we now expect "redis".
@@ -859,6 +1341,20 @@ RegistrarDb *RegistrarDb::initialize(Agent *ag){
 		params.timeout = registrar->get<ConfigInt>("redis-server-timeout")->read();
 		params.auth = registrar->get<ConfigString>("redis-auth-password")->read();
 		params.mSlaveCheckTimeout = registrar->get<ConfigInt>("redis-slave-check-period")->read();
+		params.mUseServerSideBind = registrar->get<ConfigBoolean>("redis-server-side-bind")->read();
+		params.mConnectionPoolSize = registrar->get<ConfigInt>("redis-connection-pool-size")->read();
+		params.mUseCluster = registrar->get<ConfigBoolean>("redis-cluster")->read();
+		params.mRecordCacheSize = (size_t)max(registrar->get<ConfigInt>("redis-record-cache-size")->read(), 0) * 1024;
+		params.mRecordCacheMaxAge = registrar->get<ConfigInt>("redis-record-cache-max-age")->read();
+		params.mUseReplicaReads = registrar->get<ConfigBoolean>("redis-replica-reads")->read();
+		params.mReplicaReadAfterWriteDelay = registrar->get<ConfigInt>("redis-replica-read-after-write-delay")->read();
+		string contactFormat = registrar->get<ConfigString>("redis-contact-format")->read();
+		if (contactFormat != "url-encoded" && contactFormat != "binary") {
+			LOGF("Unsupported redis contact format '%s', supported formats are 'url-encoded' and 'binary'",
+				contactFormat.c_str());
+		}
+		params.mUseBinaryContacts = contactFormat == "binary";
+		params.mPubSubChannels = registrar->get<ConfigInt>("redis-pubsub-channels")->read();
 
 		sUnique = new RegistrarDbRedisAsync(ag, params);
 		sUnique->mUseGlobalDomain = useGlobalDomain;
@@ -868,9 +1364,9 @@ RegistrarDb *RegistrarDb::initialize(Agent *ag){
 	else {
 		LOGF("Unsupported implementation '%s'. %s",
 #ifdef ENABLE_REDIS
-				"Supported implementations are 'internal' or 'redis'.", dbImplementation.c_str());
+				"Supported implementations are 'internal', 'file' or 'redis'.", dbImplementation.c_str());
 #else
-				"Supported implementation is 'internal'.", dbImplementation.c_str());
+				"Supported implementations are 'internal' or 'file'.", dbImplementation.c_str());
 #endif
 	}
 	sUnique->mMessageExpiresName = mMessageExpiresName;
@@ -885,6 +1381,7 @@ RegistrarDb *RegistrarDb::get() {
 }
 
 void RegistrarDb::clear(const sip_t *sip, const shared_ptr<ContactUpdateListener> &listener) {
+	detachPendingFetches(Record::defineKeyFromUrl(sip->sip_from->a_url));
 	doClear(sip, listener);
 }
 
@@ -901,6 +1398,17 @@ const string RegistrarDb::getMessageExpires(const msg_param_t *m_params) {
 	return "";
 }
 
+/* Backend requests made by a recursive fetch, shared by the listeners of all its steps. The round trips are the
+ * requests that had to wait for each other, the aliases of a step being fetched by a single request. */
+struct RecursiveFetchTrace {
+	RecursiveFetchTrace() : requests(1), roundTrips(1), start(chrono::steady_clock::now()) {
+	}
+
+	int requests;
+	int roundTrips;
+	chrono::steady_clock::time_point start;
+};
+
 class RecursiveRegistrarDbListener : public ContactUpdateListener,
 									 public enable_shared_from_this<RecursiveRegistrarDbListener> {
   private:
@@ -911,12 +1419,38 @@ class RecursiveRegistrarDbListener : public ContactUpdateListener,
 	int m_request;
 	int m_step;
 	const char *m_url;
+	shared_ptr<RecursiveFetchTrace> mTrace;
+	int mDepth; // number of round trips before the record of this step was received
 	static int sMaxStep;
 
+	/* Gives each alias of a step the answer to its url in the batched request of the step, the aliases being in the
+	 * order of the urls. */
+	class AliasListListener : public ListContactUpdateListener {
+	  public:
+		void addAlias(const shared_ptr<RecursiveRegistrarDbListener> &listener) {
+			mAliases.push_back(listener);
+		}
+
+		void onContactsUpdated() override {
+			for (size_t i = 0; i < mAliases.size(); ++i) {
+				if (failedFetches[i]) {
+					mAliases[i]->onError();
+				} else {
+					mAliases[i]->onRecordFound(recordsByUrl[i]);
+				}
+			}
+		}
+
+	  private:
+		vector<shared_ptr<RecursiveRegistrarDbListener>> mAliases;
+	};
+
   public:
 	RecursiveRegistrarDbListener(RegistrarDb *database, const shared_ptr<ContactUpdateListener> &original_listerner,
-								 const url_t *url, int step = sMaxStep)
-		: m_database(database), mOriginalListener(original_listerner), m_request(1), m_step(step) {
+								 const url_t *url, int step = sMaxStep,
+								 const shared_ptr<RecursiveFetchTrace> &trace = nullptr, int depth = 1)
+		: m_database(database), mOriginalListener(original_listerner), m_request(1), m_step(step),
+		  mTrace(trace ? trace : make_shared<RecursiveFetchTrace>()), mDepth(depth) {
 		m_record = make_shared<Record>(url);
 		su_home_init(&m_home);
 		m_url = url_as_string(&m_home, url);
@@ -948,13 +1482,7 @@ class RecursiveRegistrarDbListener : public ContactUpdateListener,
 					}
 				}
 			}
-			m_request += vectToRecurseOn.size();
-			for (auto itrec : vectToRecurseOn) {
-				m_database->fetch(itrec->m_url,
-								  make_shared<RecursiveRegistrarDbListener>(m_database, this->shared_from_this(),
-																			itrec->m_url, m_step - 1),
-								  false);
-			}
+			if (!vectToRecurseOn.empty()) fetchAliases(vectToRecurseOn);
 		}
 
 		if (waitPullUpOrFail()) {
@@ -981,6 +1509,23 @@ class RecursiveRegistrarDbListener : public ContactUpdateListener,
 	}
 
   private:
+	/* The aliases found at this step are fetched in parallel by a single request, each of them being then resolved by
+	 * its own listener for the next step. */
+	void fetchAliases(const list<sip_contact_t *> &aliases) {
+		auto aliasListener = make_shared<AliasListListener>();
+		vector<url_t *> urls;
+		for (auto alias : aliases) {
+			aliasListener->addAlias(make_shared<RecursiveRegistrarDbListener>(m_database,
+				this->shared_from_this(), alias->m_url, m_step - 1, mTrace, mDepth + 1));
+			urls.push_back(alias->m_url);
+		}
+		m_request += aliases.size();
+		mTrace->requests++;
+		mTrace->roundTrips = max(mTrace->roundTrips, mDepth + 1);
+		SLOGD << "Step: " << m_step << "\tFetching " << urls.size() << " aliases of " << m_url << " in one request";
+		m_database->fetchList(urls, aliasListener);
+	}
+
 	shared_ptr<ExtendedContact> transformContactUsedAsRoute(const char *uri, const shared_ptr<ExtendedContact> &ec) {
 		/* This function does the following:
 		 * - make a copy of the extended contact
@@ -991,11 +1536,14 @@ class RecursiveRegistrarDbListener : public ContactUpdateListener,
 		 * Contact but still preserving
 		 * the last request uri that was found recursed through the alias mechanism.
 		*/
+		SofiaAutoHome home;
 		shared_ptr<ExtendedContact> newEc = make_shared<ExtendedContact>(*ec);
-		newEc->mSipContact = sip_contact_create(newEc->mHome.home(), (url_string_t*)uri, nullptr);
+		newEc->setSipContact(sip_contact_create(home.home(), (url_string_t*)uri, nullptr));
 		ostringstream path;
-		path<<*ec->toSofiaUrlClean(newEc->mHome.home());
-		newEc->mPath.push_back(path.str());
+		path<<*ec->toSofiaUrlClean(home.home());
+		vector<string> newPath(newEc->mPath.begin(), newEc->mPath.end());
+		newPath.push_back(path.str());
+		newEc->mPath = newPath;
 		// LOGD("transformContactUsedAsRoute(): path to %s added for %s", ec->mSipUri.c_str(), uri);
 		newEc->mUsedAsRoute = false;
 		return newEc;
@@ -1005,6 +1553,12 @@ class RecursiveRegistrarDbListener : public ContactUpdateListener,
 		if (--m_request != 0)
 			return false; // wait for all pending responses
 
+		if (mDepth == 1) {
+			auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - mTrace->start);
+			SLOGD << "Recursive fetch of " << m_url << " done in " << duration.count() << "ms with "
+				  << mTrace->requests << " backend requests and " << mTrace->roundTrips << " round trips";
+		}
+
 		// No more results expected for this recursion level
 		if (m_record->getExtendedContacts().empty()) {
 			return true; // no contacts collected on below recursion levels
@@ -1047,55 +1601,186 @@ void RegistrarDb::fetch(const url_t *url, const shared_ptr<ContactUpdateListener
 		if (url_param(url->url_params, "gr", buffer, sizeof(buffer)) > 0) {
 			stringstream gruu;
 			gruu << "\"<" << buffer << ">\"";
-			doFetchForGruu(url, gruu.str(), recursive
+			fetchCoalesced(url, gruu.str(), recursive
 						   ? make_shared<RecursiveRegistrarDbListener>(this, listener, url)
 						   : listener);
 			return;
 		}
 	}
-	doFetch(url, recursive
+	fetchCoalesced(url, "", recursive
 			? make_shared<RecursiveRegistrarDbListener>(this, listener, url)
 			: listener);
 }
 
 void RegistrarDb::fetchForGruu(const url_t *url, const string &gruu, const shared_ptr<ContactUpdateListener> &listener) {
-	doFetchForGruu(url, gruu, listener);
+	fetchCoalesced(url, gruu, listener);
 }
 
-void RegistrarDb::fetchList(const vector<url_t *> urls, const shared_ptr<ListContactUpdateListener> &listener) {
-	class InternalContactUpdateListener : public ContactUpdateListener {
-	public:
-		InternalContactUpdateListener(shared_ptr<ListContactUpdateListener> listener, size_t size) : listListener(listener), count(size) {}
-
-	private:
-		void onError() override{
-			SLOGE << "Error while fetching contact";
-			updateCount();
-		}
-		void onInvalid() override{
-			SLOGE << "Invalid fetch of contact";
-			updateCount();
-		}
-		void onRecordFound(const shared_ptr<Record> &r) override{
-			SLOGI << "Contact fetched";
-			if (r) listListener->records.push_back(r);
-			updateCount();
+namespace flexisip {
+
+/* Answers all the fetches of a record, or of a gruu in a record, requested while its database lookup was pending.
+ * The first listener is given the record read from the database, the other ones a copy of it and of its contacts, so
+ * that a listener modifying a contact, its expiration for instance, does not change the contacts of the others. */
+class CoalescedFetchListener : public ContactUpdateListener {
+public:
+	CoalescedFetchListener(RegistrarDb *database, const string &key) : mDatabase(database), mKey(key) {}
+
+	void addListener(const shared_ptr<ContactUpdateListener> &listener) {
+		mListeners.push_back(listener);
+	}
+
+private:
+	void onRecordFound(const shared_ptr<Record> &r) override{
+		auto listeners = detach();
+		for (size_t i = 0; i < listeners.size(); ++i) {
+			if (i == 0 || r == nullptr) {
+				listeners[i]->onRecordFound(r);
+				continue;
+			}
+			auto record = make_shared<Record>(r->getAor());
+			for (const auto &ec : r->getExtendedContacts()) record->pushContact(make_shared<ExtendedContact>(*ec));
+			listeners[i]->onRecordFound(record);
 		}
-		void onContactUpdated(const shared_ptr<ExtendedContact> &ec) override{}
-		void updateCount() {
-			count--;
-			if (count == 0)
-				listListener->onContactsUpdated();
+	}
+	void onError() override{
+		for (const auto &listener : detach()) listener->onError();
+	}
+	void onInvalid() override{
+		for (const auto &listener : detach()) listener->onInvalid();
+	}
+	void onContactUpdated(const shared_ptr<ExtendedContact> &ec) override{
+		for (const auto &listener : mListeners) listener->onContactUpdated(ec);
+	}
+
+	/* Stops accepting new listeners, and gives the ones to answer. The database still holds a reference on this
+	 * listener while it answers. */
+	vector<shared_ptr<ContactUpdateListener>> detach() {
+		auto it = mDatabase->mPendingFetches.find(mKey);
+		if (it != mDatabase->mPendingFetches.end() && it->second.get() == this) mDatabase->mPendingFetches.erase(it);
+		vector<shared_ptr<ContactUpdateListener>> listeners;
+		listeners.swap(mListeners);
+		return listeners;
+	}
+
+	RegistrarDb *mDatabase;
+	string mKey;
+	vector<shared_ptr<ContactUpdateListener>> mListeners;
+};
+
+}
+
+/* A fetch requested while an identical one is waiting for the database is attached to it, so that a burst of requests
+ * to the same AOR costs a single lookup. */
+void RegistrarDb::fetchCoalesced(const url_t *url, const string &gruu, const shared_ptr<ContactUpdateListener> &listener) {
+	string key = Record::defineKeyFromUrl(url);
+	if (!gruu.empty()) key += ";gr=" + gruu;
+
+	auto it = mPendingFetches.find(key);
+	if (it != mPendingFetches.end()) {
+		mStats.mCoalescedFetches++;
+		it->second->addListener(listener);
+		return;
+	}
+	auto pending = make_shared<CoalescedFetchListener>(this, key);
+	pending->addListener(listener);
+	mPendingFetches[key] = pending;
+	if (gruu.empty()) {
+		doFetch(url, pending);
+	} else {
+		doFetchForGruu(url, gruu, pending);
+	}
+}
+
+/* A fetch requested after a write of the record must see it: the lookups pending at the time of the write still
+ * answer their listeners, but no new fetch is attached to them. */
+void RegistrarDb::detachPendingFetches(const string &key) {
+	auto it = mPendingFetches.lower_bound(key);
+	while (it != mPendingFetches.end() && it->first.compare(0, key.size(), key) == 0) {
+		if (it->first.size() == key.size() || it->first.compare(key.size(), 4, ";gr=") == 0) {
+			it = mPendingFetches.erase(it);
+		} else {
+			++it;
 		}
+	}
+}
+
+/* Answers the fetch of the url at a position of a fetchList(), the list listener being notified once all the urls are
+ * answered. */
+class ListFetchListener : public ContactUpdateListener {
+public:
+	struct Progress {
+		Progress(const shared_ptr<ListContactUpdateListener> &listener, size_t size) : listListener(listener), count(size) {}
 
 		shared_ptr<ListContactUpdateListener> listListener;
 		size_t count;
 	};
 
-	shared_ptr<InternalContactUpdateListener> urlListener = make_shared<InternalContactUpdateListener>(listener, urls.size());
-	for (const auto &url : urls) {
-		fetch(url, urlListener);
+	ListFetchListener(const shared_ptr<Progress> &progress, size_t index) : mProgress(progress), mIndex(index) {}
+
+private:
+	void onError() override{
+		SLOGE << "Error while fetching contact";
+		mProgress->listListener->failedFetches[mIndex] = true;
+		updateCount();
+	}
+	void onInvalid() override{
+		SLOGE << "Invalid fetch of contact";
+		mProgress->listListener->failedFetches[mIndex] = true;
+		updateCount();
+	}
+	void onRecordFound(const shared_ptr<Record> &r) override{
+		SLOGD << "Contact fetched";
+		if (r) {
+			mProgress->listListener->records.push_back(r);
+			mProgress->listListener->recordsByUrl[mIndex] = r;
+		}
+		updateCount();
+	}
+	void onContactUpdated(const shared_ptr<ExtendedContact> &ec) override{}
+	void updateCount() {
+		mProgress->count--;
+		if (mProgress->count == 0)
+			mProgress->listListener->onContactsUpdated();
+	}
+
+	shared_ptr<Progress> mProgress;
+	size_t mIndex;
+};
+
+/* The urls are looked up as fetch() does: a url whose record is already being fetched is attached to the pending
+ * lookup, gruu are fetched on their own, and the other urls are read in a single request to the backend, each of them
+ * being pending until it answers. */
+void RegistrarDb::fetchList(const vector<url_t *> urls, const shared_ptr<ListContactUpdateListener> &listener) {
+	if (urls.empty()) {
+		listener->onContactsUpdated();
+		return;
+	}
+	listener->recordsByUrl.assign(urls.size(), nullptr);
+	listener->failedFetches.assign(urls.size(), false);
+	auto progress = make_shared<ListFetchListener::Progress>(listener, urls.size());
+
+	vector<url_t *> batch;
+	vector<shared_ptr<ContactUpdateListener>> batchListeners;
+	for (size_t i = 0; i < urls.size(); ++i) {
+		auto urlListener = make_shared<ListFetchListener>(progress, i);
+		if (url_has_param(urls[i], "gr")) {
+			fetch(urls[i], urlListener);
+			continue;
+		}
+		string key = Record::defineKeyFromUrl(urls[i]);
+		auto it = mPendingFetches.find(key);
+		if (it != mPendingFetches.end()) {
+			mStats.mCoalescedFetches++;
+			it->second->addListener(urlListener);
+			continue;
+		}
+		auto pending = make_shared<CoalescedFetchListener>(this, key);
+		pending->addListener(urlListener);
+		mPendingFetches[key] = pending;
+		batch.push_back(urls[i]);
+		batchListeners.push_back(pending);
 	}
+	if (!batch.empty()) doFetchList(batch, batchListeners);
 }
 
 void RegistrarDb::bind(const sip_t *sip, const BindingParameters &parameter, const shared_ptr<ContactUpdateListener> &listener) {
@@ -1124,6 +1809,9 @@ void RegistrarDb::bind(const sip_t *sip, const BindingParameters &parameter, con
 		return;
 	}
 
+	detachPendingFetches(Record::defineKeyFromUrl(sip->sip_from->a_url));
+	// Most REGISTERs are periodic refreshes of a binding that did not change, which need not rewrite the record.
+	if (!parameter.alias && doRefresh(sip, parameter.globalExpire, listener)) return;
 	doBind(sip, parameter.globalExpire, parameter.alias, parameter.version, listener);
 }
 
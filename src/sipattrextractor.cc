@@ -18,129 +18,168 @@
 
 #include "sipattrextractor.hh"
 #include <string>
-#include <sstream>
 #include <sofia-sip/sip.h>
 #include <sofia-sip/sip_protos.h>
 #include <stdexcept>
+#include <unordered_map>
+#include <cstdio>
+#include <cstring>
 
 using namespace std;
 using namespace flexisip;
 
-static string subKey(const string &key, size_t *pos) {
-	size_t dot = key.find('.', *pos) - *pos;
-	if (dot != string::npos) {
-		string id = key.substr(*pos, dot);
-		//			LOGD("SUBKEY '%s' from '%s'", id.c_str(), key.c_str());
-		*pos += dot + 1;
-		return id;
-	}
-
-	if (key.size() != *pos) {
-		//			LOGD("SUBKEY '%s'", key.c_str());
-		*pos = key.size();
-		return key;
-	}
-	return "";
+static bool is_request(const sip_t *sip) {
+	return sip_is_request((sip_header_t *)sip->sip_request);
 }
 
-inline static string cstring_get(const string &key, size_t pos, const char *str) {
-	if (!str)
-		throw invalid_argument("Null string found in sip msg for " + key);
-	return str;
+/*
+ * Accessors of the attributes. They neither allocate nor throw, a missing attribute being returned as null.
+ */
+
+static const char *url_domain(const url_t *url) {
+	return url ? url->url_host : nullptr;
 }
-inline static string cstring_or_empty_get(const string &key, size_t pos, const char *str) {
-	return str ? str : "";
+static const char *url_user(const url_t *url) {
+	return url ? url->url_user : nullptr;
 }
-
-inline static string int_get(const string &key, size_t pos, int value) {
-	ostringstream oss;
-	oss << value;
-	return oss.str();
+static const char *url_params(const url_t *url) {
+	return url ? (url->url_params ? url->url_params : "") : nullptr;
 }
-
-static string url_get(const string &key, size_t pos, const url_t *url) {
-	string id = subKey(key, &pos);
-	if (!url)
-		throw invalid_argument("No url found in sip msg for " + key);
-	if (id == "domain")
-		return cstring_get(key, pos, url->url_host);
-	if (id == "user")
-		return cstring_get(key, pos, url->url_user);
-	if (id == "params")
-		return cstring_or_empty_get(key, pos, url->url_params);
-	throw runtime_error("url_get: unhandled arg '" + id + "' in " + key);
+static const url_t *addr_url(const sip_addr_s *addr) {
+	return addr ? addr->a_url : nullptr;
+}
+static const char *int_value(int value, char *buffer, size_t size) {
+	snprintf(buffer, size, "%d", value);
+	return buffer;
 }
 
-static string addr_get(const string &key, size_t pos, const sip_addr_s *addr) {
-	string id = subKey(key, &pos);
-	if (!addr)
-		throw invalid_argument("No address found in sip msg for " + key);
-	if (id == "uri")
-		return url_get(key, pos, addr->a_url);
-	throw runtime_error("addr_get: unhandled arg '" + id + "' in " + key);
+#define ADDR_ACCESSORS(name, header)                                                                                   \
+	static const char *name##_uri_domain(const sip_t *sip, char *, size_t) {                                         \
+		return url_domain(addr_url((const sip_addr_s *)sip->header));                                                  \
+	}                                                                                                                  \
+	static const char *name##_uri_user(const sip_t *sip, char *, size_t) {                                           \
+		return url_user(addr_url((const sip_addr_s *)sip->header));                                                    \
+	}                                                                                                                  \
+	static const char *name##_uri_params(const sip_t *sip, char *, size_t) {                                         \
+		return url_params(addr_url((const sip_addr_s *)sip->header));                                                  \
+	}
+ADDR_ACCESSORS(from, sip_from)
+ADDR_ACCESSORS(to, sip_to)
+
+static const char *request_uri_domain(const sip_t *sip, char *, size_t) {
+	return sip->sip_request ? url_domain(sip->sip_request->rq_url) : nullptr;
+}
+static const char *request_uri_user(const sip_t *sip, char *, size_t) {
+	return sip->sip_request ? url_user(sip->sip_request->rq_url) : nullptr;
+}
+static const char *request_uri_params(const sip_t *sip, char *, size_t) {
+	return sip->sip_request ? url_params(sip->sip_request->rq_url) : nullptr;
+}
+static const char *request_method_name(const sip_t *sip, char *, size_t) {
+	return sip->sip_request ? sip->sip_request->rq_method_name : nullptr;
+}
+static const char *direction(const sip_t *sip, char *, size_t) {
+	return is_request(sip) ? "request" : "response";
+}
+static const char *status_phrase(const sip_t *sip, char *, size_t) {
+	return sip->sip_status ? sip->sip_status->st_phrase : nullptr;
+}
+static const char *status_code(const sip_t *sip, char *buffer, size_t size) {
+	return sip->sip_status ? int_value(sip->sip_status->st_status, buffer, size) : nullptr;
+}
+static const char *user_agent(const sip_t *sip, char *, size_t) {
+	return sip->sip_user_agent ? sip->sip_user_agent->g_string : nullptr;
+}
+static const char *callid(const sip_t *sip, char *, size_t) {
+	return sip->sip_call_id ? sip->sip_call_id->i_id : nullptr;
+}
+static const char *callid_hash(const sip_t *sip, char *buffer, size_t size) {
+	return sip->sip_call_id ? int_value(sip->sip_call_id->i_hash, buffer, size) : nullptr;
 }
 
-static string request_get(const string &key, size_t pos, const sip_request_t *req) {
-	string id = subKey(key, &pos);
-	if (!req)
-		throw invalid_argument("No request found in sip msg for " + key);
-	if (id == "uri")
-		return url_get(key, pos, req->rq_url);
-	if (id == "mn" || id == "method-name")
-		return cstring_get(key, pos, req->rq_method_name);
-	throw runtime_error("request_get: unhandled arg '" + id + "' in " + key);
+/* The attributes, indexed by their id. */
+static const struct {
+	const char *name;
+	SipAttributeAccessor accessor;
+} sAttributes[] = {
+	{"from.uri.domain", from_uri_domain},
+	{"from.uri.user", from_uri_user},
+	{"from.uri.params", from_uri_params},
+	{"to.uri.domain", to_uri_domain},
+	{"to.uri.user", to_uri_user},
+	{"to.uri.params", to_uri_params},
+	{"request.uri.domain", request_uri_domain},
+	{"request.uri.user", request_uri_user},
+	{"request.uri.params", request_uri_params},
+	{"request.method-name", request_method_name},
+	{"direction", direction},
+	{"status.phrase", status_phrase},
+	{"status.code", status_code},
+	{"user-agent", user_agent},
+	{"callid", callid},
+	{"callid.hash", callid_hash},
+};
+static_assert(sizeof(sAttributes) / sizeof(sAttributes[0]) == SipAttributes::sAttributeCount,
+			  "SipAttributes::sAttributeCount must be the number of attributes");
+
+int SipAttributes::getAttributeId(const string &key) {
+	static const unordered_map<string, int> ids = [] {
+		unordered_map<string, int> ids;
+		for (int id = 0; id < sAttributeCount; ++id)
+			ids[sAttributes[id].name] = id;
+		ids["request.mn"] = ids["request.method-name"];
+		ids["ua"] = ids["user-agent"];
+		return ids;
+	}();
+	auto it = ids.find(key);
+	return it != ids.end() ? it->second : -1;
 }
 
-static string ua_get(const string &key, size_t pos, const sip_user_agent_t *ua) {
-	if (!ua)
-		throw invalid_argument("No user-agent found in sip msg for " + key);
-	return cstring_get(key, pos, ua->g_string);
+SipAttributeAccessor SipAttributes::getAccessor(const string &key) {
+	int id = getAttributeId(key);
+	return id >= 0 ? sAttributes[id].accessor : nullptr;
 }
 
-static string status_get(const string &key, size_t pos, const sip_status_s *status) {
-	string id = subKey(key, &pos);
-	if (!status)
-		throw invalid_argument("No status found in sip msg for " + key);
-	if (id == "phrase")
-		return cstring_get(key, pos, status->st_phrase);
-	if (id == "code")
-		return int_get(key, pos, status->st_status);
-	throw runtime_error("status_get: unhandled arg '" + id + "' in " + key);
+const string &SipAttributes::get(const string &key) const {
+	int id = getAttributeId(key);
+	if (id < 0)
+		throw runtime_error("unhandled arg '" + key + "'");
+	return get(id);
 }
 
-static string callid_get(const string &key, size_t pos, const sip_call_id_s *callid) {
-	string id = subKey(key, &pos);
-	if (id.empty())
-		return cstring_get(key, pos, callid->i_id);
-	if (id == "hash")
-		return int_get(key, pos, callid->i_hash);
-	throw runtime_error("callid_get: unhandled arg '" + id + "' in " + key);
+const string &SipAttributes::get(int id) const {
+	const string *value = find(id);
+	if (!value)
+		throw invalid_argument(string("No ") + sAttributes[id].name + " found in sip msg");
+	return *value;
 }
 
-static bool is_request(const sip_t *sip) {
-	return sip_is_request((sip_header_t *)sip->sip_request);
+const string *SipAttributes::find(int id) const {
+	CachedValue &cached = mValues[id];
+	if (cached.generation != mGeneration) {
+		char buffer[16];
+		const char *value = sAttributes[id].accessor(sip, buffer, sizeof(buffer));
+		cached.present = value != nullptr;
+		cached.value.assign(value ? value : "");
+		cached.generation = mGeneration;
+	}
+	return cached.present ? &cached.value : nullptr;
 }
 
-std::string SipAttributes::get(const std::string &key) const {
-	size_t pos = 0;
-	string id = subKey(key, &pos);
-
-	if (id == "from")
-		return addr_get(key, pos, (sip_addr_s *)sip->sip_from);
-	if (id == "to")
-		return addr_get(key, pos, (sip_addr_s *)sip->sip_to);
-	if (id == "request")
-		return request_get(key, pos, sip->sip_request);
-	if (id == "direction")
-		return is_request(sip) ? "request" : "response";
-	if (id == "status")
-		return status_get(key, pos, (sip_status_s *)sip->sip_status);
-	if (id == "ua" || id == "user-agent")
-		return ua_get(key, pos, sip->sip_user_agent);
-	if (id == "callid")
-		return callid_get(key, pos, sip->sip_call_id);
-
-	throw runtime_error("unhandled arg '" + id + "' in '" + key + "'");
+const string &SipAttributes::getOrEmpty(const string &key) const {
+	static const string empty;
+	static const int methodId = getAttributeId("request.method-name");
+	static const int statusId = getAttributeId("status.code");
+	const string *value;
+	if (key == "method_or_status") {
+		value = find(methodId);
+		if (!value || value->empty())
+			value = find(statusId);
+	} else {
+		int id = getAttributeId(key);
+		value = id >= 0 ? find(id) : nullptr;
+	}
+	return value ? *value : empty;
 }
 
 bool SipAttributes::isTrue(const string &key) const {
@@ -20,6 +20,8 @@
 
 #include <string>
 #include <memory>
+#include <vector>
+#include <flexisip/expressionparser.hh>
 
 #ifndef NO_SOFIA
 #include <sofia-sip/sip.h>
@@ -27,38 +29,71 @@
 
 namespace flexisip {
 
+/*
+ * Attributes of a sip message, as used by the filters and the logs. The attributes of a MsgSip are shared by all the
+ * modules it goes through, and each of them is extracted once and memoized until invalidate() is called. The modules
+ * change the messages through sofia-sip directly, so the changes themselves are not tracked: invalidate() is called
+ * after each module that may change them (see Module::changesMessages()), whether it did or not.
+ */
 class SipAttributes {
   public:
 #ifdef NO_SOFIA
 	SipAttributes(std::string &attributes);
 #else
+	// Number of attributes, their ids going from 0 to sAttributeCount - 1.
+	static constexpr int sAttributeCount = 16;
+
 	SipAttributes(const sip_t *isip) : sip(isip) {
 	}
+	const sip_t *getSip() const {
+		return sip;
+	}
 
   private:
+	struct CachedValue {
+		std::string value;
+		unsigned generation = 0; // The value is valid while it equals mGeneration.
+		bool present = false;
+	};
 	const sip_t *sip;
+	unsigned mGeneration = 1;
+	mutable CachedValue mValues[sAttributeCount]; // Memoized value of each attribute, by id.
 #endif
   public:
 	~SipAttributes() {
 	}
 
-	std::string get(const std::string &arg) const;
+	// Throws invalid_argument if the attribute is missing in the message, runtime_error if the key is unknown.
+	const std::string &get(const std::string &arg) const;
 
+#ifdef NO_SOFIA
 	std::string getOrEmpty(const std::string &arg) const {
-		if (arg == "method_or_status") {
-			std::string method = getOrEmpty("request.mn");
-			if (!method.empty())
-				return method;
-			return getOrEmpty("status.code");
-		}
-
 		try {
 			return get(arg);
 		} catch (...) {
 			return "";
 		}
 	}
+#else
+	// Same as get(), an empty string standing for a missing attribute or an unknown key. Never throws.
+	const std::string &getOrEmpty(const std::string &arg) const;
+#endif
 	bool isTrue(const std::string &arg) const;
+
+#ifndef NO_SOFIA
+	// Same as get(), with the id of the attribute.
+	const std::string &get(int id) const;
+	// Memoized value of the attribute of the given id, or null if it is missing in the message. Never throws.
+	const std::string *find(int id) const;
+	// Forgets the memoized values, to be called when the message may have changed.
+	void invalidate() {
+		++mGeneration;
+	}
+	// Id of the attribute of the given key, or -1 if the key is unknown.
+	static int getAttributeId(const std::string &key);
+	// Accessor of the attribute of the given key, giving the same value as get(), or null if the key is unknown.
+	static SipAttributeAccessor getAccessor(const std::string &key);
+#endif
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,212 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks that a contact serialized in binary is decoded as it was, that a truncated one is rejected, and that the
+ * offsets at which the redis scripts read the fields of a binary contact are those where serializeAsBinary() writes
+ * them.
+ */
+
+#include "../registrardb-redis-scripts.hh"
+#include "registrar-tester.hh"
+
+#include <regex>
+#include <vector>
+
+using namespace std;
+using namespace flexisip;
+
+static const time_t UPDATED_TIME = 1600000001;
+static const time_t EXPIRE_AT = 1600003601;
+static const time_t EXPIRE_NOT_AT_MESSAGE = 1600007201;
+static const uint32_t CSEQ = 4242;
+static const char *CALL_ID = "a84b4c76e66710@pc33.example.org";
+
+static shared_ptr<ExtendedContact> makeContact(const char *contact) {
+	SofiaAutoHome home;
+	auto ec = make_shared<ExtendedContact>(url_make(home.home(), "sip:alice@192.168.0.1"), "");
+	ec->setSipContact(sip_contact_make(home.home(), contact));
+	ec->mCallId = CALL_ID;
+	ec->mUserAgent = InternedString("Linphone/4.4.0 (belle-sip/4.4.0)");
+	ec->mPath = InternedStringList(vector<string>{"sip:proxy1.example.org;lr", "sip:proxy2.example.org:5070;lr"});
+	ec->mAcceptHeader = InternedStringList(vector<string>{"application/sdp", "text/plain"});
+	ec->mAlias = false;
+	ec->mUsedAsRoute = true;
+	ec->mUpdatedTime = UPDATED_TIME;
+	ec->mExpireAt = EXPIRE_AT;
+	ec->mExpireNotAtMessage = EXPIRE_NOT_AT_MESSAGE;
+	ec->mCSeq = CSEQ;
+	return ec;
+}
+
+static bool equalStrings(const char *s1, const char *s2) {
+	return (s1 && s2) ? strcmp(s1, s2) == 0 : s1 == s2;
+}
+
+static void checkRoundTrip(const char *contact) {
+	auto ec = makeContact(contact);
+	string data = ec->serializeAsBinary();
+	CHECK(ExtendedContact::isBinarySerialization(data.data(), data.size()));
+
+	ExtendedContact decoded("alice@sip.example.org", "uid", data.data(), data.size());
+	CHECK(decoded.mSipContact != nullptr);
+	if (!decoded.mSipContact) return;
+	CHECK(decoded.mCallId == ec->mCallId);
+	CHECK(decoded.getUserAgent() == ec->getUserAgent());
+	CHECK(decoded.mPath.get() == ec->mPath.get());
+	CHECK(decoded.mAcceptHeader.get() == ec->mAcceptHeader.get());
+	CHECK(decoded.mAlias == ec->mAlias);
+	CHECK(decoded.mUsedAsRoute == ec->mUsedAsRoute);
+	CHECK(decoded.mUpdatedTime == UPDATED_TIME);
+	CHECK(decoded.mExpireAt == EXPIRE_AT);
+	CHECK(decoded.mExpireNotAtMessage == EXPIRE_NOT_AT_MESSAGE);
+	CHECK(decoded.mCSeq == CSEQ);
+
+	const sip_contact_t *expected = ec->mSipContact;
+	const sip_contact_t *actual = decoded.mSipContact;
+	CHECK(equalStrings(actual->m_display, expected->m_display));
+	CHECK(url_cmp_all(actual->m_url, expected->m_url) == 0);
+	CHECK(equalStrings(actual->m_url->url_user, expected->m_url->url_user));
+	CHECK(equalStrings(actual->m_url->url_port, expected->m_url->url_port));
+	CHECK(equalStrings(actual->m_url->url_params, expected->m_url->url_params));
+	CHECK(ExtendedContact::urlToString(actual->m_url) == ExtendedContact::urlToString(expected->m_url));
+	size_t count = 0;
+	for (const msg_param_t *param = expected->m_params; param && *param; ++param, ++count) {
+		CHECK(actual->m_params && equalStrings(actual->m_params[count], *param));
+	}
+	CHECK(count == 0 || (actual->m_params && actual->m_params[count] == nullptr));
+
+	// Decoding then encoding again gives the same bytes.
+	CHECK(decoded.serializeAsBinary() == data);
+
+	// A truncated contact, or one of another version, is rejected instead of being read past its end.
+	for (size_t size = 1; size < data.size(); ++size) {
+		ExtendedContact truncated("alice@sip.example.org", "uid", data.data(), size);
+		CHECK(truncated.mSipContact == nullptr);
+	}
+	string otherVersion = data;
+	otherVersion[1] = (char)(otherVersion[1] + 1);
+	ExtendedContact unsupported("alice@sip.example.org", "uid", otherVersion.data(), otherVersion.size());
+	CHECK(unsupported.mSipContact == nullptr);
+}
+
+static int64_t readInt64(const string &data, size_t pos) {
+	uint64_t value = 0;
+	for (int i = 7; i >= 0; --i) value = (value << 8) | (uint8_t)data[pos + i];
+	return (int64_t)value;
+}
+
+static uint32_t readUint32(const string &data, size_t pos) {
+	uint32_t value = 0;
+	for (int i = 3; i >= 0; --i) value = (value << 8) | (uint8_t)data[pos + i];
+	return value;
+}
+
+/* The body of a local function of a script, up to its end at the start of a line. */
+static string functionBody(const string &script, const string &name) {
+	size_t start = script.find("local function " + name + "(");
+	if (start == string::npos) return string();
+	size_t end = script.find("\nend\n", start);
+	return script.substr(start, end == string::npos ? string::npos : end - start);
+}
+
+/* The 1-based offsets of the struct.unpack() of the given format in a script. */
+static vector<size_t> unpackOffsets(const string &script, const string &format) {
+	vector<size_t> offsets;
+	regex unpack("struct\\.unpack\\('" + format + "', \\w+, (\\d+)\\)");
+	for (sregex_iterator it(script.begin(), script.end(), unpack), end; it != end; ++it) {
+		offsets.push_back(stoul((*it)[1]));
+	}
+	return offsets;
+}
+
+static void checkBindScriptOffsets() {
+	string script = sServerSideBindScript;
+	string data = makeContact("<sip:alice@192.168.0.1;transport=tcp>")->serializeAsBinary();
+
+	auto updatedAt = unpackOffsets(functionBody(script, "updatedAt"), "<i8");
+	CHECK(updatedAt.size() == 1);
+	for (auto offset : updatedAt) CHECK(readInt64(data, offset - 1) == UPDATED_TIME);
+
+	auto expireAt = unpackOffsets(functionBody(script, "expireAt"), "<i8");
+	CHECK(expireAt.size() == 1);
+	for (auto offset : expireAt) CHECK(readInt64(data, offset - 1) == EXPIRE_AT);
+
+	auto cseq = unpackOffsets(functionBody(script, "cseq"), "<I4");
+	CHECK(cseq.size() == 1);
+	for (auto offset : cseq) CHECK(readUint32(data, offset - 1) == CSEQ);
+
+	string callIdBody = functionBody(script, "callId");
+	auto callIdSize = unpackOffsets(callIdBody, "<I4");
+	CHECK(callIdSize.size() == 1);
+	smatch sub;
+	CHECK(regex_search(callIdBody, sub, regex("string\\.sub\\(contact, (\\d+), (\\d+) \\+ size\\)")));
+	if (callIdSize.size() == 1 && sub.size() == 3) {
+		size_t sizeOffset = callIdSize[0];
+		CHECK(readUint32(data, sizeOffset - 1) == strlen(CALL_ID));
+		size_t first = stoul(sub[1]), last = stoul(sub[2]);
+		CHECK(first == sizeOffset + 4);
+		CHECK(last == first - 1);
+		CHECK(data.substr(first - 1, strlen(CALL_ID)) == CALL_ID);
+	}
+}
+
+/* The refresh script compares the stored and new contacts from their call-id on, as only the fields before it may
+ * change with a refresh. */
+static void checkRefreshScriptOffsets() {
+	string script = sRefreshScript;
+	auto ec = makeContact("<sip:alice@192.168.0.1;transport=tcp>");
+	string data = ec->serializeAsBinary();
+
+	auto expireAt = unpackOffsets(script, "<i8");
+	CHECK(!expireAt.empty());
+	for (auto offset : expireAt) CHECK(readInt64(data, offset - 1) == EXPIRE_AT);
+	auto cseq = unpackOffsets(script, "<I4");
+	CHECK(!cseq.empty());
+	for (auto offset : cseq) CHECK(readUint32(data, offset - 1) == CSEQ);
+
+	smatch tail;
+	CHECK(regex_search(script, tail, regex("string\\.sub\\(stored, (\\d+)\\) ~= string\\.sub\\(contact, (\\d+)\\)")));
+	if (tail.size() != 3) return;
+	size_t offset = stoul(tail[1]);
+	CHECK(stoul(tail[2]) == offset);
+	CHECK(readUint32(data, offset - 1) == strlen(CALL_ID));
+
+	ec->mUpdatedTime += 3600;
+	ec->mExpireAt += 3600;
+	ec->mExpireNotAtMessage += 3600;
+	ec->mCSeq++;
+	string refreshed = ec->serializeAsBinary();
+	CHECK(refreshed.substr(0, 2) == data.substr(0, 2));
+	CHECK(refreshed.substr(offset - 1) == data.substr(offset - 1));
+	CHECK(refreshed != data);
+}
+
+int main() {
+	map<string, string> overrides;
+	RegistrarTester tester("binary-contact", overrides);
+
+	checkRoundTrip("<sip:alice@192.168.0.1;transport=tcp>");
+	checkRoundTrip("\"Alice Liddell\" <sips:alice@[2001:db8::1]:5071;transport=tls;gr=urn:uuid:0001>;+sip.instance=\""
+				   "<urn:uuid:00000000-0000-0000-0000-000000000001>\";q=0.5;expires=3600");
+	checkRoundTrip("<sip:192.168.0.1:5060>;+org.linphone.specs=\"groupchat,lime\"");
+	checkRoundTrip("<sip:alice:secret@192.168.0.1?Subject=hello>;methods=\"INVITE, MESSAGE\"");
+	checkBindScriptOffsets();
+	checkRefreshScriptOffsets();
+	return sFailures == 0 ? 0 : 1;
+}
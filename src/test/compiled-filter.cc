@@ -0,0 +1,242 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks that a compiled filter gives the same result as the expression tree it was compiled from, for each
+ * expression and message, the tree raising an exception where the program reports a missing attribute. Also checks
+ * that the memoized attributes are read again once invalidated.
+ */
+
+#include <flexisip/expressionparser.hh>
+#include <flexisip/logmanager.hh>
+
+#include "../sipattrextractor.hh"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sofia-sip/msg.h>
+#include <sofia-sip/sip.h>
+
+using namespace std;
+using namespace flexisip;
+
+static int sFailures = 0;
+
+#define CHECK(cond)                                                                                                    \
+	do {                                                                                                               \
+		if (!(cond)) {                                                                                                 \
+			cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << endl;                                   \
+			++sFailures;                                                                                               \
+		}                                                                                                              \
+	} while (0)
+
+static const char *sMessages[] = {
+	"INVITE sip:ipbob@sip.example.org SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 192.168.1.27:5060;branch=z9hG4bK776asdhds\r\n"
+	"From: <sip:alice@a.org>;tag=1928301774\r\n"
+	"To: <sip:1234@b.org>\r\n"
+	"Call-ID: a84b4c76e66710@pc33.example.org\r\n"
+	"CSeq: 314159 INVITE\r\n"
+	"User-Agent: Linphone/3.5.2 (belle-sip/1.0)\r\n"
+	"Contact: <sip:alice@192.168.1.27>\r\n"
+	"Content-Length: 0\r\n\r\n",
+
+	"REGISTER sip:sip.example.org SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 192.168.1.28:5060;branch=z9hG4bKnashds7\r\n"
+	"From: <sip:bob@c.org;transport=tcp>;tag=456248\r\n"
+	"To: <sip:bob@c.org>\r\n"
+	"Call-ID: 843817637684230@998sdasdh09\r\n"
+	"CSeq: 1826 REGISTER\r\n"
+	"Contact: <sip:bob@192.168.1.28>\r\n"
+	"Expires: 3600\r\n"
+	"Content-Length: 0\r\n\r\n",
+
+	"MESSAGE sip:sip.linphone.org;transport=tls SIP/2.0\r\n"
+	"Via: SIP/2.0/TLS 192.168.1.29:5061;branch=z9hG4bKmsg8\r\n"
+	"From: <sip:carol@sip.linphone.org>;tag=99\r\n"
+	"To: <sip:dave@sip.linphone.org;user=phone>\r\n"
+	"Call-ID: msg-1\r\n"
+	"CSeq: 2 MESSAGE\r\n"
+	"User-Agent: Linphone v2\r\n"
+	"Content-Length: 0\r\n\r\n",
+
+	"SIP/2.0 200 OK\r\n"
+	"Via: SIP/2.0/UDP 192.168.1.27:5060;branch=z9hG4bK776asdhds\r\n"
+	"From: <sip:alice@a.org>;tag=1928301774\r\n"
+	"To: <sip:1234@b.org>;tag=a6c85cf\r\n"
+	"Call-ID: a84b4c76e66710@pc33.example.org\r\n"
+	"CSeq: 314159 INVITE\r\n"
+	"User-Agent: Linphone v2\r\n"
+	"Content-Length: 0\r\n\r\n",
+
+	"SIP/2.0 404 Not Found\r\n"
+	"Via: SIP/2.0/UDP 192.168.1.28:5060;branch=z9hG4bKnashds7\r\n"
+	"From: <sip:bob@c.org;transport=tcp>;tag=456248\r\n"
+	"To: <sip:bob@c.org>;tag=77\r\n"
+	"Call-ID: 843817637684230@998sdasdh09\r\n"
+	"CSeq: 1826 REGISTER\r\n"
+	"Content-Length: 0\r\n\r\n",
+};
+
+static const char *sExpressions[] = {
+	"",
+	"true",
+	"false",
+	"false||false||true",
+	"true&&true&&false",
+	"!(true) || true",
+	"!(false && true) && !false",
+	"'a'=='b'",
+	"'a'!='b'",
+	"'toto' regex 'to+'",
+	"'A' in 'C A B'",
+	"'A' nin 'AB'",
+	"'x' contains ''",
+	"from.uri.user == ''",
+	"from.uri.user == 'alice'",
+	"from.uri.user != 'alice'",
+	"false||(from.uri.user=='alice')||false",
+	"from.uri.user regex 'al.*'",
+	"from.uri.user regex '^b'",
+	"from.uri.params != ''",
+	"from.uri.params contains 'transport=tcp'",
+	"numeric to.uri.user",
+	"numeric from.uri.user",
+	"!numeric to.uri.user || to.uri.domain == 'b.org'",
+	"to.uri.params contains 'user=phone'",
+	"defined ua",
+	"!defined ua",
+	"defined user-agent && user-agent contains 'Linphone'",
+	"ua == 'Linphone v2'",
+	"is_response || !(ua contains 'Linphone/3.5.2') || ((request.method-name == 'INVITE') && "
+	"!(request.uri.user contains 'ip'))",
+	"from.uri.domain contains 'sip.linphone.org'",
+	"from.uri.domain in 'a.org b.org c.org'",
+	"from.uri.domain nin 'a.org b.org'",
+	"(to.uri.domain in 'a.org  b.org c.org') && (user-agent contains 'Linphone v2')",
+	"is_request && request.method-name == 'INVITE'",
+	"is_request && request.mn in 'REGISTER MESSAGE'",
+	"request.uri.domain == 'sip.example.org'",
+	"request.uri.params contains 'transport=tls'",
+	"request.uri.user == 'ipbob' || is_response",
+	"request.uri.domain in from.uri.domain",
+	"from.uri.user in request.uri.user",
+	"status.code == '200' || direction == 'request'",
+	"status.code == '404' && status.phrase regex '^Not'",
+	"direction == 'response'",
+	"callid == 'msg-1'",
+	"callid contains '@' && !(callid.hash == '')",
+	"numeric callid.hash",
+};
+
+/* The tree evaluation, 1 or 0, or -1 if it raised an exception for a missing attribute. */
+static int treeEval(BooleanExpression &expr, const sip_t *sip) {
+	SipAttributes attributes(sip);
+	try {
+		return expr.eval(&attributes) ? 1 : 0;
+	} catch (exception &) {
+		return -1;
+	}
+}
+
+static int compiledEval(const CompiledBooleanExpression &program, const SipAttributes &attributes) {
+	bool result;
+	return program.eval(attributes, result) ? (result ? 1 : 0) : -1;
+}
+
+static int compiledEval(const CompiledBooleanExpression &program, const sip_t *sip) {
+	bool result;
+	return program.eval(sip, result) ? (result ? 1 : 0) : -1;
+}
+
+static void checkEquivalence(const vector<const sip_t *> &sips) {
+	vector<SipAttributes> attributes;
+	for (const sip_t *sip : sips) attributes.emplace_back(sip);
+
+	for (const char *text : sExpressions) {
+		auto expr = BooleanExpression::parse(text);
+		auto program = CompiledBooleanExpression::compile(expr);
+		CHECK(program != nullptr);
+		if (!program) continue;
+		for (size_t i = 0; i < sips.size(); ++i) {
+			int expected = treeEval(*expr, sips[i]);
+			// Twice over the same attributes, the second time from their memoized values.
+			int memoized = compiledEval(*program, attributes[i]);
+			int again = compiledEval(*program, attributes[i]);
+			int direct = compiledEval(*program, sips[i]);
+			if (expected != memoized || expected != again || expected != direct) {
+				cerr << "'" << text << "' on message " << i << ": tree " << expected << ", compiled " << memoized << "/"
+					 << again << "/" << direct << endl;
+				++sFailures;
+			}
+		}
+	}
+}
+
+/* Expressions reading attributes unknown when compiling are left to the tree. */
+static void checkUnknownAttributes() {
+	CHECK(CompiledBooleanExpression::compile(BooleanExpression::parse("foo.bar == 'x'")) == nullptr);
+	CHECK(CompiledBooleanExpression::compile(BooleanExpression::parse("is_request && foo.bar contains 'x'")) ==
+		  nullptr);
+}
+
+/* A module changing the message invalidates the attributes, which are then read again. */
+static void checkInvalidation(sip_t *sip) {
+	auto program = CompiledBooleanExpression::compile(BooleanExpression::parse("from.uri.user == 'alice'"));
+	CHECK(program != nullptr);
+	if (!program) return;
+	SipAttributes attributes(sip);
+	CHECK(compiledEval(*program, attributes) == 1);
+
+	const char *user = sip->sip_from->a_url->url_user;
+	sip->sip_from->a_url->url_user = "mallory";
+	CHECK(compiledEval(*program, attributes) == 1);
+	attributes.invalidate();
+	CHECK(compiledEval(*program, attributes) == 0);
+	CHECK(compiledEval(*program, attributes) == treeEval(*BooleanExpression::parse("from.uri.user == 'alice'"), sip));
+	sip->sip_from->a_url->url_user = user;
+	attributes.invalidate();
+	CHECK(compiledEval(*program, attributes) == 1);
+}
+
+int main() {
+	flexisip::log::preinit(flexisip_sUseSyslog, false, 0, "compiled-filter");
+	flexisip::log::initLogs(flexisip_sUseSyslog, "error", "error", false, true);
+
+	vector<msg_t *> msgs;
+	vector<const sip_t *> sips;
+	for (const char *text : sMessages) {
+		msg_t *msg = msg_make(sip_default_mclass(), 0, text, strlen(text));
+		sip_t *sip = msg ? (sip_t *)msg_object(msg) : nullptr;
+		CHECK(sip && !sip->sip_error);
+		if (!sip || sip->sip_error) return 1;
+		msgs.push_back(msg);
+		sips.push_back(sip);
+	}
+
+	checkEquivalence(sips);
+	checkUnknownAttributes();
+	checkInvalidation((sip_t *)sips[0]);
+
+	for (msg_t *msg : msgs) msg_destroy(msg);
+	return sFailures == 0 ? 0 : 1;
+}
@@ -75,7 +75,7 @@ class SipAttributes {
 		free(dup);
 	}
 
-	virtual string get(const std::string &id) const {
+	virtual const string &get(const std::string &id) const {
 		auto it = mStringArgs.find(id);
 		if (it != mStringArgs.end())
 			return (*it).second;
@@ -0,0 +1,223 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks that the fetches of a record requested while its lookup is pending share this lookup, and that a bind or a
+ * clear of the record makes the next fetches issue their own lookup, so that they see the write. The urls of a
+ * fetchList() share the pending lookups as well, and are answered by position.
+ */
+
+#include "../registrardb-internal.hh"
+#include "registrar-tester.hh"
+
+#include <functional>
+#include <vector>
+
+using namespace std;
+using namespace flexisip;
+
+static const char *ALICE = "sip:alice@sip.example.org";
+static const char *BOB = "sip:bob@sip.example.org";
+
+/* The internal database, whose lookups are only answered when asked to, as a remote database would. */
+class DeferredRegistrarDb : public RegistrarDbInternal {
+  public:
+	DeferredRegistrarDb(Agent *ag) : RegistrarDbInternal(ag) {
+	}
+	size_t countPendingLookups() const {
+		return mLookups.size();
+	}
+	void answerLookups() {
+		vector<function<void()>> lookups;
+		lookups.swap(mLookups);
+		for (const auto &lookup : lookups) lookup();
+	}
+
+  protected:
+	void doFetch(const url_t *url, const shared_ptr<ContactUpdateListener> &listener) override {
+		url_t *copy = url_hdup(mHome.home(), url);
+		mLookups.push_back([this, copy, listener]() { RegistrarDbInternal::doFetch(copy, listener); });
+	}
+	void doFetchForGruu(const url_t *url, const string &gruu,
+						const shared_ptr<ContactUpdateListener> &listener) override {
+		url_t *copy = url_hdup(mHome.home(), url);
+		mLookups.push_back(
+			[this, copy, gruu, listener]() { RegistrarDbInternal::doFetchForGruu(copy, gruu, listener); });
+	}
+	void doFetchList(const vector<url_t *> urls, const vector<shared_ptr<ContactUpdateListener>> &listeners) override {
+		vector<url_t *> copies;
+		for (auto url : urls) copies.push_back(url_hdup(mHome.home(), url));
+		mLookups.push_back([this, copies, listeners]() { RegistrarDbInternal::doFetchList(copies, listeners); });
+	}
+
+  private:
+	SofiaAutoHome mHome;
+	vector<function<void()>> mLookups;
+};
+
+static void bind(RegistrarDb &db, const string &aor, const string &contact) {
+	BindingParameters parameter;
+	parameter.globalExpire = 3600;
+	msg_t *msg = makeRegister(aor, "<" + contact + ">", "call-id-" + contact, 1, 3600);
+	db.bind(sip_object(msg), parameter, make_shared<RecordListener>());
+	msg_unref(msg);
+}
+
+static void checkCoalescing(DeferredRegistrarDb &db, su_home_t *home) {
+	auto alice = url_make(home, ALICE);
+	auto first = make_shared<RecordListener>();
+	auto second = make_shared<RecordListener>();
+	auto other = make_shared<RecordListener>();
+
+	bind(db, ALICE, "sip:alice@192.168.0.1");
+	uint64_t coalesced = db.getStats().mCoalescedFetches;
+	db.fetch(alice, first);
+	db.fetch(alice, second);
+	db.fetch(url_make(home, BOB), other);
+	CHECK(db.countPendingLookups() == 2);
+	CHECK(db.getStats().mCoalescedFetches == coalesced + 1);
+
+	db.answerLookups();
+	CHECK(first->mAnswers == 1 && second->mAnswers == 1 && other->mAnswers == 1);
+	CHECK(first->countContacts() == 1);
+	CHECK(second->countContacts() == 1);
+	// Each listener is given its own record and contacts, which it may modify.
+	CHECK(first->mRecord != second->mRecord);
+	if (first->countContacts() == 1 && second->countContacts() == 1) {
+		const auto &firstContact = first->mRecord->getExtendedContacts().front();
+		const auto &secondContact = second->mRecord->getExtendedContacts().front();
+		CHECK(firstContact != secondContact);
+		CHECK(firstContact->mExpireAt == secondContact->mExpireAt);
+		firstContact->mExpireAt = 0;
+		CHECK(secondContact->mExpireAt != 0);
+	}
+	CHECK(other->mRecord == nullptr);
+
+	// Once answered, the lookup is not shared anymore.
+	auto third = make_shared<RecordListener>();
+	db.fetch(alice, third);
+	CHECK(db.countPendingLookups() == 1);
+	db.answerLookups();
+	CHECK(third->countContacts() == 1);
+}
+
+static void checkDetachOnBind(DeferredRegistrarDb &db, su_home_t *home) {
+	auto alice = url_make(home, ALICE);
+	auto before = make_shared<RecordListener>();
+	auto after = make_shared<RecordListener>();
+
+	db.fetch(alice, before);
+	bind(db, ALICE, "sip:alice@192.168.0.2");
+	uint64_t coalesced = db.getStats().mCoalescedFetches;
+	db.fetch(alice, after);
+	CHECK(db.countPendingLookups() == 2);
+	CHECK(db.getStats().mCoalescedFetches == coalesced);
+
+	db.answerLookups();
+	CHECK(before->mAnswers == 1);
+	CHECK(after->mAnswers == 1);
+	CHECK(after->countContacts() == 2);
+}
+
+static void checkDetachOnClear(DeferredRegistrarDb &db, su_home_t *home) {
+	auto alice = url_make(home, ALICE);
+	auto before = make_shared<RecordListener>();
+	auto after = make_shared<RecordListener>();
+
+	db.fetch(alice, before);
+	msg_t *msg = makeRegister(ALICE, "", "call-id-clear", 1, 0);
+	db.clear(sip_object(msg), make_shared<RecordListener>());
+	msg_unref(msg);
+	db.fetch(alice, after);
+	CHECK(db.countPendingLookups() == 2);
+
+	db.answerLookups();
+	CHECK(before->mAnswers == 1);
+	CHECK(after->mAnswers == 1);
+	CHECK(after->mRecord == nullptr);
+}
+
+/* A bind of the record also detaches the fetches of one of its gruus, but not those of another record whose key starts
+ * with the same characters. */
+static void checkDetachOfGruus(DeferredRegistrarDb &db, su_home_t *home) {
+	auto alice = url_make(home, ALICE);
+	auto other = url_make(home, "sip:alice@sip.example.organization");
+	const string gruu = "\"<urn:uuid:00000000-0000-0000-0000-000000000001>\"";
+
+	db.fetchForGruu(alice, gruu, make_shared<RecordListener>());
+	db.fetch(other, make_shared<RecordListener>());
+	bind(db, ALICE, "sip:alice@192.168.0.3");
+	uint64_t coalesced = db.getStats().mCoalescedFetches;
+	db.fetchForGruu(alice, gruu, make_shared<RecordListener>());
+	db.fetch(other, make_shared<RecordListener>());
+	CHECK(db.countPendingLookups() == 3);
+	CHECK(db.getStats().mCoalescedFetches == coalesced + 1);
+	db.answerLookups();
+}
+
+class ListListener : public ListContactUpdateListener {
+  public:
+	void onContactsUpdated() override {
+		mAnswers++;
+	}
+	int mAnswers = 0;
+};
+
+/* A url whose record is being fetched shares the pending lookup, a gruu is fetched on its own, and each url is given
+ * its own answer, whatever the other urls of the same record. */
+static void checkFetchList(DeferredRegistrarDb &db, su_home_t *home) {
+	auto alice = url_make(home, ALICE);
+	bind(db, ALICE, "sip:alice@192.168.0.4");
+	auto pending = make_shared<RecordListener>();
+	db.fetch(alice, pending);
+	uint64_t coalesced = db.getStats().mCoalescedFetches;
+
+	auto listener = make_shared<ListListener>();
+	db.fetchList({alice, url_make(home, "sip:alice@sip.example.org;gr=urn:uuid:00000000-0000-0000-0000-000000000002"),
+				  url_make(home, BOB)}, listener);
+	CHECK(db.getStats().mCoalescedFetches == coalesced + 1);
+	// The pending fetch, the gruu and a batch holding bob.
+	CHECK(db.countPendingLookups() == 3);
+	db.answerLookups();
+
+	CHECK(listener->mAnswers == 1);
+	CHECK(listener->recordsByUrl.size() == 3 && listener->failedFetches.size() == 3);
+	if (listener->recordsByUrl.size() != 3) return;
+	CHECK(listener->recordsByUrl[0] != nullptr && listener->recordsByUrl[0] != pending->mRecord);
+	// The record of alice has no contact with this gruu: the gruu url must not be given the record of the plain one.
+	CHECK(!listener->recordsByUrl[1] || listener->recordsByUrl[1]->getExtendedContacts().empty());
+	CHECK(listener->recordsByUrl[2] == nullptr);
+	CHECK(!listener->failedFetches[0] && !listener->failedFetches[1] && !listener->failedFetches[2]);
+}
+
+int main() {
+	map<string, string> overrides;
+	overrides["module::Registrar/db-implementation"] = "internal";
+	RegistrarTester tester("fetch-coalescing", overrides);
+	SofiaAutoHome home;
+	{
+		// The singleton initialized by the tester is only used to compute the keys.
+		DeferredRegistrarDb db(tester.getAgent());
+		checkCoalescing(db, home.home());
+		checkDetachOnBind(db, home.home());
+		checkDetachOnClear(db, home.home());
+		checkDetachOfGruus(db, home.home());
+		checkFetchList(db, home.home());
+	}
+	return sFailures == 0 ? 0 : 1;
+}
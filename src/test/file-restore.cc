@@ -0,0 +1,141 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks that the file database restores the records it wrote, including after a crash cut its log in the middle of
+ * an entry or left garbage after its last entry, and that the records written after such a restart are kept.
+ */
+
+#include "../registrardb-file.hh"
+#include "registrar-tester.hh"
+
+#include <fstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace flexisip;
+
+static const char *ALICE = "sip:alice@sip.example.org";
+static const char *BOB = "sip:bob@sip.example.org";
+static const char *CAROL = "sip:carol@sip.example.org";
+static const char *DAVE = "sip:dave@sip.example.org";
+static const char *ERIN = "sip:erin@sip.example.org";
+
+static void bind(RegistrarDb &db, const string &aor, const string &contact) {
+	BindingParameters parameter;
+	parameter.globalExpire = 3600;
+	msg_t *msg = makeRegister(aor, "<" + contact + ">", "call-id-" + contact, 1, 3600);
+	db.bind(sip_object(msg), parameter, make_shared<RecordListener>());
+	msg_unref(msg);
+}
+
+static void clear(RegistrarDb &db, const string &aor) {
+	msg_t *msg = makeRegister(aor, "", "call-id-clear-" + aor, 1, 0);
+	db.clear(sip_object(msg), make_shared<RecordListener>());
+	msg_unref(msg);
+}
+
+static size_t countContacts(RegistrarDb &db, const char *aor) {
+	SofiaAutoHome home;
+	auto listener = make_shared<RecordListener>();
+	db.fetch(url_make(home.home(), aor), listener);
+	CHECK(listener->mAnswers == 1);
+	return listener->countContacts();
+}
+
+static off_t fileSize(const string &path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+static void appendToFile(const string &path, const string &data) {
+	ofstream file(path, ios::binary | ios::app);
+	file.write(data.data(), data.size());
+}
+
+int main() {
+	map<string, string> overrides;
+	overrides["module::Registrar/db-implementation"] = "internal";
+	RegistrarTester tester("file-restore", overrides);
+	Agent *agent = tester.getAgent();
+	const string path = "file-restore-" + to_string(getpid()) + ".db";
+	unlink(path.c_str());
+
+	// The records are written to the log as they change; the database writes whatever is pending when destroyed.
+	{
+		RegistrarDbFile db(agent, path, 0);
+		db.open();
+		bind(db, ALICE, "sip:alice@192.168.0.1");
+		bind(db, ALICE, "sip:alice@192.168.0.2");
+		bind(db, BOB, "sip:bob@192.168.0.3");
+		bind(db, CAROL, "sip:carol@192.168.0.4");
+		clear(db, CAROL);
+	}
+
+	// An entry whose header announces more bytes than the file holds, as when a crash cut the last write.
+	string torn;
+	torn.append("\xe8\x03\x00\x00", 4); // 1000 bytes
+	torn.append("\x12\x34\x56\x78", 4);
+	torn.append("\x01\x05\x00\x00\x00" "alice", 10);
+	appendToFile(path, torn);
+	{
+		RegistrarDbFile db(agent, path, 0);
+		db.open();
+		CHECK(countContacts(db, ALICE) == 2);
+		CHECK(countContacts(db, BOB) == 1);
+		CHECK(countContacts(db, CAROL) == 0);
+		bind(db, DAVE, "sip:dave@192.168.0.5");
+	}
+
+	// A complete entry whose checksum does not match its body, followed by a valid looking one: the log is read up to
+	// the first bad entry.
+	string corrupted;
+	corrupted.append("\x0a\x00\x00\x00", 4); // 10 bytes
+	corrupted.append("\x00\x00\x00\x00", 4);
+	corrupted.append("\x02\x05\x00\x00\x00" "alice", 10);
+	appendToFile(path, corrupted);
+	appendToFile(path, torn);
+	{
+		RegistrarDbFile db(agent, path, 0);
+		db.open();
+		// The record written after the first restart was not lost behind the torn entry.
+		CHECK(countContacts(db, DAVE) == 1);
+		CHECK(countContacts(db, ALICE) == 2);
+		CHECK(countContacts(db, BOB) == 1);
+		bind(db, ERIN, "sip:erin@192.168.0.6");
+	}
+
+	// The last entry, that of erin, loses its last bytes.
+	off_t size = fileSize(path);
+	CHECK(size > 0);
+	CHECK(truncate(path.c_str(), size - 3) == 0);
+	{
+		RegistrarDbFile db(agent, path, 0);
+		db.open();
+		CHECK(countContacts(db, ERIN) == 0);
+		CHECK(countContacts(db, DAVE) == 1);
+		CHECK(countContacts(db, ALICE) == 2);
+		CHECK(countContacts(db, BOB) == 1);
+		CHECK(db.getStats().mRecords == 3);
+	}
+
+	unlink(path.c_str());
+	return sFailures == 0 ? 0 : 1;
+}
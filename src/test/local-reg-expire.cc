@@ -0,0 +1,134 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks that the timer wheel counting the local registrations removes each of them at its expiration time, whether it
+ * was scheduled in the first level of the wheel or had to be cascaded from the higher ones, and whatever the alignment
+ * of the current time on the slots of the wheel.
+ */
+
+#include "../registrardb-internal.hh"
+#include "registrar-tester.hh"
+
+#include <vector>
+
+using namespace std;
+using namespace flexisip;
+
+/* The expiration delays, in seconds: in the first level, at the boundaries of each level, and past the span of the
+ * wheel, so that the entry waits in the last slot of the last level. */
+static const vector<time_t> sDelays = {1,
+									   2,
+									   255,
+									   256,
+									   257,
+									   300,
+									   1000,
+									   256 * 64 - 1,
+									   256 * 64,
+									   256 * 64 + 5,
+									   256 * 64 * 64 - 1,
+									   256 * 64 * 64 + 10,
+									   256 * 64 * 64 * 64 - 1,
+									   256 * 64 * 64 * 64 + 100};
+
+class WheelRegistrarDb : public RegistrarDbInternal {
+  public:
+	WheelRegistrarDb(Agent *ag) : RegistrarDbInternal(ag) {
+	}
+	LocalRegExpire &getLocalRegExpire() {
+		return *mLocalRegExpire;
+	}
+};
+
+static string keyOf(size_t index) {
+	return "user" + to_string(index) + "@sip.example.org";
+}
+
+/* Steps the time up to the expiration of each entry, checking that it is still counted one second before. */
+static void checkExpirations(Agent *agent, time_t base) {
+	WheelRegistrarDb db(agent);
+	auto &wheel = db.getLocalRegExpire();
+	wheel.removeExpiredBefore(base);
+
+	// Scheduled in reverse order, so that the order of the entries in a slot is not that of their times.
+	for (size_t i = sDelays.size(); i-- > 0;) {
+		wheel.update(keyOf(i), base + sDelays[i]);
+	}
+	CHECK(wheel.countActives() == sDelays.size());
+	for (size_t i = 0; i < sDelays.size(); ++i) {
+		wheel.removeExpiredBefore(base + sDelays[i] - 1);
+		CHECK(wheel.countActives() == sDelays.size() - i);
+		wheel.removeExpiredBefore(base + sDelays[i]);
+		CHECK(wheel.countActives() == sDelays.size() - i - 1);
+	}
+}
+
+/* A rescheduled entry expires at its new time, an unscheduled or removed one is not counted anymore. */
+static void checkUpdates(Agent *agent, time_t base) {
+	WheelRegistrarDb db(agent);
+	auto &wheel = db.getLocalRegExpire();
+	wheel.removeExpiredBefore(base);
+
+	wheel.update(keyOf(0), base + 100);
+	wheel.update(keyOf(1), base + 3600);
+	wheel.update(keyOf(2), base + 3600);
+	wheel.update(keyOf(3), base + 7200);
+	CHECK(wheel.countActives() == 4);
+
+	// Refreshed later, then sooner than its first time.
+	wheel.update(keyOf(0), base + 5000);
+	wheel.update(keyOf(1), base + 50);
+	wheel.update(keyOf(2), 0);
+	wheel.remove(keyOf(3));
+	CHECK(wheel.countActives() == 2);
+
+	wheel.removeExpiredBefore(base + 100);
+	CHECK(wheel.countActives() == 1);
+	wheel.removeExpiredBefore(base + 4999);
+	CHECK(wheel.countActives() == 1);
+	wheel.removeExpiredBefore(base + 5000);
+	CHECK(wheel.countActives() == 0);
+
+	// A time already passed expires at the next step.
+	wheel.update(keyOf(4), base);
+	CHECK(wheel.countActives() == 1);
+	wheel.removeExpiredBefore(base + 5001);
+	CHECK(wheel.countActives() == 0);
+
+	wheel.update(keyOf(5), base + 6000);
+	wheel.clearAll();
+	CHECK(wheel.countActives() == 0);
+}
+
+int main() {
+	map<string, string> overrides;
+	overrides["module::Registrar/db-implementation"] = "internal";
+	RegistrarTester tester("local-reg-expire", overrides);
+	Agent *agent = tester.getAgent();
+
+	// A time aligned on all the levels of the wheel, so that all their slots are cascaded at once.
+	const time_t span = time_t(1) << 26;
+	time_t aligned = (getCurrentTime() / span + 1) * span;
+	checkExpirations(agent, aligned);
+	checkExpirations(agent, aligned + span - 1);
+	checkExpirations(agent, aligned + 12345);
+	checkUpdates(agent, aligned);
+	checkUpdates(agent, aligned - 1 + (time_t(1) << 14));
+	return sFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks the redis registrar in cluster mode against a cluster of three local redis-server: the records are bound,
+ * fetched and cleared on the masters serving their hash slot, and the registrations published for a record reach the
+ * listeners of its topic whatever the node the publication went through.
+ */
+
+#include "redis-server.hh"
+#include "registrar-tester.hh"
+
+#include <vector>
+
+using namespace std;
+using namespace flexisip;
+
+static const int FIRST_PORT = 27101;
+static const int NODE_COUNT = 3;
+static const int AOR_COUNT = 30;
+
+static string aor(int i) {
+	return "sip:user" + to_string(i) + "@sip.example.org";
+}
+
+static long long countKeys(const RedisCluster &cluster, vector<long long> *perNode = nullptr) {
+	long long total = 0;
+	for (const auto &node : cluster.getNodes()) {
+		long long keys = node->integer({"DBSIZE"});
+		if (perNode) perNode->push_back(keys);
+		total += keys;
+	}
+	return total;
+}
+
+/* Waits for all the listeners to be answered, and checks that none of them got an error. */
+static void waitAnswers(RegistrarTester &tester, const vector<shared_ptr<RecordListener>> &listeners) {
+	CHECK(tester.waitFor([&listeners]() {
+		for (const auto &listener : listeners) {
+			if (listener->mAnswers == 0) return false;
+		}
+		return true;
+	}));
+	for (const auto &listener : listeners) CHECK(listener->mErrors == 0);
+}
+
+static void checkBindFetchClear(RegistrarTester &tester, const RedisCluster &cluster) {
+	vector<shared_ptr<RecordListener>> listeners;
+	for (int i = 0; i < AOR_COUNT; ++i) {
+		msg_t *msg = makeRegister(aor(i), "<sip:user" + to_string(i) + "@192.168.0.1:5060;transport=tcp>",
+								  "call-id-" + to_string(i), 1, 3600);
+		BindingParameters parameter;
+		parameter.globalExpire = 3600;
+		listeners.push_back(make_shared<RecordListener>());
+		RegistrarDb::get()->bind(sip_object(msg), parameter, listeners.back());
+		msg_unref(msg);
+	}
+	waitAnswers(tester, listeners);
+
+	// Each record is a key of the master of its slot, and the slots are spread over all the masters.
+	vector<long long> perNode;
+	CHECK(countKeys(cluster, &perNode) == AOR_COUNT);
+	for (auto keys : perNode) CHECK(keys > 0);
+
+	listeners.clear();
+	SofiaAutoHome home;
+	for (int i = 0; i < AOR_COUNT; ++i) {
+		listeners.push_back(make_shared<RecordListener>());
+		RegistrarDb::get()->fetch(url_make(home.home(), aor(i).c_str()), listeners.back());
+	}
+	waitAnswers(tester, listeners);
+	for (const auto &listener : listeners) CHECK(listener->countContacts() == 1);
+
+	listeners.clear();
+	for (int i = 0; i < AOR_COUNT; ++i) {
+		msg_t *msg = makeRegister(aor(i), "", "call-id-" + to_string(i), 2, 0);
+		listeners.push_back(make_shared<RecordListener>());
+		RegistrarDb::get()->clear(sip_object(msg), listeners.back());
+		msg_unref(msg);
+	}
+	waitAnswers(tester, listeners);
+	CHECK(countKeys(cluster) == 0);
+
+	listeners.clear();
+	for (int i = 0; i < AOR_COUNT; ++i) {
+		listeners.push_back(make_shared<RecordListener>());
+		RegistrarDb::get()->fetch(url_make(home.home(), aor(i).c_str()), listeners.back());
+	}
+	waitAnswers(tester, listeners);
+	for (const auto &listener : listeners) CHECK(listener->mRecord == nullptr);
+}
+
+class RegisteredListener : public ContactRegisteredListener {
+  public:
+	void onContactRegistered(const shared_ptr<Record> &r, const string &uid) override {
+		mUids.push_back(uid);
+	}
+	vector<string> mUids;
+};
+
+static void checkPublish(RegistrarTester &tester) {
+	SofiaAutoHome home;
+	string topic = Record::defineKeyFromUrl(url_make(home.home(), aor(0).c_str()));
+	auto listener = make_shared<RegisteredListener>();
+	RegistrarDb::get()->subscribe(topic, listener);
+
+	// The subscription is not acknowledged to the listener: publish until it is active.
+	bool received = false;
+	for (int i = 0; i < 20 && !received; ++i) {
+		RegistrarDb::get()->publish(topic, "uid-0");
+		received = tester.waitFor([&listener]() { return !listener->mUids.empty(); }, 250);
+	}
+	CHECK(received);
+	if (received) CHECK(listener->mUids.front() == "uid-0");
+	RegistrarDb::get()->unsubscribe(topic, listener);
+}
+
+int main() {
+	if (!RedisServer::isAvailable()) {
+		std::cerr << "redis-server not found, skipping" << std::endl;
+		return TEST_SKIPPED;
+	}
+	RedisCluster cluster(FIRST_PORT, NODE_COUNT);
+	if (!cluster.isReady()) {
+		std::cerr << "Couldn't start a redis cluster on ports " << FIRST_PORT << " to " << FIRST_PORT + NODE_COUNT - 1
+				  << std::endl;
+		return 1;
+	}
+
+	map<string, string> overrides;
+	overrides["module::Registrar/db-implementation"] = "redis";
+	overrides["module::Registrar/redis-server-domain"] = "127.0.0.1";
+	overrides["module::Registrar/redis-server-port"] = to_string(FIRST_PORT);
+	overrides["module::Registrar/redis-cluster"] = "true";
+	RegistrarTester tester("redis-cluster", overrides);
+	CHECK(tester.waitFor([]() { return RegistrarDb::get()->isWritable(); }));
+
+	checkBindFetchClear(tester, cluster);
+	checkPublish(tester);
+	return sFailures == 0 ? 0 : 1;
+}
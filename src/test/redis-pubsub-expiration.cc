@@ -0,0 +1,137 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks how the expiration of the records is followed with multiplexed pub/sub channels on a local redis-server,
+ * whose notify-keyspace-events setting is given as argument: the expiration events are subscribed when the server
+ * sends them, otherwise the expiration of the subscribed records is watched, the registrations published carrying the
+ * expiration date of their record so that no time to live is asked for them.
+ */
+
+#include "redis-server.hh"
+#include "registrar-tester.hh"
+
+using namespace std;
+using namespace flexisip;
+
+static const char *AOR = "sip:alice@sip.example.org";
+
+/* Publishes the registration once bound, as the registrar module does. */
+class PublishingListener : public ContactUpdateListener {
+  public:
+	void onRecordFound(const shared_ptr<Record> &r) override {
+		++mAnswers;
+		if (r) RegistrarDb::get()->publish(r->getKey(), "uid-alice");
+	}
+	void onError() override {
+		++mAnswers;
+	}
+	void onInvalid() override {
+		++mAnswers;
+	}
+	void onContactUpdated(const shared_ptr<ExtendedContact> &ec) override {
+	}
+	int mAnswers = 0;
+};
+
+class RegisteredListener : public ContactRegisteredListener {
+  public:
+	void onContactRegistered(const shared_ptr<Record> &r, const string &uid) override {
+		mUids.push_back(uid);
+	}
+	vector<string> mUids;
+};
+
+static void bind(RegistrarTester &tester, int expire) {
+	msg_t *msg = makeRegister(AOR, "<sip:alice@192.168.0.1:5070;transport=tcp>", "call-id-alice", 1, expire);
+	BindingParameters parameter;
+	parameter.globalExpire = expire;
+	auto listener = make_shared<PublishingListener>();
+	RegistrarDb::get()->bind(sip_object(msg), parameter, listener);
+	msg_unref(msg);
+	CHECK(tester.waitFor([&listener]() { return listener->mAnswers > 0; }));
+}
+
+static long long countCalls(const RedisServer &server, const string &command) {
+	auto reply = server.command({"INFO", "commandstats"});
+	if (!reply || !reply->str) return -1;
+	const string stat = "cmdstat_" + command + ":calls=";
+	const char *calls = strstr(reply->str, stat.c_str());
+	return calls ? atoll(calls + stat.size()) : 0;
+}
+
+static long long countExpirationSubscribers(const RedisServer &server) {
+	auto reply = server.command({"PUBSUB", "NUMSUB", "__keyevent@0__:expired"});
+	if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) return -1;
+	return reply->element[1]->integer;
+}
+
+static void check(RegistrarTester &tester, const RedisServer &server, bool events) {
+	SofiaAutoHome home;
+	string topic = Record::defineKeyFromUrl(url_make(home.home(), AOR));
+	bind(tester, 3600);
+	auto listener = make_shared<RegisteredListener>();
+	RegistrarDb::get()->subscribe(topic, listener);
+
+	// The subscription is not acknowledged to the listener: bind until the publication is received.
+	bool received = false;
+	for (int i = 0; i < 20 && !received; ++i) {
+		bind(tester, 3600);
+		received = tester.waitFor([&listener]() { return !listener->mUids.empty(); }, 250);
+	}
+	CHECK(received);
+	CHECK(countExpirationSubscribers(server) == (events ? 1 : 0));
+
+	// The expiration date comes with the publication, no time to live is asked for it.
+	long long ttls = countCalls(server, "ttl");
+	size_t uids = listener->mUids.size();
+	bind(tester, 3600);
+	CHECK(tester.waitFor([&listener, uids]() { return listener->mUids.size() > uids; }));
+	CHECK(countCalls(server, "ttl") == ttls);
+	if (events) CHECK(ttls == 0);
+	RegistrarDb::get()->unsubscribe(topic, listener);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		std::cerr << "usage: " << argv[0] << " events|watch port" << std::endl;
+		return 1;
+	}
+	if (!RedisServer::isAvailable()) {
+		std::cerr << "redis-server not found, skipping" << std::endl;
+		return TEST_SKIPPED;
+	}
+	RedisServer server(atoi(argv[2]));
+	if (!server.isRunning()) {
+		std::cerr << "Couldn't start redis-server on port " << argv[2] << std::endl;
+		return 1;
+	}
+	bool events = string(argv[1]) == "events";
+	server.command({"CONFIG", "SET", "notify-keyspace-events", events ? "Ex" : ""});
+
+	map<string, string> overrides;
+	overrides["module::Registrar/db-implementation"] = "redis";
+	overrides["module::Registrar/redis-server-domain"] = "127.0.0.1";
+	overrides["module::Registrar/redis-server-port"] = argv[2];
+	overrides["module::Registrar/redis-pubsub-channels"] = "16";
+	RegistrarTester tester("redis-pubsub-expiration", overrides);
+	CHECK(tester.waitFor([]() { return RegistrarDb::get()->isWritable(); }));
+
+	check(tester, server, events);
+	return sFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks the record cache of the redis registrar on a local redis-server: a record changed by another node between
+ * its first fetch and the confirmation of the subscription to its topic, whose publication is therefore not received,
+ * must not be served from the cache.
+ */
+
+#include "redis-server.hh"
+#include "registrar-tester.hh"
+
+using namespace std;
+using namespace flexisip;
+
+static const char *AOR = "sip:alice@sip.example.org";
+
+/* Deletes the record and publishes it on its topic when it is first found, as another node unregistering it would,
+ * before the SUBSCRIBE sent for the cache reached redis. */
+class DeletingListener : public RecordListener {
+  public:
+	DeletingListener(const RedisServer &server) : mServer(server) {
+	}
+	void onRecordFound(const shared_ptr<Record> &r) override {
+		RecordListener::onRecordFound(r);
+		if (mAnswers > 1 || !r) return;
+		mServer.command({"DEL", "fs:" + r->getKey()});
+		mServer.command({"PUBLISH", r->getKey(), "uid-alice"});
+	}
+
+  private:
+	const RedisServer &mServer;
+};
+
+static void bind(RegistrarTester &tester) {
+	msg_t *msg = makeRegister(AOR, "<sip:alice@192.168.0.1:5070;transport=tcp>", "call-id-alice", 1, 3600);
+	BindingParameters parameter;
+	parameter.globalExpire = 3600;
+	auto listener = make_shared<RecordListener>();
+	RegistrarDb::get()->bind(sip_object(msg), parameter, listener);
+	msg_unref(msg);
+	CHECK(tester.waitFor([&listener]() { return listener->mAnswers > 0; }));
+}
+
+static shared_ptr<RecordListener> fetch(RegistrarTester &tester, const shared_ptr<RecordListener> &listener) {
+	SofiaAutoHome home;
+	RegistrarDb::get()->fetch(url_make(home.home(), AOR), listener);
+	CHECK(tester.waitFor([&listener]() { return listener->mAnswers > 0; }));
+	return listener;
+}
+
+/* Waits until redis has the given number of subscribers on the topic, then lets the replies reach the registrar. */
+static void waitForSubscribers(RegistrarTester &tester, const RedisServer &server, const string &topic,
+							   long long subscribers) {
+	CHECK(tester.waitFor([&server, &topic, subscribers]() {
+		auto reply = server.command({"PUBSUB", "NUMSUB", topic});
+		return reply && reply->type == REDIS_REPLY_ARRAY && reply->elements == 2 &&
+			   reply->element[1]->integer == subscribers;
+	}));
+	tester.waitFor([]() { return false; }, 100);
+}
+
+static void checkSubscriptionWindow(RegistrarTester &tester, const RedisServer &server) {
+	SofiaAutoHome home;
+	string topic = Record::defineKeyFromUrl(url_make(home.home(), AOR));
+	bind(tester);
+
+	auto deleting = fetch(tester, make_shared<DeletingListener>(server));
+	CHECK(deleting->countContacts() == 1);
+	// The record was deleted in the meantime, which the cache did not hear of.
+	CHECK(fetch(tester, make_shared<RecordListener>())->countContacts() == 0);
+	waitForSubscribers(tester, server, topic, 1);
+
+	// The publication of the bind invalidates the cached record, whose topic is unsubscribed.
+	bind(tester);
+	waitForSubscribers(tester, server, topic, 0);
+
+	// Once the subscription is confirmed, the record fetched is served from the cache.
+	CHECK(fetch(tester, make_shared<RecordListener>())->countContacts() == 1);
+	waitForSubscribers(tester, server, topic, 1);
+	CHECK(fetch(tester, make_shared<RecordListener>())->countContacts() == 1);
+	uint64_t hits = RegistrarDb::get()->getStats().mCacheHits;
+	CHECK(fetch(tester, make_shared<RecordListener>())->countContacts() == 1);
+	CHECK(RegistrarDb::get()->getStats().mCacheHits == hits + 1);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		std::cerr << "usage: " << argv[0] << " port" << std::endl;
+		return 1;
+	}
+	if (!RedisServer::isAvailable()) {
+		std::cerr << "redis-server not found, skipping" << std::endl;
+		return TEST_SKIPPED;
+	}
+	RedisServer server(atoi(argv[1]));
+	if (!server.isRunning()) {
+		std::cerr << "Couldn't start redis-server on port " << argv[1] << std::endl;
+		return 1;
+	}
+
+	map<string, string> overrides;
+	overrides["module::Registrar/db-implementation"] = "redis";
+	overrides["module::Registrar/redis-server-domain"] = "127.0.0.1";
+	overrides["module::Registrar/redis-server-port"] = argv[1];
+	overrides["module::Registrar/redis-record-cache-size"] = "1024";
+	RegistrarTester tester("redis-record-cache", overrides);
+	CHECK(tester.waitFor([]() { return RegistrarDb::get()->isWritable(); }));
+
+	checkSubscriptionWindow(tester, server);
+	return sFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks the refresh of the bindings on a local redis-server, with the contact format given as argument: a refresh
+ * only moves the expiry and CSeq of the stored binding and publishes nothing, and any other REGISTER is bound with no
+ * more commands than a regular bind.
+ */
+
+#include "redis-server.hh"
+#include "registrar-tester.hh"
+
+using namespace std;
+using namespace flexisip;
+
+static const char *CONTACT = "<sip:alice@192.168.0.1:5070;transport=tcp>;+sip.instance=\"<urn:uuid:0001>\"";
+static const char *CALL_ID = "call-id-alice";
+
+static shared_ptr<RecordListener> bind(RegistrarTester &tester, const string &aor, const char *contact, uint32_t cseq,
+									   int expire = 3600) {
+	msg_t *msg = makeRegister(aor, contact, CALL_ID, cseq, expire);
+	BindingParameters parameter;
+	parameter.globalExpire = expire;
+	auto listener = make_shared<RecordListener>();
+	RegistrarDb::get()->bind(sip_object(msg), parameter, listener);
+	msg_unref(msg);
+	CHECK(tester.waitFor([&listener]() { return listener->mAnswers > 0; }));
+	return listener;
+}
+
+static shared_ptr<RecordListener> fetch(RegistrarTester &tester, const string &aor) {
+	SofiaAutoHome home;
+	auto listener = make_shared<RecordListener>();
+	RegistrarDb::get()->fetch(url_make(home.home(), aor.c_str()), listener);
+	CHECK(tester.waitFor([&listener]() { return listener->mAnswers > 0; }));
+	return listener;
+}
+
+/* Waits for the replies of all the commands sent, and gives the number of commands answered so far. */
+static uint64_t countCommands(RegistrarTester &tester) {
+	const auto &connections = RegistrarDb::get()->getStats().mConnections;
+	CHECK(tester.waitFor([&connections]() {
+		for (const auto &connection : connections) {
+			if (connection.mPendingCommands > 0) return false;
+		}
+		return true;
+	}));
+	uint64_t count = 0;
+	for (const auto &connection : connections) count += connection.mCommandCount;
+	return count;
+}
+
+static long long countPublish(const RedisServer &server) {
+	auto reply = server.command({"INFO", "commandstats"});
+	if (!reply || !reply->str) return -1;
+	const char *stat = strstr(reply->str, "cmdstat_publish:calls=");
+	return stat ? atoll(stat + strlen("cmdstat_publish:calls=")) : 0;
+}
+
+static void checkRefresh(RegistrarTester &tester, const RedisServer &server) {
+	const string aor = "sip:alice@sip.example.org";
+	bind(tester, aor, CONTACT, 1, 60);
+	countCommands(tester);
+
+	uint64_t refreshes = RegistrarDb::get()->getStats().mRefreshes;
+	long long published = countPublish(server);
+	auto listener = bind(tester, aor, CONTACT, 2);
+	CHECK(RegistrarDb::get()->getStats().mRefreshes == refreshes + 1);
+	CHECK(listener->mErrors == 0 && listener->countContacts() == 1);
+	countCommands(tester);
+	// The record cache is disabled: nothing is published for a refresh.
+	CHECK(countPublish(server) == published);
+
+	// The stored binding has its new CSeq and expiry.
+	auto fetched = fetch(tester, aor);
+	CHECK(fetched->countContacts() == 1);
+	if (fetched->countContacts() == 1) {
+		const auto &ec = fetched->mRecord->getExtendedContacts().front();
+		CHECK(ec->mCSeq == 2);
+		CHECK(ec->mExpireAt > getCurrentTime() + 60);
+		CHECK(server.integer({"TTL", "fs:" + fetched->mRecord->getKey()}) > 60);
+	}
+}
+
+/* A changed binding is merged into the record handed back by the refresh script: the script, the write of the contact
+ * and the update of the record expiry. */
+static void checkNoRefresh(RegistrarTester &tester) {
+	const string aor = "sip:bob@sip.example.org";
+	bind(tester, aor, CONTACT, 1);
+	uint64_t commands = countCommands(tester);
+
+	uint64_t refreshes = RegistrarDb::get()->getStats().mRefreshes;
+	auto listener =
+		bind(tester, aor, "<sip:alice@192.168.0.2:5070;transport=tcp>;+sip.instance=\"<urn:uuid:0001>\"", 2);
+	CHECK(RegistrarDb::get()->getStats().mRefreshes == refreshes);
+	CHECK(countCommands(tester) - commands <= 3);
+	CHECK(listener->mErrors == 0 && listener->countContacts() == 1);
+
+	auto fetched = fetch(tester, aor);
+	CHECK(fetched->countContacts() == 1);
+	if (fetched->countContacts() == 1) {
+		const auto &ec = fetched->mRecord->getExtendedContacts().front();
+		CHECK(ec->mCSeq == 2);
+		CHECK(string(ec->mSipContact->m_url->url_host) == "192.168.0.2");
+	}
+
+	// A replayed CSeq is not a refresh either.
+	refreshes = RegistrarDb::get()->getStats().mRefreshes;
+	bind(tester, aor, "<sip:alice@192.168.0.2:5070;transport=tcp>;+sip.instance=\"<urn:uuid:0001>\"", 2);
+	CHECK(RegistrarDb::get()->getStats().mRefreshes == refreshes);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		std::cerr << "usage: " << argv[0] << " url-encoded|binary port" << std::endl;
+		return 1;
+	}
+	if (!RedisServer::isAvailable()) {
+		std::cerr << "redis-server not found, skipping" << std::endl;
+		return TEST_SKIPPED;
+	}
+	RedisServer server(atoi(argv[2]));
+	if (!server.isRunning()) {
+		std::cerr << "Couldn't start redis-server on port " << argv[2] << std::endl;
+		return 1;
+	}
+
+	map<string, string> overrides;
+	overrides["module::Registrar/db-implementation"] = "redis";
+	overrides["module::Registrar/redis-server-domain"] = "127.0.0.1";
+	overrides["module::Registrar/redis-server-port"] = argv[2];
+	overrides["module::Registrar/redis-contact-format"] = argv[1];
+	// No replication check may add a command while they are counted.
+	overrides["module::Registrar/redis-slave-check-period"] = "3600";
+	RegistrarTester tester("redis-registration-refresh", overrides);
+	CHECK(tester.waitFor([]() { return RegistrarDb::get()->isWritable(); }));
+
+	checkRefresh(tester, server);
+	checkNoRefresh(tester);
+	return sFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * redis-server instances spawned by the tests of the redis registrar, each in a directory of its own and listening on
+ * localhost only. The tests return TEST_SKIPPED when redis-server is not installed.
+ */
+
+#pragma once
+
+#include <hiredis/hiredis.h>
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Exit status telling CTest that the test was skipped (see the SKIP_RETURN_CODE property of the redis tests). */
+static const int TEST_SKIPPED = 77;
+
+class RedisServer {
+  public:
+	static bool isAvailable() {
+		return system("redis-server --version > /dev/null 2>&1") == 0;
+	}
+
+	/* Starts redis-server on the port and waits until it answers, isRunning() tells whether it did. In cluster mode,
+	 * the instance is a node of a cluster that still has to be formed (see RedisCluster). */
+	RedisServer(int port, bool cluster = false) : mPort(port), mPid(-1) {
+		char dir[] = "/tmp/flexisip-redis-XXXXXX";
+		if (!mkdtemp(dir)) return;
+		mDir = dir;
+
+		std::vector<std::string> args{"redis-server", "--port", std::to_string(port), "--bind", "127.0.0.1",
+									  "--dir", mDir, "--save", "", "--appendonly", "no"};
+		if (cluster) {
+			args.insert(args.end(), {"--cluster-enabled", "yes", "--cluster-config-file", "nodes.conf"});
+		}
+		mPid = fork();
+		if (mPid == 0) {
+			std::vector<char *> argv;
+			for (auto &arg : args) argv.push_back(&arg[0]);
+			argv.push_back(nullptr);
+			freopen("/dev/null", "w", stdout);
+			execvp(argv[0], argv.data());
+			_exit(127);
+		}
+		for (int i = 0; i < 100 && mPid > 0; ++i) {
+			auto reply = command({"PING"});
+			if (reply && reply->type == REDIS_REPLY_STATUS) return;
+			usleep(50000);
+		}
+		stop();
+	}
+	~RedisServer() {
+		stop();
+		if (!mDir.empty()) system(("rm -rf " + mDir).c_str());
+	}
+
+	bool isRunning() const {
+		return mPid > 0;
+	}
+	int getPort() const {
+		return mPort;
+	}
+
+	struct ReplyDeleter {
+		void operator()(redisReply *reply) const {
+			freeReplyObject(reply);
+		}
+	};
+	typedef std::unique_ptr<redisReply, ReplyDeleter> Reply;
+
+	/* Sends a command over a connection of its own and returns the reply, or nullptr if it failed. */
+	Reply command(const std::vector<std::string> &args) const {
+		redisContext *context = redisConnect("127.0.0.1", mPort);
+		if (!context || context->err) {
+			if (context) redisFree(context);
+			return nullptr;
+		}
+		std::vector<const char *> argv;
+		std::vector<size_t> argvlen;
+		for (const auto &arg : args) {
+			argv.push_back(arg.c_str());
+			argvlen.push_back(arg.size());
+		}
+		Reply reply((redisReply *)redisCommandArgv(context, (int)argv.size(), argv.data(), argvlen.data()));
+		redisFree(context);
+		return reply;
+	}
+	long long integer(const std::vector<std::string> &args) const {
+		auto reply = command(args);
+		return reply && reply->type == REDIS_REPLY_INTEGER ? reply->integer : -1;
+	}
+
+  private:
+	void stop() {
+		if (mPid <= 0) return;
+		kill(mPid, SIGTERM);
+		waitpid(mPid, nullptr, 0);
+		mPid = -1;
+	}
+
+	int mPort;
+	pid_t mPid;
+	std::string mDir;
+};
+
+/* A cluster of masters without replicas on consecutive ports, the hash slots being split evenly between them. */
+class RedisCluster {
+  public:
+	RedisCluster(int firstPort, int nodeCount) {
+		for (int i = 0; i < nodeCount; ++i) {
+			mNodes.emplace_back(new RedisServer(firstPort + i, true));
+			if (!mNodes.back()->isRunning()) return;
+		}
+		for (int i = 0; i < nodeCount; ++i) {
+			std::vector<std::string> addSlots{"CLUSTER", "ADDSLOTS"};
+			for (int slot = 16384 * i / nodeCount; slot < 16384 * (i + 1) / nodeCount; ++slot) {
+				addSlots.push_back(std::to_string(slot));
+			}
+			mNodes[i]->command(addSlots);
+			if (i > 0) mNodes[0]->command({"CLUSTER", "MEET", "127.0.0.1", std::to_string(firstPort + i)});
+		}
+		for (int i = 0; i < 200 && !mReady; ++i) {
+			mReady = true;
+			for (const auto &node : mNodes) {
+				auto reply = node->command({"CLUSTER", "INFO"});
+				if (!reply || !reply->str || !strstr(reply->str, "cluster_state:ok") ||
+					!strstr(reply->str, ("cluster_known_nodes:" + std::to_string(nodeCount)).c_str())) {
+					mReady = false;
+				}
+			}
+			if (!mReady) usleep(50000);
+		}
+	}
+
+	bool isReady() const {
+		return mReady;
+	}
+	const std::vector<std::unique_ptr<RedisServer>> &getNodes() const {
+		return mNodes;
+	}
+
+  private:
+	std::vector<std::unique_ptr<RedisServer>> mNodes;
+	bool mReady = false;
+};
@@ -0,0 +1,131 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Helpers shared by the registrar tests: an agent with a configuration overridden for the test, REGISTER messages and
+ * a listener keeping what the database answered. Each test is a program returning a non-zero status if a check failed.
+ */
+
+#pragma once
+
+#include <flexisip/agent.hh>
+#include <flexisip/configmanager.hh>
+#include <flexisip/logmanager.hh>
+#include <flexisip/registrardb.hh>
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <sofia-sip/sip_protos.h>
+#include <sofia-sip/su_wait.h>
+
+static int sFailures = 0;
+
+#define CHECK(cond)                                                                                                    \
+	do {                                                                                                               \
+		if (!(cond)) {                                                                                                 \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl;                         \
+			++sFailures;                                                                                               \
+		}                                                                                                              \
+	} while (0)
+
+/* An agent over its own event loop, with the given configuration overrides applied, and the registrar database they
+ * define. */
+class RegistrarTester {
+  public:
+	RegistrarTester(const char *name, const std::map<std::string, std::string> &overrides) {
+		flexisip::log::preinit(flexisip_sUseSyslog, getenv("FLEXISIP_TEST_DEBUG") != nullptr, 0, name);
+		flexisip::log::initLogs(flexisip_sUseSyslog, getenv("FLEXISIP_TEST_DEBUG") ? "debug" : "error", "error",
+								false, true);
+		su_init();
+		mRoot = su_root_create(NULL);
+		mAgent = std::make_shared<flexisip::Agent>(mRoot);
+		flexisip::GenericManager::get()->setOverrideMap(overrides);
+		flexisip::GenericManager::get()->applyOverrides(true);
+		flexisip::RegistrarDb::initialize(mAgent.get());
+	}
+	~RegistrarTester() {
+		mAgent.reset();
+		su_root_destroy(mRoot);
+		su_deinit();
+	}
+
+	flexisip::Agent *getAgent() const {
+		return mAgent.get();
+	}
+	su_root_t *getRoot() const {
+		return mRoot;
+	}
+	/* Runs the event loop until the condition holds, returns false if it still does not after timeoutMs. */
+	template <typename Condition> bool waitFor(Condition condition, int timeoutMs = 5000) {
+		for (int elapsed = 0; !condition(); elapsed += 10) {
+			if (elapsed >= timeoutMs) return false;
+			su_root_step(mRoot, 10);
+		}
+		return true;
+	}
+
+  private:
+	su_root_t *mRoot;
+	std::shared_ptr<flexisip::Agent> mAgent;
+};
+
+static inline msg_t *makeRegister(const std::string &from, const std::string &contact, const std::string &callId,
+								  uint32_t cseq, int expire) {
+	msg_t *msg = msg_create(sip_default_mclass(), 0);
+	su_home_t *home = msg_home(msg);
+	sip_t *sip = sip_object(msg);
+
+	sip->sip_from = sip_from_make(home, from.c_str());
+	sip->sip_to = sip_to_make(home, from.c_str());
+	if (!contact.empty()) sip->sip_contact = sip_contact_make(home, contact.c_str());
+	sip->sip_call_id = sip_call_id_make(home, callId.c_str());
+	sip->sip_cseq = sip_cseq_create(home, cseq, sip_method_register, nullptr);
+	sip->sip_expires = sip_expires_create(home, expire);
+	return msg;
+}
+
+/* Keeps the last answer of the database. */
+class RecordListener : public flexisip::ContactUpdateListener {
+  public:
+	virtual void onRecordFound(const std::shared_ptr<flexisip::Record> &r) override {
+		mRecord = r;
+		mAnswers++;
+	}
+	virtual void onError() override {
+		mErrors++;
+		mAnswers++;
+	}
+	virtual void onInvalid() override {
+		mErrors++;
+		mAnswers++;
+	}
+	virtual void onContactUpdated(const std::shared_ptr<flexisip::ExtendedContact> &ec) override {
+	}
+
+	size_t countContacts() const {
+		return mRecord ? mRecord->getExtendedContacts().size() : 0;
+	}
+
+	std::shared_ptr<flexisip::Record> mRecord;
+	int mAnswers = 0;
+	int mErrors = 0;
+};
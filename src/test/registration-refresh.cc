@@ -0,0 +1,182 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks which REGISTERs the registrar database handles as refreshes of an unchanged binding: only those of the same
+ * call-id with a greater cseq, carrying a single contact registered exactly as before. Any other one goes through a
+ * full bind.
+ */
+
+#include "registrar-tester.hh"
+
+#include <functional>
+
+using namespace std;
+using namespace flexisip;
+
+static const char *CONTACT = "<sip:alice@192.168.0.1:5070;transport=tcp>;+sip.instance=\"<urn:uuid:0001>\"";
+static const char *CALL_ID = "call-id-alice";
+
+static int sAor = 0;
+
+/* A REGISTER to customize before it is bound. */
+struct Register {
+	Register(const string &aor, const char *contact, const char *callId, uint32_t cseq, int expire = 3600)
+		: msg(makeRegister(aor, contact, callId, cseq, expire)), home(msg_home(msg)), sip(sip_object(msg)) {
+		sip->sip_user_agent = sip_user_agent_make(home, "Linphone/4.4.0");
+		sip->sip_path = sip_path_make(home, "<sip:proxy.example.org;lr>");
+		sip->sip_accept = sip_accept_make(home, "application/sdp");
+	}
+	~Register() {
+		msg_unref(msg);
+	}
+
+	msg_t *msg;
+	su_home_t *home;
+	sip_t *sip;
+};
+
+static shared_ptr<RecordListener> bind(const Register &reg, bool alias = false) {
+	BindingParameters parameter;
+	// As the registrar module does, the expiration of the contacts without an expires parameter is that of the request.
+	parameter.globalExpire = reg.sip->sip_expires->ex_delta;
+	parameter.alias = alias;
+	auto listener = make_shared<RecordListener>();
+	RegistrarDb::get()->bind(reg.sip, parameter, listener);
+	return listener;
+}
+
+static uint64_t countRefreshes() {
+	return RegistrarDb::get()->getStats().mRefreshes;
+}
+
+/* Binds a first REGISTER to a new aor, then a second one customized by the given function, and tells whether the
+ * second one was handled as a refresh. */
+static bool isRefresh(const function<void(Register &)> &customize, uint32_t cseq = 2) {
+	string aor = "sip:alice" + to_string(++sAor) + "@sip.example.org";
+	Register first(aor, CONTACT, CALL_ID, 1);
+	auto bound = bind(first);
+	CHECK(bound->mAnswers == 1 && bound->mErrors == 0);
+
+	Register second(aor, CONTACT, CALL_ID, cseq);
+	customize(second);
+	uint64_t refreshes = countRefreshes();
+	auto listener = bind(second);
+	CHECK(listener->mAnswers == 1);
+	return countRefreshes() != refreshes;
+}
+
+static void unchanged(Register &) {
+}
+
+static void checkRefresh() {
+	CHECK(isRefresh(unchanged));
+	CHECK(isRefresh(unchanged, 1000));
+
+	// The refreshed binding is the one answered, with its new cseq, and it is still the only one.
+	string aor = "sip:bob@sip.example.org";
+	Register first(aor, CONTACT, CALL_ID, 1, 60);
+	bind(first);
+	Register second(aor, CONTACT, CALL_ID, 2, 3600);
+	uint64_t refreshes = countRefreshes();
+	auto listener = bind(second);
+	CHECK(countRefreshes() == refreshes + 1);
+	CHECK(listener->countContacts() == 1);
+	if (listener->countContacts() == 1) {
+		const auto &ec = listener->mRecord->getExtendedContacts().front();
+		CHECK(ec->mCSeq == 2);
+		CHECK(ec->mExpireAt > getCurrentTime() + 60);
+	}
+}
+
+static void checkNoRefresh() {
+	// Replayed or older requests.
+	CHECK(!isRefresh(unchanged, 1));
+	CHECK(!isRefresh([](Register &reg) {
+		reg.sip->sip_cseq = sip_cseq_create(reg.home, 0, sip_method_register, nullptr);
+	}));
+	// Another registration of the device.
+	CHECK(!isRefresh([](Register &reg) { reg.sip->sip_call_id = sip_call_id_make(reg.home, "call-id-other"); }));
+	// Anything that changed in the binding.
+	CHECK(!isRefresh([](Register &reg) {
+		reg.sip->sip_contact = sip_contact_make(reg.home, "<sip:alice@192.168.0.2:5070;transport=tcp>;+sip.instance="
+														  "\"<urn:uuid:0001>\"");
+	}));
+	CHECK(!isRefresh([](Register &reg) {
+		reg.sip->sip_contact =
+			sip_contact_make(reg.home, "<sip:alice@192.168.0.1:5070;transport=tcp>;+sip.instance=\"<urn:uuid:0001>\";"
+									   "+org.linphone.specs=\"lime\"");
+	}));
+	CHECK(!isRefresh([](Register &reg) {
+		reg.sip->sip_contact = sip_contact_make(reg.home, "\"Alice\" <sip:alice@192.168.0.1:5070;transport=tcp>;"
+														  "+sip.instance=\"<urn:uuid:0001>\"");
+	}));
+	CHECK(!isRefresh([](Register &reg) {
+		reg.sip->sip_path = sip_path_make(reg.home, "<sip:proxy2.example.org;lr>");
+	}));
+	CHECK(!isRefresh([](Register &reg) { reg.sip->sip_path = nullptr; }));
+	CHECK(!isRefresh([](Register &reg) {
+		reg.sip->sip_path->r_next = sip_path_make(reg.home, "<sip:proxy2.example.org;lr>");
+	}));
+	CHECK(!isRefresh([](Register &reg) { reg.sip->sip_user_agent = sip_user_agent_make(reg.home, "Linphone/4.5.0"); }));
+	CHECK(!isRefresh([](Register &reg) { reg.sip->sip_user_agent = nullptr; }));
+	CHECK(!isRefresh([](Register &reg) { reg.sip->sip_accept = sip_accept_make(reg.home, "text/plain"); }));
+	// Several contacts, or none, are left to a full bind.
+	CHECK(!isRefresh([](Register &reg) {
+		reg.sip->sip_contact->m_next = sip_contact_make(reg.home, "<sip:alice@192.168.0.3:5070;transport=tcp>");
+	}));
+	CHECK(!isRefresh([](Register &reg) { reg.sip->sip_contact = nullptr; }));
+}
+
+/* An unregistration with the call-id of the binding removes it instead of refreshing it. */
+static void checkUnregister() {
+	string aor = "sip:carol@sip.example.org";
+	Register first(aor, CONTACT, CALL_ID, 1);
+	bind(first);
+	Register second(aor, CONTACT, CALL_ID, 2, 0);
+	uint64_t refreshes = countRefreshes();
+	auto listener = bind(second);
+	CHECK(countRefreshes() == refreshes);
+	CHECK(listener->countContacts() == 0);
+}
+
+/* A binding registered by an alias is never refreshed, nor is an alias bind one. */
+static void checkAlias() {
+	string aor = "sip:dave@sip.example.org";
+	Register first(aor, "<sip:alice@sip.example.org>", CALL_ID, 1);
+	bind(first, true);
+	Register second(aor, "<sip:alice@sip.example.org>", CALL_ID, 2);
+	uint64_t refreshes = countRefreshes();
+	bind(second, true);
+	CHECK(countRefreshes() == refreshes);
+	Register third(aor, "<sip:alice@sip.example.org>", CALL_ID, 3);
+	bind(third);
+	CHECK(countRefreshes() == refreshes);
+}
+
+int main() {
+	map<string, string> overrides;
+	overrides["module::Registrar/db-implementation"] = "internal";
+	RegistrarTester tester("registration-refresh", overrides);
+
+	checkRefresh();
+	checkNoRefresh();
+	checkUnregister();
+	checkAlias();
+	return sFailures == 0 ? 0 : 1;
+}
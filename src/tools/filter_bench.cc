@@ -0,0 +1,213 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Microbenchmark of the module entry filters. The expressions of the expression parser tests, with their variables
+ * mapped to SIP attributes, and the filters given as examples in the configuration, are evaluated on a few messages
+ * by walking the expression tree over SipAttributes, as filters were evaluated before, and by running the program
+ * they are compiled to. Both must give the same results. Results are written on the standard output, one JSON object
+ * per line.
+ */
+
+#include <flexisip/expressionparser.hh>
+#include <flexisip/logmanager.hh>
+
+#include "../sipattrextractor.hh"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sofia-sip/msg.h>
+#include <sofia-sip/sip.h>
+
+using namespace std;
+using namespace flexisip;
+
+struct BenchArgs {
+	BenchArgs() : iterations(1000000), debug(false) {
+	}
+	int iterations;
+	bool debug;
+
+	void usage(const char *app) {
+		cout << app << " --iterations n --debug" << endl;
+	}
+
+	void parse(int argc, char *argv[]) {
+#define EQ0(i, name) (strcmp(name, argv[i]) == 0)
+#define EQ1(i, name) (strcmp(name, argv[i]) == 0 && argc > i + 1)
+		for (int i = 1; i < argc; ++i) {
+			if (EQ1(i, "--iterations")) {
+				iterations = atoi(argv[++i]);
+			} else if (EQ0(i, "--debug")) {
+				debug = true;
+			} else if (EQ0(i, "--help") || EQ0(i, "-h")) {
+				usage(*argv);
+				exit(0);
+			} else {
+				cerr << "? arg" << i << " " << argv[i] << endl;
+				usage(*argv);
+				exit(-1);
+			}
+		}
+		if (iterations < 1) {
+			cerr << "Invalid parameters" << endl;
+			usage(*argv);
+			exit(-1);
+		}
+	}
+};
+
+static const char *sMessages[] = {
+	"INVITE sip:ipbob@sip.example.org SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 192.168.1.27:5060;branch=z9hG4bK776asdhds\r\n"
+	"From: <sip:alice@a.org>;tag=1928301774\r\n"
+	"To: <sip:1234@b.org>\r\n"
+	"Call-ID: a84b4c76e66710@pc33.example.org\r\n"
+	"CSeq: 314159 INVITE\r\n"
+	"User-Agent: Linphone/3.5.2 (belle-sip/1.0)\r\n"
+	"Contact: <sip:alice@192.168.1.27>\r\n"
+	"Content-Length: 0\r\n\r\n",
+
+	"REGISTER sip:sip.example.org SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 192.168.1.28:5060;branch=z9hG4bKnashds7\r\n"
+	"From: <sip:bob@c.org;transport=tcp>;tag=456248\r\n"
+	"To: <sip:bob@c.org>\r\n"
+	"Call-ID: 843817637684230@998sdasdh09\r\n"
+	"CSeq: 1826 REGISTER\r\n"
+	"Contact: <sip:bob@192.168.1.28>\r\n"
+	"Expires: 3600\r\n"
+	"Content-Length: 0\r\n\r\n",
+
+	"SIP/2.0 200 OK\r\n"
+	"Via: SIP/2.0/UDP 192.168.1.27:5060;branch=z9hG4bK776asdhds\r\n"
+	"From: <sip:alice@a.org>;tag=1928301774\r\n"
+	"To: <sip:1234@b.org>;tag=a6c85cf\r\n"
+	"Call-ID: a84b4c76e66710@pc33.example.org\r\n"
+	"CSeq: 314159 INVITE\r\n"
+	"User-Agent: Linphone v2\r\n"
+	"Content-Length: 0\r\n\r\n",
+};
+
+static const char *sExpressions[] = {
+	"",
+	"true",
+	"false||false||true",
+	"true&&true&&false",
+	"'a'=='b'",
+	"'toto' regex 'to+'",
+	"'A' in 'C A B'",
+	"'A' nin 'AB'",
+	"!(true) || true",
+	"from.uri.user == 'alice'",
+	"false||(from.uri.user=='alice')||false",
+	"from.uri.user regex 'al.*'",
+	"numeric to.uri.user",
+	"defined ua",
+	"!defined ua",
+	"is_response || !(ua contains 'Linphone/3.5.2') || ((request.method-name == 'INVITE') && "
+	"!(request.uri.user contains 'ip'))",
+	"from.uri.domain contains 'sip.linphone.org'",
+	"from.uri.domain in 'a.org b.org c.org'",
+	"(to.uri.domain in 'a.org b.org c.org') && (user-agent contains 'Linphone v2')",
+	"is_request && request.method-name == 'INVITE'",
+	"status.code == '200' || direction == 'request'",
+};
+
+/* Before: the expression tree over the attributes, an exception being raised by missing attributes. */
+static int treeEval(BooleanExpression &expr, const SipAttributes &attr) {
+	try {
+		return expr.eval(&attr) ? 1 : 0;
+	} catch (exception &) {
+		return -1;
+	}
+}
+
+/* After: the compiled program, over the same memoized attributes. */
+static int compiledEval(const CompiledBooleanExpression &program, const SipAttributes &attr) {
+	bool result;
+	return program.eval(attr, result) ? (result ? 1 : 0) : -1;
+}
+
+int main(int argc, char *argv[]) {
+	BenchArgs args;
+	args.parse(argc, argv);
+
+	flexisip::log::preinit(flexisip_sUseSyslog, args.debug, 0, "filter_bench");
+	flexisip::log::initLogs(flexisip_sUseSyslog, args.debug ? "debug" : "error", "error", false, true);
+
+	vector<msg_t *> msgs;
+	vector<const sip_t *> sips;
+	vector<SipAttributes> attrs;
+	for (const char *text : sMessages) {
+		msg_t *msg = msg_make(sip_default_mclass(), 0, text, strlen(text));
+		const sip_t *sip = msg ? (const sip_t *)msg_object(msg) : nullptr;
+		if (!sip || sip->sip_error) {
+			cerr << "Cannot parse message " << text << endl;
+			return -1;
+		}
+		msgs.push_back(msg);
+		sips.push_back(sip);
+		attrs.emplace_back(sip);
+	}
+
+	int mismatches = 0;
+	for (const char *text : sExpressions) {
+		auto expr = BooleanExpression::parse(text);
+		auto program = CompiledBooleanExpression::compile(expr);
+		if (!program) {
+			cerr << "Cannot compile " << text << endl;
+			return -1;
+		}
+
+		bool agree = true;
+		for (size_t i = 0; i < sips.size(); ++i) {
+			agree = agree && treeEval(*expr, attrs[i]) == compiledEval(*program, attrs[i]);
+		}
+		if (!agree)
+			++mismatches;
+
+		long checksum = 0;
+		auto start = chrono::steady_clock::now();
+		for (int n = 0; n < args.iterations; ++n) {
+			for (const auto &attr : attrs)
+				checksum += treeEval(*expr, attr);
+		}
+		double treeNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+		start = chrono::steady_clock::now();
+		for (int n = 0; n < args.iterations; ++n) {
+			for (const auto &attr : attrs)
+				checksum -= compiledEval(*program, attr);
+		}
+		double compiledNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+
+		double evaluations = (double)args.iterations * sips.size();
+		cout << "{\"expression\":\"" << text << "\",\"instructions\":" << program->size()
+			 << ",\"evaluations\":" << (long)evaluations << ",\"tree_ns_per_eval\":" << treeNs / evaluations
+			 << ",\"compiled_ns_per_eval\":" << compiledNs / evaluations
+			 << ",\"agree\":" << (agree && checksum == 0 ? "true" : "false") << "}" << endl;
+	}
+
+	for (msg_t *msg : msgs)
+		msg_destroy(msg);
+	return mismatches ? 1 : 0;
+}
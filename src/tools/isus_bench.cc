@@ -0,0 +1,199 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Microbenchmark of Agent::isUs(). An agent is started with a number of transports on the loopback interface and a
+ * number of aliases, and the hosts of a typical message (request uri, route and vias, some local and some not) are
+ * looked up through Agent::isUs() and through the linear scan of the aliases and transports it used to perform, which
+ * gives the before and after cost per message. Results are written on the standard output, one JSON object per line.
+ */
+
+#include <flexisip/agent.hh>
+#include <flexisip/configmanager.hh>
+#include <flexisip/logmanager.hh>
+#include <flexisip/module.hh>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <sofia-sip/tport.h>
+
+using namespace std;
+using namespace flexisip;
+
+struct BenchArgs {
+	BenchArgs() : aliases(10), transports(4), port(25060), iterations(1000000), debug(false) {
+	}
+	int aliases;
+	int transports;
+	int port;
+	int iterations;
+	bool debug;
+
+	void usage(const char *app) {
+		cout << app << " --aliases n --transports n --port first-port --iterations n --debug" << endl;
+	}
+
+	void parse(int argc, char *argv[]) {
+#define EQ0(i, name) (strcmp(name, argv[i]) == 0)
+#define EQ1(i, name) (strcmp(name, argv[i]) == 0 && argc > i + 1)
+		for (int i = 1; i < argc; ++i) {
+			if (EQ1(i, "--aliases")) {
+				aliases = atoi(argv[++i]);
+			} else if (EQ1(i, "--transports")) {
+				transports = atoi(argv[++i]);
+			} else if (EQ1(i, "--port")) {
+				port = atoi(argv[++i]);
+			} else if (EQ1(i, "--iterations")) {
+				iterations = atoi(argv[++i]);
+			} else if (EQ0(i, "--debug")) {
+				debug = true;
+			} else if (EQ0(i, "--help") || EQ0(i, "-h")) {
+				usage(*argv);
+				exit(0);
+			} else {
+				cerr << "? arg" << i << " " << argv[i] << endl;
+				usage(*argv);
+				exit(-1);
+			}
+		}
+		if (aliases < 0 || transports < 1 || port < 1 || iterations < 1) {
+			cerr << "Invalid parameters" << endl;
+			usage(*argv);
+			exit(-1);
+		}
+	}
+};
+
+struct Lookup {
+	string host;
+	const char *port; // Null for a host without port.
+	bool checkAliases;
+};
+
+/* The lookup isUs() performed before it used a precomputed set of local addresses. */
+static bool linearIsUs(nta_agent_t *agent, const list<string> &aliases, const char *host, const char *port,
+					   bool checkAliases) {
+	if (checkAliases) {
+		for (const auto &alias : aliases) {
+			if (ModuleToolbox::urlHostMatch(host, alias.c_str())) return true;
+		}
+	}
+	const char *matchedPort = port;
+	for (tport_t *tport = tport_primaries(nta_agent_tports(agent)); tport != NULL; tport = tport_next(tport)) {
+		const tp_name_t *tn = tport_name(tport);
+		if (port == NULL) matchedPort = strcasecmp(tn->tpn_proto, "tls") == 0 ? "5061" : "5060";
+		if (strcmp(matchedPort, tn->tpn_port) == 0) {
+			if (ModuleToolbox::urlHostMatch(host, tn->tpn_canon) || ModuleToolbox::urlHostMatch(host, tn->tpn_host))
+				return true;
+		}
+	}
+	return false;
+}
+
+static void report(const BenchArgs &args, const string &name, const vector<Lookup> &message,
+				   const function<bool(const Lookup &)> &isUs) {
+	size_t found = 0;
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < args.iterations; ++i) {
+		for (const auto &lookup : message) {
+			if (isUs(lookup)) ++found;
+		}
+	}
+	double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+	cout << "{\"lookup\":\"" << name << "\",\"aliases\":" << args.aliases << ",\"transports\":" << args.transports
+		 << ",\"messages\":" << args.iterations << ",\"calls_per_message\":" << message.size()
+		 << ",\"local_per_message\":" << found / args.iterations
+		 << ",\"ns_per_call\":" << ns / ((double)args.iterations * message.size())
+		 << ",\"ns_per_message\":" << ns / args.iterations << "}" << endl;
+}
+
+int main(int argc, char *argv[]) {
+	BenchArgs args;
+	args.parse(argc, argv);
+
+	flexisip::log::preinit(flexisip_sUseSyslog, args.debug, 0, "isus_bench");
+	flexisip::log::initLogs(flexisip_sUseSyslog, args.debug ? "debug" : "error", "error", false, true);
+	flexisip::log::updateFilter("%Severity% >= debug");
+
+	ostringstream transports, aliases;
+	for (int i = 0; i < args.transports; ++i) {
+		transports << (i ? " " : "") << "sip:127.0.0.1:" << args.port + i;
+	}
+	for (int i = 0; i < args.aliases; ++i) {
+		aliases << (i ? " " : "") << "alias" << i << ".sip.example.org";
+	}
+	string configFile = "/tmp/flexisip-isus-bench-" + to_string(getpid()) + ".conf";
+	{
+		ofstream config(configFile);
+		config << "[global]" << endl
+			   << "transports=" << transports.str() << endl
+			   << "aliases=" << aliases.str() << endl;
+	}
+
+	su_init();
+	su_root_t *root = su_root_create(NULL);
+	{
+		// The configuration is echoed on the standard output, which is kept for the results.
+		streambuf *out = cout.rdbuf(cerr.rdbuf());
+		GenericManager *cfg = GenericManager::get();
+		if (cfg->load(configFile.c_str()) == -1) {
+			cout.rdbuf(out);
+			cerr << "Cannot load " << configFile << endl;
+			unlink(configFile.c_str());
+			return -1;
+		}
+		auto agent = make_shared<Agent>(root);
+		agent->loadConfig(cfg);
+		agent->start("", "");
+		cout.rdbuf(out);
+		unlink(configFile.c_str());
+
+		// A request routed through this proxy: request uri on the last alias, a route on one of the transports and
+		// two foreign vias, as checked by the modules and by countUsInVia().
+		string lastTransportPort = to_string(args.port + args.transports - 1);
+		vector<Lookup> message = {
+			{args.aliases ? "alias" + to_string(args.aliases - 1) + ".sip.example.org" : "127.0.0.1", nullptr, true},
+			{"127.0.0.1", lastTransportPort.c_str(), true},
+			{"192.168.1.27", "5060", true},
+			{"client.example.net", nullptr, true},
+			{"192.168.1.27", "5060", false},
+		};
+
+		list<string> aliasList = GenericManager::get()->getGlobal()->get<ConfigStringList>("aliases")->read();
+		nta_agent_t *sofiaAgent = agent->getSofiaAgent();
+		report(args, "linear", message, [&](const Lookup &lookup) {
+			return linearIsUs(sofiaAgent, aliasList, lookup.host.c_str(), lookup.port, lookup.checkAliases);
+		});
+		report(args, "hashed", message, [&](const Lookup &lookup) {
+			return agent->isUs(lookup.host.c_str(), lookup.port, lookup.checkAliases);
+		});
+		agent->unloadConfig();
+	}
+	su_root_destroy(root);
+	su_deinit();
+	return 0;
+}
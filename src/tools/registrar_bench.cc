@@ -0,0 +1,610 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Throughput benchmark of the registrar database. The same synthetic workload of registrations is bound, refreshed,
+ * fetched and cleared through each backend, and each record serializer serializes and parses the resulting records.
+ * Each backend runs in its own process, as the RegistrarDb is a singleton, so that the memory figures of a backend are
+ * not those of the previous ones. Results are written on the standard output, one JSON object per line and per phase.
+ */
+
+#include "../recordserializer.hh"
+#include <flexisip/agent.hh>
+#include <flexisip/configmanager.hh>
+#include <flexisip/logmanager.hh>
+#include <flexisip/registrardb.hh>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <sofia-sip/sip_protos.h>
+#include <sofia-sip/su_wait.h>
+
+using namespace std;
+using namespace flexisip;
+
+static const int REGISTER_EXPIRE = 3600;
+static const int STALL_TIMEOUT = 10; /* In seconds, without any completed operation. */
+
+struct BenchArgs {
+	BenchArgs()
+		: aors(1000), devicesMin(1), devicesMax(3), refreshRatio(0.8), aliasDepth(0), rounds(3), concurrency(100),
+		  seed(1), redisServer("redis-server"), redisPort(16379), debug(false) {
+	}
+	vector<string> backends;
+	int aors;
+	int devicesMin;
+	int devicesMax;
+	double refreshRatio;
+	int aliasDepth;
+	int rounds;
+	int concurrency;
+	unsigned int seed;
+	string redisServer;
+	int redisPort;
+	string fileDbPath;
+	bool debug;
+
+	void usage(const char *app) {
+		cout << app
+			 << " --backends internal,file,redis,redis-binary,c,json,protobuf,msgpack --aors n --devices min-max"
+				" --refresh-ratio r --alias-depth n --rounds n --concurrency n --seed n --redis-server path"
+				" --redis-port port --file-db-path path --debug"
+			 << endl;
+	}
+
+	void parse(int argc, char *argv[]) {
+#define EQ0(i, name) (strcmp(name, argv[i]) == 0)
+#define EQ1(i, name) (strcmp(name, argv[i]) == 0 && argc > i + 1)
+		for (int i = 1; i < argc; ++i) {
+			if (EQ1(i, "--backends")) {
+				stringstream list(argv[++i]);
+				string backend;
+				while (getline(list, backend, ',')) {
+					if (!backend.empty()) backends.push_back(backend);
+				}
+			} else if (EQ1(i, "--aors")) {
+				aors = atoi(argv[++i]);
+			} else if (EQ1(i, "--devices")) {
+				const char *range = argv[++i];
+				const char *dash = strchr(range, '-');
+				devicesMin = atoi(range);
+				devicesMax = dash ? atoi(dash + 1) : devicesMin;
+			} else if (EQ1(i, "--refresh-ratio")) {
+				refreshRatio = atof(argv[++i]);
+			} else if (EQ1(i, "--alias-depth")) {
+				aliasDepth = atoi(argv[++i]);
+			} else if (EQ1(i, "--rounds")) {
+				rounds = atoi(argv[++i]);
+			} else if (EQ1(i, "--concurrency")) {
+				concurrency = atoi(argv[++i]);
+			} else if (EQ1(i, "--seed")) {
+				seed = (unsigned int)atoi(argv[++i]);
+			} else if (EQ1(i, "--redis-server")) {
+				redisServer = argv[++i];
+			} else if (EQ1(i, "--redis-port")) {
+				redisPort = atoi(argv[++i]);
+			} else if (EQ1(i, "--file-db-path")) {
+				fileDbPath = argv[++i];
+			} else if (EQ0(i, "--debug")) {
+				debug = true;
+			} else if (EQ0(i, "--help") || EQ0(i, "-h")) {
+				usage(*argv);
+				exit(0);
+			} else {
+				cerr << "? arg" << i << " " << argv[i] << endl;
+				usage(*argv);
+				exit(-1);
+			}
+		}
+		if (backends.empty()) backends = {"internal", "file"};
+		if (fileDbPath.empty()) fileDbPath = "/tmp/flexisip-registrar-bench-" + to_string(getpid()) + ".log";
+		if (aors < 1 || devicesMin < 1 || devicesMax < devicesMin || refreshRatio < 0 || refreshRatio > 1 ||
+			aliasDepth < 0 || rounds < 0 || concurrency < 1) {
+			cerr << "Invalid workload parameters" << endl;
+			usage(*argv);
+			exit(-1);
+		}
+	}
+};
+
+/*
+ * Synthetic registrations: each AOR has a number of devices drawn between the bounds, and a chain of aliases ending
+ * on it, the last alias of the chain being the address fetched.
+ */
+struct Device {
+	string contact;
+	string callId;
+	uint32_t cseq;
+};
+
+struct Aor {
+	string uri;
+	url_t *url;
+	vector<Device> devices;
+	vector<string> aliases; // aliases[0] is bound to the AOR, aliases[n] to aliases[n - 1]
+	url_t *fetchedUrl;
+};
+
+struct Phase {
+	Phase(const string &name) : mName(name), mPending(0), mErrors(0), mSeconds(0) {
+	}
+	string mName;
+	vector<uint64_t> mLatencies; // microseconds
+	size_t mPending;
+	uint64_t mErrors;
+	double mSeconds;
+	chrono::steady_clock::time_point mLastProgress;
+};
+
+class BenchListener : public ContactUpdateListener {
+  public:
+	BenchListener(Phase &phase, const function<void(const shared_ptr<Record> &)> &onRecord = nullptr)
+		: mPhase(phase), mOnRecord(onRecord), mStart(chrono::steady_clock::now()), mDone(false) {
+	}
+	virtual void onRecordFound(const shared_ptr<Record> &r) override {
+		if (!mDone && mOnRecord) mOnRecord(r);
+		done(false);
+	}
+	virtual void onError() override {
+		done(true);
+	}
+	virtual void onInvalid() override {
+		done(true);
+	}
+	virtual void onContactUpdated(const shared_ptr<ExtendedContact> &ec) override {
+	}
+
+  private:
+	void done(bool error) {
+		if (mDone) return;
+		mDone = true;
+		auto now = chrono::steady_clock::now();
+		mPhase.mLatencies.push_back(chrono::duration_cast<chrono::microseconds>(now - mStart).count());
+		mPhase.mLastProgress = now;
+		mPhase.mPending--;
+		if (error) mPhase.mErrors++;
+	}
+
+	Phase &mPhase;
+	function<void(const shared_ptr<Record> &)> mOnRecord;
+	chrono::steady_clock::time_point mStart;
+	bool mDone;
+};
+
+static void readMemory(uint64_t &rss, uint64_t &peakRss) {
+	ifstream status("/proc/self/status");
+	string line;
+	rss = peakRss = 0;
+	while (getline(status, line)) {
+		if (line.compare(0, 6, "VmRSS:") == 0) rss = strtoull(line.c_str() + 6, nullptr, 10);
+		else if (line.compare(0, 6, "VmHWM:") == 0) peakRss = strtoull(line.c_str() + 6, nullptr, 10);
+	}
+}
+
+static msg_t *makeRegister(const string &from, const string &contact, const string &callId, uint32_t cseq,
+						   int expire) {
+	msg_t *msg = msg_create(sip_default_mclass(), 0);
+	su_home_t *home = msg_home(msg);
+	sip_t *sip = sip_object(msg);
+
+	sip->sip_from = sip_from_make(home, from.c_str());
+	sip->sip_to = sip_to_make(home, from.c_str());
+	if (!contact.empty()) sip->sip_contact = sip_contact_make(home, contact.c_str());
+	sip->sip_call_id = sip_call_id_make(home, callId.c_str());
+	sip->sip_cseq = sip_cseq_create(home, cseq, sip_method_register, nullptr);
+	sip->sip_expires = sip_expires_create(home, expire);
+	return msg;
+}
+
+class RegistrarBench {
+  public:
+	RegistrarBench(const BenchArgs &args, const string &backend, su_root_t *root)
+		: mArgs(args), mBackend(backend), mRoot(root), mRandom(args.seed), mOperation(0) {
+		generate();
+	}
+
+	int run() {
+		RecordSerializer *serializer = nullptr;
+		if (mBackend != "internal" && mBackend != "file" && mBackend != "redis" && mBackend != "redis-binary") {
+			serializer = RecordSerializer::create(mBackend);
+			if (!serializer) {
+				cerr << "Unsupported backend or record serializer: '" << mBackend << "'" << endl;
+				return -1;
+			}
+		}
+		if (!waitWritable()) {
+			cerr << "[" << mBackend << "] registrar database not writable" << endl;
+			return -1;
+		}
+
+		Phase bind("bind");
+		bindAll(bind);
+		if (serializer) return runSerializer(unique_ptr<RecordSerializer>(serializer));
+		report(bind);
+
+		for (int round = 0; round < mArgs.rounds; ++round) {
+			Phase rebind("rebind");
+			rebindAll(rebind);
+			report(rebind);
+		}
+
+		Phase fetch("fetch");
+		vector<Aor *> aors;
+		for (auto &aor : mAors) aors.push_back(&aor);
+		runPhase(fetch, aors.size(), [&](size_t i, const shared_ptr<ContactUpdateListener> &listener) {
+			RegistrarDb::get()->fetch(aors[i]->fetchedUrl, listener, true);
+		});
+		report(fetch);
+
+		vector<string> keys;
+		for (const auto &aor : mAors) {
+			keys.push_back(aor.uri);
+			keys.insert(keys.end(), aor.aliases.begin(), aor.aliases.end());
+		}
+		Phase clear("clear");
+		runPhase(clear, keys.size(), [&](size_t i, const shared_ptr<ContactUpdateListener> &listener) {
+			msg_t *msg = makeRegister(keys[i], "", nextCallId(), 1, 0);
+			RegistrarDb::get()->clear(sip_object(msg), listener);
+			msg_unref(msg);
+		});
+		report(clear);
+		return 0;
+	}
+
+  private:
+	void generate() {
+		uniform_int_distribution<int> devices(mArgs.devicesMin, mArgs.devicesMax);
+		mAors.resize(mArgs.aors);
+		for (int i = 0; i < mArgs.aors; ++i) {
+			Aor &aor = mAors[i];
+			aor.uri = "sip:user" + to_string(i) + "@bench.example.org";
+			aor.url = url_make(mHome.home(), aor.uri.c_str());
+			int count = devices(mRandom);
+			for (int j = 0; j < count; ++j) {
+				Device device;
+				ostringstream contact;
+				contact << "<sip:user" << i << "@10." << (i >> 16 & 0xff) << "." << (i >> 8 & 0xff) << "." << (i & 0xff)
+						<< ":" << 5060 + j << ";transport=tcp>;+sip.instance=\"<urn:uuid:bench-" << i << "-" << j
+						<< ">\"";
+				device.contact = contact.str();
+				device.callId = nextCallId();
+				device.cseq = 1;
+				aor.devices.push_back(device);
+			}
+			for (int depth = 0; depth < mArgs.aliasDepth; ++depth) {
+				aor.aliases.push_back("sip:alias" + to_string(depth) + "-" + to_string(i) + "@bench.example.org");
+			}
+			aor.fetchedUrl = aor.aliases.empty() ? aor.url : url_make(mHome.home(), aor.aliases.back().c_str());
+		}
+	}
+
+	string nextCallId() {
+		return "bench-" + to_string(mOperation++);
+	}
+
+	bool waitWritable() {
+		auto start = chrono::steady_clock::now();
+		while (!RegistrarDb::get()->isWritable()) {
+			if (chrono::steady_clock::now() - start > chrono::seconds(STALL_TIMEOUT)) return false;
+			su_root_step(mRoot, 10);
+		}
+		return true;
+	}
+
+	/* Runs count operations, with at most the configured concurrency pending at once, until all are completed. */
+	void runPhase(Phase &phase, size_t count,
+				  const function<void(size_t, const shared_ptr<ContactUpdateListener> &)> &operation,
+				  const function<void(const shared_ptr<Record> &)> &onRecord = nullptr) {
+		phase.mLatencies.reserve(count);
+		auto start = chrono::steady_clock::now();
+		phase.mLastProgress = start;
+		for (size_t i = 0; i < count; ++i) {
+			while (phase.mPending >= (size_t)mArgs.concurrency) step(phase);
+			phase.mPending++;
+			operation(i, make_shared<BenchListener>(phase, onRecord));
+		}
+		while (phase.mPending > 0) step(phase);
+		phase.mSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	void step(Phase &phase) {
+		su_root_step(mRoot, 10);
+		if (chrono::steady_clock::now() - phase.mLastProgress > chrono::seconds(STALL_TIMEOUT)) {
+			cerr << "[" << mBackend << "] " << phase.mName << ": no answer for " << STALL_TIMEOUT << " seconds, "
+				 << phase.mPending << " operations pending" << endl;
+			exit(-1);
+		}
+	}
+
+	void bindAll(Phase &phase) {
+		vector<pair<Aor *, Device *>> devices;
+		for (auto &aor : mAors) {
+			for (auto &device : aor.devices) devices.emplace_back(&aor, &device);
+		}
+		runPhase(phase, devices.size(), [&](size_t i, const shared_ptr<ContactUpdateListener> &listener) {
+			bindDevice(*devices[i].first, *devices[i].second, listener);
+		});
+
+		vector<pair<string, string>> aliases;
+		for (const auto &aor : mAors) {
+			for (size_t depth = 0; depth < aor.aliases.size(); ++depth) {
+				aliases.emplace_back(aor.aliases[depth], depth == 0 ? aor.uri : aor.aliases[depth - 1]);
+			}
+		}
+		Phase aliasPhase("bind-alias");
+		runPhase(aliasPhase, aliases.size(), [&](size_t i, const shared_ptr<ContactUpdateListener> &listener) {
+			BindingParameters parameter;
+			parameter.alias = true;
+			parameter.globalExpire = REGISTER_EXPIRE;
+			msg_t *msg = makeRegister(aliases[i].first, "<" + aliases[i].second + ">", nextCallId(), 1, REGISTER_EXPIRE);
+			RegistrarDb::get()->bind(sip_object(msg), parameter, listener);
+			msg_unref(msg);
+		});
+		if (!aliases.empty()) report(aliasPhase);
+	}
+
+	/* Either refreshes each binding, with the same call-id, or registers it again as a restarted device would. */
+	void rebindAll(Phase &phase) {
+		bernoulli_distribution refresh(mArgs.refreshRatio);
+		vector<pair<Aor *, Device *>> devices;
+		for (auto &aor : mAors) {
+			for (auto &device : aor.devices) {
+				if (refresh(mRandom)) {
+					device.cseq++;
+				} else {
+					device.callId = nextCallId();
+					device.cseq = 1;
+				}
+				devices.emplace_back(&aor, &device);
+			}
+		}
+		shuffle(devices.begin(), devices.end(), mRandom);
+		runPhase(phase, devices.size(), [&](size_t i, const shared_ptr<ContactUpdateListener> &listener) {
+			bindDevice(*devices[i].first, *devices[i].second, listener);
+		});
+	}
+
+	void bindDevice(const Aor &aor, const Device &device, const shared_ptr<ContactUpdateListener> &listener) {
+		BindingParameters parameter;
+		parameter.globalExpire = REGISTER_EXPIRE;
+		msg_t *msg = makeRegister(aor.uri, device.contact, device.callId, device.cseq, REGISTER_EXPIRE);
+		RegistrarDb::get()->bind(sip_object(msg), parameter, listener);
+		msg_unref(msg);
+	}
+
+	int runSerializer(unique_ptr<RecordSerializer> serializer) {
+		vector<shared_ptr<Record>> records;
+		Phase fetch("fetch");
+		runPhase(fetch, mAors.size(),
+				 [&](size_t i, const shared_ptr<ContactUpdateListener> &listener) {
+					 RegistrarDb::get()->fetch(mAors[i].url, listener);
+				 },
+				 [&](const shared_ptr<Record> &r) {
+					 if (r) records.push_back(r);
+				 });
+
+		vector<string> serialized(records.size());
+		Phase serialize("serialize");
+		uint64_t bytes = 0;
+		auto start = chrono::steady_clock::now();
+		for (size_t i = 0; i < records.size(); ++i) {
+			auto opStart = chrono::steady_clock::now();
+			if (!serializer->serialize(records[i].get(), serialized[i], false)) serialize.mErrors++;
+			serialize.mLatencies.push_back(
+				chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - opStart).count());
+			bytes += serialized[i].size();
+		}
+		serialize.mSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		report(serialize, bytes);
+
+		Phase parse("parse");
+		start = chrono::steady_clock::now();
+		for (size_t i = 0; i < records.size(); ++i) {
+			auto opStart = chrono::steady_clock::now();
+			Record record(records[i]->getAor());
+			if (!serializer->parse(serialized[i], &record)) parse.mErrors++;
+			parse.mLatencies.push_back(
+				chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - opStart).count());
+		}
+		parse.mSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		report(parse, bytes);
+		return 0;
+	}
+
+	void report(Phase &phase, uint64_t bytes = 0) {
+		vector<uint64_t> &latencies = phase.mLatencies;
+		sort(latencies.begin(), latencies.end());
+		auto percentile = [&latencies](size_t p) -> uint64_t {
+			if (latencies.empty()) return 0;
+			return latencies[min(latencies.size() - 1, latencies.size() * p / 100)];
+		};
+		uint64_t rss, peakRss;
+		readMemory(rss, peakRss);
+
+		ostringstream out;
+		out << fixed << setprecision(1);
+		out << "{\"backend\":\"" << mBackend << "\",\"phase\":\"" << phase.mName << "\""
+			<< ",\"aors\":" << mArgs.aors << ",\"devices\":\"" << mArgs.devicesMin << "-" << mArgs.devicesMax << "\""
+			<< ",\"refresh_ratio\":" << mArgs.refreshRatio << ",\"alias_depth\":" << mArgs.aliasDepth
+			<< ",\"concurrency\":" << mArgs.concurrency << ",\"ops\":" << latencies.size()
+			<< ",\"errors\":" << phase.mErrors << ",\"seconds\":" << setprecision(6) << phase.mSeconds
+			<< setprecision(1) << ",\"ops_per_sec\":" << (phase.mSeconds > 0 ? latencies.size() / phase.mSeconds : 0)
+			<< ",\"p50_us\":" << percentile(50) << ",\"p99_us\":" << percentile(99)
+			<< ",\"max_us\":" << (latencies.empty() ? 0 : latencies.back())
+			<< ",\"refreshes\":" << RegistrarDb::get()->getStats().mRefreshes;
+		if (bytes) out << ",\"bytes\":" << bytes;
+		out << ",\"rss_kb\":" << rss << ",\"peak_rss_kb\":" << peakRss << "}";
+		cout << out.str() << endl;
+	}
+
+	const BenchArgs &mArgs;
+	string mBackend;
+	su_root_t *mRoot;
+	mt19937 mRandom;
+	uint64_t mOperation;
+	SofiaAutoHome mHome;
+	vector<Aor> mAors;
+};
+
+#ifdef ENABLE_REDIS
+static bool waitListening(int port, pid_t pid) {
+	for (int attempt = 0; attempt < 100; ++attempt) {
+		int status;
+		if (waitpid(pid, &status, WNOHANG) == pid) return false;
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		bool connected = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+		close(fd);
+		if (connected) return true;
+		usleep(50000);
+	}
+	return false;
+}
+
+/* Starts a redis server without persistence, to be stopped with stopRedis(). */
+static pid_t spawnRedis(const BenchArgs &args) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		string port = to_string(args.redisPort);
+		int devnull = open("/dev/null", O_WRONLY);
+		if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+		execlp(args.redisServer.c_str(), args.redisServer.c_str(), "--port", port.c_str(), "--bind", "127.0.0.1",
+			   "--save", "", "--appendonly", "no", (char *)nullptr);
+		cerr << "Cannot execute " << args.redisServer << ": " << strerror(errno) << endl;
+		_exit(127);
+	}
+	if (pid < 0 || !waitListening(args.redisPort, pid)) {
+		cerr << "Cannot start " << args.redisServer << " on port " << args.redisPort << endl;
+		if (pid > 0) {
+			kill(pid, SIGTERM);
+			waitpid(pid, nullptr, 0);
+		}
+		return -1;
+	}
+	return pid;
+}
+
+static void stopRedis(pid_t pid) {
+	kill(pid, SIGTERM);
+	waitpid(pid, nullptr, 0);
+}
+#endif
+
+static int runBackend(const BenchArgs &args, const string &backend) {
+	bool redis = backend == "redis" || backend == "redis-binary";
+	pid_t redisPid = -1;
+	if (redis) {
+#ifdef ENABLE_REDIS
+		redisPid = spawnRedis(args);
+		if (redisPid < 0) return -1;
+#else
+		cerr << "Redis backend not available, this build has no redis support" << endl;
+		return -1;
+#endif
+	}
+
+	map<string, string> overrides;
+	if (backend == "file") {
+		overrides["module::Registrar/db-implementation"] = "file";
+		overrides["module::Registrar/file-db-path"] = args.fileDbPath;
+		unlink(args.fileDbPath.c_str());
+	} else if (redis) {
+		overrides["module::Registrar/db-implementation"] = "redis";
+		overrides["module::Registrar/redis-server-domain"] = "127.0.0.1";
+		overrides["module::Registrar/redis-server-port"] = to_string(args.redisPort);
+		overrides["module::Registrar/redis-contact-format"] = backend == "redis-binary" ? "binary" : "url-encoded";
+	} else {
+		overrides["module::Registrar/db-implementation"] = "internal";
+	}
+	overrides["module::Registrar/max-contacts-by-aor"] = to_string(max(args.devicesMax, 256));
+
+	su_init();
+	su_root_t *root = su_root_create(NULL);
+	int ret;
+	{
+		// The configuration overrides are echoed on the standard output, which is kept for the results.
+		streambuf *out = cout.rdbuf(cerr.rdbuf());
+		auto agent = make_shared<Agent>(root);
+		GenericManager::get()->setOverrideMap(overrides);
+		GenericManager::get()->applyOverrides(true);
+		RegistrarDb::initialize(agent.get());
+		cout.rdbuf(out);
+
+		RegistrarBench bench(args, backend, root);
+		ret = bench.run();
+	}
+#ifdef ENABLE_REDIS
+	if (redisPid > 0) stopRedis(redisPid);
+#endif
+	if (backend == "file") unlink(args.fileDbPath.c_str());
+	return ret;
+}
+
+int main(int argc, char *argv[]) {
+	BenchArgs args;
+	args.parse(argc, argv);
+
+	flexisip::log::preinit(flexisip_sUseSyslog, args.debug, 0, "registrar_bench");
+	flexisip::log::initLogs(flexisip_sUseSyslog, args.debug ? "debug" : "error", "error", false, true);
+	flexisip::log::updateFilter("%Severity% >= debug");
+
+	int ret = 0;
+	for (const auto &backend : args.backends) {
+		cout.flush();
+		pid_t pid = fork();
+		if (pid == 0) {
+			int status = runBackend(args, backend);
+			cout.flush();
+			_exit(status == 0 ? 0 : 1);
+		} else if (pid < 0) {
+			cerr << "Cannot fork: " << strerror(errno) << endl;
+			return -1;
+		}
+		int status = 0;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			cerr << "Benchmark of backend '" << backend << "' failed" << endl;
+			ret = -1;
+		}
+	}
+	return ret;
+}
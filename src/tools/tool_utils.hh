@@ -66,7 +66,7 @@ bool compare(const ExtendedContact &ec1, bool alias, const ExtendedContactCommon
 	check("callid", ec1.mCallId, common.mCallId);
 	check("contactid", ec1.mContactId, common.mContactId);
 	check("line", ec1.mUniqueId, common.mUniqueId);
-	check("path", ec1.mPath, common.mPath);
+	check("path", ec1.mPath.toList(), common.mPath);
 	check("cseq", ec1.mCSeq, cseq);
 	check("mExpireAt", ec1.mExpireAt, expireat);
 	check("mQ", ec1.mQ, q);
@@ -77,7 +77,7 @@ bool compare(const ExtendedContact &ec1, bool alias, const ExtendedContactCommon
 }
 
 bool compare(const ExtendedContact &ec1, const ExtendedContact &ec2) {
-	ExtendedContactCommon ecc(ec2.mContactId.c_str(), ec2.mPath, ec2.mCallId.c_str(), ec2.mUniqueId.c_str());
+	ExtendedContactCommon ecc(ec2.mContactId.c_str(), ec2.mPath.toList(), ec2.mCallId.c_str(), ec2.mUniqueId.c_str());
 	return compare(ec1, ec2.mAlias, ecc, ec2.mCSeq, ec2.mExpireAt, ec2.mQ, ExtendedContact::urlToString(ec2.mSipContact->m_url),
 			ec2.mUpdatedTime);
 }
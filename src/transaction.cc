@@ -20,6 +20,7 @@
 #include <flexisip/event.hh>
 #include <flexisip/common.hh>
 #include <flexisip/agent.hh>
+#include "loop-monitor.hh"
 #include <algorithm>
 #include <sofia-sip/su_tagarg.h>
 #include <sofia-sip/su_random.h>
@@ -142,6 +143,8 @@ void OutgoingTransaction::send(const shared_ptr<MsgSip> &ms, url_string_t const
 
 int OutgoingTransaction::_callback(nta_outgoing_magic_t *magic, nta_outgoing_t *irq, const sip_t *sip) {
 	OutgoingTransaction *otr = reinterpret_cast<OutgoingTransaction *>(magic);
+	LoopMonitor::Probe probe(otr->mAgent->getLoopMonitor(), LoopMonitor::SourceOutgoingTransaction,
+							 sip ? nta_outgoing_getresponse(otr->mOutgoing) : nullptr);
 	LOGD("OutgoingTransaction callback %p", otr);
 	if (sip != NULL) {
 		msg_t *msg = nta_outgoing_getresponse(otr->mOutgoing);
@@ -244,6 +247,8 @@ void IncomingTransaction::reply(const shared_ptr<MsgSip> &msgIgnored, int status
 
 int IncomingTransaction::_callback(nta_incoming_magic_t *magic, nta_incoming_t *irq, const sip_t *sip) {
 	IncomingTransaction *it = reinterpret_cast<IncomingTransaction *>(magic);
+	LoopMonitor::Probe probe(it->mAgent->getLoopMonitor(), LoopMonitor::SourceIncomingTransaction,
+							 sip ? nta_incoming_getrequest_ackcancel(it->mIncoming) : nullptr);
 	LOGD("IncomingTransaction callback %p", it);
 	if (sip != NULL) {
 		msg_t *msg = nta_incoming_getrequest_ackcancel(it->mIncoming);